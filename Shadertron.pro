@@ -48,7 +48,24 @@ SOURCES += \
     src/AboutDialog.cpp \
     src/LogWidget.cpp \
     src/TextureAudioSurface.cpp \
-    src/Preferences.cpp
+    src/Preferences.cpp \
+    src/AudioRingBuffer.cpp \
+    src/ShaderTemplate.cpp \
+    src/SoundRenderer.cpp \
+    src/SoundOutput.cpp \
+    src/OfflineSoundRenderer.cpp \
+    src/AudioSpectrum.cpp \
+    src/LiveAudioInput.cpp \
+    src/DownloadScheduler.cpp \
+    src/AssetBundle.cpp \
+    src/AssetPack.cpp \
+    src/TextureSidecar.cpp \
+    src/ShaderToyReader.cpp \
+    src/ShaderIndex.cpp \
+    src/RenderThread.cpp \
+    src/OfflineImageRenderer.cpp \
+    src/TexturePool.cpp \
+    src/FileHash.cpp
 
 HEADERS += \
     src/RenderWidget.h \
@@ -63,7 +80,24 @@ HEADERS += \
     src/AboutDialog.h \
     src/LogWidget.h \
     src/TextureAudioSurface.h \
-    src/Preferences.h
+    src/Preferences.h \
+    src/AudioRingBuffer.h \
+    src/ShaderTemplate.h \
+    src/SoundRenderer.h \
+    src/SoundOutput.h \
+    src/OfflineSoundRenderer.h \
+    src/AudioSpectrum.h \
+    src/LiveAudioInput.h \
+    src/DownloadScheduler.h \
+    src/AssetBundle.h \
+    src/AssetPack.h \
+    src/TextureSidecar.h \
+    src/ShaderToyReader.h \
+    src/ShaderIndex.h \
+    src/RenderThread.h \
+    src/OfflineImageRenderer.h \
+    src/TexturePool.h \
+    src/FileHash.h
 
 FORMS +=
 
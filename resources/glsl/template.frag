@@ -11,6 +11,7 @@
 #define SHADER_TYPE_SOUND   3
 
 #macro SHADER_TYPE
+#macro SOUND_ENTRY_POINT
 
 #macro SAMPLER_0_TYPE
 #macro SAMPLER_1_TYPE
@@ -36,16 +37,21 @@ uniform SAMPLER_3_TYPE iChannel3;
 in vec3 fRayDir;
 #endif
 
+#if SHADER_TYPE == SHADER_TYPE_SOUND
+uniform int       iSoundBlockOffset;     // index of the first sample in this block
+uniform int       iSoundBlockWidth;      // width of the block texture (in samples)
+#endif
+
 layout(location=0) out vec4 Shadertron_oColor;
 
 #line 1 2
 #macro COMMON_CODE
-#line 43 0
+#line 49 0
 
 // Source string 1 is the user code for this shader
 #line 1 1
 #macro USER_CODE
-#line 48 0
+#line 54 0
 
 #if SHADER_TYPE == SHADER_TYPE_CUBEMAP
 
@@ -61,11 +67,34 @@ layout(location=0) out vec4 Shadertron_oColor;
     Shadertron_oColor = fragColor;
   }
 
+#elif SHADER_TYPE == SHADER_TYPE_SOUND
+
+  // Each texel of the output holds one stereo sample, in row-major order.
+  void main()
+  {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    int samp = iSoundBlockOffset + texel.y * iSoundBlockWidth + texel.x;
+    float time = float(samp) / iSampleRate;
+
+  #ifdef SOUND_ENTRY_POINT_TAKES_SAMPLE
+    vec2 sound = mainSound(samp, time);
+  #else
+    vec2 sound = mainSound(time);
+  #endif
+
+    Shadertron_oColor = vec4(sound, 0.0, 1.0);
+  }
+
 #else
 
+  // Added to gl_FragCoord to get the fragCoord we pass on: where the current
+  // tile starts within the full image when rendering in tiles, plus a
+  // sub-pixel jitter when supersampling. Always zero otherwise.
+  uniform vec2 Shadertron_iFragCoordOffset;
+
   void main()
   {
-    vec2 fragCoord = gl_FragCoord.xy;
+    vec2 fragCoord = gl_FragCoord.xy + Shadertron_iFragCoordOffset;
     vec4 fragColor;
 
     mainImage(fragColor, fragCoord);
@@ -73,4 +102,4 @@ layout(location=0) out vec4 Shadertron_oColor;
     Shadertron_oColor = fragColor;
   }
 
-#endif // (SHADER_TYPE == SHADER_TYPE_IMAGE) || (SHADER_TYPE == SHADER_TYPE_BUFFER)
+#endif // SHADER_TYPE
@@ -0,0 +1,9 @@
+// A white disc on black with a hard edge and nothing else, so the only
+// thing supersampling has to do is anti-alias the edge.
+
+void mainImage( out vec4 fragColor, in vec2 fragCoord ) {
+  vec2 p = fragCoord - 0.5 * iResolution.xy;
+  float radius = 0.4 * min(iResolution.x, iResolution.y);
+  float inside = step(length(p), radius);
+  fragColor = vec4(vec3(inside), 1.0);
+}
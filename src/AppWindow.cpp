@@ -23,6 +23,8 @@
 #include <QRect>
 #include <QScreen>
 #include <QStandardPaths>
+#include <QStatusBar>
+#include <QSurfaceFormat>
 #include <QUrl>
 
 #include <QTreeWidgetItem>
@@ -42,6 +44,10 @@ namespace vh {
   // the program.
   static const int kDesktopUIVersion = 1;
 
+  // How long a download progress message stays in the status bar if no more
+  // progress is reported.
+  static const int kDownloadProgressMessageMS = 2000;
+
 
   //
   // Globals
@@ -69,6 +75,9 @@ namespace vh {
     _cache = new FileCache(this);
     connect(_cache, &FileCache::shaderReady, this, &AppWindow::openDownloadedFile);
     connect(_cache, &FileCache::standardAssetsReady, this, &AppWindow::standardAssetsReady);
+    connect(_cache, &FileCache::scrubFinished, this, &AppWindow::cacheScrubFinished);
+    connect(_cache, &FileCache::packFinished, this, &AppWindow::cachePackFinished);
+    connect(_cache, &FileCache::downloadProgress, this, &AppWindow::downloadProgress);
 
     createWidgets();
     createMenus();
@@ -100,10 +109,12 @@ namespace vh {
       // Restore the old document.
       _document = _oldDocument;
       _oldDocument = nullptr;
+      _cache->setOpenDocument(_document);
       return false;
     }
 
     _renderWidget->setShaderToyDocument(_document);
+    _cache->setOpenDocument(_document);
     return true;
   }
 
@@ -127,6 +138,7 @@ namespace vh {
     _document = defaultShaderToyDocument();
 
     _renderWidget->setShaderToyDocument(_document);
+    _cache->setOpenDocument(_document);
   }
 
 
@@ -173,7 +185,7 @@ namespace vh {
 
   void AppWindow::downloadFromShaderToy()
   {
-    ShaderToyDownloadForm* downloadForm = new ShaderToyDownloadForm();
+    ShaderToyDownloadForm* downloadForm = new ShaderToyDownloadForm(_cache);
     int option = downloadForm->exec();
     if (option == QDialog::Rejected || downloadForm->selectedShaderID().isEmpty()) {
       delete downloadForm;
@@ -205,6 +217,7 @@ namespace vh {
     _document = nullptr;
 
     _renderWidget->setShaderToyDocument(nullptr);
+    _cache->setOpenDocument(nullptr);
   }
 
 
@@ -337,6 +350,52 @@ namespace vh {
   }
 
 
+  void AppWindow::cachePackFinished(bool ok, int entries, qint64 bytes)
+  {
+    if (ok) {
+      statusBar()->showMessage(QString("Packed %1 images (%2 MB)").arg(entries).arg(bytes / (1024.0 * 1024.0), 0, 'f', 1));
+    }
+    else {
+      statusBar()->showMessage("Packing cached images failed, see the log for details");
+    }
+  }
+
+
+  void AppWindow::cacheScrubFinished(int checked, int missing, int corrupt, int migrated)
+  {
+    QString message = QString("Checked %1 cached files: %2 missing, %3 corrupt.").arg(checked).arg(missing).arg(corrupt);
+    if (migrated > 0) {
+      message += QString(" Moved %1 files into the new cache layout.").arg(migrated);
+    }
+    if (missing + corrupt > 0) {
+      message += "\n\nDamaged files have been removed and will be downloaded again when next needed.";
+    }
+    QMessageBox::information(this, "Cache verified", message);
+  }
+
+
+  void AppWindow::showCacheStats()
+  {
+    if (_cache == nullptr) {
+      return;
+    }
+
+    const double kMB = 1024.0 * 1024.0;
+    FileCacheStats stats = _cache->stats();
+    QString budget = (stats.maxBytes > 0) ? QString("%1 MB").arg(stats.maxBytes / kMB, 0, 'f', 0) : QString("unlimited");
+    QString message = QString("Size: %1 MB (budget: %2)\n"
+                              "Lookups: %3 hits, %4 misses\n"
+                              "Evicted: %5 files, %6 MB")
+                      .arg(stats.totalBytes / kMB, 0, 'f', 1)
+                      .arg(budget)
+                      .arg(stats.hits)
+                      .arg(stats.misses)
+                      .arg(stats.evictedFiles)
+                      .arg(stats.evictedBytes / kMB, 0, 'f', 1);
+    QMessageBox::information(this, "Cache statistics", message);
+  }
+
+
   void AppWindow::restoreWindowState()
   {
     qDebug("Restoring window state");
@@ -419,6 +478,7 @@ namespace vh {
     connect(_renderWidget, &RenderWidget::closeRequested, this, &QMainWindow::close);
     connect(_renderWidget, &RenderWidget::currentShaderToyDocumentChanged, this, &AppWindow::renderWidgetDocumentChanged);
     connect(_renderWidget, &RenderWidget::frameCaptured, this, &AppWindow::saveScreenshot);
+    connect(_renderWidget, &RenderWidget::renderingFailed, this, &AppWindow::renderWidgetFailed);
 
     _docTree = new QTreeWidget(this);
     _docTreeDockable = new QDockWidget("Doc Tree", this);
@@ -546,6 +606,7 @@ namespace vh {
     _viewPassMenu   = menu->addMenu("&Pass");
     QAction* toggleInputsAction  = menu->addAction("Show &Inputs",  renderWidget, &RenderWidget::toggleInputs);
     QAction* toggleOutputsAction = menu->addAction("Show &Outputs", renderWidget, &RenderWidget::toggleOutputs);
+    QAction* passUpdateRatesAction = menu->addAction("Use pass &update rates");
     menu->addSeparator();
     QMenu* viewHUDContentsMenu = menu->addMenu("HUD &Contents");
     QAction* toggleHUDAction     = menu->addAction("Show &HUD",     renderWidget, &RenderWidget::toggleHUD);
@@ -561,6 +622,10 @@ namespace vh {
     toggleOutputsAction->setCheckable(true);
     toggleOutputsAction->setChecked(false);
 
+    passUpdateRatesAction->setCheckable(true);
+    passUpdateRatesAction->setChecked(renderWidget->passUpdateRatesEnabled());
+    QObject::connect(passUpdateRatesAction, &QAction::toggled, renderWidget, &RenderWidget::setPassUpdateRatesEnabled);
+
     setupViewRenderMenu(viewRenderMenu);
     setupViewZoomMenu(viewZoomMenu);
     setupViewPassMenu(_viewPassMenu);
@@ -579,6 +644,12 @@ namespace vh {
       url.setPath(cache->cacheDir().absolutePath());
       QDesktopServices::openUrl(url);
     });
+    menu->addAction("Verify cache contents", cache, &FileCache::scrubInBackground);
+    menu->addAction("Pack cached images", [this, cache](){
+      statusBar()->showMessage("Packing cached images...");
+      cache->rebuildPackInBackground();
+    });
+    menu->addAction("Cache statistics...", this, &AppWindow::showCacheStats);
     menu->addSeparator();
     menu->addAction("Clear cache...", this, &AppWindow::deleteCache);
   }
@@ -677,6 +748,9 @@ namespace vh {
     actions.push_back(menu->addAction("1.25x window", [renderWidget](){ renderWidget->setRelativeRenderResolution(1.25f); }));
     actions.push_back(menu->addAction("1.5x window", [renderWidget](){ renderWidget->setRelativeRenderResolution(1.5f); }));
     actions.push_back(menu->addAction("2.0x window", [renderWidget](){ renderWidget->setRelativeRenderResolution(2.0f); }));
+    menu->addSeparator();
+    actions.push_back(menu->addAction("Adaptive, 60 FPS target", [renderWidget](){ renderWidget->setAdaptiveRenderResolution(1000.0f / 60.0f); }));
+    actions.push_back(menu->addAction("Adaptive, 30 FPS target", [renderWidget](){ renderWidget->setAdaptiveRenderResolution(1000.0f / 30.0f); }));
 
     for (QAction* action : actions) {
       group->addAction(action);
@@ -687,6 +761,41 @@ namespace vh {
       defaultRenderSizeAction = actions.front();
     }
     defaultRenderSizeAction->setChecked(true);
+
+    // Frame pacing. Shaders which don't change over time are only rendered
+    // when something changes, whatever the mode.
+    menu->addSeparator();
+    auto setPacing = [this, renderWidget](PacingMode mode, int fps) {
+      renderWidget->setPacingMode(mode);
+      if (fps > 0) {
+        renderWidget->setMaxFPS(fps);
+      }
+      if (RenderWidget::swapIntervalForPacing(mode) != QSurfaceFormat::defaultFormat().swapInterval()) {
+        statusBar()->showMessage("Restart Shadertron to turn vsync on or off");
+      }
+    };
+    QActionGroup* pacingGroup = new QActionGroup(menu);
+    QAction* vsyncAction    = menu->addAction("Pace frames to &vsync",                [setPacing](){ setPacing(PacingMode::eVSync, 0); });
+    QAction* uncappedAction = menu->addAction("&Uncapped frame rate (benchmarking)",  [setPacing](){ setPacing(PacingMode::eUncapped, 0); });
+    QAction* fixed60Action  = menu->addAction("Fixed 60 FPS",                         [setPacing](){ setPacing(PacingMode::eFixedRate, 60); });
+    QAction* fixed30Action  = menu->addAction("Fixed 30 FPS",                         [setPacing](){ setPacing(PacingMode::eFixedRate, 30); });
+    for (QAction* action : { vsyncAction, uncappedAction, fixed60Action, fixed30Action }) {
+      pacingGroup->addAction(action);
+      action->setCheckable(true);
+    }
+
+    switch (renderWidget->pacingMode()) {
+    case PacingMode::eVSync:
+      vsyncAction->setChecked(true);
+      break;
+    case PacingMode::eUncapped:
+      uncappedAction->setChecked(true);
+      break;
+    case PacingMode::eFixedRate:
+      fixed60Action->setChecked(renderWidget->maxFPS() == 60);
+      fixed30Action->setChecked(renderWidget->maxFPS() == 30);
+      break;
+    }
   }
 
 
@@ -759,6 +868,7 @@ namespace vh {
     actions.push_back(menu->addAction("&Frames per second",      [renderWidget](){ renderWidget->toggleHUDFlag(kHUD_FramesPerSec); }));
     actions.push_back(menu->addAction("&Mouse position",         [renderWidget](){ renderWidget->toggleHUDFlag(kHUD_MousePos); }));
     actions.push_back(menu->addAction("&Mouse down position",    [renderWidget](){ renderWidget->toggleHUDFlag(kHUD_MouseDownPos); }));
+    actions.push_back(menu->addAction("&Render target memory",   [renderWidget](){ renderWidget->toggleHUDFlag(kHUD_TextureMemory); }));
 
     for (int i = 0; i < actions.size(); i++) {
       actions[i]->setCheckable(true);
@@ -891,6 +1001,12 @@ namespace vh {
   }
 
 
+  void AppWindow::renderWidgetFailed(const QString& message)
+  {
+    QMessageBox::critical(this, "Rendering failed", message);
+  }
+
+
   void AppWindow::watchedfileChanged(const QString& path)
   {
     qDebug("detected a change to file %s, reloading", qPrintable(path));
@@ -904,6 +1020,23 @@ namespace vh {
   }
 
 
+  void AppWindow::downloadProgress(const QString& path, qint64 bytesReceived, qint64 bytesTotal)
+  {
+    const double kMB = 1024.0 * 1024.0;
+    QString name = QFileInfo(path).fileName();
+    if (bytesTotal > 0) {
+      statusBar()->showMessage(QString("Downloading %1: %2 of %3 MB (%4%)")
+                               .arg(name)
+                               .arg(bytesReceived / kMB, 0, 'f', 1)
+                               .arg(bytesTotal / kMB, 0, 'f', 1)
+                               .arg(int(bytesReceived * 100 / bytesTotal)), kDownloadProgressMessageMS);
+    }
+    else {
+      statusBar()->showMessage(QString("Downloading %1: %2 MB").arg(name).arg(bytesReceived / kMB, 0, 'f', 1), kDownloadProgressMessageMS);
+    }
+  }
+
+
   void AppWindow::saveWindowState()
   {
     if (!_saveWindowState) {
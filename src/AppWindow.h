@@ -58,6 +58,9 @@ namespace vh {
     void toggleFullscreen();
 
     void deleteCache();
+    void cachePackFinished(bool ok, int entries, qint64 bytes);
+    void cacheScrubFinished(int checked, int missing, int corrupt, int migrated);
+    void showCacheStats();
 
     void restoreWindowState();
     void resizeToRenderWidgetDisplayRect();
@@ -94,8 +97,10 @@ namespace vh {
   private slots:
     void reloadFile();
     void renderWidgetDocumentChanged();
+    void renderWidgetFailed(const QString& message);
     void watchedfileChanged(const QString& path);
     void standardAssetsReady();
+    void downloadProgress(const QString& path, qint64 bytesReceived, qint64 bytesTotal);
 
     void saveWindowState();
     void removeSavedWindowState();
@@ -0,0 +1,174 @@
+// Copyright 2019 Vilya Harvey
+#include "AssetBundle.h"
+
+#include "FileCache.h"
+#include "FileHash.h"
+#include "ShaderToy.h"
+#include "Timer.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+#include <stdexcept>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static const QString kBundledDocumentPath("documents/%1");
+
+
+  //
+  // AssetBundle public methods
+  //
+
+  AssetBundle::AssetBundle(FileCache* cache) :
+    _cache(cache)
+  {
+  }
+
+
+  bool AssetBundle::exportTo(const QString& bundleFilename, const QStringList& shaders)
+  {
+    _stats = AssetBundleStats();
+    Timer timer(true);
+
+    QVector<AssetPackSource> sources;
+    for (const QString& shader : shaders) {
+      if (!addDocument(shader, sources)) {
+        return false;
+      }
+    }
+
+    AssetPackWriteStats packStats;
+    if (!AssetPack::write(bundleFilename, sources, &packStats)) {
+      return false;
+    }
+
+    _stats.files = packStats.entries;
+    _stats.objects = packStats.objects;
+    _stats.bytes = packStats.bytes;
+    _stats.secs = timer.elapsedSecs();
+    return true;
+  }
+
+
+  bool AssetBundle::importFrom(const QString& bundleFilename)
+  {
+    _stats = AssetBundleStats();
+    Timer timer(true);
+
+    // The pack maps the whole bundle if it can, so files go from the page
+    // cache straight into the cache without an extra copy.
+    AssetPack pack;
+    if (!pack.open(bundleFilename)) {
+      return false;
+    }
+
+    int failures = 0;
+    const QHash<QString, AssetPackEntry>& entries = pack.entries();
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+      const QString& path = it.key();
+      const AssetPackEntry& entry = it.value();
+
+      ++_stats.files;
+      if (_cache->hasCachedContent(path, entry.sha256)) {
+        ++_stats.skipped;
+        continue;
+      }
+
+      if (!_cache->saveFileToCache(path, pack.data(entry), nullptr)) {
+        ++failures;
+        continue;
+      }
+      if (_cache->contentHash(path) != entry.sha256) {
+        qWarning("%s in %s is corrupt", qPrintable(path), qPrintable(bundleFilename));
+        _cache->removeFromCache(path);
+        ++failures;
+        continue;
+      }
+
+      ++_stats.objects;
+      _stats.bytes += entry.size;
+    }
+
+    _stats.secs = timer.elapsedSecs();
+    return failures == 0;
+  }
+
+
+  const AssetBundleStats& AssetBundle::stats() const
+  {
+    return _stats;
+  }
+
+
+  //
+  // AssetBundle private methods
+  //
+
+  bool AssetBundle::addDocument(const QString& shader, QVector<AssetPackSource>& sources)
+  {
+    QString path, filename;
+    if (QFileInfo(shader).isFile()) {
+      path = kBundledDocumentPath.arg(QFileInfo(shader).fileName());
+      filename = shader;
+    }
+    else {
+      path = FileCache::pathForShaderID(shader);
+      if (path.isEmpty()) {
+        qCritical("%s is not a file or a ShaderToy ID", qPrintable(shader));
+        return false;
+      }
+      if (!_cache->isCached(path)) {
+        qCritical("Shader %s is not in the cache", qPrintable(shader));
+        return false;
+      }
+      filename = _cache->pathForCachedFile(path);
+    }
+
+    ShaderToyDocument* doc = nullptr;
+    try {
+      doc = loadShaderToyJSONFile(filename, ShaderToyLoadMode::eAssetsOnly);
+    }
+    catch (const std::runtime_error& err) {
+      qCritical("Unable to load %s: %s", qPrintable(filename), err.what());
+      return false;
+    }
+    QSet<QString> assets = FileCache::assetsForDocument(doc);
+    delete doc;
+
+    addFile(path, filename, !QFileInfo(shader).isFile(), sources);
+    for (const QString& asset : assets) {
+      if (!asset.startsWith("/media/")) {
+        continue;
+      }
+      if (!_cache->isCached(asset)) {
+        qWarning("%s uses %s, which is not in the cache", qPrintable(shader), qPrintable(asset));
+        ++_stats.skipped;
+        continue;
+      }
+      addFile(asset.mid(1), _cache->pathForCachedFile(asset), true, sources);
+    }
+    return true;
+  }
+
+
+  void AssetBundle::addFile(const QString& path, const QString& filename, bool cached, QVector<AssetPackSource>& sources)
+  {
+    for (const AssetPackSource& source : sources) {
+      if (source.path == path) {
+        return;
+      }
+    }
+
+    AssetPackSource source;
+    source.path = path;
+    source.filename = filename;
+    source.sha256 = cached ? _cache->contentHash(path) : sha256OfFile(filename); // The cache usually knows the hash already.
+    sources.append(source);
+  }
+
+} // namespace vh
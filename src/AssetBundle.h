@@ -0,0 +1,68 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_ASSETBUNDLE_H
+#define VH_ASSETBUNDLE_H
+
+#include "AssetPack.h"
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // Forward declarations
+  //
+
+  class FileCache;
+
+
+  //
+  // Structs
+  //
+
+  struct AssetBundleStats {
+    int files     = 0;      // Cache paths exported or imported.
+    int skipped   = 0;      // Paths which were already in the cache, or missing when exporting.
+    int objects   = 0;      // Distinct file contents written.
+    qint64 bytes  = 0;      // Total size of the distinct file contents written.
+    double secs   = 0.0;
+  };
+
+
+  //
+  // AssetBundle class
+  //
+
+  /// A single file holding a set of shaders together with every asset they
+  /// use, for copying onto machines with no network access.
+  ///
+  /// A bundle is an `AssetPack` keyed by cache path. Importing maps it and
+  /// copies each file into the cache, skipping anything the cache already
+  /// has with the same hash.
+  class AssetBundle
+  {
+  public:
+    explicit AssetBundle(FileCache* cache);
+
+    /// Each of `shaders` is a ShaderToy ID, a view URL or the filename of a
+    /// local ShaderToy JSON file. Shaders given by ID must already be in the
+    /// cache. Local files are bundled under `documents/<filename>`.
+    bool exportTo(const QString& bundleFilename, const QStringList& shaders);
+
+    bool importFrom(const QString& bundleFilename);
+
+    const AssetBundleStats& stats() const;
+
+  private:
+    bool addDocument(const QString& shader, QVector<AssetPackSource>& sources);
+    void addFile(const QString& path, const QString& filename, bool cached, QVector<AssetPackSource>& sources);
+
+  private:
+    FileCache* _cache;
+    AssetBundleStats _stats;
+  };
+
+} // namespace vh
+
+#endif // VH_ASSETBUNDLE_H
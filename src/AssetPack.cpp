@@ -0,0 +1,269 @@
+// Copyright 2019 Vilya Harvey
+#include "AssetPack.h"
+
+#include <QDataStream>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPair>
+#include <QSaveFile>
+
+#include <cstring>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static const char kAssetPackMagic[8] = { 'S', 'H', 'T', 'R', 'P', 'A', 'C', 'K' };
+  static constexpr qint64 kAssetPackHeaderBytes = 32;
+  static constexpr qint64 kCopyChunkBytes = 1024 * 1024;
+
+
+  //
+  // Private helper functions
+  //
+
+  // Header layout: magic (8 bytes), version (u32), reserved (u32), index
+  // offset (u64), index size (u64). All little endian.
+  static void writeHeader(QIODevice& file, qint64 indexOffset, qint64 indexSize)
+  {
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.writeRawData(kAssetPackMagic, sizeof(kAssetPackMagic));
+    out << quint32(kAssetPackVersion);
+    out << quint32(0);
+    out << quint64(indexOffset);
+    out << quint64(indexSize);
+  }
+
+
+  static bool readHeader(QIODevice& file, qint64& indexOffset, qint64& indexSize)
+  {
+    QDataStream in(&file);
+    in.setByteOrder(QDataStream::LittleEndian);
+
+    char magic[sizeof(kAssetPackMagic)];
+    quint32 version = 0, reserved = 0;
+    quint64 offset = 0, size = 0;
+    if (in.readRawData(magic, sizeof(magic)) != int(sizeof(magic)) ||
+        memcmp(magic, kAssetPackMagic, sizeof(magic)) != 0) {
+      qCritical("Not an asset pack");
+      return false;
+    }
+    in >> version >> reserved >> offset >> size;
+    if (in.status() != QDataStream::Ok) {
+      qCritical("Asset pack header is truncated");
+      return false;
+    }
+    if (version < 1 || version > quint32(kAssetPackVersion)) {
+      qCritical("Asset pack version %u is not supported", version);
+      return false;
+    }
+
+    indexOffset = qint64(offset);
+    indexSize = qint64(size);
+    return true;
+  }
+
+
+  //
+  // AssetPack public methods
+  //
+
+  AssetPack::AssetPack()
+  {
+  }
+
+
+  AssetPack::~AssetPack()
+  {
+    close();
+  }
+
+
+  bool AssetPack::open(const QString& filename)
+  {
+    close();
+
+    _file.setFileName(filename);
+    if (!_file.open(QIODevice::ReadOnly)) {
+      qCritical("Unable to open %s: %s", qPrintable(filename), qPrintable(_file.errorString()));
+      return false;
+    }
+
+    qint64 indexOffset = 0, indexSize = 0;
+    if (!readHeader(_file, indexOffset, indexSize)) {
+      close();
+      return false;
+    }
+    if (indexOffset < kAssetPackHeaderBytes || indexSize < 0 || indexOffset + indexSize > _file.size()) {
+      qCritical("%s is truncated or corrupt", qPrintable(filename));
+      close();
+      return false;
+    }
+
+    // If the OS won't map it (e.g. on a 32-bit build with a very large
+    // pack), we fall back to reading each file as it's asked for.
+    _base = _file.map(0, _file.size());
+    if (_base == nullptr) {
+      qDebug("Unable to memory map %s, reading it instead", qPrintable(filename));
+    }
+
+    QByteArray indexData;
+    if (_base != nullptr) {
+      indexData = QByteArray::fromRawData(reinterpret_cast<const char*>(_base + indexOffset), int(indexSize));
+    }
+    else {
+      _file.seek(indexOffset);
+      indexData = _file.read(indexSize);
+    }
+
+    QJsonObject index = QJsonDocument::fromJson(indexData).object()["entries"].toObject();
+    for (auto it = index.constBegin(); it != index.constEnd(); ++it) {
+      QJsonObject obj = it.value().toObject();
+      AssetPackEntry entry;
+      entry.offset = qint64(obj["offset"].toDouble());
+      entry.size   = qint64(obj["size"].toDouble());
+      entry.sha256 = obj["sha256"].toString().toLatin1();
+      entry.format = obj["format"].toString();
+      if (it.key().isEmpty() || entry.offset < kAssetPackHeaderBytes || entry.size < 0 || entry.offset + entry.size > indexOffset) {
+        qWarning("Skipping bad entry for %s in %s", qPrintable(it.key()), qPrintable(filename));
+        continue;
+      }
+      _entries.insert(it.key(), entry);
+    }
+    return true;
+  }
+
+
+  void AssetPack::close()
+  {
+    if (_base != nullptr) {
+      _file.unmap(const_cast<uchar*>(_base));
+      _base = nullptr;
+    }
+    _file.close();
+    _entries.clear();
+  }
+
+
+  bool AssetPack::isOpen() const
+  {
+    return _file.isOpen();
+  }
+
+
+  bool AssetPack::isMapped() const
+  {
+    return _base != nullptr;
+  }
+
+
+  const QHash<QString, AssetPackEntry>& AssetPack::entries() const
+  {
+    return _entries;
+  }
+
+
+  bool AssetPack::contains(const QString& path) const
+  {
+    return _entries.contains(path);
+  }
+
+
+  const AssetPackEntry* AssetPack::entry(const QString& path) const
+  {
+    auto it = _entries.constFind(path);
+    return (it != _entries.constEnd()) ? &it.value() : nullptr;
+  }
+
+
+  QByteArray AssetPack::data(const AssetPackEntry& entry)
+  {
+    if (_base != nullptr) {
+      return QByteArray::fromRawData(reinterpret_cast<const char*>(_base + entry.offset), int(entry.size));
+    }
+    if (!_file.isOpen() || !_file.seek(entry.offset)) {
+      return QByteArray();
+    }
+    return _file.read(entry.size);
+  }
+
+
+  bool AssetPack::write(const QString& filename, const QVector<AssetPackSource>& sources, AssetPackWriteStats* stats)
+  {
+    AssetPackWriteStats localStats;
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+      qCritical("Unable to open %s for writing: %s", qPrintable(filename), qPrintable(file.errorString()));
+      return false;
+    }
+    writeHeader(file, 0, 0);
+
+    // Write the contents of each distinct file, sharing them between names
+    // with the same hash.
+    QHash<QByteArray, QPair<qint64, qint64>> written;
+    QJsonObject index;
+    QByteArray buffer(int(kCopyChunkBytes), '\0');
+    for (const AssetPackSource& source : sources) {
+      if (index.contains(source.path)) {
+        continue;
+      }
+
+      auto it = written.constFind(source.sha256);
+      if (it == written.constEnd()) {
+        QFile src(source.filename);
+        if (!src.open(QIODevice::ReadOnly)) {
+          qCritical("Unable to read %s: %s", qPrintable(source.filename), qPrintable(src.errorString()));
+          file.cancelWriting();
+          return false;
+        }
+        qint64 offset = file.pos();
+        qint64 bytesRead;
+        while ((bytesRead = src.read(buffer.data(), buffer.size())) > 0) {
+          if (file.write(buffer.constData(), bytesRead) != bytesRead) {
+            qCritical("Failed writing to %s: %s", qPrintable(filename), qPrintable(file.errorString()));
+            file.cancelWriting();
+            return false;
+          }
+        }
+        it = written.insert(source.sha256, qMakePair(offset, file.pos() - offset));
+
+        ++localStats.objects;
+        localStats.bytes += it->second;
+      }
+
+      QJsonObject obj;
+      obj["offset"] = double(it->first);
+      obj["size"]   = double(it->second);
+      obj["sha256"] = QString::fromLatin1(source.sha256);
+      obj["format"] = QFileInfo(source.path).suffix().toLower();
+      index[source.path] = obj;
+      ++localStats.entries;
+    }
+
+    QJsonObject json;
+    json["version"] = kAssetPackVersion;
+    json["entries"] = index;
+
+    QByteArray indexData = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    qint64 indexOffset = file.pos();
+    file.write(indexData);
+
+    file.seek(0);
+    writeHeader(file, indexOffset, indexData.size());
+    if (!file.commit()) {
+      qCritical("Unable to save %s: %s", qPrintable(filename), qPrintable(file.errorString()));
+      return false;
+    }
+
+    if (stats != nullptr) {
+      *stats = localStats;
+    }
+    return true;
+  }
+
+} // namespace vh
@@ -0,0 +1,92 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_ASSETPACK_H
+#define VH_ASSETPACK_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kAssetPackVersion = 1;
+
+
+  //
+  // Structs
+  //
+
+  struct AssetPackEntry {
+    qint64 offset = 0;
+    qint64 size = 0;
+    QByteArray sha256;        // Hex encoded.
+    QString format;           // File suffix, e.g. "png". Used as a hint when decoding.
+  };
+
+
+  struct AssetPackSource {
+    QString path;             // Name to store it under.
+    QString filename;         // Where to read the contents from.
+    QByteArray sha256;        // Hex encoded. Sources with the same hash share their contents in the pack.
+  };
+
+
+  struct AssetPackWriteStats {
+    int entries = 0;
+    int objects = 0;          // Distinct contents written.
+    qint64 bytes = 0;         // Total size of the distinct contents.
+  };
+
+
+  //
+  // AssetPack class
+  //
+
+  /// Lots of files packed into one, so they can be read with a single
+  /// memory mapping instead of an open and read per file.
+  ///
+  /// The layout is a fixed size header giving the location of the index,
+  /// then the contents of each distinct file back to back, then the index:
+  /// a JSON object mapping each name onto the offset, size, SHA-256 and
+  /// format of its contents. Names with identical contents share the same
+  /// bytes.
+  ///
+  /// Once open, the pack stays mapped and `data()` returns arrays which
+  /// point directly into the mapping; they're only valid until the pack is
+  /// closed.
+  class AssetPack
+  {
+  public:
+    AssetPack();
+    ~AssetPack();
+
+    bool open(const QString& filename);
+    void close();
+    bool isOpen() const;
+    bool isMapped() const;
+
+    const QHash<QString, AssetPackEntry>& entries() const;
+    bool contains(const QString& path) const;
+    const AssetPackEntry* entry(const QString& path) const;
+
+    /// Zero-copy if the pack is mapped, otherwise reads the contents in.
+    QByteArray data(const AssetPackEntry& entry);
+
+    /// Writes a new pack (via a temp file, so an existing pack with the same
+    /// name is only replaced once the new one is complete).
+    static bool write(const QString& filename, const QVector<AssetPackSource>& sources, AssetPackWriteStats* stats = nullptr);
+
+  private:
+    QFile _file;
+    const uchar* _base = nullptr;
+    QHash<QString, AssetPackEntry> _entries;
+  };
+
+} // namespace vh
+
+#endif // VH_ASSETPACK_H
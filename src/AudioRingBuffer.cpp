@@ -0,0 +1,254 @@
+// Copyright 2019 Vilya Harvey
+#include "AudioRingBuffer.h"
+
+#include <QAudioFormat>
+#include <QMutexLocker>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  // Buffer timestamps are only accurate to the nearest microsecond, so
+  // consecutive buffers may appear to overlap or leave a gap of a frame or
+  // two. Anything within this tolerance is treated as contiguous.
+  static constexpr qint64 kMaxTimestampJitterFrames = 2;
+
+
+  //
+  // Private helper functions
+  //
+
+  // Converts interleaved samples in any of the formats QAudioProbe is likely
+  // to hand us into mono floats in the range [-1, 1]. Returns false if the
+  // format isn't one we know how to handle.
+  static bool convertToMonoFloat(const QAudioBuffer& buffer, QVector<float>& dst)
+  {
+    const QAudioFormat format = buffer.format();
+    const int channels = format.channelCount();
+    const int frames = buffer.frameCount();
+    if (channels <= 0 || frames <= 0) {
+      return false;
+    }
+
+    dst.resize(frames);
+    const float channelScale = 1.0f / float(channels);
+
+    if (format.sampleType() == QAudioFormat::SignedInt && format.sampleSize() == 16) {
+      const qint16* src = reinterpret_cast<const qint16*>(buffer.constData());
+      for (int i = 0; i < frames; i++) {
+        float total = 0.0f;
+        for (int c = 0; c < channels; c++) {
+          total += float(*src++) / 32768.0f;
+        }
+        dst[i] = total * channelScale;
+      }
+    }
+    else if (format.sampleType() == QAudioFormat::SignedInt && format.sampleSize() == 32) {
+      const qint32* src = reinterpret_cast<const qint32*>(buffer.constData());
+      for (int i = 0; i < frames; i++) {
+        float total = 0.0f;
+        for (int c = 0; c < channels; c++) {
+          total += float(double(*src++) / 2147483648.0);
+        }
+        dst[i] = total * channelScale;
+      }
+    }
+    else if (format.sampleType() == QAudioFormat::UnSignedInt && format.sampleSize() == 8) {
+      const quint8* src = reinterpret_cast<const quint8*>(buffer.constData());
+      for (int i = 0; i < frames; i++) {
+        float total = 0.0f;
+        for (int c = 0; c < channels; c++) {
+          total += (float(*src++) - 128.0f) / 128.0f;
+        }
+        dst[i] = total * channelScale;
+      }
+    }
+    else if (format.sampleType() == QAudioFormat::Float && format.sampleSize() == 32) {
+      const float* src = reinterpret_cast<const float*>(buffer.constData());
+      for (int i = 0; i < frames; i++) {
+        float total = 0.0f;
+        for (int c = 0; c < channels; c++) {
+          total += *src++;
+        }
+        dst[i] = total * channelScale;
+      }
+    }
+    else {
+      return false;
+    }
+
+    return true;
+  }
+
+
+  //
+  // AudioRingBuffer public methods
+  //
+
+  AudioRingBuffer::AudioRingBuffer()
+  {
+  }
+
+
+  void AudioRingBuffer::clear()
+  {
+    QMutexLocker lock(&_mutex);
+    _numFrames = 0;
+    _endFrame = 0;
+  }
+
+
+  bool AudioRingBuffer::isEmpty() const
+  {
+    QMutexLocker lock(&_mutex);
+    return _numFrames == 0;
+  }
+
+
+  int AudioRingBuffer::sampleRate() const
+  {
+    QMutexLocker lock(&_mutex);
+    return _sampleRate;
+  }
+
+
+  qint64 AudioRingBuffer::startTimeUS() const
+  {
+    QMutexLocker lock(&_mutex);
+    return timeForFrame(_endFrame - _numFrames);
+  }
+
+
+  qint64 AudioRingBuffer::endTimeUS() const
+  {
+    QMutexLocker lock(&_mutex);
+    return timeForFrame(_endFrame);
+  }
+
+
+  void AudioRingBuffer::append(const QAudioBuffer& buffer)
+  {
+    QMutexLocker lock(&_mutex);
+    if (!convertToMonoFloat(buffer, _scratch)) {
+      qWarning("Ignoring audio buffer with unsupported format (%d bit, type %d)",
+               buffer.format().sampleSize(), int(buffer.format().sampleType()));
+      return;
+    }
+    appendLocked(_scratch.constData(), _scratch.size(), buffer.format().sampleRate(), buffer.startTime());
+  }
+
+
+  void AudioRingBuffer::append(const float* samples, int numFrames, int sampleRate, qint64 startTimeUS)
+  {
+    QMutexLocker lock(&_mutex);
+    appendLocked(samples, numFrames, sampleRate, startTimeUS);
+  }
+
+
+  bool AudioRingBuffer::extract(qint64 startTimeUS, int numFrames, float* dst) const
+  {
+    QMutexLocker lock(&_mutex);
+    if (numFrames <= 0) {
+      return false;
+    }
+
+    if (_numFrames == 0) {
+      memset(dst, 0, sizeof(float) * size_t(numFrames));
+      return false;
+    }
+
+    const int capacity = _samples.size();
+    const qint64 firstAvailable = _endFrame - _numFrames;
+    const qint64 startFrame = frameForTime(startTimeUS);
+
+    bool anyAvailable = false;
+    for (int i = 0; i < numFrames; i++) {
+      qint64 frame = startFrame + i;
+      if (frame < firstAvailable || frame >= _endFrame) {
+        dst[i] = 0.0f;
+      }
+      else {
+        dst[i] = _samples[int(frame % capacity)];
+        anyAvailable = true;
+      }
+    }
+    return anyAvailable;
+  }
+
+
+  //
+  // AudioRingBuffer private methods
+  //
+
+  void AudioRingBuffer::appendLocked(const float* samples, int numFrames, int sampleRate, qint64 startTimeUS)
+  {
+    if (numFrames <= 0 || sampleRate <= 0) {
+      return;
+    }
+
+    if (sampleRate != _sampleRate) {
+      reset(sampleRate, 0);
+    }
+
+    // Work out where this buffer sits relative to the data we already have.
+    // If it follows on from the previous buffer we just keep appending,
+    // otherwise playback has jumped (e.g. a seek or the playlist looping) and
+    // the old history is no longer meaningful.
+    qint64 startFrame = frameForTime(startTimeUS);
+    qint64 delta = startFrame - _endFrame;
+    if (_numFrames > 0 && delta >= -kMaxTimestampJitterFrames && delta <= kMaxTimestampJitterFrames) {
+      startFrame = _endFrame;
+    }
+    else {
+      reset(sampleRate, startFrame);
+    }
+
+    // If the incoming data is bigger than the whole ring, only the tail of it
+    // is going to survive anyway.
+    const int capacity = _samples.size();
+    if (numFrames > capacity) {
+      samples += (numFrames - capacity);
+      startFrame += (numFrames - capacity);
+      numFrames = capacity;
+    }
+
+    int writePos = int(startFrame % capacity);
+    int firstChunk = qMin(numFrames, capacity - writePos);
+    memcpy(_samples.data() + writePos, samples, sizeof(float) * size_t(firstChunk));
+    if (firstChunk < numFrames) {
+      memcpy(_samples.data(), samples + firstChunk, sizeof(float) * size_t(numFrames - firstChunk));
+    }
+
+    _endFrame = startFrame + numFrames;
+    _numFrames = qMin(_numFrames + numFrames, capacity);
+  }
+
+
+  void AudioRingBuffer::reset(int sampleRate, qint64 firstFrame)
+  {
+    if (sampleRate != _sampleRate || _samples.isEmpty()) {
+      _sampleRate = sampleRate;
+      _samples.resize(qMax(1, sampleRate * kAudioRingBufferMS / 1000));
+    }
+    _endFrame = firstFrame;
+    _numFrames = 0;
+  }
+
+
+  qint64 AudioRingBuffer::frameForTime(qint64 timeUS) const
+  {
+    // Multiply before dividing to preserve accuracy. Rounds towards negative
+    // infinity so that times just before zero don't map onto frame zero.
+    qint64 scaled = timeUS * qint64(_sampleRate);
+    return (scaled >= 0) ? (scaled / 1000000) : -((-scaled + 999999) / 1000000);
+  }
+
+
+  qint64 AudioRingBuffer::timeForFrame(qint64 frame) const
+  {
+    return (_sampleRate > 0) ? (frame * 1000000 / qint64(_sampleRate)) : 0;
+  }
+
+} // namespace vh
@@ -0,0 +1,72 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_AUDIORINGBUFFER_H
+#define VH_AUDIORINGBUFFER_H
+
+#include <QAudioBuffer>
+#include <QMutex>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kAudioRingBufferMS       = 500;   // How much decoded audio history we keep around.
+  static constexpr int kDefaultAudioSampleRate  = 44100;
+
+
+  //
+  // AudioRingBuffer class
+  //
+
+  /// Holds the most recent few hundred milliseconds of decoded audio, mixed
+  /// down to mono, indexed by presentation timestamp. This lets us extract
+  /// the exact window of samples for any playback position, even when that
+  /// window straddles the boundary between two decoded buffers.
+  ///
+  /// All public methods are thread safe, so capture threads can append while
+  /// the render thread extracts.
+  class AudioRingBuffer
+  {
+  public:
+    AudioRingBuffer();
+
+    void clear();
+
+    bool isEmpty() const;
+    int sampleRate() const;
+
+    /// Timestamps (in microseconds) of the oldest sample we still hold and of
+    /// the point just past the newest sample.
+    qint64 startTimeUS() const;
+    qint64 endTimeUS() const;
+
+    void append(const QAudioBuffer& buffer);
+    void append(const float* samples, int numFrames, int sampleRate, qint64 startTimeUS);
+
+    /// Copies `numFrames` samples starting at `startTimeUS` into `dst`. Any
+    /// part of the window which isn't in the buffer is filled with silence.
+    /// Returns false if none of the window was available.
+    bool extract(qint64 startTimeUS, int numFrames, float* dst) const;
+
+  private:
+    // These all assume the caller already holds _mutex.
+    void appendLocked(const float* samples, int numFrames, int sampleRate, qint64 startTimeUS);
+    void reset(int sampleRate, qint64 firstFrame);
+
+    qint64 frameForTime(qint64 timeUS) const;
+    qint64 timeForFrame(qint64 frame) const;
+
+  private:
+    mutable QMutex _mutex;
+    QVector<float> _samples;  // Circular buffer of mono samples.
+    QVector<float> _scratch;  // Reused when converting incoming buffers to mono float.
+    int _sampleRate   = 0;
+    qint64 _endFrame  = 0;    // Absolute index of the frame just past the newest one we hold.
+    int _numFrames    = 0;    // How many valid frames we hold, ending at _endFrame.
+  };
+
+} // namespace vh
+
+#endif // VH_AUDIORINGBUFFER_H
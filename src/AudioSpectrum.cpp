@@ -0,0 +1,121 @@
+// Copyright 2019 Vilya Harvey
+#include "AudioSpectrum.h"
+
+#include <QtGlobal>
+
+#include <cmath>
+#include <cstring>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  // These are the WebAudio AnalyserNode defaults, which is what ShaderToy uses.
+  static constexpr float kSmoothingTimeConstant = 0.8f;
+  static constexpr float kMinDecibels           = -100.0f;
+  static constexpr float kMaxDecibels           = -30.0f;
+
+  static constexpr double kPi = 3.14159265358979323846;
+
+
+  //
+  // AudioSpectrum public methods
+  //
+
+  AudioSpectrum::AudioSpectrum()
+  {
+    // Blackman window, with the same coefficients as WebAudio.
+    const double a0 = 0.42, a1 = 0.5, a2 = 0.08;
+    for (int i = 0; i < kAudioFFTSize; i++) {
+      double x = double(i) / double(kAudioFFTSize);
+      _window[i] = float(a0 - a1 * std::cos(2.0 * kPi * x) + a2 * std::cos(4.0 * kPi * x));
+    }
+
+    for (int i = 0; i < kAudioFFTSize / 2; i++) {
+      double angle = -2.0 * kPi * double(i) / double(kAudioFFTSize);
+      _cos[i] = float(std::cos(angle));
+      _sin[i] = float(std::sin(angle));
+    }
+
+    int bits = 0;
+    while ((1 << bits) < kAudioFFTSize) {
+      ++bits;
+    }
+    for (int i = 0; i < kAudioFFTSize; i++) {
+      int r = 0;
+      for (int b = 0; b < bits; b++) {
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      _bitReverse[i] = r;
+    }
+
+    reset();
+  }
+
+
+  void AudioSpectrum::reset()
+  {
+    memset(_smoothed, 0, sizeof(_smoothed));
+    memset(_levels, 0, sizeof(_levels));
+  }
+
+
+  void AudioSpectrum::analyse(const float* samples)
+  {
+    for (int i = 0; i < kAudioFFTSize; i++) {
+      int j = _bitReverse[i];
+      _re[j] = samples[i] * _window[i];
+      _im[j] = 0.0f;
+    }
+
+    fft();
+
+    const float scale = 1.0f / float(kAudioFFTSize);
+    const float dbRange = kMaxDecibels - kMinDecibels;
+    for (int k = 0; k < kAudioFFTBins; k++) {
+      float magnitude = std::sqrt(_re[k] * _re[k] + _im[k] * _im[k]) * scale;
+      _smoothed[k] = kSmoothingTimeConstant * _smoothed[k] + (1.0f - kSmoothingTimeConstant) * magnitude;
+
+      float db = (_smoothed[k] > 0.0f) ? 20.0f * std::log10(_smoothed[k]) : kMinDecibels;
+      _levels[k] = qBound(0.0f, (db - kMinDecibels) / dbRange, 1.0f);
+    }
+  }
+
+
+  const float* AudioSpectrum::levels() const
+  {
+    return _levels;
+  }
+
+
+  //
+  // AudioSpectrum private methods
+  //
+
+  // In-place iterative radix-2 FFT. Expects the input to already be in
+  // bit-reversed order.
+  void AudioSpectrum::fft()
+  {
+    for (int size = 2; size <= kAudioFFTSize; size *= 2) {
+      const int half = size / 2;
+      const int twiddleStep = kAudioFFTSize / size;
+      for (int start = 0; start < kAudioFFTSize; start += size) {
+        for (int k = 0; k < half; k++) {
+          const float wr = _cos[k * twiddleStep];
+          const float wi = _sin[k * twiddleStep];
+          const int a = start + k;
+          const int b = a + half;
+          const float tr = wr * _re[b] - wi * _im[b];
+          const float ti = wr * _im[b] + wi * _re[b];
+          _re[b] = _re[a] - tr;
+          _im[b] = _im[a] - ti;
+          _re[a] += tr;
+          _im[a] += ti;
+        }
+      }
+    }
+  }
+
+} // namespace vh
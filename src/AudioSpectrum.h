@@ -0,0 +1,55 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_AUDIOSPECTRUM_H
+#define VH_AUDIOSPECTRUM_H
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kAudioFFTSize = 1024;
+  static constexpr int kAudioFFTBins = kAudioFFTSize / 2;
+
+
+  //
+  // AudioSpectrum class
+  //
+
+  /// Computes the frequency spectrum that ShaderToy puts in the first row of
+  /// an audio channel. This follows the WebAudio AnalyserNode that ShaderToy
+  /// uses: a Blackman window, a 1024 point FFT, smoothing over time and a
+  /// decibel scale from -100 dB to -30 dB, mapped onto [0, 1].
+  class AudioSpectrum
+  {
+  public:
+    AudioSpectrum();
+
+    /// Forgets the smoothing history, e.g. after a seek.
+    void reset();
+
+    /// `samples` must hold kAudioFFTSize mono samples, oldest first.
+    void analyse(const float* samples);
+
+    /// kAudioFFTBins values in [0, 1], lowest frequency first.
+    const float* levels() const;
+
+  private:
+    void fft();
+
+  private:
+    float _window[kAudioFFTSize];
+    float _cos[kAudioFFTSize / 2];
+    float _sin[kAudioFFTSize / 2];
+    int _bitReverse[kAudioFFTSize];
+
+    float _re[kAudioFFTSize];
+    float _im[kAudioFFTSize];
+
+    float _smoothed[kAudioFFTBins];
+    float _levels[kAudioFFTBins];
+  };
+
+} // namespace vh
+
+#endif // VH_AUDIOSPECTRUM_H
@@ -0,0 +1,445 @@
+// Copyright 2019 Vilya Harvey
+#include "DownloadScheduler.h"
+
+#include "FileHash.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QNetworkRequest>
+#include <QRegularExpression>
+#include <QTimer>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kHTTPStatusOK                  = 200;
+  static constexpr int kHTTPStatusPartialContent      = 206;
+  static constexpr int kHTTPStatusRangeNotSatisfiable = 416;
+
+
+  //
+  // Private helper functions
+  //
+
+  // Errors where trying again won't help.
+  static bool isPermanentError(QNetworkReply::NetworkError err)
+  {
+    switch (err) {
+    case QNetworkReply::ContentAccessDenied:
+    case QNetworkReply::ContentNotFoundError:
+    case QNetworkReply::ContentGoneError:
+    case QNetworkReply::AuthenticationRequiredError:
+    case QNetworkReply::ProtocolUnknownError:
+    case QNetworkReply::ProtocolInvalidOperationError:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+
+  // Makes sure everything written to the file has reached the disk, so
+  // that once it's renamed into the cache a crash can't leave a truncated
+  // object behind. This is what QSaveFile::commit does for in-memory writes.
+  static bool syncFile(QFile& file)
+  {
+    if (!file.flush()) {
+      return false;
+    }
+#ifdef _WIN32
+    return _commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+  }
+
+
+  // The full size of the resource, from a 416 reply's
+  // `Content-Range: bytes */<size>` header. Returns -1 if it didn't say.
+  static qint64 totalSizeFromContentRange(QNetworkReply* reply)
+  {
+    static const QRegularExpression rangeRE("^bytes\\s+\\*/(\\d+)$");
+    QRegularExpressionMatch match = rangeRE.match(QString::fromLatin1(reply->rawHeader("Content-Range")).trimmed());
+    return match.hasMatch() ? match.captured(1).toLongLong() : -1;
+  }
+
+
+  // Where the data in a 206 reply starts, from its
+  // `Content-Range: bytes <first>-<last>/<size>` header. Returns -1 if it
+  // didn't say.
+  static qint64 rangeStartFromContentRange(QNetworkReply* reply)
+  {
+    static const QRegularExpression rangeRE("^bytes\\s+(\\d+)-\\d+/(\\d+|\\*)$");
+    QRegularExpressionMatch match = rangeRE.match(QString::fromLatin1(reply->rawHeader("Content-Range")).trimmed());
+    return match.hasMatch() ? match.captured(1).toLongLong() : -1;
+  }
+
+
+  //
+  // DownloadScheduler public methods
+  //
+
+  DownloadScheduler::DownloadScheduler(QObject* parent) :
+    QObject(parent)
+  {
+    _network = new QNetworkAccessManager(this);
+  }
+
+
+  DownloadScheduler::~DownloadScheduler()
+  {
+    for (auto it = _active.begin(); it != _active.end(); ++it) {
+      it.key()->disconnect(this);
+      it.key()->abort();
+      it.key()->deleteLater();
+      endFileTransfer(it.value()); // Keeps whatever we've got so far, so we can resume next time.
+    }
+  }
+
+
+  int DownloadScheduler::maxConcurrent() const
+  {
+    return _maxConcurrent;
+  }
+
+
+  void DownloadScheduler::setMaxConcurrent(int n)
+  {
+    _maxConcurrent = qMax(1, n);
+    startPending();
+  }
+
+
+  int DownloadScheduler::maxRetries() const
+  {
+    return _maxRetries;
+  }
+
+
+  void DownloadScheduler::setMaxRetries(int n)
+  {
+    _maxRetries = qMax(0, n);
+  }
+
+
+  void DownloadScheduler::enqueue(const QUrl& url, const QString& tag)
+  {
+    Job job;
+    job.url = url;
+    job.tag = tag;
+    enqueueJob(job);
+  }
+
+
+  void DownloadScheduler::enqueueToFile(const QUrl& url, const QString& tag, const QString& filename, const QByteArray& expectedSHA256)
+  {
+    Job job;
+    job.url = url;
+    job.tag = tag;
+    job.filename = filename;
+    job.expectedSHA256 = expectedSHA256;
+    enqueueJob(job);
+  }
+
+
+  bool DownloadScheduler::isIdle() const
+  {
+    return _pending.isEmpty() && _active.isEmpty() && _waitingForRetry == 0;
+  }
+
+
+  const DownloadSchedulerStats& DownloadScheduler::stats() const
+  {
+    return _stats;
+  }
+
+
+  //
+  // DownloadScheduler private slots
+  //
+
+  void DownloadScheduler::replyFinished()
+  {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    reply->deleteLater();
+
+    auto it = _active.find(reply);
+    if (it == _active.end()) {
+      return;
+    }
+    Transfer transfer = it.value();
+    _active.erase(it);
+
+    const Job& job = transfer.job;
+    QNetworkReply::NetworkError err = reply->error();
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    bool ok = (err == QNetworkReply::NoError);
+    if (ok && !job.filename.isEmpty()) {
+      // Write out anything still buffered in the reply.
+      if (!transfer.started) {
+        ok = beginFileTransfer(reply, transfer);
+      }
+      ok = ok && transfer.writable; // e.g. a 204, which isn't an error but isn't our file either.
+      if (ok) {
+        QByteArray data = reply->readAll();
+        transfer.hash->addData(data);
+        ok = transfer.file->write(data) == data.size() && syncFile(*transfer.file);
+      }
+    }
+
+    // We ask for the bytes after the end of the partial file, so a 416 can
+    // just mean it's already complete, e.g. if we were stopped after the
+    // last byte arrived but before the file was moved into the cache. Only
+    // start again if it isn't.
+    if (!ok && status == kHTTPStatusRangeNotSatisfiable && !job.filename.isEmpty()) {
+      endFileTransfer(transfer);
+      QByteArray sha256;
+      if (isCompletePartial(reply, job, sha256)) {
+        qDebug("Already had all of %s", qPrintable(job.url.toDisplayString()));
+        ++_stats.succeeded;
+        emit fileDownloadFinished(job.tag, job.filename, sha256);
+        startPending();
+        checkIdle();
+        return;
+      }
+      qDebug("Partial download of %s doesn't match the server's copy, starting again", qPrintable(job.url.toDisplayString()));
+      QFile::remove(job.filename);
+    }
+
+    if (ok) {
+      if (job.filename.isEmpty()) {
+        QByteArray data = reply->readAll();
+        ++_stats.succeeded;
+        _stats.bytes += data.size();
+        emit downloadFinished(job.tag, data);
+      }
+      else {
+        QByteArray sha256 = transfer.hash->result().toHex();
+        _stats.bytes += transfer.file->size() - transfer.resumeFrom;
+        endFileTransfer(transfer);
+        ++_stats.succeeded;
+        emit fileDownloadFinished(job.tag, job.filename, sha256);
+      }
+    }
+    else {
+      endFileTransfer(transfer);
+
+      QString error = (err != QNetworkReply::NoError) ? reply->errorString() : QString("unable to write to %1").arg(job.filename);
+      if (!isPermanentError(err) && job.attempts <= _maxRetries) {
+        int delayMS = kDownloadRetryBaseDelayMS << (job.attempts - 1);
+        qDebug("Download of %s failed (%s), retrying in %d ms",
+               qPrintable(job.url.toDisplayString()), qPrintable(error), delayMS);
+        ++_stats.retries;
+        ++_waitingForRetry;
+        Job retry = job;
+        QTimer::singleShot(delayMS, this, [this, retry]() {
+          --_waitingForRetry;
+          _pending.enqueue(retry);
+          startPending();
+        });
+      }
+      else {
+        qWarning("Download of %s failed: %s", qPrintable(job.url.toDisplayString()), qPrintable(error));
+        if (isPermanentError(err) && !job.filename.isEmpty()) {
+          QFile::remove(job.filename);
+        }
+        ++_stats.failed;
+        emit downloadFailed(job.tag, error);
+      }
+    }
+
+    startPending();
+    checkIdle();
+  }
+
+
+  void DownloadScheduler::replyReadyRead()
+  {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    auto it = _active.find(reply);
+    if (it == _active.end()) {
+      return;
+    }
+
+    Transfer& transfer = it.value();
+    if (!transfer.started && !beginFileTransfer(reply, transfer)) {
+      reply->abort();
+      return;
+    }
+
+    QByteArray data = reply->readAll();
+    if (!transfer.writable) {
+      return; // Discard error pages.
+    }
+    transfer.hash->addData(data);
+    if (transfer.file->write(data) != data.size()) {
+      qWarning("Unable to write to %s: %s", qPrintable(transfer.job.filename), qPrintable(transfer.file->errorString()));
+      reply->abort();
+    }
+  }
+
+
+  void DownloadScheduler::replyProgress(qint64 bytesReceived, qint64 bytesTotal)
+  {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    auto it = _active.constFind(reply);
+    if (it == _active.constEnd()) {
+      return;
+    }
+
+    // The reply only knows about the part of the file we asked for.
+    qint64 offset = it->writable ? it->resumeFrom : 0;
+    emit downloadProgress(it->job.tag, offset + bytesReceived, (bytesTotal >= 0) ? offset + bytesTotal : -1);
+  }
+
+
+  //
+  // DownloadScheduler private methods
+  //
+
+  void DownloadScheduler::enqueueJob(const Job& job)
+  {
+    if (isIdle()) {
+      _stats = DownloadSchedulerStats();
+      _timer.start();
+    }
+    _pending.enqueue(job);
+    startPending();
+  }
+
+
+  void DownloadScheduler::startPending()
+  {
+    while (!_pending.isEmpty() && _active.size() < _maxConcurrent) {
+      Transfer transfer;
+      transfer.job = _pending.dequeue();
+      ++transfer.job.attempts;
+
+      QNetworkRequest request(transfer.job.url);
+      request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+
+      if (!transfer.job.filename.isEmpty()) {
+        transfer.resumeFrom = QFileInfo(transfer.job.filename).size();
+        if (transfer.resumeFrom > 0) {
+          qDebug("Resuming download of %s from byte %lld", qPrintable(transfer.job.url.toDisplayString()), transfer.resumeFrom);
+          request.setRawHeader("Range", QString("bytes=%1-").arg(transfer.resumeFrom).toLatin1());
+        }
+      }
+
+      QNetworkReply* reply = _network->get(request);
+      connect(reply, &QNetworkReply::finished, this, &DownloadScheduler::replyFinished);
+      connect(reply, &QNetworkReply::downloadProgress, this, &DownloadScheduler::replyProgress);
+      if (!transfer.job.filename.isEmpty()) {
+        // Stops the reply from buffering more than this, so memory use is
+        // bounded no matter how big the file is.
+        reply->setReadBufferSize(kDownloadReadBufferBytes);
+        connect(reply, &QNetworkReply::readyRead, this, &DownloadScheduler::replyReadyRead);
+      }
+      _active.insert(reply, transfer);
+    }
+  }
+
+
+  void DownloadScheduler::checkIdle()
+  {
+    if (isIdle()) {
+      _timer.stop();
+      _stats.secs = _timer.elapsedSecs();
+      emit idle();
+    }
+  }
+
+
+  // Whether the partial file for a job which got a 416 is actually the whole
+  // file: it has to be the size the server says the file is, and match the
+  // expected hash if we know it. With neither to go on, we can't tell.
+  bool DownloadScheduler::isCompletePartial(QNetworkReply* reply, const Job& job, QByteArray& sha256) const
+  {
+    qint64 size = QFileInfo(job.filename).size();
+    qint64 totalSize = totalSizeFromContentRange(reply);
+    if (size <= 0 || (totalSize >= 0 && totalSize != size) || (totalSize < 0 && job.expectedSHA256.isEmpty())) {
+      return false;
+    }
+
+    sha256 = sha256OfFile(job.filename);
+    if (sha256.isEmpty() || (!job.expectedSHA256.isEmpty() && sha256 != job.expectedSHA256)) {
+      return false;
+    }
+    return true;
+  }
+
+
+  // Called when the first data arrives. Works out whether the server is
+  // giving us the rest of the file or the whole thing, and opens the file to
+  // match.
+  bool DownloadScheduler::beginFileTransfer(QNetworkReply* reply, Transfer& transfer)
+  {
+    transfer.started = true;
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status != kHTTPStatusOK && status != kHTTPStatusPartialContent) {
+      transfer.writable = false;
+      return true;
+    }
+    transfer.writable = true;
+
+    if (status == kHTTPStatusOK && transfer.resumeFrom > 0) {
+      qDebug("Server ignored our range request for %s, starting again", qPrintable(transfer.job.url.toDisplayString()));
+      transfer.resumeFrom = 0;
+    }
+    else if (status == kHTTPStatusPartialContent) {
+      // Appending any other range would put it at the wrong offset, which
+      // we'd only find out from the hash once the whole file had arrived.
+      qint64 rangeStart = rangeStartFromContentRange(reply);
+      if (rangeStart != transfer.resumeFrom && (rangeStart >= 0 || transfer.resumeFrom > 0)) {
+        qDebug("Server sent %s from byte %lld rather than %lld, starting again",
+               qPrintable(transfer.job.url.toDisplayString()), rangeStart, transfer.resumeFrom);
+        QFile::remove(transfer.job.filename);
+        transfer.writable = false;
+        return false;
+      }
+    }
+
+    QDir().mkpath(QFileInfo(transfer.job.filename).absolutePath());
+
+    transfer.file = new QFile(transfer.job.filename);
+    transfer.hash = new QCryptographicHash(QCryptographicHash::Sha256);
+
+    if (transfer.resumeFrom > 0) {
+      // Hash what we already have, then carry on from the end of it.
+      if (!transfer.file->open(QIODevice::ReadWrite) || !transfer.hash->addData(transfer.file) ||
+          transfer.file->pos() != transfer.resumeFrom) {
+        qWarning("Unable to resume %s: %s", qPrintable(transfer.job.filename), qPrintable(transfer.file->errorString()));
+        return false;
+      }
+    }
+    else if (!transfer.file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qWarning("Unable to open %s for writing: %s", qPrintable(transfer.job.filename), qPrintable(transfer.file->errorString()));
+      return false;
+    }
+    return true;
+  }
+
+
+  void DownloadScheduler::endFileTransfer(Transfer& transfer)
+  {
+    if (transfer.file != nullptr) {
+      transfer.file->close();
+      delete transfer.file;
+      transfer.file = nullptr;
+    }
+    delete transfer.hash;
+    transfer.hash = nullptr;
+  }
+
+} // namespace vh
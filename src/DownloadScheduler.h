@@ -0,0 +1,144 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_DOWNLOADSCHEDULER_H
+#define VH_DOWNLOADSCHEDULER_H
+
+#include "Timer.h"
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QObject>
+#include <QQueue>
+#include <QString>
+#include <QUrl>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kDefaultDownloadConcurrency = 4;
+  static constexpr int kDefaultDownloadRetries     = 3;
+  static constexpr int kDownloadRetryBaseDelayMS   = 500;  // Doubled after each failed attempt.
+  static constexpr qint64 kDownloadReadBufferBytes = 256 * 1024; // Most we'll hold in memory for a download to file.
+
+
+  //
+  // Structs
+  //
+
+  struct DownloadSchedulerStats {
+    int succeeded = 0;
+    int failed    = 0;
+    int retries   = 0;
+    qint64 bytes  = 0;
+    double secs   = 0.0;    // Wall clock time from the first download starting until the queue emptied.
+
+    double bytesPerSec() const { return (secs > 0.0) ? double(bytes) / secs : 0.0; }
+  };
+
+
+  //
+  // DownloadScheduler class
+  //
+
+  /// A queue of HTTP GET requests, of which at most `maxConcurrent()` are in
+  /// flight at once. Requests which fail with a transient error (anything
+  /// other than the server saying the file doesn't exist) are retried with
+  /// exponential backoff.
+  ///
+  /// Each request carries a caller-supplied tag which is passed back when it
+  /// finishes, so the caller doesn't need to work out what a reply was for
+  /// from its URL.
+  ///
+  /// Downloads can either be returned in memory, or streamed to a file as
+  /// they arrive so that large files never have to be held in memory in one
+  /// piece. If the file already exists (e.g. from an earlier, interrupted
+  /// attempt, or a retry) we ask the server for just the remaining bytes
+  /// using an HTTP range request. The SHA-256 of the whole file is computed
+  /// as it's written.
+  class DownloadScheduler : public QObject
+  {
+    Q_OBJECT
+  public:
+    explicit DownloadScheduler(QObject* parent = nullptr);
+    virtual ~DownloadScheduler();
+
+    int maxConcurrent() const;
+    void setMaxConcurrent(int n);
+
+    int maxRetries() const;
+    void setMaxRetries(int n);
+
+    void enqueue(const QUrl& url, const QString& tag);
+    /// Streams the download into `filename`. If `expectedSHA256` (hex
+    /// encoded) is given, a partial file left over from an earlier attempt
+    /// which the server says is already complete is checked against it
+    /// before being used.
+    void enqueueToFile(const QUrl& url, const QString& tag, const QString& filename, const QByteArray& expectedSHA256 = QByteArray());
+
+    /// True if nothing is queued, in flight or waiting to be retried.
+    bool isIdle() const;
+
+    /// Stats since the scheduler last became busy.
+    const DownloadSchedulerStats& stats() const;
+
+  signals:
+    void downloadFinished(const QString& tag, const QByteArray& data);
+    void fileDownloadFinished(const QString& tag, const QString& filename, const QByteArray& sha256);
+    void downloadProgress(const QString& tag, qint64 bytesReceived, qint64 bytesTotal);
+    void downloadFailed(const QString& tag, const QString& error);
+    void idle();
+
+  private slots:
+    void replyFinished();
+    void replyReadyRead();
+    void replyProgress(qint64 bytesReceived, qint64 bytesTotal);
+
+  private:
+    struct Job {
+      QUrl url;
+      QString tag;
+      QString filename;     // Empty for downloads into memory.
+      QByteArray expectedSHA256; // Hex encoded. Empty if we don't know it in advance.
+      int attempts = 0;
+    };
+
+    struct Transfer {
+      Job job;
+      QFile* file = nullptr;
+      QCryptographicHash* hash = nullptr;
+      qint64 resumeFrom = 0;  // Bytes we already had when the request was made.
+      bool started = false;   // Whether we've checked the response status and opened the file yet.
+      bool writable = false;  // False if the response isn't the file contents, e.g. an error page.
+    };
+
+    void enqueueJob(const Job& job);
+    void startPending();
+    void checkIdle();
+
+    bool isCompletePartial(QNetworkReply* reply, const Job& job, QByteArray& sha256) const;
+    bool beginFileTransfer(QNetworkReply* reply, Transfer& transfer);
+    void endFileTransfer(Transfer& transfer);
+
+  private:
+    QNetworkAccessManager* _network = nullptr;
+
+    QQueue<Job> _pending;
+    QHash<QNetworkReply*, Transfer> _active;
+    int _waitingForRetry = 0;
+
+    int _maxConcurrent = kDefaultDownloadConcurrency;
+    int _maxRetries    = kDefaultDownloadRetries;
+
+    DownloadSchedulerStats _stats;
+    Timer _timer;
+  };
+
+} // namespace vh
+
+#endif // VH_DOWNLOADSCHEDULER_H
@@ -1,11 +1,25 @@
 // Copyright 2019 Vilya Harvey
 #include "FileCache.h"
 
+#include "FileHash.h"
+#include "Preferences.h"
 #include "ShaderToy.h"
+#include "Timer.h"
 
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QMessageBox>
 #include <QMessageLogger>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QRunnable>
+#include <QSaveFile>
 #include <QStandardPaths>
+#include <QVector>
+
+#include <algorithm>
 
 namespace vh {
 
@@ -15,12 +29,29 @@ namespace vh {
 
   const QString kShaderToyViewURLPrefix("https://www.shadertoy.com/view/");
 
-  static const QString kShaderToyShaderURL("https://www.shadertoy.com/api/v1/shaders/%1?key=%2");
-  static const QString kShaderToyAssetURL("https://www.shadertoy.com/%1?key=%2");
+  static const QString kShaderToyShaderURL("%1/api/v1/shaders/%2?key=%3");
+  static const QString kShaderToyAssetURL("%1/%2?key=%3");
+
+  static const QString kPrefetchShaderTag("shader:");
+  static const QString kPrefetchAssetTag("asset:");
+  static const QString kFetchAssetTag("fetch:");
 
   static const QString kShaderToyShaderPath("api/v1/shaders/%1.json");
   static const QString kShaderToyThumbnailPath("/media/shaders/%1.jpg");
 
+  static const QString kCacheIndexFilename("index.json");
+  static const QString kCacheObjectsDir("objects");
+  static const QString kCachePartialDir("partial");   // Downloads in progress.
+  static const QString kCachePackFilename("images.stpack");
+  static const QString kCacheNewPackFilename("images.stpack.new");  // Written in the background, then renamed over the pack.
+  static const QString kShaderIndexFilename("shaderindex.json");
+  static const QString kCacheTexturesDir("textures");  // Decoded copies of images; see TextureSidecar.
+  static const QString kTextureSidecarPath("%1/%2.%3.sttex");
+  static const QString kCubemapSidecarPrefix("cube");     // Cubemap sidecars are named cube-<face>-<face>-...
+  static constexpr int kCubemapSidecarFaceHashChars = 16; // How much of each face's hash goes in a cubemap sidecar's name.
+  static constexpr int kCacheIndexVersion = 2;
+  static constexpr int kCacheIndexSaveDelayMS = 2000;  // Batch up index writes when lots of files arrive at once.
+
 
   static const QString kStandardShaderToyAssets[] = {
     // Images
@@ -77,332 +108,559 @@ namespace vh {
 
 
   //
-  // FileCache public methods
+  // Private types
   //
 
-  FileCache::FileCache(QObject* parent) :
-    QObject(parent)
-  {
-    _cacheDir = QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
-    qDebug("cache dir is %s", qPrintable(_cacheDir.absolutePath()));
-  }
+  // Something `evict` could delete: either an index entry or a texture
+  // sidecar, ordered by when it was last used.
+  struct EvictionCandidate {
+    qint64 atimeMS;
+    QString key;    // Index key, or the sidecar's absolute path.
+    bool sidecar;
 
+    bool operator < (const EvictionCandidate& other) const { return atimeMS < other.atimeMS; }
+  };
 
-  FileCache::~FileCache()
+
+  //
+  // Private helper functions
+  //
+
+  // Whether the sidecar file `sidecarName` is a decoded copy of the object
+  // `objectName` (both without directories), either on its own or as one of
+  // the faces of a cubemap.
+  static bool isSidecarOf(const QString& sidecarName, const QString& objectName)
   {
+    QString hash = QFileInfo(objectName).completeBaseName();
+    if (sidecarName.startsWith(hash + ".")) {
+      return true;
+    }
+    QString base = sidecarName.section('.', 0, 0);
+    return base.startsWith(kCubemapSidecarPrefix + "-") && base.contains(hash.left(kCubemapSidecarFaceHashChars));
   }
 
 
-  QDir FileCache::cacheDir() const
+  // ShaderToy names most of its media files after the SHA-256 of their
+  // contents. If `path` is one of those, returns the hash from its name so we
+  // can check downloads against it. Otherwise returns an empty array.
+  static QByteArray expectedHashForPath(const QString& path)
   {
-    return _cacheDir;
+    static const QRegularExpression mediaRE("^/?media/a/([0-9a-f]{64})\\.[A-Za-z0-9]+$");
+    QRegularExpressionMatch match = mediaRE.match(path);
+    return match.hasMatch() ? match.captured(1).toLatin1() : QByteArray();
   }
 
 
-  bool FileCache::saveFileToCache(const QString& path, const QByteArray& data, QWidget* parentForErrorDialogs)
+  // Returns the ID from a ShaderToy ID or view URL, or an empty string if it
+  // isn't valid.
+  static QString shaderIDFromIDorURL(const QString& idOrURL)
   {
-    QString cachePath = pathForCachedFile(path);
+    QString id = idOrURL.trimmed();
 
-    // Don't allow paths that would cause us to write outside the cache dir.
-    if (!cachePath.startsWith(_cacheDir.canonicalPath())) {
-      qDebug("Cannot save %s to the cache because it would write to a location outside the cache directory", qPrintable(path));
-      qDebug("    Cache dir:   %s", qPrintable(_cacheDir.canonicalPath()));
-      qDebug("    Target file: %s", qPrintable(cachePath));
-      if (parentForErrorDialogs != nullptr) {
-        QMessageBox::critical(parentForErrorDialogs, "Save failed", QString("Cannot save %s to the cache because it would write to a location outside the cache directory").arg(path));
-      }
-      return false;
+    // If we've been given a URL, extract the ID from it. The only URLs that we
+    // accept are ShaderToy "view" URLs, i.e. ones that have the form
+    // `https://www.shadertoy.com/view/<shader-id>`
+    if (id.startsWith(kShaderToyViewURLPrefix)) {
+      id = id.mid(kShaderToyViewURLPrefix.size());
     }
 
-    // If the file is inside a subdirectory of the cache dir and that
-    // subdirectory doesn't exist yet, create it.
-    QDir dir = QFileInfo(cachePath).absoluteDir();
-    if (!dir.exists()) {
-      QString relDir = _cacheDir.relativeFilePath(dir.absolutePath());
-      if (!_cacheDir.mkpath(relDir)) {
-        qDebug("Failed to create directory %s in the cache", qPrintable(relDir));
-        if (parentForErrorDialogs) {
-          QMessageBox::critical(parentForErrorDialogs, "Save failed", QString("Failed to create directory %1 in the cache").arg(relDir));
-        }
-        return false;
-      }
+    // Validate the id. All ShaderToy IDs are 6 characters long and consist of
+    // only digits and upper- or lower-case letters.
+    if (id.size() != 6) {
+      return QString();
     }
-
-    // Save the file.
-    QFile file(cachePath);
-    if (!file.open(QIODevice::WriteOnly)) {
-      qCritical("Unable to save downloaded file to %s", qPrintable(cachePath));
-      if (parentForErrorDialogs) {
-        QMessageBox::critical(parentForErrorDialogs, "Save failed", QString("Unable to save downloaded file to %1").arg(cachePath));
+    for (int i = 0; i < id.length(); i++) {
+      if (!id.at(i).isLetterOrNumber()) {
+        return QString();
       }
-      return false;
     }
-
-    file.write(data);
-    file.close();
-    return true;
+    return id;
   }
 
 
-  QString FileCache::pathForCachedFile(const QString& path)
+  static bool isContentAddressed(const QString& key)
   {
-    if (path.startsWith("/")) {
-      return _cacheDir.absoluteFilePath(path.mid(1));
-    }
-    else {
-      return _cacheDir.absoluteFilePath(path);
-    }
+    return key.startsWith("media/");
   }
 
 
-  bool FileCache::isResource(const QString& path)
+  // Images are what we load most often, and each one is small enough that
+  // the open and read dominate. Videos and audio are streamed, so they'd
+  // gain nothing from being in the pack.
+  static bool isPackable(const QString& key)
   {
-    return path.startsWith("/media") && QFileInfo(QString(":%1").arg(path)).exists();
+    QString suffix = QFileInfo(key).suffix().toLower();
+    return isContentAddressed(key) && (suffix == "png" || suffix == "jpg" || suffix == "jpeg");
   }
 
 
-  bool FileCache::isCached(const QString& path)
+  static bool isStandardAsset(const QString& key)
   {
-    QFileInfo info(pathForCachedFile(path));
-    return info.exists();
+    static QSet<QString> standardKeys;
+    static QMutex standardKeysLock;
+
+    QMutexLocker lock(&standardKeysLock);
+    if (standardKeys.isEmpty()) {
+      for (const QString& path : kStandardShaderToyAssets) {
+        standardKeys.insert(QDir::cleanPath(path.mid(1)));
+      }
+    }
+    return standardKeys.contains(key);
   }
 
 
   //
-  // FileCache public slots
+  // FileCacheScrubTask class
   //
 
-  bool FileCache::fetchShaderToyByIDorURL(const QString& idOrURL, bool forceDownload)
+  class FileCacheScrubTask : public QRunnable
   {
-    QString id = idOrURL;
-
-    // If we've been given a URL, extract the ID from it. The only URLs that we
-    // accept are ShaderToy "view" URLs, i.e. ones that have the form
-    // `https://www.shadertoy.com/view/<shader-id>`
-    if (id.startsWith(kShaderToyViewURLPrefix)) {
-      id = id.mid(kShaderToyViewURLPrefix.size());
-    }
-
-    // Validate the id. All ShaderToy IDs are 6 characters long and consist of
-    // only digits and upper- or lower-case letters.
-    if (id.size() != 6) {
-      return false;
-    }
-    for (int i = 0; i < id.length(); i++) {
-      if (!id.at(i).isLetterOrNumber()) {
-        return false;
-      }
-    }
-
-    if (_networkAccess == nullptr) {
-      _networkAccess = new QNetworkAccessManager(this);
+  public:
+    FileCacheScrubTask(FileCache* cache, std::atomic<bool>* running) : _cache(cache), _running(running) {}
+
+    virtual void run() override
+    {
+      FileCacheScrubStats stats = _cache->scrub();
+      *_running = false;
+      emit _cache->scrubFinished(stats.checked, stats.missing, stats.corrupt, stats.migrated);
     }
 
-    QString path = kShaderToyShaderPath.arg(id);
-    if (isCached(path) && !forceDownload) {
-      qDebug("Using cached copy of shader with id %s", qPrintable(id));
-      _downloadedShaderFile = pathForCachedFile(path);
-      fetchAssetsForDownloadedShader();
-      return true;
-    }
+  private:
+    FileCache* _cache;
+    std::atomic<bool>* _running;
+  };
 
-    QString urlStr = kShaderToyShaderURL.arg(id).arg(kShaderToyAppKey);
-    QNetworkReply* reply = _networkAccess->get(QNetworkRequest(QUrl(urlStr)));
-    connect(reply, &QNetworkReply::finished, this, &FileCache::shaderDownloaded);
-    connect(reply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::error), this, &FileCache::shaderDownloadFailed);
-    return true;
-  }
 
+  //
+  // FileCacheEvictTask class
+  //
 
-  void FileCache::fetchShaderToyStandardAssets()
+  class FileCacheEvictTask : public QRunnable
   {
-    if (_networkAccess == nullptr) {
-      _networkAccess = new QNetworkAccessManager(this);
+  public:
+    FileCacheEvictTask(FileCache* cache, std::atomic<bool>* running, std::atomic<bool>* requested) :
+      _cache(cache), _running(running), _requested(requested) {}
+
+    virtual void run() override
+    {
+      // Keep going while there are new requests, so that one which arrives
+      // just as we finish isn't lost.
+      while (true) {
+        while (_requested->exchange(false)) {
+          _cache->evict(_cache->maxBytes());
+        }
+        *_running = false;
+        if (!*_requested || _running->exchange(true)) {
+          break;
+        }
+      }
     }
 
-    _assetsToDownloadLock.lock();
-    _assetsToDownload.clear();
-    _downloadedShaderFile.clear();
-    for (const QString& path : kStandardShaderToyAssets) {
-      if (isCached(path)) {
-        qDebug("Already have %s", qPrintable(path));
-        continue;
-      }
+  private:
+    FileCache* _cache;
+    std::atomic<bool>* _running;
+    std::atomic<bool>* _requested;
+  };
 
-      if (_assetsToDownload.contains(path)) {
-        continue;
-      }
 
-      qDebug("Need to download %s", qPrintable(path));
-      _assetsToDownload.insert(path);
+  //
+  // FileCacheShaderIndexTask class
+  //
 
-      QString urlStr = kShaderToyAssetURL.arg(path.mid(1)).arg(kShaderToyAppKey);
-      QNetworkReply* reply = _networkAccess->get(QNetworkRequest(QUrl(urlStr)));
-      connect(reply, &QNetworkReply::finished, this, &FileCache::assetDownloaded);
-      connect(reply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::error), this, &FileCache::assetDownloadFailed);
-    }
-    bool ready = _assetsToDownload.empty();
-    _assetsToDownloadLock.unlock();
-    if (ready) {
-      emit standardAssetsReady();
+  class FileCacheShaderIndexTask : public QRunnable
+  {
+  public:
+    explicit FileCacheShaderIndexTask(FileCache* cache) : _cache(cache) {}
+
+    virtual void run() override
+    {
+      _cache->updateShaderIndex();
     }
-  }
 
+  private:
+    FileCache* _cache;
+  };
 
-  void FileCache::deleteCache()
-  {
-    qDebug("Removing all files and subdirectories from the cache");
 
-    QDir dir = _cacheDir;
+  //
+  // FileCachePackTask class
+  //
 
-    // Remove all files inside the directory.
-    dir.setFilter(QDir::NoDotAndDotDot | QDir::Files);
-    for (QString filename : dir.entryList()) {
-      qDebug("Removing %s", qPrintable(filename));
-      dir.remove(filename);
+  class FileCachePackTask : public QRunnable
+  {
+  public:
+    explicit FileCachePackTask(FileCache* cache) : _cache(cache) {}
+
+    virtual void run() override
+    {
+      AssetPackWriteStats stats;
+      bool ok = _cache->writePack(&stats);
+      // The pack can only be swapped over on the main thread.
+      QMetaObject::invokeMethod(_cache, "packWritten", Qt::QueuedConnection,
+                                Q_ARG(bool, ok), Q_ARG(int, stats.entries), Q_ARG(qint64, stats.bytes));
     }
 
-    // Remove all subdirectories inside the directory.
-    dir.setFilter(QDir::NoDotAndDotDot | QDir::Dirs);
-    for (QString dirname : dir.entryList()) {
-      qDebug("Removing %s", qPrintable(dirname));
-      QDir subdir = QDir(dir.absoluteFilePath(dirname));
-      subdir.removeRecursively();
-    }
-  }
+  private:
+    FileCache* _cache;
+  };
 
 
   //
-  // FileCache private slots
+  // FileCache public methods
   //
 
-  void FileCache::shaderDownloaded()
+  FileCache::FileCache(QObject* parent) :
+    QObject(parent)
   {
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    QString path = reply->url().path();
+    _cacheDir = QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+    qDebug("cache dir is %s", qPrintable(_cacheDir.absolutePath()));
 
-    if (QFileInfo(path).suffix() != "json") {
-      path += ".json";
-    }
+    _indexSaveTimer = new QTimer(this);
+    _indexSaveTimer->setSingleShot(true);
+    _indexSaveTimer->setInterval(kCacheIndexSaveDelayMS);
+    connect(_indexSaveTimer, &QTimer::timeout, this, &FileCache::saveIndex);
 
-    QByteArray data = reply->readAll();
-    reply->deleteLater();
+    _workers.setMaxThreadCount(1);
 
-    QWidget* parentForErrorDialogs = qobject_cast<QWidget*>(parent());
+    Preferences prefs;
+    _maxBytes = qint64(qMax(0, prefs.cacheMaxMB())) * 1024 * 1024;
+    setServerURL(prefs.shaderToyURL());
 
-    // Save data to a local file, then open it
-    if (!saveFileToCache(path, data, parentForErrorDialogs)) {
-      return;
-    }
+    _scheduler = new DownloadScheduler(this);
+    connect(_scheduler, &DownloadScheduler::downloadFinished,     this, &FileCache::scheduledDownloadFinished);
+    connect(_scheduler, &DownloadScheduler::fileDownloadFinished, this, &FileCache::scheduledFileDownloadFinished);
+    connect(_scheduler, &DownloadScheduler::downloadProgress,     this, &FileCache::scheduledDownloadProgress);
+    connect(_scheduler, &DownloadScheduler::downloadFailed,       this, &FileCache::scheduledDownloadFailed);
+    connect(_scheduler, &DownloadScheduler::idle,             this, &FileCache::prefetchIdle);
 
-    qDebug("Successfully downloaded %s", qPrintable(reply->url().toDisplayString()));
-    _downloadedShaderFile = pathForCachedFile(path);
+    buildIndex();
+    evictInBackground();
 
-    fetchAssetsForDownloadedShader();
+    // Catch up with any shaders which arrived or left while the index wasn't
+    // being maintained (e.g. by an older version, or by copying files in).
+    _shaderIndex.load(_cacheDir.absoluteFilePath(kShaderIndexFilename));
+    _workers.start(new FileCacheShaderIndexTask(this));
+
+    QString packFilename = _cacheDir.absoluteFilePath(kCachePackFilename);
+    if (QFileInfo::exists(packFilename)) {
+      _pack.open(packFilename);
+    }
   }
 
 
-  void FileCache::shaderDownloadFailed(QNetworkReply::NetworkError /*err*/)
+  FileCache::~FileCache()
   {
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    reply->deleteLater();
+    _workers.waitForDone();
+    saveIndex();
+  }
 
-    QWidget* parentForErrorDialogs = qobject_cast<QWidget*>(parent());
 
-    qCritical("Failed to download shader from ShaderToy (url was %s)", qPrintable(reply->url().toDisplayString()));
-    QMessageBox::critical(parentForErrorDialogs, "Download failed", "Failed to download shader from ShaderToy");
+  QDir FileCache::cacheDir() const
+  {
+    return _cacheDir;
   }
 
 
-  void FileCache::assetDownloaded()
+  bool FileCache::saveFileToCache(const QString& path, const QByteArray& data, QWidget* parentForErrorDialogs)
   {
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    QString path = reply->url().path();
+    QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+    QString object;
+    if (!validateDownload(path, hash, data.size(), parentForErrorDialogs, object)) {
+      return false;
+    }
 
-    bool ready = false;
-    _assetsToDownloadLock.lock();
-    if (_assetsToDownload.remove(path)) {
-      qDebug("Successfully downloaded asset %s", qPrintable(path));
-      ready = _assetsToDownload.isEmpty();
+    // Media files are stored by their contents, so if we already have an
+    // object with the same contents there's no need to write it again.
+    if (!isContentAddressed(indexKey(path)) || !QFileInfo::exists(_cacheDir.absoluteFilePath(object))) {
+      QString error;
+      if (!writeObject(object, data, error)) {
+        qCritical("Unable to save downloaded file %s: %s", qPrintable(path), qPrintable(error));
+        if (parentForErrorDialogs) {
+          QMessageBox::critical(parentForErrorDialogs, "Save failed", QString("Unable to save downloaded file %1: %2").arg(path).arg(error));
+        }
+        return false;
+      }
     }
-    _assetsToDownloadLock.unlock();
 
-    QByteArray data = reply->readAll();
-    reply->deleteLater();
+    indexObject(indexKey(path), object, data.size(), hash);
+    return true;
+  }
 
-    saveFileToCache(path, data, nullptr);
 
-    if (ready) {
-      if (_downloadedShaderFile.isEmpty()) {
-        emit standardAssetsReady();
-      }
-      else {
-        emit shaderReady(_downloadedShaderFile);
-        _downloadedShaderFile = QString();
+  bool FileCache::saveDownloadedFileToCache(const QString& path, const QString& filename, const QByteArray& sha256, QWidget* parentForErrorDialogs)
+  {
+    qint64 size = QFileInfo(filename).size();
+    QString object;
+    if (!validateDownload(path, sha256, size, parentForErrorDialogs, object)) {
+      QFile::remove(filename);
+      return false;
+    }
+
+    QString objectFile = _cacheDir.absoluteFilePath(object);
+    if (isContentAddressed(indexKey(path)) && QFileInfo::exists(objectFile)) {
+      QFile::remove(filename);
+    }
+    else {
+      _cacheDir.mkpath(QFileInfo(object).path());
+      QFile::remove(objectFile); // Rename won't overwrite an existing file.
+      if (!QFile::rename(filename, objectFile)) {
+        qCritical("Unable to move downloaded file %s into the cache", qPrintable(path));
+        if (parentForErrorDialogs) {
+          QMessageBox::critical(parentForErrorDialogs, "Save failed", QString("Unable to move downloaded file %1 into the cache").arg(path));
+        }
+        QFile::remove(filename);
+        return false;
       }
     }
+
+    indexObject(indexKey(path), object, size, sha256);
+    return true;
   }
 
 
-  void FileCache::assetDownloadFailed(QNetworkReply::NetworkError /*err*/)
+  QString FileCache::partialFileForPath(const QString& path) const
   {
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    QString path = reply->url().path();
-
-    bool ready = false;
-    _assetsToDownloadLock.lock();
-    if (_assetsToDownload.remove(path)) {
-      ready = _assetsToDownload.isEmpty();
-    }
-    _assetsToDownloadLock.unlock();
+    QByteArray name = QCryptographicHash::hash(indexKey(path).toUtf8(), QCryptographicHash::Sha1).toHex();
+    return _cacheDir.absoluteFilePath(QString("%1/%2.part").arg(kCachePartialDir).arg(QString::fromLatin1(name)));
+  }
 
-    reply->deleteLater();
-    qCritical("Failed to download asset from ShaderToy (url was %s)", qPrintable(reply->url().toDisplayString()));
 
-    if (ready) {
-      if (_downloadedShaderFile.isEmpty()) {
-        emit standardAssetsReady();
-      }
-      else {
-        emit shaderReady(_downloadedShaderFile);
-        _downloadedShaderFile = QString();
+  QString FileCache::pathForCachedFile(const QString& path)
+  {
+    QString key = indexKey(path);
+    {
+      QMutexLocker lock(&_indexLock);
+      auto it = _index.find(key);
+      if (it != _index.end()) {
+        it->atimeMS = QDateTime::currentMSecsSinceEpoch();
+        return _cacheDir.absoluteFilePath(it->object);
       }
     }
+    return _cacheDir.absoluteFilePath(key);
   }
 
 
-  //
-  // FileCache private methods
-  //
+  bool FileCache::isResource(const QString& path)
+  {
+    return path.startsWith("/media") && QFileInfo(QString(":%1").arg(path)).exists();
+  }
 
-  void FileCache::fetchAssetsForDownloadedShader()
+
+  bool FileCache::isCached(const QString& path)
   {
-    if (_downloadedShaderFile.isEmpty()) {
-      return;
+    QMutexLocker lock(&_indexLock);
+    auto it = _index.find(indexKey(path));
+    if (it == _index.end()) {
+      ++_misses;
+      return false;
     }
+    it->atimeMS = QDateTime::currentMSecsSinceEpoch();
+    ++_hits;
+    return true;
+  }
 
-    QWidget* parentForErrorDialogs = qobject_cast<QWidget*>(parent());
 
-    // Download successful, now let's parse the document so we can also grab
-    // any required assets for it.
-    ShaderToyDocument* document = nullptr;
-    try {
-      document = loadShaderToyJSONFile(_downloadedShaderFile);
+  bool FileCache::removeFromCache(const QString& path)
+  {
+    bool removed = false;
+    {
+      QMutexLocker lock(&_indexLock);
+      auto it = _index.find(indexKey(path));
+      if (it != _index.end()) {
+        QString object = it->object;
+        _index.erase(it);
+        releaseObjectLocked(object);
+        removed = true;
+      }
     }
-    catch (const std::runtime_error& err) {
-      qCritical("Unable to load %s: %s", qPrintable(_downloadedShaderFile), err.what());
-      QMessageBox::critical(parentForErrorDialogs, "Load failed", QString("Unable to load %1: %2").arg(_downloadedShaderFile).arg(err.what()));      
-      QFile::remove(_downloadedShaderFile);
-      return;
+    if (removed) {
+      scheduleIndexSave();
     }
+    return removed;
+  }
 
+
+  QByteArray FileCache::contentHash(const QString& path)
+  {
+    QString key = indexKey(path);
+    QString object;
+    {
+      QMutexLocker lock(&_indexLock);
+      auto it = _index.constFind(key);
+      if (it == _index.constEnd()) {
+        return QByteArray();
+      }
+      if (!it->sha256.isEmpty()) {
+        return it->sha256;
+      }
+      object = it->object;
+    }
+
+    // Hash without holding the lock, since it can take a while for big files.
+    QByteArray hash = sha256OfFile(_cacheDir.absoluteFilePath(object));
+
+    QMutexLocker lock(&_indexLock);
+    auto it = _index.find(key);
+    if (it != _index.end() && it->object == object) {
+      it->sha256 = hash;
+    }
+    return hash;
+  }
+
+
+  bool FileCache::hasCachedContent(const QString& path, const QByteArray& sha256)
+  {
+    QMutexLocker lock(&_indexLock);
+    auto it = _index.constFind(indexKey(path));
+    if (it == _index.constEnd()) {
+      return false;
+    }
+    // Objects are named after their hash, so even if we haven't hashed the
+    // file we may still know what's in it.
+    return it->sha256 == sha256 || QFileInfo(it->object).completeBaseName() == QString::fromLatin1(sha256);
+  }
+
+
+  QByteArray FileCache::packedData(const QString& path)
+  {
+    if (!_pack.isOpen()) {
+      return QByteArray();
+    }
+    const AssetPackEntry* entry = _pack.entry(indexKey(path));
+    if (entry == nullptr) {
+      return QByteArray();
+    }
+
+    // The pack is only a copy. If the file has been evicted or replaced
+    // since we packed it, the cache is right and the pack is stale.
+    if (!hasCachedContent(path, entry->sha256) || !isCached(path)) {
+      return QByteArray();
+    }
+    return _pack.data(*entry);
+  }
+
+
+  QImage FileCache::loadImage(const QString& path)
+  {
+    QByteArray packed = packedData(path);
+    if (!packed.isEmpty()) {
+      QByteArray format = QFileInfo(path).suffix().toLatin1();
+      QImage img;
+      if (img.loadFromData(packed, format.constData())) {
+        return img;
+      }
+    }
+
+    if (isCached(path)) {
+      return QImage(pathForCachedFile(path));
+    }
+    return QImage(path);
+  }
+
+
+  bool FileCache::rebuildPack(AssetPackWriteStats* stats)
+  {
+    bool ok = writePack(stats) && installPack();
+    evictInBackground();
+    return ok;
+  }
+
+
+  bool FileCache::writePack(AssetPackWriteStats* stats)
+  {
+    QStringList keys;
+    {
+      QMutexLocker lock(&_indexLock);
+      for (auto it = _index.constBegin(); it != _index.constEnd(); ++it) {
+        if (isPackable(it.key())) {
+          keys.append(it.key());
+        }
+      }
+    }
+
+    QVector<AssetPackSource> sources;
+    for (const QString& key : keys) {
+      AssetPackSource source;
+      source.path = key;
+      source.filename = pathForCachedFile(key);
+      source.sha256 = contentHash(key);
+      if (!source.sha256.isEmpty()) {
+        sources.append(source);
+      }
+    }
+
+    // With nothing to pack, the absence of a new pack file means the old
+    // one gets removed.
+    QString newPackFilename = _cacheDir.absoluteFilePath(kCacheNewPackFilename);
+    QFile::remove(newPackFilename);
+    if (sources.isEmpty()) {
+      if (stats != nullptr) {
+        *stats = AssetPackWriteStats();
+      }
+      return true;
+    }
+    if (!AssetPack::write(newPackFilename, sources, stats)) {
+      QFile::remove(newPackFilename);
+      return false;
+    }
+    return true;
+  }
+
+
+  QString FileCache::textureSidecarPath(const QString& path, const QString& variant)
+  {
+    QString key = indexKey(path);
+    if (!isContentAddressed(key)) {
+      return QString();
+    }
+    QByteArray sha256 = contentHash(path);
+    if (sha256.isEmpty()) {
+      return QString();
+    }
+    return _cacheDir.absoluteFilePath(kTextureSidecarPath.arg(kCacheTexturesDir).arg(QString::fromLatin1(sha256)).arg(variant));
+  }
+
+
+  QString FileCache::cubemapSidecarPath(const QStringList& facePaths, const QString& variant)
+  {
+    QString name = kCubemapSidecarPrefix;
+    for (const QString& path : facePaths) {
+      if (!isContentAddressed(indexKey(path))) {
+        return QString();
+      }
+      QByteArray sha256 = contentHash(path);
+      if (sha256.isEmpty()) {
+        return QString();
+      }
+      name += "-" + QString::fromLatin1(sha256.left(kCubemapSidecarFaceHashChars));
+    }
+    return _cacheDir.absoluteFilePath(kTextureSidecarPath.arg(kCacheTexturesDir).arg(name).arg(variant));
+  }
+
+
+  void FileCache::useTextureSidecar(const QString& sidecarPath)
+  {
+    QFileInfo info(sidecarPath);
+    QFile file(info.absoluteFilePath());
+    if (file.open(QIODevice::ReadOnly)) {
+      file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+      file.close();
+    }
+
+    QMutexLocker lock(&_indexLock);
+    _sidecarsInUse.insert(info.absoluteFilePath());
+  }
+
+
+  QSet<QString> FileCache::assetsForDocument(const ShaderToyDocument* doc)
+  {
     QSet<QString> requiredAssets;
 
     // The thumbnail for this shader
-    requiredAssets.insert(kShaderToyThumbnailPath.arg(document->info.id));
+    requiredAssets.insert(kShaderToyThumbnailPath.arg(doc->info.id));
 
-    for (int passIdx = 0; passIdx < document->renderpasses.size(); passIdx++) {
-      ShaderToyRenderPass& pass = document->renderpasses[passIdx];
+    for (int passIdx = 0; passIdx < doc->renderpasses.size(); passIdx++) {
+      const ShaderToyRenderPass& pass = doc->renderpasses[passIdx];
       for (int i = 0; i < pass.inputs.size(); i++) {
         if (pass.inputs[i].ctype == kInputType_Texture ||
             pass.inputs[i].ctype == kInputType_Video  ||
@@ -424,43 +682,1205 @@ namespace vh {
       }
     }
 
-    delete document;
+    return requiredAssets;
+  }
 
-    _assetsToDownloadLock.lock();
-    _assetsToDownload.clear();
-    for (QString src : requiredAssets) {
-      // All ShaderToy assets are stored under their media folder.
-      if (!src.startsWith("/media/")) {
+
+  QStringList FileCache::cachedShaders() const
+  {
+    QStringList ids;
+    QString prefix = QFileInfo(kShaderToyShaderPath).path() + "/";
+    QMutexLocker lock(&_indexLock);
+    for (auto it = _index.constBegin(); it != _index.constEnd(); ++it) {
+      if (it.key().startsWith(prefix) && it.key().endsWith(".json")) {
+        ids.append(QFileInfo(it.key()).completeBaseName());
+      }
+    }
+    return ids;
+  }
+
+
+  QVector<ShaderIndexRecord> FileCache::searchShaders(const QString& query)
+  {
+    QVector<ShaderIndexRecord> results = _shaderIndex.search(query);
+
+    // Drop anything which has been evicted since it was indexed.
+    QMutexLocker lock(&_indexLock);
+    auto end = std::remove_if(results.begin(), results.end(), [this](const ShaderIndexRecord& record) {
+      return !_index.contains(kShaderToyShaderPath.arg(record.id));
+    });
+    results.erase(end, results.end());
+    return results;
+  }
+
+
+  void FileCache::updateShaderIndex()
+  {
+    QMutexLocker updateLock(&_shaderIndexUpdateLock);
+    Timer timer(true);
+
+    QStringList ids = cachedShaders();
+    QSet<QString> cachedIDs;
+    int parsed = 0;
+    for (const QString& id : ids) {
+      cachedIDs.insert(id);
+      if (_shaderIndex.isUpToDate(id, contentHash(kShaderToyShaderPath.arg(id)))) {
         continue;
       }
+      indexShader(id);
+      ++parsed;
+    }
 
-      // Check whether the file is already in the cache. If so, we assume it's
-      // up to date.
-      if (isCached(src)) {
-        qDebug("Shader uses %s which we already have in our cache", qPrintable(src));
+    // A shader may have been downloaded since we listed them, in which case
+    // indexObject will have indexed it already. Check the cache index again
+    // before removing anything, holding its lock so that can't happen
+    // between the check and the removal.
+    int removed = 0;
+    for (const QString& id : _shaderIndex.ids()) {
+      if (cachedIDs.contains(id)) {
         continue;
       }
+      QMutexLocker lock(&_indexLock);
+      if (!_index.contains(kShaderToyShaderPath.arg(id))) {
+        _shaderIndex.remove(id);
+        ++removed;
+      }
+    }
 
-      // If this asset has already been marked for downloading, no need to do anything more.
-      if (_assetsToDownload.contains(src)) {
+    if (parsed > 0 || removed > 0) {
+      qDebug("Shader index: added or updated %d shaders, removed %d, in %.3f secs", parsed, removed, timer.elapsedSecs());
+      QMetaObject::invokeMethod(this, "scheduleIndexSave", Qt::QueuedConnection);
+    }
+  }
+
+
+  QString FileCache::pathForShaderID(const QString& idOrURL)
+  {
+    QString id = shaderIDFromIDorURL(idOrURL);
+    return id.isEmpty() ? QString() : kShaderToyShaderPath.arg(id);
+  }
+
+
+  FileCacheScrubStats FileCache::scrub()
+  {
+    FileCacheScrubStats stats;
+
+    QHash<QString, FileCacheEntry> snapshot;
+    {
+      QMutexLocker lock(&_indexLock);
+      snapshot = _index;
+    }
+
+    // Several entries can share an object, so remember what we found for
+    // each one rather than hashing it repeatedly.
+    QHash<QString, QByteArray> objectHashes;
+
+    for (auto it = snapshot.constBegin(); it != snapshot.constEnd(); ++it) {
+      const QString& key = it.key();
+      const FileCacheEntry& entry = it.value();
+      ++stats.checked;
+
+      if (!objectHashes.contains(entry.object)) {
+        objectHashes[entry.object] = sha256OfFile(_cacheDir.absoluteFilePath(entry.object));
+      }
+      QByteArray actual = objectHashes[entry.object];
+
+      QByteArray expected = expectedHashForPath(key);
+      if (expected.isEmpty()) {
+        expected = entry.sha256; // Empty if we never hashed it, in which case we have to trust what's there.
+      }
+
+      FileCacheEntry updated = entry;
+      bool remove = false;
+      if (actual.isEmpty()) {
+        qWarning("Cache entry %s is missing its contents", qPrintable(key));
+        ++stats.missing;
+        remove = true;
+      }
+      else if (!expected.isEmpty() && actual != expected) {
+        qWarning("Cache entry %s is corrupt", qPrintable(key));
+        ++stats.corrupt;
+        removeObjectFile(entry.object);
+        remove = true;
+      }
+      else if (isContentAddressed(key) && !entry.object.startsWith(kCacheObjectsDir + "/")) {
+        // Left over from before the cache was content addressed.
+        QString object = objectPath(actual, QFileInfo(key).suffix());
+        QString objectFile = _cacheDir.absoluteFilePath(object);
+        QString legacyFile = _cacheDir.absoluteFilePath(entry.object);
+        _cacheDir.mkpath(QFileInfo(object).path());
+        if (QFileInfo::exists(objectFile) || QFile::rename(legacyFile, objectFile)) {
+          QFile::remove(legacyFile); // No-op if the rename succeeded.
+          updated.object = object;
+          updated.sha256 = actual;
+          updated.mtimeMS = QFileInfo(objectFile).lastModified().toMSecsSinceEpoch();
+          ++stats.migrated;
+        }
+      }
+      else {
+        updated.sha256 = actual;
+      }
+
+      // Apply the result, unless the entry changed while we were working.
+      QMutexLocker lock(&_indexLock);
+      auto current = _index.find(key);
+      if (current == _index.end() || current->object != entry.object) {
         continue;
       }
+      if (remove) {
+        _index.erase(current);
+        unrefObjectLocked(entry.object);
+      }
+      else {
+        if (updated.object != entry.object) {
+          retainObjectLocked(updated.object);
+          unrefObjectLocked(entry.object);
+        }
+        *current = updated;
+      }
+    }
 
-      qDebug("Need to download %s", qPrintable(src));
-      _assetsToDownload.insert(src);
+    qDebug("Cache scrub checked %d entries: %d missing, %d corrupt, %d migrated",
+           stats.checked, stats.missing, stats.corrupt, stats.migrated);
+
+    QMetaObject::invokeMethod(this, "scheduleIndexSave", Qt::QueuedConnection);
+    return stats;
+  }
+
+
+  qint64 FileCache::maxBytes() const
+  {
+    return _maxBytes;
+  }
+
+
+  void FileCache::setMaxBytes(qint64 maxBytes)
+  {
+    _maxBytes = qMax(qint64(0), maxBytes);
+    evictInBackground();
+  }
 
-      QString urlStr = kShaderToyAssetURL.arg(src.mid(1)).arg(kShaderToyAppKey);
-      QNetworkReply* reply = _networkAccess->get(QNetworkRequest(QUrl(urlStr)));
-      connect(reply, &QNetworkReply::finished, this, &FileCache::assetDownloaded);
-      connect(reply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::error), this, &FileCache::assetDownloadFailed);
+
+  qint64 FileCache::evict(qint64 maxBytes)
+  {
+    if (maxBytes <= 0) {
+      return 0;
     }
-    bool ready = _assetsToDownload.empty();
-    _assetsToDownloadLock.unlock();
-    if (ready) {
-      emit shaderReady(_downloadedShaderFile);
-      _downloadedShaderFile = QString();
+
+    qint64 freedBytes = 0;
+    int freedFiles = 0;
+
+    // List these before taking the lock, since it means going to the disk.
+    QFileInfoList sidecars = textureSidecars();
+    {
+      QMutexLocker lock(&_indexLock);
+
+      // Objects can be shared between entries, so count each one once and
+      // only consider its space freed when nothing refers to it any more.
+      QHash<QString, qint64> objectSizes;
+      for (auto it = _index.constBegin(); it != _index.constEnd(); ++it) {
+        objectSizes.insert(it->object, it->size);
+      }
+      qint64 totalBytes = packBytes();
+      for (qint64 size : objectSizes) {
+        totalBytes += size;
+      }
+      for (const QFileInfo& sidecar : sidecars) {
+        totalBytes += sidecar.size();
+      }
+      if (totalBytes <= maxBytes) {
+        return 0;
+      }
+
+      // Sidecars are in the same least recently used order as the objects,
+      // using the time they were last written or loaded. The open document's
+      // are exempt, like its objects, so a sidecar isn't thrown away as soon
+      // as it's written just because pinned files fill the budget.
+      QHash<QString, qint64> sidecarSizes;
+      QVector<EvictionCandidate> candidates;
+      for (const QFileInfo& sidecar : sidecars) {
+        sidecarSizes.insert(sidecar.absoluteFilePath(), sidecar.size());
+        if (!_sidecarsInUse.contains(sidecar.absoluteFilePath())) {
+          candidates.append(EvictionCandidate{ sidecar.lastModified().toMSecsSinceEpoch(), sidecar.absoluteFilePath(), true });
+        }
+      }
+      for (auto it = _index.constBegin(); it != _index.constEnd(); ++it) {
+        if (!isPinnedLocked(it.key())) {
+          candidates.append(EvictionCandidate{ it->atimeMS, it.key(), false });
+        }
+      }
+      std::sort(candidates.begin(), candidates.end());
+
+      for (const EvictionCandidate& candidate : candidates) {
+        if (totalBytes <= maxBytes) {
+          break;
+        }
+
+        if (candidate.sidecar) {
+          // It may already have gone along with its object.
+          if (sidecarSizes.contains(candidate.key) && QFile::remove(candidate.key)) {
+            qint64 size = sidecarSizes.take(candidate.key);
+            totalBytes -= size;
+            freedBytes += size;
+            ++freedFiles;
+          }
+          continue;
+        }
+
+        QString object = _index.value(candidate.key).object;
+        _index.remove(candidate.key);
+        if (releaseObjectLocked(object)) {
+          totalBytes -= objectSizes[object];
+          freedBytes += objectSizes[object];
+          ++freedFiles;
+
+          // Deleting the object deleted its sidecars too.
+          for (auto sidecarIt = sidecarSizes.begin(); sidecarIt != sidecarSizes.end(); ) {
+            if (isSidecarOf(QFileInfo(sidecarIt.key()).fileName(), object)) {
+              totalBytes -= sidecarIt.value();
+              freedBytes += sidecarIt.value();
+              sidecarIt = sidecarSizes.erase(sidecarIt);
+            }
+            else {
+              ++sidecarIt;
+            }
+          }
+        }
+      }
+
+      if (totalBytes > maxBytes) {
+        qWarning("Cache is still %lld bytes over budget after eviction; everything left is pinned", totalBytes - maxBytes);
+      }
     }
+
+    if (freedFiles > 0) {
+      _evictedFiles += freedFiles;
+      _evictedBytes += freedBytes;
+      qDebug("Evicted %d files (%lld bytes) from the cache", freedFiles, freedBytes);
+      QMetaObject::invokeMethod(this, "scheduleIndexSave", Qt::QueuedConnection);
+    }
+    return freedBytes;
+  }
+
+
+  FileCacheStats FileCache::stats() const
+  {
+    FileCacheStats stats;
+    stats.hits         = _hits;
+    stats.misses       = _misses;
+    stats.evictedFiles = _evictedFiles;
+    stats.evictedBytes = _evictedBytes;
+    stats.maxBytes     = _maxBytes;
+
+    stats.totalBytes = packBytes();
+    for (const QFileInfo& sidecar : textureSidecars()) {
+      stats.totalBytes += sidecar.size();
+    }
+
+    QMutexLocker lock(&_indexLock);
+    QHash<QString, qint64> objectSizes;
+    for (auto it = _index.constBegin(); it != _index.constEnd(); ++it) {
+      objectSizes.insert(it->object, it->size);
+    }
+    for (qint64 size : objectSizes) {
+      stats.totalBytes += size;
+    }
+    return stats;
+  }
+
+
+  void FileCache::setOpenDocument(const ShaderToyDocument* doc)
+  {
+    QSet<QString> pinned;
+    if (doc != nullptr) {
+      for (const QString& path : assetsForDocument(doc)) {
+        pinned.insert(indexKey(path));
+      }
+      if (!doc->src.isEmpty()) {
+        QString relPath = _cacheDir.relativeFilePath(doc->src);
+        if (!relPath.startsWith("..") && !QDir::isAbsolutePath(relPath)) {
+          pinned.insert(indexKey(relPath));
+        }
+      }
+    }
+
+    QMutexLocker lock(&_indexLock);
+    _pinned = pinned;
+    _sidecarsInUse.clear();
   }
 
-} // namespace vh
 
+  QString FileCache::serverURL() const
+  {
+    return _serverURL;
+  }
+
+
+  void FileCache::setServerURL(const QString& url)
+  {
+    _serverURL = url.isEmpty() ? kDefaultShaderToyURL : url;
+    while (_serverURL.endsWith("/")) {
+      _serverURL.chop(1);
+    }
+  }
+
+
+  int FileCache::downloadConcurrency() const
+  {
+    return _scheduler->maxConcurrent();
+  }
+
+
+  void FileCache::setDownloadConcurrency(int n)
+  {
+    _scheduler->setMaxConcurrent(n);
+  }
+
+
+  const DownloadSchedulerStats& FileCache::prefetchStats() const
+  {
+    return _scheduler->stats();
+  }
+
+
+  //
+  // FileCache public slots
+  //
+
+  bool FileCache::fetchShaderToyByIDorURL(const QString& idOrURL, bool forceDownload)
+  {
+    QString id = shaderIDFromIDorURL(idOrURL);
+    if (id.isEmpty()) {
+      return false;
+    }
+
+    if (_networkAccess == nullptr) {
+      _networkAccess = new QNetworkAccessManager(this);
+    }
+
+    QString path = kShaderToyShaderPath.arg(id);
+    if (isCached(path) && !forceDownload) {
+      qDebug("Using cached copy of shader with id %s", qPrintable(id));
+      _downloadedShaderFile = pathForCachedFile(path);
+      fetchAssetsForDownloadedShader();
+      return true;
+    }
+
+    QNetworkRequest request(shaderURL(id));
+    request.setAttribute(QNetworkRequest::User, path);
+    QNetworkReply* reply = _networkAccess->get(request);
+    connect(reply, &QNetworkReply::finished, this, &FileCache::shaderDownloaded);
+    connect(reply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::error), this, &FileCache::shaderDownloadFailed);
+    return true;
+  }
+
+
+  void FileCache::fetchShaderToyStandardAssets()
+  {
+    _assetsToDownloadLock.lock();
+    _assetsToDownload.clear();
+    _downloadedShaderFile.clear();
+    for (const QString& path : kStandardShaderToyAssets) {
+      if (isCached(path)) {
+        qDebug("Already have %s", qPrintable(path));
+        continue;
+      }
+
+      if (_assetsToDownload.contains(path)) {
+        continue;
+      }
+
+      qDebug("Need to download %s", qPrintable(path));
+      _assetsToDownload.insert(path);
+
+      _scheduler->enqueueToFile(assetURL(path), kFetchAssetTag + path, partialFileForPath(path), expectedHashForPath(path));
+    }
+    bool ready = _assetsToDownload.empty();
+    _assetsToDownloadLock.unlock();
+    if (ready) {
+      emit standardAssetsReady();
+    }
+  }
+
+
+  void FileCache::deleteCache()
+  {
+    _workers.waitForDone();
+    _pack.close();
+
+    qDebug("Removing all files and subdirectories from the cache");
+
+    QDir dir = _cacheDir;
+
+    // Remove all files inside the directory.
+    dir.setFilter(QDir::NoDotAndDotDot | QDir::Files);
+    for (QString filename : dir.entryList()) {
+      qDebug("Removing %s", qPrintable(filename));
+      dir.remove(filename);
+    }
+
+    // Remove all subdirectories inside the directory.
+    dir.setFilter(QDir::NoDotAndDotDot | QDir::Dirs);
+    for (QString dirname : dir.entryList()) {
+      qDebug("Removing %s", qPrintable(dirname));
+      QDir subdir = QDir(dir.absoluteFilePath(dirname));
+      subdir.removeRecursively();
+    }
+
+    _shaderIndex.clear();
+
+    QMutexLocker lock(&_indexLock);
+    _index.clear();
+    _objectRefs.clear();
+  }
+
+
+  void FileCache::rebuildPackInBackground()
+  {
+    if (_packRunning.exchange(true)) {
+      qDebug("Pack rebuild already in progress");
+      return;
+    }
+    _workers.start(new FileCachePackTask(this));
+  }
+
+
+  void FileCache::scrubInBackground()
+  {
+    if (_scrubRunning.exchange(true)) {
+      qDebug("Cache scrub already in progress");
+      return;
+    }
+    _workers.start(new FileCacheScrubTask(this, &_scrubRunning));
+  }
+
+
+  void FileCache::evictInBackground()
+  {
+    if (_maxBytes <= 0) {
+      return;
+    }
+    _evictRequested = true;
+    if (!_evictRunning.exchange(true)) {
+      _workers.start(new FileCacheEvictTask(this, &_evictRunning, &_evictRequested));
+    }
+  }
+
+
+  int FileCache::prefetchShaders(const QStringList& idsOrURLs)
+  {
+    if (!_prefetchActive) {
+      _prefetchActive = true;
+      _prefetchSucceeded = 0;
+      _prefetchFailed = 0;
+    }
+
+    int numValid = 0;
+    for (const QString& idOrURL : idsOrURLs) {
+      QString id = shaderIDFromIDorURL(idOrURL);
+      if (id.isEmpty()) {
+        qWarning("Skipping invalid shader ID %s", qPrintable(idOrURL));
+        ++_prefetchFailed;
+        continue;
+      }
+      ++numValid;
+      if (_prefetches.contains(id)) {
+        continue;
+      }
+
+      _prefetches.insert(id, ShaderPrefetch());
+      if (isCached(kShaderToyShaderPath.arg(id))) {
+        prefetchAssetsForShader(id);
+      }
+      else {
+        _scheduler->enqueue(shaderURL(id), kPrefetchShaderTag + id);
+      }
+    }
+
+    // Everything might have been cached already.
+    if (_scheduler->isIdle()) {
+      QMetaObject::invokeMethod(this, "prefetchIdle", Qt::QueuedConnection);
+    }
+    return numValid;
+  }
+
+
+  //
+  // FileCache private slots
+  //
+
+  void FileCache::shaderDownloaded()
+  {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    QString path = reply->request().attribute(QNetworkRequest::User).toString();
+
+    QByteArray data = reply->readAll();
+    reply->deleteLater();
+
+    QWidget* parentForErrorDialogs = qobject_cast<QWidget*>(parent());
+
+    // Save data to a local file, then open it
+    if (!saveFileToCache(path, data, parentForErrorDialogs)) {
+      return;
+    }
+
+    qDebug("Successfully downloaded %s", qPrintable(reply->url().toDisplayString()));
+    _downloadedShaderFile = pathForCachedFile(path);
+
+    fetchAssetsForDownloadedShader();
+  }
+
+
+  void FileCache::shaderDownloadFailed(QNetworkReply::NetworkError /*err*/)
+  {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    reply->deleteLater();
+
+    QWidget* parentForErrorDialogs = qobject_cast<QWidget*>(parent());
+
+    qCritical("Failed to download shader from ShaderToy (url was %s)", qPrintable(reply->url().toDisplayString()));
+    QMessageBox::critical(parentForErrorDialogs, "Download failed", "Failed to download shader from ShaderToy");
+  }
+
+
+  void FileCache::scheduleIndexSave()
+  {
+    _indexSaveTimer->start();
+  }
+
+
+  void FileCache::scheduledDownloadFinished(const QString& tag, const QByteArray& data)
+  {
+    if (tag.startsWith(kPrefetchShaderTag)) {
+      QString id = tag.mid(kPrefetchShaderTag.size());
+      if (!saveFileToCache(kShaderToyShaderPath.arg(id), data, nullptr)) {
+        _prefetches[id].ok = false;
+        finishShaderPrefetch(id);
+        return;
+      }
+      prefetchAssetsForShader(id);
+    }
+  }
+
+
+  void FileCache::scheduledFileDownloadFinished(const QString& tag, const QString& filename, const QByteArray& sha256)
+  {
+    if (tag.startsWith(kFetchAssetTag)) {
+      QString path = tag.mid(kFetchAssetTag.size());
+      bool ok = saveDownloadedFileToCache(path, filename, sha256, nullptr);
+      if (ok) {
+        qDebug("Successfully downloaded asset %s", qPrintable(path));
+      }
+      assetFetched(path);
+    }
+    else if (tag.startsWith(kPrefetchAssetTag)) {
+      QString path = tag.mid(kPrefetchAssetTag.size());
+      prefetchAssetDone(path, saveDownloadedFileToCache(path, filename, sha256, nullptr));
+    }
+  }
+
+
+  void FileCache::scheduledDownloadProgress(const QString& tag, qint64 bytesReceived, qint64 bytesTotal)
+  {
+    int sep = tag.indexOf(':');
+    emit downloadProgress(tag.mid(sep + 1), bytesReceived, bytesTotal);
+  }
+
+
+  void FileCache::scheduledDownloadFailed(const QString& tag, const QString& /*error*/)
+  {
+    if (tag.startsWith(kFetchAssetTag)) {
+      QString path = tag.mid(kFetchAssetTag.size());
+      qCritical("Failed to download asset %s from ShaderToy", qPrintable(path));
+      assetFetched(path);
+    }
+    else if (tag.startsWith(kPrefetchShaderTag)) {
+      QString id = tag.mid(kPrefetchShaderTag.size());
+      _prefetches[id].ok = false;
+      finishShaderPrefetch(id);
+    }
+    else if (tag.startsWith(kPrefetchAssetTag)) {
+      prefetchAssetDone(tag.mid(kPrefetchAssetTag.size()), false);
+    }
+  }
+
+
+  void FileCache::prefetchIdle()
+  {
+    if (!_prefetchActive || !_scheduler->isIdle() || !_prefetches.isEmpty()) {
+      return;
+    }
+    _prefetchActive = false;
+    emit prefetchFinished(_prefetchSucceeded, _prefetchFailed);
+  }
+
+
+  void FileCache::packWritten(bool ok, int entries, qint64 bytes)
+  {
+    // If writing failed, keep the old pack rather than losing it.
+    ok = ok && installPack();
+    _packRunning = false;
+    evictInBackground();
+    emit packFinished(ok, entries, bytes);
+  }
+
+
+  //
+  // FileCache private methods
+  //
+
+  void FileCache::fetchAssetsForDownloadedShader()
+  {
+    if (_downloadedShaderFile.isEmpty()) {
+      return;
+    }
+
+    QWidget* parentForErrorDialogs = qobject_cast<QWidget*>(parent());
+
+    // Download successful, now let's parse the document so we can also grab
+    // any required assets for it.
+    ShaderToyDocument* document = nullptr;
+    try {
+      document = loadShaderToyJSONFile(_downloadedShaderFile, ShaderToyLoadMode::eAssetsOnly);
+    }
+    catch (const std::runtime_error& err) {
+      qCritical("Unable to load %s: %s", qPrintable(_downloadedShaderFile), err.what());
+      QMessageBox::critical(parentForErrorDialogs, "Load failed", QString("Unable to load %1: %2").arg(_downloadedShaderFile).arg(err.what()));      
+      removeFromCache(_cacheDir.relativeFilePath(_downloadedShaderFile));
+      return;
+    }
+
+    QSet<QString> requiredAssets = assetsForDocument(document);
+
+    delete document;
+
+    _assetsToDownloadLock.lock();
+    _assetsToDownload.clear();
+    for (QString src : requiredAssets) {
+      // All ShaderToy assets are stored under their media folder.
+      if (!src.startsWith("/media/")) {
+        continue;
+      }
+
+      // Check whether the file is already in the cache. If so, we assume it's
+      // up to date.
+      if (isCached(src)) {
+        qDebug("Shader uses %s which we already have in our cache", qPrintable(src));
+        continue;
+      }
+
+      // If this asset has already been marked for downloading, no need to do anything more.
+      if (_assetsToDownload.contains(src)) {
+        continue;
+      }
+
+      qDebug("Need to download %s", qPrintable(src));
+      _assetsToDownload.insert(src);
+
+      _scheduler->enqueueToFile(assetURL(src), kFetchAssetTag + src, partialFileForPath(src), expectedHashForPath(src));
+    }
+    bool ready = _assetsToDownload.empty();
+    _assetsToDownloadLock.unlock();
+    if (ready) {
+      emit shaderReady(_downloadedShaderFile);
+      _downloadedShaderFile = QString();
+    }
+  }
+
+
+  // Called when an asset download for the UI has finished, whether or not it
+  // succeeded. Once the last one is done, the shader is ready to open.
+  void FileCache::assetFetched(const QString& path)
+  {
+    bool ready = false;
+    _assetsToDownloadLock.lock();
+    if (_assetsToDownload.remove(path)) {
+      ready = _assetsToDownload.isEmpty();
+    }
+    _assetsToDownloadLock.unlock();
+
+    if (ready) {
+      if (_downloadedShaderFile.isEmpty()) {
+        emit standardAssetsReady();
+      }
+      else {
+        emit shaderReady(_downloadedShaderFile);
+        _downloadedShaderFile = QString();
+      }
+    }
+  }
+
+
+  QUrl FileCache::shaderURL(const QString& id) const
+  {
+    return QUrl(kShaderToyShaderURL.arg(_serverURL).arg(id).arg(kShaderToyAppKey));
+  }
+
+
+  QUrl FileCache::assetURL(const QString& path) const
+  {
+    return QUrl(kShaderToyAssetURL.arg(_serverURL).arg(indexKey(path)).arg(kShaderToyAppKey));
+  }
+
+
+  void FileCache::prefetchAssetsForShader(const QString& id)
+  {
+    QString filename = pathForCachedFile(kShaderToyShaderPath.arg(id));
+
+    ShaderToyDocument* document = nullptr;
+    try {
+      document = loadShaderToyJSONFile(filename, ShaderToyLoadMode::eAssetsOnly);
+    }
+    catch (const std::runtime_error& err) {
+      qWarning("Unable to load prefetched shader %s: %s", qPrintable(id), err.what());
+      removeFromCache(kShaderToyShaderPath.arg(id));
+      _prefetches[id].ok = false;
+      finishShaderPrefetch(id);
+      return;
+    }
+
+    QSet<QString> requiredAssets = assetsForDocument(document);
+    delete document;
+
+    ShaderPrefetch& prefetch = _prefetches[id];
+    for (const QString& src : requiredAssets) {
+      if (!src.startsWith("/media/") || isCached(src)) {
+        continue;
+      }
+
+      // Several shaders in the batch may share an asset; only download it
+      // once, but have all of them wait for it.
+      ++prefetch.pendingAssets;
+      bool inFlight = _prefetchAssetUsers.contains(src);
+      _prefetchAssetUsers[src].append(id);
+      if (!inFlight) {
+        _scheduler->enqueueToFile(assetURL(src), kPrefetchAssetTag + src, partialFileForPath(src), expectedHashForPath(src));
+      }
+    }
+
+    if (prefetch.pendingAssets == 0) {
+      finishShaderPrefetch(id);
+    }
+  }
+
+
+  void FileCache::prefetchAssetDone(const QString& path, bool ok)
+  {
+    QStringList users = _prefetchAssetUsers.take(path);
+    for (const QString& id : users) {
+      auto it = _prefetches.find(id);
+      if (it == _prefetches.end()) {
+        continue;
+      }
+      if (!ok) {
+        it->ok = false;
+      }
+      if (--it->pendingAssets == 0) {
+        finishShaderPrefetch(id);
+      }
+    }
+  }
+
+
+  void FileCache::finishShaderPrefetch(const QString& id)
+  {
+    bool ok = _prefetches.take(id).ok;
+    if (ok) {
+      ++_prefetchSucceeded;
+    }
+    else {
+      ++_prefetchFailed;
+    }
+    emit shaderPrefetched(id, ok);
+
+    // If this shader didn't need any downloads, the scheduler may have gone
+    // idle before we got here.
+    if (_prefetches.isEmpty() && _scheduler->isIdle()) {
+      QMetaObject::invokeMethod(this, "prefetchIdle", Qt::QueuedConnection);
+    }
+  }
+
+
+  QString FileCache::indexKey(const QString& path) const
+  {
+    return QDir::cleanPath(path.startsWith("/") ? path.mid(1) : path);
+  }
+
+
+  // Checks that a download can go into the cache under `path`, and works out
+  // which object it should be stored as.
+  bool FileCache::validateDownload(const QString& path, const QByteArray& sha256, qint64 size, QWidget* parentForErrorDialogs, QString& object) const
+  {
+    QString key = indexKey(path);
+
+    // Don't allow paths that would escape the cache dir. Nothing is written
+    // under the name itself any more, but it'd still be a sign that
+    // something's badly wrong.
+    if (key == ".." || key.startsWith("../") || QDir::isAbsolutePath(key)) {
+      qDebug("Cannot save %s to the cache because it would write to a location outside the cache directory", qPrintable(path));
+      if (parentForErrorDialogs != nullptr) {
+        QMessageBox::critical(parentForErrorDialogs, "Save failed", QString("Cannot save %1 to the cache because it would write to a location outside the cache directory").arg(path));
+      }
+      return false;
+    }
+
+    QByteArray expected = expectedHashForPath(path);
+    if (!expected.isEmpty() && sha256 != expected) {
+      qCritical("Downloaded %s is corrupt (%lld bytes, hash %s), not caching it", qPrintable(path), size, sha256.constData());
+      if (parentForErrorDialogs != nullptr) {
+        QMessageBox::critical(parentForErrorDialogs, "Save failed", QString("Downloaded file %1 is corrupt").arg(path));
+      }
+      return false;
+    }
+
+    // Other files (i.e. the shader JSON) keep their own names, since that's
+    // what the user will see when they're opened.
+    object = isContentAddressed(key) ? objectPath(sha256, QFileInfo(key).suffix()) : key;
+    return true;
+  }
+
+
+  void FileCache::indexObject(const QString& key, const QString& object, qint64 size, const QByteArray& sha256)
+  {
+    FileCacheEntry entry;
+    entry.object = object;
+    entry.size = size;
+    entry.mtimeMS = QFileInfo(_cacheDir.absoluteFilePath(object)).lastModified().toMSecsSinceEpoch();
+    entry.atimeMS = QDateTime::currentMSecsSinceEpoch();
+    entry.sha256 = sha256;
+
+    {
+      QMutexLocker lock(&_indexLock);
+      QString oldObject = _index.value(key).object;
+      _index[key] = entry;
+      // Retain first, so replacing an entry with the same object doesn't
+      // briefly drop its count to zero and delete it.
+      retainObjectLocked(object);
+      if (!oldObject.isEmpty()) {
+        releaseObjectLocked(oldObject);
+      }
+    }
+    if (key.startsWith(QFileInfo(kShaderToyShaderPath).path() + "/")) {
+      indexShader(QFileInfo(key).completeBaseName());
+    }
+
+    scheduleIndexSave();
+    evictInBackground();
+  }
+
+
+  // Only reads the metadata, so even thousands of shaders are quick to do.
+  void FileCache::indexShader(const QString& id)
+  {
+    QString path = kShaderToyShaderPath.arg(id);
+    QByteArray sha256 = contentHash(path);
+    if (sha256.isEmpty()) {
+      return;
+    }
+
+    ShaderToyDocument* doc = nullptr;
+    try {
+      doc = loadShaderToyJSONFile(pathForCachedFile(path), ShaderToyLoadMode::eMetadata);
+    }
+    catch (const std::runtime_error& err) {
+      qDebug("Not indexing shader %s: %s", qPrintable(id), err.what());
+      _shaderIndex.remove(id);
+      return;
+    }
+    _shaderIndex.update(id, sha256, *doc);
+    delete doc;
+  }
+
+
+  QString FileCache::objectPath(const QByteArray& sha256, const QString& suffix) const
+  {
+    QString name = QString::fromLatin1(sha256);
+    if (!suffix.isEmpty()) {
+      name += "." + suffix;
+    }
+    return QString("%1/%2/%3").arg(kCacheObjectsDir).arg(name.left(2)).arg(name);
+  }
+
+
+  bool FileCache::writeObject(const QString& object, const QByteArray& data, QString& error)
+  {
+    if (!_cacheDir.mkpath(QFileInfo(object).path())) {
+      error = QString("failed to create directory %1 in the cache").arg(QFileInfo(object).path());
+      return false;
+    }
+
+    // QSaveFile writes to a temp file and only renames it into place (after
+    // flushing it to disk) when we commit, so readers never see a partially
+    // written object.
+    QSaveFile file(_cacheDir.absoluteFilePath(object));
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+      error = file.errorString();
+      return false;
+    }
+    return true;
+  }
+
+
+  // Records that another index entry refers to the object. The caller must
+  // be holding `_indexLock`.
+  void FileCache::retainObjectLocked(const QString& object)
+  {
+    ++_objectRefs[object];
+  }
+
+
+  // Drops a reference to the object without touching its file. Returns true
+  // if that was the last one. The caller must be holding `_indexLock`.
+  bool FileCache::unrefObjectLocked(const QString& object)
+  {
+    auto it = _objectRefs.find(object);
+    if (it == _objectRefs.end()) {
+      return false;
+    }
+    if (--it.value() > 0) {
+      return false;
+    }
+    _objectRefs.erase(it);
+    return true;
+  }
+
+
+  // Drops a reference to the object and deletes its file if no index entry
+  // refers to it any more. Call this after removing or repointing the entry.
+  // The caller must be holding `_indexLock`. Returns true if that was the
+  // last reference.
+  bool FileCache::releaseObjectLocked(const QString& object)
+  {
+    if (!unrefObjectLocked(object)) {
+      return false;
+    }
+    removeObjectFile(object);
+    return true;
+  }
+
+
+  // Removes an object along with any decoded copies we made of it, including
+  // cubemaps it's one of the faces of.
+  bool FileCache::removeObjectFile(const QString& object)
+  {
+    QDir texturesDir(_cacheDir.absoluteFilePath(kCacheTexturesDir));
+    for (const QString& sidecar : texturesDir.entryList(QDir::Files)) {
+      if (isSidecarOf(sidecar, object)) {
+        texturesDir.remove(sidecar);
+      }
+    }
+    return QFile::remove(_cacheDir.absoluteFilePath(object));
+  }
+
+
+  // The caller must be holding `_indexLock`.
+  bool FileCache::isPinnedLocked(const QString& key) const
+  {
+    return _pinned.contains(key) || isStandardAsset(key);
+  }
+
+
+  // Swaps the pack written by `writePack` in for the current one. Main thread
+  // only, because nothing can be using the old mapping when it's closed.
+  bool FileCache::installPack()
+  {
+    QString packFilename = _cacheDir.absoluteFilePath(kCachePackFilename);
+    QString newPackFilename = _cacheDir.absoluteFilePath(kCacheNewPackFilename);
+
+    // Some platforms won't let us replace a file while it's mapped.
+    _pack.close();
+
+    bool ok = !QFileInfo::exists(packFilename) || QFile::remove(packFilename);
+    if (ok && QFileInfo::exists(newPackFilename)) {
+      ok = QFile::rename(newPackFilename, packFilename);
+    }
+
+    if (QFileInfo::exists(packFilename)) {
+      _pack.open(packFilename);
+    }
+    return ok;
+  }
+
+
+  // All the decoded texture sidecars, least recently written first.
+  QFileInfoList FileCache::textureSidecars() const
+  {
+    QDir texturesDir(_cacheDir.absoluteFilePath(kCacheTexturesDir));
+    return texturesDir.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+  }
+
+
+  // Size of the pack on disk. It's a copy of files which are already in the
+  // cache, but it's still disk space the cache is using.
+  qint64 FileCache::packBytes() const
+  {
+    return QFileInfo(_cacheDir.absoluteFilePath(kCachePackFilename)).size();
+  }
+
+
+  void FileCache::buildIndex()
+  {
+    QHash<QString, FileCacheEntry> saved;
+    loadIndex(saved);
+
+    // Find out what's actually on disk. Anything under objects/ is content
+    // addressed; anything else is a file saved under its own name (either
+    // the shader JSON, or media from before the cache was content addressed).
+    QHash<QString, QFileInfo> objects;
+    QHash<QString, QFileInfo> legacy;
+    QDirIterator it(_cacheDir.absolutePath(), QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+      it.next();
+      QFileInfo info = it.fileInfo();
+      QString relPath = _cacheDir.relativeFilePath(info.absoluteFilePath());
+      if (relPath == kCacheIndexFilename || relPath == kCachePackFilename || relPath == kCacheNewPackFilename || relPath == kShaderIndexFilename ||
+          relPath.startsWith(kCachePartialDir + "/") || relPath.startsWith(kCacheTexturesDir + "/")) {
+        continue;
+      }
+      if (relPath.startsWith(kCacheObjectsDir + "/")) {
+        objects.insert(relPath, info);
+      }
+      else {
+        legacy.insert(relPath, info);
+      }
+    }
+
+    QMutexLocker lock(&_indexLock);
+    _index.clear();
+
+    QSet<QString> referenced;
+    int reusedHashes = 0;
+
+    // Keep saved entries whose object is still there and the right size. If
+    // it hasn't been modified since we saved the index, we can trust the
+    // hash we had for it then too.
+    for (auto old = saved.constBegin(); old != saved.constEnd(); ++old) {
+      const QHash<QString, QFileInfo>& files = old->object.startsWith(kCacheObjectsDir + "/") ? objects : legacy;
+      auto file = files.constFind(old->object);
+      if (file == files.constEnd() || file->size() != old->size) {
+        continue;
+      }
+
+      FileCacheEntry entry = old.value();
+      qint64 mtimeMS = file->lastModified().toMSecsSinceEpoch();
+      if (mtimeMS != entry.mtimeMS) {
+        entry.mtimeMS = mtimeMS;
+        entry.sha256.clear();
+      }
+      else if (!entry.sha256.isEmpty()) {
+        ++reusedHashes;
+      }
+      _index.insert(old.key(), entry);
+      referenced.insert(entry.object);
+    }
+
+    // Files saved under their own names are their own objects.
+    for (auto file = legacy.constBegin(); file != legacy.constEnd(); ++file) {
+      if (_index.contains(file.key())) {
+        continue;
+      }
+      FileCacheEntry entry;
+      entry.object  = file.key();
+      entry.size    = file->size();
+      entry.mtimeMS = file->lastModified().toMSecsSinceEpoch();
+      entry.atimeMS = entry.mtimeMS;
+      _index.insert(file.key(), entry);
+    }
+
+    // If we lost the index, we can still recover names for ShaderToy media
+    // since they're named after their hash too.
+    int orphans = 0;
+    for (auto file = objects.constBegin(); file != objects.constEnd(); ++file) {
+      if (referenced.contains(file.key())) {
+        continue;
+      }
+      QString key = QString("media/a/%1").arg(file->fileName());
+      if (_index.contains(key)) {
+        ++orphans;
+        continue;
+      }
+      FileCacheEntry entry;
+      entry.object  = file.key();
+      entry.size    = file->size();
+      entry.mtimeMS = file->lastModified().toMSecsSinceEpoch();
+      entry.atimeMS = entry.mtimeMS;
+      _index.insert(key, entry);
+    }
+
+    _objectRefs.clear();
+    for (auto entry = _index.constBegin(); entry != _index.constEnd(); ++entry) {
+      retainObjectLocked(entry->object);
+    }
+
+    qDebug("Cache index has %d files in %d objects (%d hashes reused, %d orphaned objects)",
+           _index.size(), objects.size() + legacy.size(), reusedHashes, orphans);
+  }
+
+
+  void FileCache::loadIndex(QHash<QString, FileCacheEntry>& saved) const
+  {
+    QFile file(_cacheDir.absoluteFilePath(kCacheIndexFilename));
+    if (!file.open(QIODevice::ReadOnly)) {
+      return;
+    }
+
+    QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+    int version = json["version"].toInt();
+    if (version < 1 || version > kCacheIndexVersion) {
+      return;
+    }
+
+    QJsonObject entries = json["entries"].toObject();
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+      QJsonObject obj = it.value().toObject();
+      FileCacheEntry entry;
+      entry.object  = obj["object"].toString(it.key()); // Version 1 indexes stored every file under its own name.
+      entry.size    = qint64(obj["size"].toDouble());
+      entry.mtimeMS = qint64(obj["mtime"].toDouble());
+      entry.atimeMS = qint64(obj["atime"].toDouble(double(entry.mtimeMS)));
+      entry.sha256  = obj["sha256"].toString().toLatin1();
+      saved.insert(it.key(), entry);
+    }
+  }
+
+
+  void FileCache::saveIndex() const
+  {
+    QJsonObject entries;
+    {
+      QMutexLocker lock(&_indexLock);
+      for (auto it = _index.constBegin(); it != _index.constEnd(); ++it) {
+        QJsonObject obj;
+        obj["object"] = it->object;
+        obj["size"]   = double(it->size);
+        obj["mtime"]  = double(it->mtimeMS);
+        obj["atime"]  = double(it->atimeMS);
+        obj["sha256"] = QString::fromLatin1(it->sha256);
+        entries[it.key()] = obj;
+      }
+    }
+
+    QJsonObject json;
+    json["version"] = kCacheIndexVersion;
+    json["entries"] = entries;
+
+    if (!_cacheDir.exists() && !_cacheDir.mkpath(".")) {
+      return;
+    }
+
+    QSaveFile file(_cacheDir.absoluteFilePath(kCacheIndexFilename));
+    if (!file.open(QIODevice::WriteOnly)) {
+      qWarning("Unable to save the cache index: %s", qPrintable(file.errorString()));
+      return;
+    }
+    file.write(QJsonDocument(json).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+      qWarning("Unable to save the cache index: %s", qPrintable(file.errorString()));
+    }
+
+    if (_shaderIndex.isDirty()) {
+      _shaderIndex.save(_cacheDir.absoluteFilePath(kShaderIndexFilename));
+    }
+  }
+
+} // namespace vh
@@ -2,16 +2,112 @@
 #ifndef VH_FILECACHE_H
 #define VH_FILECACHE_H
 
+#include "AssetPack.h"
+#include "DownloadScheduler.h"
+#include "ShaderIndex.h"
+
+#include <QByteArray>
+#include <QDateTime>
 #include <QDir>
+#include <QFileInfoList>
+#include <QHash>
+#include <QImage>
 #include <QMutex>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QObject>
 #include <QSet>
 #include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <atomic>
 
 namespace vh {
 
+  //
+  // Forward declarations
+  //
+
+  struct ShaderToyDocument;
+
+
+  //
+  // Structs
+  //
+
+  struct FileCacheEntry {
+    QString object;           // File holding the contents, relative to the cache dir. For media files this is objects/<aa>/<sha256>.<ext>.
+    qint64 size    = 0;
+    qint64 mtimeMS = 0;       // Last modified time, in milliseconds since the epoch.
+    qint64 atimeMS = 0;       // When we last looked the file up, in milliseconds since the epoch. Used for LRU eviction.
+    QByteArray sha256;        // Hex encoded. Empty if we haven't hashed the file yet.
+  };
+
+
+  struct FileCacheScrubStats {
+    int checked  = 0;         // Number of index entries examined.
+    int missing  = 0;         // Entries whose contents had disappeared.
+    int corrupt  = 0;         // Entries whose contents didn't match their hash.
+    int migrated = 0;         // Files moved from the old path-based layout into the object store.
+  };
+
+
+  struct FileCacheStats {
+    qint64 hits         = 0;  // Lookups which found the file in the cache.
+    qint64 misses       = 0;  // Lookups which didn't.
+    qint64 evictedFiles = 0;
+    qint64 evictedBytes = 0;
+    qint64 totalBytes   = 0;  // Current size of everything in the cache.
+    qint64 maxBytes     = 0;  // Size budget. 0 means unlimited.
+  };
+
+
+  //
+  // FileCache class
+  //
+
+  /// Local copies of files downloaded from ShaderToy. We keep an in-memory
+  /// index of everything in the cache directory, so checking whether a file
+  /// is cached doesn't need to touch the filesystem. The index is built by
+  /// scanning the directory once at startup (reusing hashes from the index
+  /// file saved last time, where the file hasn't changed since) and is kept
+  /// up to date as files are added and removed.
+  ///
+  /// Media files are stored by the SHA-256 of their contents under
+  /// `objects/`, so assets which are referenced under several names are only
+  /// stored once, and the index maps each name onto its object. Names which
+  /// embed a hash (such as ShaderToy's `/media/a/<sha256>.png`) are verified
+  /// before being stored, and all writes go via a temp file which is renamed
+  /// into place, so a failed or truncated download can never end up in the
+  /// cache.
+  ///
+  /// The cache is kept under a size budget (from Preferences) by evicting
+  /// the least recently used files on a background thread. The standard
+  /// assets and anything used by the currently open document are never
+  /// evicted. Decoded texture sidecars count towards the budget too, and
+  /// are evicted (oldest first) before any downloaded files, since they can
+  /// be rebuilt without the network.
+  ///
+  /// Asset downloads go through a DownloadScheduler, which limits how many
+  /// are in flight and retries failures. Assets are streamed to a file under
+  /// `partial/` as they arrive, so big videos are never held in memory, and
+  /// an interrupted download picks up where it left off. Besides fetching
+  /// shaders one at a time for the UI, the cache can prefetch a whole batch
+  /// of shaders and their assets, with each shader in the batch tracking its
+  /// own outstanding assets.
+  ///
+  /// Every cached shader's metadata is kept in a ShaderIndex, saved
+  /// alongside the cache index, so cached shaders can be searched without
+  /// parsing their JSON.
+  ///
+  /// Cached images can also be packed into a single memory mapped file (see
+  /// `rebuildPack`), so loading a shader's textures doesn't need an open and
+  /// read per image. The loose files stay the source of truth: the pack is
+  /// a read-only copy which is only used where its hash still matches the
+  /// index, and is refreshed by rebuilding it. The pack counts towards the
+  /// size budget.
   class FileCache : public QObject
   {
     Q_OBJECT
@@ -22,28 +118,200 @@ namespace vh {
     QDir cacheDir() const;
 
     bool saveFileToCache(const QString& path, const QByteArray& data, QWidget* parentForErrorDialogs);
+
+    /// Like `saveFileToCache`, but for a download which has already been
+    /// written to `filename` (whose SHA-256 is `sha256`). The file is moved
+    /// into the cache rather than copied, or deleted if it's corrupt or
+    /// we already have the same contents.
+    bool saveDownloadedFileToCache(const QString& path, const QString& filename, const QByteArray& sha256, QWidget* parentForErrorDialogs);
+
     QString pathForCachedFile(const QString& path);
     bool isCached(const QString& path);
     bool isResource(const QString& path);
+    bool removeFromCache(const QString& path);
+
+    /// SHA-256 of a cached file's contents, hex encoded. Computed on first
+    /// use if we don't already know it. Returns an empty array if the file
+    /// isn't cached.
+    QByteArray contentHash(const QString& path);
+
+    /// True if `path` is cached and we already know its contents have the
+    /// given hash. Never reads the file.
+    bool hasCachedContent(const QString& path, const QByteArray& sha256);
+
+    /// The contents of a cached file straight from the pack, without
+    /// copying. Returns an empty array if the file isn't packed or the
+    /// packed copy is out of date, in which case read it from
+    /// `pathForCachedFile` as usual. The array is only valid until the pack
+    /// is next rebuilt. Main thread only.
+    QByteArray packedData(const QString& path);
+
+    /// Loads an image, decoding it straight from the pack if it's packed,
+    /// otherwise from the cached copy if there is one, otherwise from `path`
+    /// itself. Returns a null image if none of those can be read. Main
+    /// thread only.
+    QImage loadImage(const QString& path);
+
+    /// Writes every cached image into the pack, replacing the old one, and
+    /// waits for it to finish. Main thread only. The UI should use
+    /// `rebuildPackInBackground` instead.
+    bool rebuildPack(AssetPackWriteStats* stats = nullptr);
+
+    /// Writes every cached image into a new pack file alongside the current
+    /// one, without touching the pack that's in use. Safe to call from any
+    /// thread.
+    bool writePack(AssetPackWriteStats* stats);
+
+    /// Where to keep a decoded copy of a cached image (see TextureSidecar).
+    /// `variant` tells apart different decodings of the same file, e.g.
+    /// flipped and unflipped. Sidecars are named after the file's hash and
+    /// are deleted along with it, so this returns an empty string if the
+    /// file isn't a cached media file.
+    QString textureSidecarPath(const QString& path, const QString& variant);
+
+    /// Where to keep a decoded copy of a cubemap built from several cached
+    /// images. The name is made from every face's hash, so replacing any one
+    /// face gives a different path rather than serving the old copy, and
+    /// removing any face from the cache deletes the sidecar too. Returns an
+    /// empty string unless every face is a cached media file.
+    QString cubemapSidecarPath(const QStringList& facePaths, const QString& variant);
+
+    /// Call after loading or writing a sidecar. It's marked as just used, so
+    /// it's evicted in the same least recently used order as the objects,
+    /// and it isn't evicted at all until another document is opened.
+    void useTextureSidecar(const QString& sidecarPath);
+
+    /// All of the ShaderToy media files that a document refers to, including
+    /// its thumbnail and every face of each cubemap.
+    static QSet<QString> assetsForDocument(const ShaderToyDocument* doc);
+
+    /// IDs of all the shaders whose JSON is in the cache.
+    QStringList cachedShaders() const;
+
+    /// Finds cached shaders using the shader index. See ShaderIndex for the
+    /// query syntax.
+    QVector<ShaderIndexRecord> searchShaders(const QString& query);
+
+    /// Brings the shader index up to date with the shaders in the cache.
+    /// This happens in the background at startup, and the index is kept up
+    /// to date as shaders are downloaded after that, so this only needs
+    /// calling to wait for it. Safe to call from any thread.
+    void updateShaderIndex();
+
+    /// The path we cache a shader's JSON under, given its ID or view URL.
+    /// Returns an empty string if it isn't a valid ID.
+    static QString pathForShaderID(const QString& idOrURL);
+
+    /// Rehashes everything in the cache, dropping entries which are missing
+    /// or don't match their expected hash (they'll be downloaded again next
+    /// time they're needed) and moving any files still stored under their
+    /// old path-based names into the object store. Safe to call from any
+    /// thread.
+    FileCacheScrubStats scrub();
+
+    qint64 maxBytes() const;
+    void setMaxBytes(qint64 maxBytes);
+
+    /// Removes least recently used files until the cache is no bigger than
+    /// `maxBytes`, skipping pinned files. Returns the number of bytes freed.
+    /// Safe to call from any thread.
+    qint64 evict(qint64 maxBytes);
+
+    FileCacheStats stats() const;
+
+    /// Pins the document's own file (if it's in the cache) and all the
+    /// assets it uses, so they won't be evicted. Replaces any previously
+    /// pinned document, along with any sidecars it was using; pass nullptr
+    /// to unpin.
+    void setOpenDocument(const ShaderToyDocument* doc);
+
+    /// Where to download from. Defaults to https://www.shadertoy.com, but can
+    /// point at a mirror or a local test server.
+    QString serverURL() const;
+    void setServerURL(const QString& url);
+
+    int downloadConcurrency() const;
+    void setDownloadConcurrency(int n);
+
+    /// Throughput for the most recent batch of prefetches.
+    const DownloadSchedulerStats& prefetchStats() const;
 
   public slots:
     bool fetchShaderToyByIDorURL(const QString& idOrURL, bool forceDownload);
     void fetchShaderToyStandardAssets();
     void deleteCache();
+    void scrubInBackground();
+    void evictInBackground();
+
+    /// Like `rebuildPack`, but hashes and copies the images on a background
+    /// thread. The new pack replaces the old one on the main thread once it's
+    /// written, then `packFinished` is emitted.
+    void rebuildPackInBackground();
+
+    /// Downloads each of the shaders and all the assets they use, skipping
+    /// anything which is already cached. Returns the number of valid IDs.
+    /// Emits `shaderPrefetched` as each shader completes and
+    /// `prefetchFinished` once the whole batch is done.
+    int prefetchShaders(const QStringList& idsOrURLs);
 
   signals:
     void shaderReady(const QString& path);
     void standardAssetsReady();
+    void scrubFinished(int checked, int missing, int corrupt, int migrated);
+    void packFinished(bool ok, int entries, qint64 bytes);
+    void shaderPrefetched(const QString& id, bool ok);
+    void prefetchFinished(int succeeded, int failed);
+    void downloadProgress(const QString& path, qint64 bytesReceived, qint64 bytesTotal);
 
   private slots:
     void shaderDownloaded();
     void shaderDownloadFailed(QNetworkReply::NetworkError err);
 
-    void assetDownloaded();
-    void assetDownloadFailed(QNetworkReply::NetworkError err);
+    void scheduleIndexSave();
+    void saveIndex() const;
+
+    void packWritten(bool ok, int entries, qint64 bytes);
+
+    void scheduledDownloadFinished(const QString& tag, const QByteArray& data);
+    void scheduledFileDownloadFinished(const QString& tag, const QString& filename, const QByteArray& sha256);
+    void scheduledDownloadProgress(const QString& tag, qint64 bytesReceived, qint64 bytesTotal);
+    void scheduledDownloadFailed(const QString& tag, const QString& error);
+    void prefetchIdle();
 
   private:
+    struct ShaderPrefetch {
+      int pendingAssets = 0;
+      bool ok = true;
+    };
+
     void fetchAssetsForDownloadedShader();
+    void assetFetched(const QString& path);
+
+    QUrl shaderURL(const QString& id) const;
+    QUrl assetURL(const QString& path) const;
+
+    void prefetchAssetsForShader(const QString& id);
+    void prefetchAssetDone(const QString& path, bool ok);
+    void finishShaderPrefetch(const QString& id);
+
+    QString indexKey(const QString& path) const;
+    void buildIndex();
+    void loadIndex(QHash<QString, FileCacheEntry>& saved) const;
+
+    QString partialFileForPath(const QString& path) const;
+    bool validateDownload(const QString& path, const QByteArray& sha256, qint64 size, QWidget* parentForErrorDialogs, QString& object) const;
+    void indexObject(const QString& key, const QString& object, qint64 size, const QByteArray& sha256);
+    QString objectPath(const QByteArray& sha256, const QString& suffix) const;
+    bool writeObject(const QString& object, const QByteArray& data, QString& error);
+    void retainObjectLocked(const QString& object);
+    bool unrefObjectLocked(const QString& object);
+    bool releaseObjectLocked(const QString& object);
+    bool removeObjectFile(const QString& object);
+    void indexShader(const QString& id);
+    bool isPinnedLocked(const QString& key) const;
+    bool installPack();
+    qint64 packBytes() const;
+    QFileInfoList textureSidecars() const;
 
   private:
     QNetworkAccessManager* _networkAccess = nullptr;
@@ -53,6 +321,39 @@ namespace vh {
     QString _downloadedShaderFile;
 
     QDir _cacheDir;
+
+    QHash<QString, FileCacheEntry> _index;  // Keyed by path relative to the cache dir.
+    QHash<QString, int> _objectRefs;        // Number of _index entries referring to each object. Guarded by _indexLock.
+    mutable QMutex _indexLock;
+    QTimer* _indexSaveTimer = nullptr;
+
+    QThreadPool _workers;                   // For background maintenance jobs.
+    std::atomic<bool> _scrubRunning { false };
+
+    std::atomic<qint64> _maxBytes { 0 };
+    QSet<QString> _pinned;                  // Index keys for the open document. Guarded by _indexLock.
+    QSet<QString> _sidecarsInUse;           // Absolute paths of the sidecars the open document has used. Guarded by _indexLock.
+    std::atomic<bool> _evictRunning { false };
+    std::atomic<bool> _evictRequested { false };
+
+    std::atomic<qint64> _hits { 0 };
+    std::atomic<qint64> _misses { 0 };
+    std::atomic<qint64> _evictedFiles { 0 };
+    std::atomic<qint64> _evictedBytes { 0 };
+
+    QString _serverURL;
+    DownloadScheduler* _scheduler = nullptr;
+    QHash<QString, ShaderPrefetch> _prefetches;       // Keyed by shader ID.
+    QHash<QString, QStringList> _prefetchAssetUsers;  // Asset path -> IDs of the shaders waiting for it.
+    bool _prefetchActive = false;
+    int _prefetchSucceeded = 0;
+    int _prefetchFailed = 0;
+
+    AssetPack _pack;
+    std::atomic<bool> _packRunning { false };
+
+    ShaderIndex _shaderIndex;
+    QMutex _shaderIndexUpdateLock;
   };
 
 } // namespace vh
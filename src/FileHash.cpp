@@ -0,0 +1,24 @@
+// Copyright 2019 Vilya Harvey
+#include "FileHash.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+
+namespace vh {
+
+  //
+  // Public functions
+  //
+
+  QByteArray sha256OfFile(const QString& filename)
+  {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+      return QByteArray();
+    }
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(&file);
+    return hash.result().toHex();
+  }
+
+} // namespace vh
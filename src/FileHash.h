@@ -0,0 +1,21 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_FILEHASH_H
+#define VH_FILEHASH_H
+
+#include <QByteArray>
+#include <QString>
+
+namespace vh {
+
+  //
+  // Public functions
+  //
+
+  /// SHA-256 of the contents of `filename`, hex encoded, the same way the
+  /// cache and ShaderToy's media file names encode it. Returns an empty array
+  /// if the file can't be read.
+  QByteArray sha256OfFile(const QString& filename);
+
+} // namespace vh
+
+#endif // VH_FILEHASH_H
@@ -0,0 +1,372 @@
+// Copyright 2019 Vilya Harvey
+#include "LiveAudioInput.h"
+
+#include <QAudioBuffer>
+#include <QAudioDeviceInfo>
+#include <QFile>
+#include <QUrlQuery>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kDefaultPCMStreamRate     = 44100;
+  static constexpr int kDefaultPCMStreamChannels = 2;
+
+  static constexpr int kReaderPollMS = 100;  // The longest the reader thread goes without checking whether it should stop.
+
+
+  //
+  // Private types
+  //
+
+  enum class StreamWait {
+    eReady,     // There's data to read, or the stream has reached EOF.
+    eTimeout,   // Nothing to read yet.
+    eClosed,    // The writer has gone away or the stream failed.
+  };
+
+
+  //
+  // Private helper functions
+  //
+
+  static QAudioFormat pcmFormat(int sampleRate, int channels)
+  {
+    QAudioFormat format;
+    format.setSampleRate(sampleRate);
+    format.setChannelCount(channels);
+    format.setSampleSize(16);
+    format.setSampleType(QAudioFormat::SignedInt);
+    format.setByteOrder(QAudioFormat::LittleEndian);
+    format.setCodec("audio/pcm");
+    return format;
+  }
+
+
+  static int openStream(const QString& filename)
+  {
+#ifdef _WIN32
+    if (filename == "-") {
+      int fd = _fileno(stdin);
+      _setmode(fd, _O_BINARY);
+      return fd;
+    }
+    return _wopen(reinterpret_cast<const wchar_t*>(filename.utf16()), _O_RDONLY | _O_BINARY);
+#else
+    if (filename == "-") {
+      return STDIN_FILENO;
+    }
+    // Opening a FIFO for reading normally blocks until there's a writer;
+    // non-blocking mode makes it return straight away, and we poll instead.
+    return ::open(QFile::encodeName(filename).constData(), O_RDONLY | O_NONBLOCK);
+#endif
+  }
+
+
+  static void closeStream(int fd)
+  {
+#ifdef _WIN32
+    if (fd != _fileno(stdin)) {
+      _close(fd);
+    }
+#else
+    if (fd != STDIN_FILENO) {
+      ::close(fd);
+    }
+#endif
+  }
+
+
+  // Waits up to `timeoutMS` for `fd` to have something to read.
+  static StreamWait waitForStream(int fd, int timeoutMS)
+  {
+#ifdef _WIN32
+    // Pipes can be peeked without blocking; anything else (i.e. a regular
+    // file) never blocks for long when read.
+    HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+    DWORD available = 0;
+    if (!PeekNamedPipe(handle, nullptr, 0, nullptr, &available, nullptr)) {
+      return (GetLastError() == ERROR_BROKEN_PIPE) ? StreamWait::eClosed : StreamWait::eReady;
+    }
+    if (available == 0) {
+      Sleep(DWORD(timeoutMS));
+      return StreamWait::eTimeout;
+    }
+    return StreamWait::eReady;
+#else
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int result = ::poll(&pfd, 1, timeoutMS);
+    if (result < 0) {
+      return (errno == EINTR) ? StreamWait::eTimeout : StreamWait::eClosed;
+    }
+    if (result == 0) {
+      return StreamWait::eTimeout;
+    }
+    // POLLHUP can arrive along with the last of the data, so read whatever
+    // is left first; the read will hit EOF after that.
+    if (pfd.revents & POLLIN) {
+      return StreamWait::eReady;
+    }
+    return StreamWait::eClosed;
+#endif
+  }
+
+
+  // Returns the number of bytes read, 0 at EOF, -1 on error or -2 if there
+  // turned out to be nothing to read yet.
+  static qint64 readStream(int fd, char* data, int size)
+  {
+#ifdef _WIN32
+    return _read(fd, data, unsigned(size));
+#else
+    qint64 bytesRead = ::read(fd, data, size_t(size));
+    if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return -2;
+    }
+    return bytesRead;
+#endif
+  }
+
+
+  //
+  // LiveAudioInput public methods
+  //
+
+  LiveAudioInput::LiveAudioInput(QObject* parent) :
+    QObject(parent)
+  {
+    _surface = new TextureAudioSurface(this);
+  }
+
+
+  LiveAudioInput::~LiveAudioInput()
+  {
+  }
+
+
+  TextureAudioSurface* LiveAudioInput::surface() const
+  {
+    return _surface;
+  }
+
+
+  //
+  // LiveAudioInput protected methods
+  //
+
+  void LiveAudioInput::deliver(const QByteArray& data, const QAudioFormat& format)
+  {
+    if (data.isEmpty() || format.sampleRate() <= 0) {
+      return;
+    }
+    qint64 startTimeUS = _framesDelivered * 1000000 / format.sampleRate();
+    QAudioBuffer buffer(data, format, startTimeUS);
+    _framesDelivered += buffer.frameCount();
+    _surface->audioBufferReady(buffer);
+  }
+
+
+  //
+  // MicrophoneInput public methods
+  //
+
+  MicrophoneInput::MicrophoneInput(QObject* parent) :
+    LiveAudioInput(parent)
+  {
+    QAudioDeviceInfo device = QAudioDeviceInfo::defaultInputDevice();
+    _format = device.nearestFormat(pcmFormat(kDefaultPCMStreamRate, 1));
+    _audio = new QAudioInput(device, _format, this);
+
+    // Keep the device buffer small: the bigger it is, the longer it takes
+    // for a sound to show up in the texture.
+    _audio->setBufferSize(kLiveAudioChunkFrames * _format.bytesPerFrame() * 2);
+  }
+
+
+  MicrophoneInput::~MicrophoneInput()
+  {
+    stop();
+  }
+
+
+  bool MicrophoneInput::start()
+  {
+    if (_device != nullptr) {
+      return true;
+    }
+    _device = _audio->start();
+    if (_device == nullptr) {
+      qWarning("Unable to start capturing from the microphone (error %d)", int(_audio->error()));
+      return false;
+    }
+    connect(_device, &QIODevice::readyRead, this, &MicrophoneInput::dataReady);
+    return true;
+  }
+
+
+  void MicrophoneInput::stop()
+  {
+    if (_device == nullptr) {
+      return;
+    }
+    _audio->stop();
+    _device = nullptr;
+    surface()->audioFlushed();
+  }
+
+
+  //
+  // MicrophoneInput private slots
+  //
+
+  void MicrophoneInput::dataReady()
+  {
+    if (_device != nullptr) {
+      deliver(_device->readAll(), _format);
+    }
+  }
+
+
+  //
+  // PCMStreamInput public methods
+  //
+
+  PCMStreamInput::PCMStreamInput(const QString& source, QObject* parent) :
+    LiveAudioInput(parent)
+  {
+    int rate = kDefaultPCMStreamRate;
+    int channels = kDefaultPCMStreamChannels;
+
+    int queryStart = source.indexOf('?');
+    if (queryStart >= 0) {
+      _filename = source.left(queryStart);
+      QUrlQuery query(source.mid(queryStart + 1));
+      if (query.hasQueryItem("rate")) {
+        rate = query.queryItemValue("rate").toInt();
+      }
+      if (query.hasQueryItem("channels")) {
+        channels = query.queryItemValue("channels").toInt();
+      }
+    }
+    else {
+      _filename = source;
+    }
+
+    _format = pcmFormat(qMax(1, rate), qBound(1, channels, 8));
+  }
+
+
+  PCMStreamInput::~PCMStreamInput()
+  {
+    stop();
+  }
+
+
+  bool PCMStreamInput::start()
+  {
+    if (_thread != nullptr) {
+      return true;
+    }
+    _thread = new ReaderThread(this);
+    _thread->start();
+    return true;
+  }
+
+
+  void PCMStreamInput::stop()
+  {
+    if (_thread == nullptr) {
+      return;
+    }
+
+    // The reader checks for this at least every kReaderPollMS, so this
+    // won't wait for long. Never terminate it: it could be holding the
+    // audio surface's lock.
+    _thread->requestStop();
+    _thread->wait();
+    delete _thread;
+    _thread = nullptr;
+
+    surface()->audioFlushed();
+  }
+
+
+  //
+  // PCMStreamInput::ReaderThread methods
+  //
+
+  PCMStreamInput::ReaderThread::ReaderThread(PCMStreamInput* owner) :
+    QThread(owner),
+    _owner(owner)
+  {
+  }
+
+
+  void PCMStreamInput::ReaderThread::requestStop()
+  {
+    _quit = true;
+  }
+
+
+  void PCMStreamInput::ReaderThread::run()
+  {
+    int fd = openStream(_owner->_filename);
+    if (fd < 0) {
+      qWarning("Unable to open PCM stream %s: %s", qPrintable(_owner->_filename), strerror(errno));
+      return;
+    }
+
+    const int bytesPerFrame = _owner->_format.bytesPerFrame();
+    QByteArray chunk(kLiveAudioChunkFrames * bytesPerFrame, '\0');
+    QByteArray partial; // Bytes left over from a read which ended partway through a frame.
+
+    while (!_quit) {
+      StreamWait status = waitForStream(fd, kReaderPollMS);
+      if (status == StreamWait::eTimeout) {
+        continue;
+      }
+      else if (status == StreamWait::eClosed) {
+        break;
+      }
+
+      qint64 bytesRead = readStream(fd, chunk.data(), chunk.size());
+      if (bytesRead == -2) {
+        continue;
+      }
+      else if (bytesRead <= 0) {
+        break; // EOF, or the writer closed the pipe.
+      }
+
+      partial.append(chunk.constData(), int(bytesRead));
+      int wholeBytes = (partial.size() / bytesPerFrame) * bytesPerFrame;
+      if (wholeBytes > 0) {
+        _owner->deliver(partial.left(wholeBytes), _owner->_format);
+        partial.remove(0, wholeBytes);
+      }
+    }
+
+    closeStream(fd);
+    qDebug("PCM stream %s finished", qPrintable(_owner->_filename));
+  }
+
+} // namespace vh
@@ -0,0 +1,124 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_LIVEAUDIOINPUT_H
+#define VH_LIVEAUDIOINPUT_H
+
+#include "TextureAudioSurface.h"
+
+#include <QAudioFormat>
+#include <QAudioInput>
+#include <QIODevice>
+#include <QObject>
+#include <QString>
+#include <QThread>
+
+#include <atomic>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kLiveAudioChunkFrames = 256;  // How many frames we try to capture at a time. Smaller means lower latency.
+
+
+  //
+  // LiveAudioInput class
+  //
+
+  /// Base class for audio channels which capture audio as it happens, rather
+  /// than playing it back from a file. Captured samples are timestamped by
+  /// how many frames we've received so far and fed into a
+  /// `TextureAudioSurface`, so the channel texture always shows the most
+  /// recently captured window.
+  class LiveAudioInput : public QObject
+  {
+    Q_OBJECT
+  public:
+    explicit LiveAudioInput(QObject* parent = nullptr);
+    virtual ~LiveAudioInput();
+
+    TextureAudioSurface* surface() const;
+
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+
+  protected:
+    /// Wraps up raw PCM data in a QAudioBuffer and passes it on to the
+    /// surface. Safe to call from any thread, but only one at a time.
+    void deliver(const QByteArray& data, const QAudioFormat& format);
+
+  private:
+    TextureAudioSurface* _surface = nullptr;
+    qint64 _framesDelivered = 0;
+  };
+
+
+  //
+  // MicrophoneInput class
+  //
+
+  /// Captures from the system's default audio input device.
+  class MicrophoneInput : public LiveAudioInput
+  {
+    Q_OBJECT
+  public:
+    explicit MicrophoneInput(QObject* parent = nullptr);
+    virtual ~MicrophoneInput();
+
+    virtual bool start() override;
+    virtual void stop() override;
+
+  private slots:
+    void dataReady();
+
+  private:
+    QAudioFormat _format;
+    QAudioInput* _audio = nullptr;
+    QIODevice* _device  = nullptr;  // Owned by _audio.
+  };
+
+
+  //
+  // PCMStreamInput class
+  //
+
+  /// Reads raw, headerless PCM from a named pipe, a file, or stdin (if the
+  /// source is "-"). By default this expects signed 16-bit little-endian
+  /// stereo at 44.1 KHz; other rates and channel counts can be requested by
+  /// appending a query to the source, e.g. "/tmp/audio.fifo?rate=48000&channels=1".
+  ///
+  /// Reads happen on a separate thread. It never blocks for longer than a
+  /// short poll interval, so `stop()` can always wait for it to finish
+  /// rather than having to kill it.
+  class PCMStreamInput : public LiveAudioInput
+  {
+    Q_OBJECT
+  public:
+    explicit PCMStreamInput(const QString& source, QObject* parent = nullptr);
+    virtual ~PCMStreamInput();
+
+    virtual bool start() override;
+    virtual void stop() override;
+
+  private:
+    class ReaderThread : public QThread
+    {
+    public:
+      explicit ReaderThread(PCMStreamInput* owner);
+      void requestStop();
+    protected:
+      virtual void run() override;
+    private:
+      PCMStreamInput* _owner;
+      std::atomic<bool> _quit { false };
+    };
+
+    QString _filename;
+    QAudioFormat _format;
+    ReaderThread* _thread = nullptr;
+  };
+
+} // namespace vh
+
+#endif // VH_LIVEAUDIOINPUT_H
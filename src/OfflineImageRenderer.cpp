@@ -0,0 +1,608 @@
+// Copyright 2019 Vilya Harvey
+#include "OfflineImageRenderer.h"
+
+#include "FileCache.h"
+#include "ShaderTemplate.h"
+#include "SoundRenderer.h"
+#include "Timer.h"
+
+#include <QFile>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kConvergenceCheckSamples = 8;  // How often we read back the accumulators to see whether a tile has converged.
+
+
+  //
+  // Private helper functions
+  //
+
+  // The `index`th element of the van der Corput sequence in `base`, i.e. the
+  // digits of `index` mirrored around the decimal point.
+  static double radicalInverse(int index, int base)
+  {
+    double result = 0.0;
+    double scale = 1.0 / double(base);
+    while (index > 0) {
+      result += double(index % base) * scale;
+      index /= base;
+      scale /= double(base);
+    }
+    return result;
+  }
+
+
+  static QOpenGLTexture* createBlankTexture(int width, int height, QOpenGLTexture::TextureFormat format, QOpenGLTexture::PixelFormat sourceFormat, int bytesPerPixel)
+  {
+    QByteArray zeros(width * height * bytesPerPixel, '\0');
+
+    QOpenGLTexture* tex = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    tex->setSize(width, height);
+    tex->setFormat(format);
+    tex->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    tex->setWrapMode(QOpenGLTexture::ClampToEdge);
+    tex->setAutoMipMapGenerationEnabled(false);
+    tex->allocateStorage();
+
+    QOpenGLPixelTransferOptions transferOptions;
+    transferOptions.setAlignment(1);
+    tex->setData(sourceFormat, QOpenGLTexture::UInt8, zeros.constData(), &transferOptions);
+    return tex;
+  }
+
+
+  //
+  // OfflineImageRenderer public methods
+  //
+
+  OfflineImageRenderer::OfflineImageRenderer()
+  {
+  }
+
+
+  void OfflineImageRenderer::setFileCache(FileCache* cache)
+  {
+    _cache = cache;
+  }
+
+
+  void OfflineImageRenderer::setSize(int width, int height)
+  {
+    _width = width;
+    _height = height;
+  }
+
+
+  void OfflineImageRenderer::setTileSize(int tileSize)
+  {
+    _tileSize = tileSize;
+  }
+
+
+  void OfflineImageRenderer::setTimeSecs(double secs)
+  {
+    _timeSecs = secs;
+  }
+
+
+  void OfflineImageRenderer::setSamples(int samples)
+  {
+    _samples = samples;
+  }
+
+
+  void OfflineImageRenderer::setNoiseThreshold(double threshold)
+  {
+    _noiseThreshold = threshold;
+  }
+
+
+  void OfflineImageRenderer::setTimeBudgetSecs(double secs)
+  {
+    _timeBudgetSecs = secs;
+  }
+
+
+  bool OfflineImageRenderer::render(const ShaderToyDocument* doc, const QString& ppmFilename)
+  {
+    _stats = OfflineImageStats();
+
+    if (_width <= 0 || _height <= 0) {
+      qCritical("Invalid image size %dx%d", _width, _height);
+      return false;
+    }
+
+    int imageIdx = doc->findRenderPassByType(kRenderPassType_Image);
+    if (imageIdx == -1) {
+      qCritical("%s has no image pass", qPrintable(doc->src));
+      return false;
+    }
+    for (const ShaderToyRenderPass& pass : doc->renderpasses) {
+      if (pass.type == kRenderPassType_Buffer || pass.type == kRenderPassType_CubeMap) {
+        qCritical("%s has a %s pass, so it can't be rendered in tiles", qPrintable(doc->src), qPrintable(pass.type));
+        return false;
+      }
+    }
+    const ShaderToyRenderPass& imagePass = doc->renderpasses[imageIdx];
+    for (const ShaderToyInput& input : imagePass.inputs) {
+      if (input.ctype != kInputType_Texture && input.ctype != kInputType_Keyboard) {
+        qCritical("Channel %d of the image pass in %s is a %s input, so it can't be rendered in tiles",
+                  input.channel, qPrintable(doc->src), qPrintable(input.ctype));
+        return false;
+      }
+    }
+    int commonIdx = doc->findRenderPassByType(kRenderPassType_Common);
+    QString commonCode = (commonIdx != -1) ? doc->renderpasses[commonIdx].code : QString();
+    QDir commonDir = includeDirForPass(doc->refDir, (commonIdx != -1) ? doc->renderpasses[commonIdx].filename : QString());
+
+    QOffscreenSurface surface;
+    surface.setFormat(QSurfaceFormat::defaultFormat());
+    surface.create();
+
+    QOpenGLContext context;
+    context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!context.create() || !context.makeCurrent(&surface)) {
+      qCritical("Unable to create an OpenGL context for offline image rendering");
+      return false;
+    }
+    initializeOpenGLFunctions();
+
+    // Each tile has to fit in a texture and a viewport.
+    GLint maxTextureSize = 0;
+    GLint maxViewportDims[2] = { 0, 0 };
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewportDims);
+    int tileSize = qBound(1, _tileSize, qMin(maxTextureSize, qMin(maxViewportDims[0], maxViewportDims[1])));
+    if (tileSize != _tileSize) {
+      qWarning("Using %d pixel tiles, the largest this GPU supports", tileSize);
+    }
+    const int tileWidth  = qMin(tileSize, _width);
+    const int tileHeight = qMin(tileSize, _height);
+
+    // The file is sized up front and each tile's rows are written straight
+    // to where they belong, so we never hold more than one tile in memory.
+    QFile file(ppmFilename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qCritical("Unable to open %s for writing", qPrintable(ppmFilename));
+      context.doneCurrent();
+      return false;
+    }
+    const QByteArray header = QString("P6\n%1 %2\n255\n").arg(_width).arg(_height).toLatin1();
+    const qint64 rowBytes = qint64(_width) * 3;
+    if (file.write(header) != header.size() || !file.resize(header.size() + rowBytes * _height)) {
+      qCritical("Failed writing to %s: %s", qPrintable(ppmFilename), qPrintable(file.errorString()));
+      file.close();
+      file.remove();
+      context.doneCurrent();
+      return false;
+    }
+
+    Timer timer(true);
+
+    if (!setup(commonDir, commonCode, includeDirForPass(doc->refDir, imagePass.filename), imagePass)) {
+      teardown();
+      file.close();
+      file.remove();
+      context.doneCurrent();
+      return false;
+    }
+
+    // The accumulators are float, so that summing many samples doesn't lose
+    // precision and values outside [0, 1] average out properly.
+    glGenTextures(2, _accumTextures);
+    glGenFramebuffers(2, _accumFBOs);
+    for (int i = 0; i < 2; i++) {
+      glBindTexture(GL_TEXTURE_2D, _accumTextures[i]);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, tileWidth, tileHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glBindTexture(GL_TEXTURE_2D, 0);
+
+      glBindFramebuffer(GL_FRAMEBUFFER, _accumFBOs[i]);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _accumTextures[i], 0);
+      glDrawBuffer(GL_COLOR_ATTACHMENT0);
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+      GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+      if (status != GL_FRAMEBUFFER_COMPLETE) {
+        qCritical("Image tile framebuffer is incomplete (status 0x%x)", status);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        teardown();
+        file.close();
+        file.remove();
+        context.doneCurrent();
+        return false;
+      }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    QByteArray pixels(tileWidth * tileHeight * 3, '\0');
+    const int tilesX = (_width  + tileWidth  - 1) / tileWidth;
+    const int tilesY = (_height + tileHeight - 1) / tileHeight;
+    const double tileBudgetSecs = _timeBudgetSecs / double(tilesX * tilesY);
+    bool ok = true;
+
+    // Work down from the top of the image, so the file fills in order.
+    for (int ty = tilesY - 1; ty >= 0 && ok; ty--) {
+      const int y = ty * tileHeight;
+      const int h = qMin(tileHeight, _height - y);
+      for (int tx = 0; tx < tilesX && ok; tx++) {
+        const int x = tx * tileWidth;
+        const int w = qMin(tileWidth, _width - x);
+
+        double noise = 0.0;
+        int samples = renderTile(x, y, w, h, tileBudgetSecs, noise);
+        resolveTile(w, h, samples, pixels);
+        _stats.numSamples += qint64(samples) * w * h;
+        _stats.maxNoise = qMax(_stats.maxNoise, noise);
+
+        // GL rows go bottom up, PPM rows go top down.
+        for (int row = 0; row < h; row++) {
+          const qint64 fileRow = _height - 1 - (y + row);
+          const qint64 writeBytes = qint64(w) * 3;
+          if (!file.seek(header.size() + fileRow * rowBytes + qint64(x) * 3) ||
+              file.write(pixels.constData() + row * writeBytes, writeBytes) != writeBytes) {
+            qCritical("Failed writing to %s: %s", qPrintable(ppmFilename), qPrintable(file.errorString()));
+            ok = false;
+            break;
+          }
+        }
+        _stats.numTiles++;
+      }
+      qInfo("Rendered %d of %d rows of tiles", tilesY - ty, tilesY);
+    }
+
+    teardown();
+    context.doneCurrent();
+
+    file.close();
+    if (!ok) {
+      file.remove();
+    }
+
+    _stats.width = _width;
+    _stats.height = _height;
+    _stats.renderSecs = timer.elapsedSecs();
+
+    return ok;
+  }
+
+
+  const OfflineImageStats& OfflineImageRenderer::stats() const
+  {
+    return _stats;
+  }
+
+
+  //
+  // OfflineImageRenderer private methods
+  //
+
+  bool OfflineImageRenderer::setup(const QDir& commonDir, const QString& commonCode, const QDir& passDir, const ShaderToyRenderPass& pass)
+  {
+    glGenSamplers(kMaxInputs, _samplers);
+    for (const ShaderToyInput& input : pass.inputs) {
+      if (input.channel < 0 || input.channel >= kMaxInputs) {
+        continue;
+      }
+      if (!setupInput(input)) {
+        return false;
+      }
+    }
+    for (int i = 0; i < kMaxInputs; i++) {
+      if (_inputs[i] == nullptr) {
+        _inputs[i] = createBlankTexture(1, 1, QOpenGLTexture::RGBA8_UNorm, QOpenGLTexture::RGBA, 4);
+      }
+    }
+
+    QMap<QString, QString> macros;
+#ifdef SHADERTOOL_USE_GL41
+    macros["GLSL_VERSION"]   =  "#version 410 core";
+#else
+    macros["GLSL_VERSION"]   =  "#version 450 core";
+#endif // SHADERTOOL_USE_GL41
+    macros["SHADER_TYPE"] = QString("#define SHADER_TYPE %1").arg(int(PassType::eImage));
+    macros["SAMPLER_0_TYPE"] = "#define SAMPLER_0_TYPE sampler2D";
+    macros["SAMPLER_1_TYPE"] = "#define SAMPLER_1_TYPE sampler2D";
+    macros["SAMPLER_2_TYPE"] = "#define SAMPLER_2_TYPE sampler2D";
+    macros["SAMPLER_3_TYPE"] = "#define SAMPLER_3_TYPE sampler2D";
+    ShaderIncludes includes;
+    includes.refDir = commonDir;
+    macros["COMMON_CODE"] = expandIncludes(commonCode, kSourceString_Common, includes);
+    includes.refDir = passDir;
+    macros["USER_CODE"] = expandIncludes(pass.code, kSourceString_User, includes);
+
+    QString vertShaderSource = preprocessShaderSource(":/glsl/fullscreen.vert", macros);
+    QString fragShaderSource = preprocessShaderSource(":/glsl/template.frag",   macros);
+
+    _program = new QOpenGLShaderProgram();
+    _program->addShaderFromSourceCode(QOpenGLShader::Vertex,   vertShaderSource);
+    _program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragShaderSource);
+    if (!_program->link()) {
+      qCritical("Failed to compile image pass: %s", qPrintable(_program->log()));
+      return false;
+    }
+
+    // Nothing but the tile offset changes from one tile to the next, so all
+    // the other uniforms can be set once up front.
+    float iChannelResolution[kMaxInputs][3];
+    float iChannelTime[kMaxInputs];
+    for (int i = 0; i < kMaxInputs; i++) {
+      iChannelResolution[i][0] = float(_inputs[i]->width());
+      iChannelResolution[i][1] = float(_inputs[i]->height());
+      iChannelResolution[i][2] = float(_inputs[i]->depth());
+      iChannelTime[i] = 0.0f;
+    }
+
+    _program->bind();
+    _program->setUniformValue("iResolution", float(_width), float(_height), 1.0f);
+    _program->setUniformValue("iTime", float(_timeSecs));
+    _program->setUniformValue("iTimeDelta", 0.0f);
+    _program->setUniformValue("iFrame", 0);
+    _program->setUniformValue("iMouse", 0.0f, 0.0f, -1.0f, -1.0f);
+    _program->setUniformValue("iSampleRate", float(kSoundSampleRate));
+    _program->setUniformValueArray("iChannelResolution", reinterpret_cast<const GLfloat*>(iChannelResolution), kMaxInputs, 3);
+    _program->setUniformValueArray("iChannelTime", iChannelTime, kMaxInputs, 1);
+    _program->setUniformValue("iChannel0", 0);
+    _program->setUniformValue("iChannel1", 1);
+    _program->setUniformValue("iChannel2", 2);
+    _program->setUniformValue("iChannel3", 3);
+    _program->release();
+
+    _iFragCoordOffsetLoc = _program->uniformLocation("Shadertron_iFragCoordOffset");
+
+    glGenVertexArrays(1, &_vao);
+    return true;
+  }
+
+
+  void OfflineImageRenderer::teardown()
+  {
+    if (_vao != 0) {
+      glDeleteVertexArrays(1, &_vao);
+      _vao = 0;
+    }
+    if (_accumFBOs[0] != 0) {
+      glDeleteFramebuffers(2, _accumFBOs);
+      _accumFBOs[0] = _accumFBOs[1] = 0;
+    }
+    if (_accumTextures[0] != 0) {
+      glDeleteTextures(2, _accumTextures);
+      _accumTextures[0] = _accumTextures[1] = 0;
+    }
+    _accumPixels[0].clear();
+    _accumPixels[1].clear();
+    delete _program;
+    _program = nullptr;
+    for (int i = 0; i < kMaxInputs; i++) {
+      delete _inputs[i];
+      _inputs[i] = nullptr;
+    }
+    if (_samplers[0] != 0) {
+      glDeleteSamplers(kMaxInputs, _samplers);
+      for (int i = 0; i < kMaxInputs; i++) {
+        _samplers[i] = 0;
+      }
+    }
+    _iFragCoordOffsetLoc = -1;
+  }
+
+
+  bool OfflineImageRenderer::setupInput(const ShaderToyInput& input)
+  {
+    GLuint sampler = _samplers[input.channel];
+
+    if (input.ctype == kInputType_Keyboard) {
+      // No keys are ever down in an offline render.
+      _inputs[input.channel] = createBlankTexture(256, 3, QOpenGLTexture::R8_UNorm, QOpenGLTexture::Red, 1);
+      glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      return true;
+    }
+
+    GLenum minFilter = GL_NEAREST;
+    GLenum magFilter = GL_NEAREST;
+    if (input.sampler.filter == kSamplerFilterType_Mipmap) {
+      minFilter = GL_LINEAR_MIPMAP_LINEAR;
+      magFilter = GL_LINEAR;
+    }
+    else if (input.sampler.filter == kSamplerFilterType_Linear) {
+      minFilter = GL_LINEAR;
+      magFilter = GL_LINEAR;
+    }
+    glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, minFilter);
+    glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, magFilter);
+
+    GLenum wrap = GL_REPEAT;
+    if (input.sampler.wrap == kSamplerWrapType_Clamp) {
+      wrap = GL_CLAMP_TO_EDGE;
+    }
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, wrap);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, wrap);
+
+    QImage img = (_cache != nullptr) ? _cache->loadImage(input.src) : QImage(input.src);
+    if (img.isNull()) {
+      qWarning("Failed to load texture %s for channel %d, using a blank texture instead", qPrintable(input.src), input.channel);
+      return true;
+    }
+    img = img.convertToFormat(QImage::Format_RGBA8888);
+    if (input.sampler.vflip == "true") {
+      img = img.mirrored();
+    }
+
+    QOpenGLTexture::TextureFormat targetFormat = (input.sampler.srgb == "true") ? QOpenGLTexture::SRGB8_Alpha8 : QOpenGLTexture::RGBA8_UNorm;
+
+    QOpenGLTexture* tex = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    tex->setSize(img.width(), img.height());
+    tex->setFormat(targetFormat);
+    tex->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+    tex->setWrapMode(QOpenGLTexture::ClampToEdge);
+    tex->allocateStorage();
+
+    QOpenGLPixelTransferOptions transferOptions;
+    transferOptions.setAlignment(4);
+    tex->setData(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, img.constBits(), &transferOptions);
+    tex->generateMipMaps();
+
+    _inputs[input.channel] = tex;
+    return true;
+  }
+
+
+  // Draws samples into the accumulators until we've done as many as we were
+  // asked for, the noise estimate drops below the threshold or the tile's
+  // time budget runs out. Returns the number of samples drawn and sets
+  // `noise` to the final noise estimate. The accumulators are left read back
+  // into `_accumPixels`.
+  int OfflineImageRenderer::renderTile(int x, int y, int w, int h, double budgetSecs, double& noise)
+  {
+    const int maxSamples = qMax(1, _samples);
+
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int i = 0; i < 2; i++) {
+      glBindFramebuffer(GL_FRAMEBUFFER, _accumFBOs[i]);
+      glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    Timer timer(true);
+    noise = 0.0;
+    int samples = 0;
+    while (samples < maxSamples) {
+      // A single sample goes through the pixel centre, as when rendering
+      // interactively. Otherwise the jitter follows a Halton sequence, which
+      // covers the pixel evenly however many samples we end up taking.
+      float jitterX = 0.0f;
+      float jitterY = 0.0f;
+      if (maxSamples > 1) {
+        jitterX = float(radicalInverse(samples + 1, 2)) - 0.5f;
+        jitterY = float(radicalInverse(samples + 1, 3)) - 0.5f;
+      }
+      drawSample(float(x) + jitterX, float(y) + jitterY, w, h, _accumFBOs[samples % 2]);
+      ++samples;
+
+      if (samples == maxSamples) {
+        break;
+      }
+      if (_noiseThreshold > 0.0 && samples % kConvergenceCheckSamples == 0) {
+        readAccumulators(w, h);
+        noise = estimateNoise(w, h, samples);
+        if (noise <= _noiseThreshold) {
+          break;
+        }
+      }
+      if (budgetSecs > 0.0) {
+        glFinish();
+        if (timer.elapsedSecs() >= budgetSecs) {
+          break;
+        }
+      }
+    }
+
+    readAccumulators(w, h);
+    noise = (samples >= 2) ? estimateNoise(w, h, samples) : 0.0;
+    return samples;
+  }
+
+
+  void OfflineImageRenderer::drawSample(float offsetX, float offsetY, int w, int h, GLuint fbo)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glViewport(0, 0, w, h);
+
+    _program->bind();
+    glUniform2f(_iFragCoordOffsetLoc, offsetX, offsetY);
+
+    for (int i = 0; i < kMaxInputs; i++) {
+      glActiveTexture(GLenum(GL_TEXTURE0 + i));
+      glBindTexture(GL_TEXTURE_2D, _inputs[i]->textureId());
+      glBindSampler(GLuint(i), _samplers[i]);
+    }
+
+    glBindVertexArray(_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    for (int i = 0; i < kMaxInputs; i++) {
+      glActiveTexture(GLenum(GL_TEXTURE0 + i));
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glBindSampler(GLuint(i), 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    _program->release();
+    glDisable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+
+  void OfflineImageRenderer::readAccumulators(int w, int h)
+  {
+    for (int i = 0; i < 2; i++) {
+      _accumPixels[i].resize(w * h * 4);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, _accumFBOs[i]);
+      glReadPixels(0, 0, w, h, GL_RGBA, GL_FLOAT, _accumPixels[i].data());
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  }
+
+
+  // The averages of the even and odd numbered samples are independent
+  // estimates of the same value, so the difference between them tells us
+  // roughly how far the overall average is from converging: with n samples
+  // the halves each have about twice the variance of the whole, so half the
+  // absolute difference is about the error of the result. We return the
+  // worst pixel rather than the mean over the tile, because aliasing only
+  // happens along edges: a few hundred unconverged pixels would vanish in
+  // the average of a million flat ones and the tile would stop after the
+  // first check. Colours are clamped first, since that's what ends up in
+  // the file.
+  double OfflineImageRenderer::estimateNoise(int w, int h, int samples) const
+  {
+    const float invEven = 1.0f / float((samples + 1) / 2);
+    const float invOdd  = 1.0f / float(samples / 2);
+    const float* even = _accumPixels[0].constData();
+    const float* odd  = _accumPixels[1].constData();
+
+    float worst = 0.0f;
+    const int numPixels = w * h;
+    for (int i = 0; i < numPixels; i++) {
+      for (int c = 0; c < 3; c++) {
+        float a = qBound(0.0f, even[i * 4 + c] * invEven, 1.0f);
+        float b = qBound(0.0f, odd[i * 4 + c] * invOdd, 1.0f);
+        worst = qMax(worst, qAbs(a - b));
+      }
+    }
+    return 0.5 * double(worst);
+  }
+
+
+  // Averages the accumulators into 8 bit RGB, bottom row first.
+  void OfflineImageRenderer::resolveTile(int w, int h, int samples, QByteArray& pixels) const
+  {
+    const float invSamples = 1.0f / float(samples);
+    const float* even = _accumPixels[0].constData();
+    const float* odd  = _accumPixels[1].constData();
+    uchar* out = reinterpret_cast<uchar*>(pixels.data());
+
+    const int numPixels = w * h;
+    for (int i = 0; i < numPixels; i++) {
+      for (int c = 0; c < 3; c++) {
+        float value = (even[i * 4 + c] + odd[i * 4 + c]) * invSamples;
+        out[i * 3 + c] = uchar(qBound(0.0f, value, 1.0f) * 255.0f + 0.5f);
+      }
+    }
+  }
+
+} // namespace vh
@@ -0,0 +1,134 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_OFFLINEIMAGERENDERER_H
+#define VH_OFFLINEIMAGERENDERER_H
+
+#include "RenderData.h"
+#include "ShaderToy.h"
+
+#include <QImage>
+#include <QString>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // Forward declarations
+  //
+
+  class FileCache;
+
+
+  //
+  // Constants
+  //
+
+  static constexpr int kDefaultOfflineImageWidth    = 3840;
+  static constexpr int kDefaultOfflineImageHeight   = 2160;
+  static constexpr int kDefaultOfflineImageTileSize = 1024;  // Small enough that a heavy raymarcher finishes a tile well inside the driver's watchdog timeout.
+  static constexpr double kDefaultOfflineImageTimeSecs = 0.0;
+  static constexpr int kDefaultOfflineImageSamples     = 1;
+  static constexpr double kDefaultOfflineImageNoiseThreshold = 0.5 / 255.0;  // Half a step in the 8 bit output.
+  static constexpr double kDefaultOfflineImageTimeBudgetSecs = 0.0;          // No limit.
+
+
+  //
+  // Structs
+  //
+
+  struct OfflineImageStats {
+    int width         = 0;
+    int height        = 0;
+    int numTiles      = 0;
+    qint64 numSamples = 0;    // Summed over every pixel.
+    double maxNoise   = 0.0;  // Highest estimated noise of any pixel, or 0 if no tile had enough samples to tell.
+    double renderSecs = 0.0;  // Wall clock time taken, including readback & writing the file.
+
+    double megapixelsPerSec() const { return (renderSecs > 0.0) ? (double(width) * double(height) / 1e6) / renderSecs : 0.0; }
+    double samplesPerPixel() const { return (width > 0 && height > 0) ? double(numSamples) / (double(width) * double(height)) : 0.0; }
+  };
+
+
+  //
+  // OfflineImageRenderer class
+  //
+
+  /// Renders a single frame of a document's Image pass at any resolution,
+  /// writing it to a binary PPM file. Uses its own offscreen OpenGL context,
+  /// so it doesn't need a window.
+  ///
+  /// The frame is split into tiles which are each drawn, read back and
+  /// written straight to their place in the file, so the output can be far
+  /// bigger than the maximum texture or viewport size, each draw call stays
+  /// short enough not to trip the driver's watchdog, and memory use is
+  /// bounded by the tile size rather than the image size. Every tile sees
+  /// the full image size in `iResolution` and gets its `fragCoord` offset
+  /// to its position in the full image, so the shader can't tell the
+  /// difference.
+  ///
+  /// With more than one sample per pixel, each tile is drawn repeatedly with
+  /// a different sub-pixel jitter added to `fragCoord` and the results are
+  /// averaged, which anti-aliases the image without changing the shader.
+  /// Alternate samples are summed into two separate float accumulators; the
+  /// difference between their averages gives an estimate of the noise left
+  /// in each pixel, so a tile stops early once the noisiest pixel in it falls
+  /// below the noise threshold. A time budget, shared out evenly between the
+  /// tiles, also stops a tile early.
+  ///
+  /// Only documents whose Image pass reads nothing but textures (and the
+  /// keyboard, which is always blank) can be tiled: a buffer, cubemap or
+  /// media input could be sampled anywhere, so every tile would need the
+  /// whole of it at full resolution anyway.
+  class OfflineImageRenderer : protected GLFunctions
+  {
+  public:
+    OfflineImageRenderer();
+
+    void setFileCache(FileCache* cache);
+    void setSize(int width, int height);
+    void setTileSize(int tileSize);
+    void setTimeSecs(double secs);
+    void setSamples(int samples);
+    void setNoiseThreshold(double threshold);
+    void setTimeBudgetSecs(double secs);
+
+    bool render(const ShaderToyDocument* doc, const QString& ppmFilename);
+
+    const OfflineImageStats& stats() const;
+
+  private:
+    bool setup(const QDir& commonDir, const QString& commonCode, const QDir& passDir, const ShaderToyRenderPass& pass);
+    void teardown();
+
+    bool setupInput(const ShaderToyInput& input);
+
+    int renderTile(int x, int y, int w, int h, double budgetSecs, double& noise);
+    void drawSample(float offsetX, float offsetY, int w, int h, GLuint fbo);
+    void readAccumulators(int w, int h);
+    double estimateNoise(int w, int h, int samples) const;
+    void resolveTile(int w, int h, int samples, QByteArray& pixels) const;
+
+  private:
+    FileCache* _cache = nullptr;
+    int _width        = kDefaultOfflineImageWidth;
+    int _height       = kDefaultOfflineImageHeight;
+    int _tileSize     = kDefaultOfflineImageTileSize;
+    double _timeSecs  = kDefaultOfflineImageTimeSecs;
+    int _samples      = kDefaultOfflineImageSamples;
+    double _noiseThreshold = kDefaultOfflineImageNoiseThreshold;
+    double _timeBudgetSecs = kDefaultOfflineImageTimeBudgetSecs;
+    OfflineImageStats _stats;
+
+    QOpenGLShaderProgram* _program        = nullptr;
+    QOpenGLTexture* _inputs[kMaxInputs]   = {};
+    GLuint _samplers[kMaxInputs]          = {};
+    GLuint _accumTextures[2] = {};        // Even numbered samples go in the first, odd in the second.
+    GLuint _accumFBOs[2]     = {};
+    GLuint _vao              = 0;
+    QVector<float> _accumPixels[2];       // The accumulators for the current tile, read back as RGBA.
+
+    int _iFragCoordOffsetLoc = -1;
+  };
+
+} // namespace vh
+
+#endif // VH_OFFLINEIMAGERENDERER_H
@@ -0,0 +1,214 @@
+// Copyright 2019 Vilya Harvey
+#include "OfflineSoundRenderer.h"
+
+#include "ShaderTemplate.h"
+#include "SoundRenderer.h"
+#include "Timer.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QtEndian>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kWAVHeaderBytes = 44;
+  static constexpr int kWAVChannels    = 2;
+  static constexpr int kWAVBitsPerSample = 16;
+  static constexpr qint64 kWAVMaxDataBytes = qint64(0xFFFFFFFFu) - (kWAVHeaderBytes - 8); // So the RIFF chunk size still fits in a quint32.
+
+
+  //
+  // Private helper functions
+  //
+
+  // Writes a canonical 44 byte PCM WAV header. Call it once with
+  // `numFrames` = 0 before writing the data, then seek back to the start and
+  // call it again with the real count once we know it.
+  static void writeWAVHeader(QFile& file, int sampleRate, qint64 numFrames)
+  {
+    const quint32 blockAlign = kWAVChannels * kWAVBitsPerSample / 8;
+    const quint32 dataBytes  = quint32(numFrames * blockAlign);
+
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.writeRawData("RIFF", 4);
+    out << quint32(kWAVHeaderBytes - 8 + dataBytes);
+    out.writeRawData("WAVE", 4);
+    out.writeRawData("fmt ", 4);
+    out << quint32(16);                       // Size of the fmt chunk.
+    out << quint16(1);                        // PCM
+    out << quint16(kWAVChannels);
+    out << quint32(sampleRate);
+    out << quint32(quint32(sampleRate) * blockAlign);
+    out << quint16(blockAlign);
+    out << quint16(kWAVBitsPerSample);
+    out.writeRawData("data", 4);
+    out << quint32(dataBytes);
+  }
+
+
+  static void convertToInt16(const float* src, int numValues, QByteArray& dst)
+  {
+    dst.resize(numValues * int(sizeof(qint16)));
+    qint16* out = reinterpret_cast<qint16*>(dst.data());
+    for (int i = 0; i < numValues; i++) {
+      out[i] = qToLittleEndian(qint16(qBound(-1.0f, src[i], 1.0f) * 32767.0f));
+    }
+  }
+
+
+  //
+  // OfflineSoundRenderer public methods
+  //
+
+  OfflineSoundRenderer::OfflineSoundRenderer()
+  {
+  }
+
+
+  double OfflineSoundRenderer::maxDurationSecs()
+  {
+    const qint64 maxFrames = kWAVMaxDataBytes / (kWAVChannels * kWAVBitsPerSample / 8);
+    return double(maxFrames) / double(kSoundSampleRate);
+  }
+
+
+  void OfflineSoundRenderer::setDurationSecs(double secs)
+  {
+    _durationSecs = secs;
+  }
+
+
+  void OfflineSoundRenderer::setBlockSamples(int samples)
+  {
+    _blockSamples = samples;
+  }
+
+
+  bool OfflineSoundRenderer::render(const ShaderToyDocument* doc, const QString& wavFilename)
+  {
+    _stats = OfflineSoundStats();
+
+    if (!(_durationSecs > 0.0 && _durationSecs <= maxDurationSecs())) {
+      qCritical("Can't render %g secs of sound, the duration must be more than 0 and at most %.0f secs", _durationSecs, maxDurationSecs());
+      return false;
+    }
+
+    int soundIdx = doc->findRenderPassByType(kRenderPassType_Sound);
+    if (soundIdx == -1) {
+      qCritical("%s has no sound pass", qPrintable(doc->src));
+      return false;
+    }
+    int commonIdx = doc->findRenderPassByType(kRenderPassType_Common);
+    QString commonCode = (commonIdx != -1) ? doc->renderpasses[commonIdx].code : QString();
+    QDir commonDir = includeDirForPass(doc->refDir, (commonIdx != -1) ? doc->renderpasses[commonIdx].filename : QString());
+    QDir soundDir  = includeDirForPass(doc->refDir, doc->renderpasses[soundIdx].filename);
+
+    QOffscreenSurface surface;
+    surface.setFormat(QSurfaceFormat::defaultFormat());
+    surface.create();
+
+    QOpenGLContext context;
+    context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!context.create() || !context.makeCurrent(&surface)) {
+      qCritical("Unable to create an OpenGL context for offline sound rendering");
+      return false;
+    }
+
+    QFile file(wavFilename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qCritical("Unable to open %s for writing", qPrintable(wavFilename));
+      context.doneCurrent();
+      return false;
+    }
+
+    Timer timer(true);
+
+    SoundRenderer renderer;
+    int blockSamples = qMax(kSoundBlockWidth, (_blockSamples / kSoundBlockWidth) * kSoundBlockWidth);
+    if (!renderer.setup(commonDir, commonCode, soundDir, doc->renderpasses[soundIdx].code, blockSamples, kSoundSampleRate)) {
+      file.close();
+      file.remove();
+      context.doneCurrent();
+      return false;
+    }
+    blockSamples = renderer.samplesPerBlock();
+
+    const qint64 totalSamples = qint64(_durationSecs * double(kSoundSampleRate));
+
+    writeWAVHeader(file, kSoundSampleRate, 0);
+
+    // Keep the GPU busy: fill the readback queue, then each time we collect
+    // the oldest block, queue up another one in its place. Writing the file
+    // overlaps with the GPU working on later blocks.
+    QVector<float> samples;
+    QByteArray pcm;
+    qint64 nextSample = 0;
+    qint64 samplesWritten = 0;
+    bool ok = true;
+
+    while (nextSample < totalSamples && renderer.queueBlock(nextSample)) {
+      nextSample += blockSamples;
+    }
+
+    qint64 firstSample = 0;
+    while (samplesWritten < totalSamples) {
+      // Slow sound shaders can take longer than collectBlock is prepared to
+      // wait, so keep waiting for as long as the block is still queued. It's
+      // only an error if the renderer gave up on it.
+      if (!renderer.collectBlock(firstSample, samples, true)) {
+        if (renderer.blocksInFlight() == 0) {
+          qCritical("Rendering the sound pass failed at sample %lld", samplesWritten);
+          ok = false;
+          break;
+        }
+        continue;
+      }
+
+      if (nextSample < totalSamples && renderer.queueBlock(nextSample)) {
+        nextSample += blockSamples;
+      }
+
+      int numFrames = int(qMin(qint64(blockSamples), totalSamples - firstSample));
+      convertToInt16(samples.constData(), numFrames * kWAVChannels, pcm);
+      if (file.write(pcm) != pcm.size()) {
+        qCritical("Failed writing to %s: %s", qPrintable(wavFilename), qPrintable(file.errorString()));
+        ok = false;
+        break;
+      }
+      samplesWritten += numFrames;
+    }
+
+    renderer.teardown();
+    context.doneCurrent();
+
+    _stats.numSamples = samplesWritten;
+    _stats.renderSecs = timer.elapsedSecs();
+
+    // Don't leave a short file behind which looks like a complete render.
+    if (!ok) {
+      file.close();
+      file.remove();
+      return false;
+    }
+
+    file.seek(0);
+    writeWAVHeader(file, kSoundSampleRate, samplesWritten);
+    file.close();
+    return true;
+  }
+
+
+  const OfflineSoundStats& OfflineSoundRenderer::stats() const
+  {
+    return _stats;
+  }
+
+} // namespace vh
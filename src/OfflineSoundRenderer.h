@@ -0,0 +1,62 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_OFFLINESOUNDRENDERER_H
+#define VH_OFFLINESOUNDRENDERER_H
+
+#include "ShaderToy.h"
+
+#include <QString>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr double kDefaultOfflineSoundDurationSecs = 180.0;  // ShaderToy's sound passes generate 3 minutes of audio.
+  static constexpr int kDefaultOfflineSoundBlockSamples    = 512 * 512;
+
+
+  //
+  // Structs
+  //
+
+  struct OfflineSoundStats {
+    qint64 numSamples  = 0;
+    double renderSecs  = 0.0;  // Wall clock time taken, including readback & writing the file.
+
+    double samplesPerSec() const { return (renderSecs > 0.0) ? double(numSamples) / renderSecs : 0.0; }
+  };
+
+
+  //
+  // OfflineSoundRenderer class
+  //
+
+  /// Bakes a document's sound pass to a 16-bit stereo WAV file as quickly as
+  /// the GPU can generate it, with no realtime playback. Uses its own
+  /// offscreen OpenGL context, so it doesn't need a window.
+  class OfflineSoundRenderer
+  {
+  public:
+    OfflineSoundRenderer();
+
+    /// The longest duration which fits in a WAV file, whose chunk sizes are
+    /// 32 bit. `render` fails for anything longer.
+    static double maxDurationSecs();
+
+    void setDurationSecs(double secs);
+    void setBlockSamples(int samples);
+
+    bool render(const ShaderToyDocument* doc, const QString& wavFilename);
+
+    const OfflineSoundStats& stats() const;
+
+  private:
+    double _durationSecs = kDefaultOfflineSoundDurationSecs;
+    int _blockSamples    = kDefaultOfflineSoundBlockSamples;
+    OfflineSoundStats _stats;
+  };
+
+} // namespace vh
+
+#endif // VH_OFFLINESOUNDRENDERER_H
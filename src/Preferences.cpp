@@ -24,6 +24,16 @@ namespace vh {
 
   static const QString kHUDFlags                  = "hudFlags";
 
+  static const QString kSoundBlockSamples         = "soundBlockSamples";
+  static const QString kSoundLookAheadBlocks      = "soundLookAheadBlocks";
+
+  static const QString kCacheMaxMB                = "cacheMaxMB";
+  static const QString kTexturePoolMaxMB          = "texturePoolMaxMB";
+  static const QString kPacingMode                = "pacingMode";
+  static const QString kFixedRateFPS              = "fixedRateFPS";
+  static const QString kLegacyMaxFPS              = "maxFPS";           // An FPS cap, stored by builds from before there were pacing modes. Absent meant uncapped.
+  static const QString kShaderToyURL              = "shaderToyURL";
+
 
   //
   // Preferences public methods
@@ -31,6 +41,17 @@ namespace vh {
 
   Preferences::Preferences()
   {
+    // The old FPS cap is what the fixed rate mode does now, so a cap carries
+    // over as that. It's stored under a new key because the old one meant
+    // "uncapped" when it was missing, whereas the fixed rate has a default.
+    if (_settings.contains(kLegacyMaxFPS)) {
+      int fps = _settings.value(kLegacyMaxFPS).toInt();
+      _settings.remove(kLegacyMaxFPS);
+      if (fps > 0 && !_settings.contains(kPacingMode)) {
+        setPacingMode(PacingMode::eFixedRate);
+        setMaxFPS(fps);
+      }
+    }
   }
 
 
@@ -125,6 +146,58 @@ namespace vh {
   }
 
 
+  int Preferences::soundBlockSamples() const
+  {
+    return _settings.value(kSoundBlockSamples, kDefaultSoundBlockSamples).toInt();
+  }
+
+
+  int Preferences::soundLookAheadBlocks() const
+  {
+    return _settings.value(kSoundLookAheadBlocks, kDefaultSoundLookAheadBlocks).toInt();
+  }
+
+
+  int Preferences::cacheMaxMB() const
+  {
+    return _settings.value(kCacheMaxMB, kDefaultCacheMaxMB).toInt();
+  }
+
+
+  int Preferences::texturePoolMaxMB() const
+  {
+    return _settings.value(kTexturePoolMaxMB, kDefaultTexturePoolMaxMB).toInt();
+  }
+
+
+  PacingMode Preferences::pacingMode() const
+  {
+    QString mode = _settings.value(kPacingMode).toString();
+    if (mode == "uncapped") {
+      return PacingMode::eUncapped;
+    }
+    else if (mode == "fixed") {
+      return PacingMode::eFixedRate;
+    }
+    else if (mode == "vsync") {
+      return PacingMode::eVSync;
+    }
+    return kDefaultPacingMode;
+  }
+
+
+  int Preferences::maxFPS() const
+  {
+    return _settings.value(kFixedRateFPS, kDefaultMaxFPS).toInt();
+  }
+
+
+  QString Preferences::shaderToyURL() const
+  {
+    return _settings.value(kShaderToyURL, kDefaultShaderToyURL).toString();
+  }
+
+
   //
   // Preferences public slots
   //
@@ -213,4 +286,30 @@ namespace vh {
   }
 
 
+  void Preferences::setPacingMode(PacingMode mode)
+  {
+    if (mode == kDefaultPacingMode) {
+      _settings.remove(kPacingMode);
+      return;
+    }
+
+    switch (mode) {
+    case PacingMode::eVSync:     _settings.setValue(kPacingMode, "vsync");    break;
+    case PacingMode::eUncapped:  _settings.setValue(kPacingMode, "uncapped"); break;
+    case PacingMode::eFixedRate: _settings.setValue(kPacingMode, "fixed");    break;
+    }
+  }
+
+
+  void Preferences::setMaxFPS(int fps)
+  {
+    if (fps == kDefaultMaxFPS) {
+      _settings.remove(kFixedRateFPS);
+    }
+    else {
+      _settings.setValue(kFixedRateFPS, fps);
+    }
+  }
+
+
 } // namespace vh
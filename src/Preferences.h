@@ -17,15 +17,33 @@ namespace vh {
   static constexpr int kMaxRecentFiles     = 10;
   static constexpr int kMaxRecentDownloads = 10;
 
+  static constexpr int kDefaultSoundBlockSamples    = 32768; // Samples generated per GPU dispatch for sound passes.
+  static constexpr int kDefaultSoundLookAheadBlocks = 2;     // How many blocks ahead of the playhead to keep queued.
+
+  static constexpr int kDefaultCacheMaxMB = 4096;            // Size budget for the download cache. 0 means unlimited.
+  static constexpr int kDefaultTexturePoolMaxMB = 512;       // Most GPU memory to keep in released render targets for reuse.
+  static constexpr int kDefaultMaxFPS = 60;                  // Frame rate for PacingMode::eFixedRate.
+
+  static const QString kDefaultShaderToyURL("https://www.shadertoy.com");
+
+  enum class PacingMode {
+    eVSync,     // Start a frame for each display refresh.
+    eUncapped,  // Swap interval 0: render as fast as possible, for benchmarking.
+    eFixedRate, // Start frames at `maxFPS`, with vsync still on.
+  };
+  static constexpr PacingMode kDefaultPacingMode = PacingMode::eVSync;
+
   static constexpr uint kHUD_FrameNum       = 1u << 0;
   static constexpr uint kHUD_Time           = 1u << 1;
   static constexpr uint kHUD_MillisPerFrame = 1u << 2;
   static constexpr uint kHUD_FramesPerSec   = 1u << 3;
   static constexpr uint kHUD_MousePos       = 1u << 4;
   static constexpr uint kHUD_MouseDownPos   = 1u << 5;
+  static constexpr uint kHUD_TextureMemory  = 1u << 6;
 
   static constexpr uint kHUD_All = kHUD_FrameNum | kHUD_Time | kHUD_MillisPerFrame |
-                                   kHUD_FramesPerSec | kHUD_MousePos | kHUD_MouseDownPos;
+                                   kHUD_FramesPerSec | kHUD_MousePos | kHUD_MouseDownPos |
+                                   kHUD_TextureMemory;
 
 
   //
@@ -60,6 +78,13 @@ namespace vh {
     QByteArray desktopWindowGeometry() const;
     QByteArray desktopWindowState() const;
     uint hudFlags() const;
+    int soundBlockSamples() const;
+    int soundLookAheadBlocks() const;
+    int cacheMaxMB() const;
+    int texturePoolMaxMB() const;
+    PacingMode pacingMode() const;
+    int maxFPS() const;
+    QString shaderToyURL() const;
 
   public slots:
     void setLastOpenDir(const QString& dirname);
@@ -70,6 +95,8 @@ namespace vh {
     void saveDesktopWindowData(const QByteArray& geometry, const QByteArray& state, int version);
     void removeDesktopWindowData();
     void setHUDFlags(uint flags);
+    void setPacingMode(PacingMode mode);
+    void setMaxFPS(int fps);
 
   private:
     QSettings _settings;
@@ -7,12 +7,39 @@
 #include <QMediaPlayer>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
+#include <QVector>
 
 #include "TextureAudioSurface.h"
 #include "TextureVideoSurface.h"
 
+#ifdef SHADERTOOL_USE_GL41
+#include <QOpenGLFunctions_4_1_Core>
+#else
+#include <QOpenGLFunctions_4_5_Core>
+#endif
+
 namespace vh {
 
+  //
+  // Forward declarations
+  //
+
+  class LiveAudioInput;
+  class SoundOutput;
+  class SoundRenderer;
+
+
+  //
+  // Types
+  //
+
+#ifdef SHADERTOOL_USE_GL41
+  typedef QOpenGLFunctions_4_1_Core GLFunctions;
+#else
+  typedef QOpenGLFunctions_4_5_Core GLFunctions;
+#endif // SHADERTOOL_USE_GL41
+
+
   //
   // Constants
   //
@@ -27,12 +54,22 @@ namespace vh {
   static constexpr int kMaxRenderpasses = 5;
   static constexpr int kMaxVideos       = 4;
   static constexpr int kMaxAudios       = 4;
+  static constexpr int kMaxLiveAudios   = 4;
   static constexpr int kMaxCameras      = 1;
   static constexpr int kMaxTextures     = kMaxRenderpasses * (2 + kMaxInputs) + (kMaxVideos * 2) + kNumSpecialTextures;
 
   static constexpr int kCubemapWidth  = 1024;
   static constexpr int kCubemapHeight = 1024;
 
+  static constexpr GLenum kCubeFaces[6] = {
+    GL_TEXTURE_CUBE_MAP_POSITIVE_X,
+    GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
+    GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
+    GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+    GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
+    GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+  };
+
 
   //
   // Enums
@@ -70,6 +107,7 @@ namespace vh {
   struct Texture {
     QOpenGLTexture* obj = nullptr;
     bool isRenderSized  = false;  // if true, this will be resized dynamically to match our render resolution.
+    bool isPooled       = false;  // if true, obj belongs to the render widget's texture pool and must be released back to it rather than deleted.
     float playbackTime  = 0.0f;   // for animated channels, this is the current time on the channel.
 
     QString samplerType(int samplerNum) const;
@@ -100,6 +138,22 @@ namespace vh {
   };
 
 
+  struct LiveAudio {
+    LiveAudioInput* input        = nullptr; // Microphone or PCM stream.
+    int texOutput                = -1;
+  };
+
+
+  struct Sound {
+    SoundRenderer* renderer = nullptr;
+    SoundOutput* output     = nullptr;
+    qint64 nextSample       = 0;      // First sample of the next block to queue for rendering.
+    int lookAheadBlocks     = 0;      // How many blocks past the playhead we try to keep rendered.
+    bool needsRestart       = false;  // Set when playback jumps; handled on the next frame, while the GL context is current.
+    QVector<float> scratch;           // Receives each block as it's read back from the GPU.
+  };
+
+
 
   struct RenderPass {
     PassType type;
@@ -116,6 +170,11 @@ namespace vh {
     QString sourceCode;
     QString sourceFile;
 
+    // How often to re-render the pass. See ShaderToyRenderPass.
+    int updateEvery    = 1;
+    bool renderOnce    = false;
+    float timeBudgetMS = 0.0f;
+
     // Uniform indexes
     int iResolutionLoc        = -1;
     int iTimeLoc              = -1;
@@ -132,6 +191,27 @@ namespace vh {
     int iSampleRateLoc        = -1;
 
     int iRayDirsLoc           = -1;
+
+    // The iChannelResolution value for each input. Only recalculated when
+    // RenderData::channelResolutionsDirty is set.
+    float iChannelResolution[kMaxInputs][3] = {};
+  };
+
+
+  /// How many times we updated a piece of GPU state versus skipped it
+  /// because nothing had changed. For profiling.
+  struct UploadCounter {
+    qint64 performed = 0;
+    qint64 skipped   = 0;
+
+    void count(bool didUpload) { if (didUpload) { ++performed; } else { ++skipped; } }
+  };
+
+
+  struct UploadStats {
+    UploadCounter keyboard;           // Keyboard texture uploads, one per frame.
+    UploadCounter channelResolutions; // Recalculating the per-pass iChannelResolution values, one per frame.
+    UploadCounter uniforms;           // glUniform calls for uniforms which don't necessarily change every frame.
   };
 
 
@@ -147,16 +227,21 @@ namespace vh {
   struct RenderData {
     Video videos[kMaxVideos]                  = {};
     Audio audios[kMaxAudios]                  = {};
+    LiveAudio liveAudios[kMaxLiveAudios]      = {};
     Texture textures[kMaxTextures]            = {}; // Element 0 will be a special "no texture" value.
     RenderPass renderpasses[kMaxRenderpasses] = {}; // In order: all of the intermediate buffers followed by the final output.
     int numVideos       = 0;
     int numAudios       = 0;
+    int numLiveAudios   = 0;
     int numTextures     = 0;
     int numRenderpasses = 0;
 
     Camera camera   = {};
     bool hasCamera  = false;
 
+    Sound sound     = {};
+    bool hasSound   = false;
+
     GLuint defaultVAO   = 0;
     GLuint defaultFBO   = 0;
     GLuint flipFBO      = 0;
@@ -179,6 +264,11 @@ namespace vh {
 
     // Source data for keyboard texture.
     uchar keyboardTexData[3][256];
+    bool keyboardDirty       = true;   // keyboardTexData has changed since it was last uploaded.
+    bool keyPressedThisFrame = false;  // Some key's "pressed" flag is set, so the row needs clearing after the next frame.
+
+    bool channelResolutionsDirty = true; // An input texture has been created or resized since the per-pass iChannelResolution values were calculated.
+    int generation = 0;                  // Incremented each time the render data is set up, so anything caching GL state can tell a new program from a recycled ID.
 
     // Utility shaders
     TexturedQuadShader texturedQuadShader;
@@ -0,0 +1,518 @@
+// Copyright 2019 Vilya Harvey
+#include "RenderThread.h"
+
+#include <QCoreApplication>
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr float kCubemapRayDirs[6][3][3] = {
+    // Ray dirs for +x face
+    {
+      {  1.0,  1.0,  1.0 },
+      {  1.0,  1.0, -3.0 },
+      {  1.0, -3.0,  1.0 },
+    },
+    // Ray dirs for -x face
+    {
+      { -1.0,  1.0, -1.0 },
+      { -1.0,  1.0,  3.0 },
+      { -1.0, -3.0, -1.0 },
+    },
+    // Ray dirs for +y face
+    {
+      { -1.0,  1.0, -1.0 },
+      {  3.0,  1.0, -1.0 },
+      { -1.0,  1.0,  3.0 },
+    },
+    // Ray dirs for -y face
+    {
+      { -1.0, -1.0,  1.0 },
+      {  3.0, -1.0,  1.0 },
+      { -1.0, -1.0, -3.0 },
+    },
+    // Ray dirs for +z face
+    {
+      { -1.0,  1.0,  1.0 },
+      {  3.0,  1.0,  1.0 },
+      { -1.0, -3.0,  1.0 },
+    },
+    // Ray dirs for -z face
+    {
+      {  1.0,  1.0, -1.0 },
+      { -3.0,  1.0, -1.0 },
+      {  1.0, -3.0, -1.0 },
+    },
+  };
+
+
+  //
+  // Private helper functions
+  //
+
+  // Copies `values` over `cached`, returning true if they were different.
+  static bool updateCached(float* cached, const float* values, int count)
+  {
+    const size_t bytes = sizeof(float) * size_t(count);
+    if (std::memcmp(cached, values, bytes) == 0) {
+      return false;
+    }
+    std::memcpy(cached, values, bytes);
+    return true;
+  }
+
+
+  //
+  // RenderThread public methods
+  //
+
+  RenderThread::RenderThread(QOpenGLContext* shareContext, QObject* parent) :
+    QThread(parent)
+  {
+    // The surface has to be created on the GUI thread, but the context can
+    // be handed over to the render thread once it exists.
+    _surface = new QOffscreenSurface();
+    _surface->setFormat(shareContext->format());
+    _surface->create();
+    if (!_surface->isValid()) {
+      qCritical("Unable to create an offscreen surface for the render thread");
+      return;
+    }
+
+    _context = new QOpenGLContext();
+    _context->setFormat(shareContext->format());
+    _context->setShareContext(shareContext);
+    if (!_context->create()) {
+      qCritical("Unable to create an OpenGL context for the render thread");
+      return;
+    }
+    _context->moveToThread(this);
+  }
+
+
+  RenderThread::~RenderThread()
+  {
+    stop();
+    delete _context;
+    delete _surface;
+  }
+
+
+  bool RenderThread::isValid() const
+  {
+    return !_failed.load() && _context != nullptr && _context->isValid() && _surface->isValid();
+  }
+
+
+  bool RenderThread::isBusy() const
+  {
+    return _state.load() == State::eRendering;
+  }
+
+
+  void RenderThread::submitFrame(const RenderData* data, const FrameRequest& request)
+  {
+    assert(_state.load() == State::eIdle);
+
+    _data = data;
+    _request = request;
+    _state.store(State::eRendering);
+    _wake.release();
+  }
+
+
+  bool RenderThread::takeFinishedFrame(GLsync& done, double& gpuMS)
+  {
+    if (_state.load() != State::eFinished) {
+      return false;
+    }
+
+    done = _finishedFence;
+    gpuMS = _finishedGPUMS;
+    _finishedFence = nullptr;
+    _finishedGPUMS = -1.0;
+    _state.store(State::eIdle);
+    return true;
+  }
+
+
+  UploadCounter RenderThread::uniformUploads() const
+  {
+    return _uniformUploads;
+  }
+
+
+  void RenderThread::stop()
+  {
+    if (!isRunning()) {
+      return;
+    }
+    _quit.store(true);
+    _wake.release();
+    wait();
+  }
+
+
+  //
+  // RenderThread protected methods
+  //
+
+  void RenderThread::run()
+  {
+    if (!_context->makeCurrent(_surface)) {
+      qCritical("Unable to make the render thread's OpenGL context current");
+      _context->moveToThread(QCoreApplication::instance()->thread());
+      _failed.store(true);
+      emit failed();
+      return;
+    }
+
+    initializeOpenGLFunctions();
+
+    glGenVertexArrays(1, &_vao);
+    glGenFramebuffers(1, &_fbo);
+    glGenFramebuffers(1, &_readFBO);
+    glGenQueries(kNumTimerQueries, _timerQueries);
+    glGenQueries(kNumTimerQueries * kMaxRenderpasses * 2, &_passTimerQueries[0][0][0]);
+
+    while (true) {
+      _wake.acquire();
+      if (_quit.load()) {
+        break;
+      }
+
+      renderFrame();
+
+      _state.store(State::eFinished);
+      emit frameFinished();
+    }
+
+    if (_state.load() == State::eRendering) {
+      glDeleteSync(_request.uploadsDone);
+    }
+    if (_finishedFence != nullptr) {
+      glDeleteSync(_finishedFence);
+      _finishedFence = nullptr;
+    }
+    glDeleteQueries(kNumTimerQueries, _timerQueries);
+    glDeleteQueries(kNumTimerQueries * kMaxRenderpasses * 2, &_passTimerQueries[0][0][0]);
+    glDeleteFramebuffers(1, &_fbo);
+    glDeleteFramebuffers(1, &_readFBO);
+    glDeleteVertexArrays(1, &_vao);
+    _fbo = 0;
+    _readFBO = 0;
+    _vao = 0;
+
+    _context->doneCurrent();
+    _context->moveToThread(QCoreApplication::instance()->thread());
+  }
+
+
+  //
+  // RenderThread private methods
+  //
+
+  // The QOpenGLTexture and QOpenGLShaderProgram objects in RenderData belong
+  // to the widget's context, so we only use them for their IDs and cached
+  // properties here and make all the GL calls ourselves.
+  void RenderThread::renderFrame()
+  {
+    const RenderData& data = *_data;
+    const FrameRequest& req = _request;
+
+    // Make sure the GPU has finished the widget's uploads for this frame
+    // before we read from any of those textures.
+    glWaitSync(req.uploadsDone, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(req.uploadsDone);
+
+    collectTimerQueries();
+
+    // If the GPU is so far behind that this query still hasn't got a result,
+    // reusing it throws that result away. That only costs us one sample.
+    int query = _nextTimerQuery;
+    _nextTimerQuery = (_nextTimerQuery + 1) % kNumTimerQueries;
+    glBeginQuery(GL_TIME_ELAPSED, _timerQueries[query]);
+    _timerPending[query] = true;
+
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_STENCIL_TEST);
+    glStencilMask(0);
+
+    glBindVertexArray(_vao);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+    glClearColor(0.0, 1.0, 0.0, 1.0);
+
+    // If we're on frame 0, clear all the output textures to make sure any
+    // render pass which reads from them doesn't get garbage values.
+    if (req.clearTextures) {
+      for (int i = 0; i < data.numRenderpasses; i++) {
+        for (int j = 0; j < 2; j++) {
+          int texIndex = data.renderpasses[i].outputs[j];
+          QOpenGLTexture* texObj = data.textures[texIndex].obj;
+          if (texObj->target() == QOpenGLTexture::TargetCubeMap) {
+            for (int face = 0; face < 6; face++) {
+              glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, kCubeFaces[face], texObj->textureId(), 0);
+              glClear(GL_COLOR_BUFFER_BIT);
+            }
+          }
+          else {
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texObj->textureId(), 0);
+            glClear(GL_COLOR_BUFFER_BIT);
+          }
+        }
+      }
+    }
+
+    // Every pass has to be rendered if its old output is missing or stale,
+    // whatever its update rate says.
+    bool renderAll = req.clearTextures || !req.usePassUpdateRates ||
+                     data.generation != _lastGeneration ||
+                     req.renderWidth != _lastRenderWidth || req.renderHeight != _lastRenderHeight;
+    if (data.generation != _lastGeneration) {
+      // Timings for the old document's passes don't tell us anything.
+      std::memset(_passGPUMS, 0, sizeof(_passGPUMS));
+      std::memset(_passTimerPending, 0, sizeof(_passTimerPending));
+    }
+    _lastGeneration   = data.generation;
+    _lastRenderWidth  = req.renderWidth;
+    _lastRenderHeight = req.renderHeight;
+
+    for (int i = 0; i < data.numRenderpasses; i++) {
+      const RenderPass& pass = data.renderpasses[i];
+
+      if (!renderAll && !passDue(i, pass, req.iFrame)) {
+        copyPassOutput(pass);
+        continue;
+      }
+      _lastRenderedFrame[i] = req.iFrame;
+
+      bool timed = (pass.timeBudgetMS > 0.0f);
+      if (timed) {
+        glQueryCounter(_passTimerQueries[query][i][0], GL_TIMESTAMP);
+      }
+
+      glUseProgram(pass.program->programId());
+
+      // Programs are recreated whenever the document is reloaded, and may
+      // get the same ID as before, so the generation has to match too.
+      UniformCache& cache = _uniformCache[i];
+      if (cache.generation != data.generation || cache.program != pass.program->programId()) {
+        cache = UniformCache();
+        cache.generation = data.generation;
+        cache.program = pass.program->programId();
+      }
+
+      // These change every frame.
+      glUniform1f(pass.iTimeLoc, req.iTime);
+      glUniform1f(pass.iTimeDeltaLoc, req.iTimeDelta);
+      glUniform1i(pass.iFrameLoc, req.iFrame);
+
+      // These mostly don't.
+      float iChannelTime[kMaxInputs];
+      for (int inputIdx = 0; inputIdx < kMaxInputs; inputIdx++) {
+        int texIdx = pass.inputs[inputIdx][req.frontBuffer];
+        QOpenGLTexture* tex = data.textures[texIdx].obj;
+
+        glActiveTexture(GLenum(GL_TEXTURE0 + inputIdx));
+        glBindTexture(GLenum(tex->target()), tex->textureId());
+        glBindSampler(GLuint(inputIdx), pass.samplers[inputIdx]);
+
+        iChannelTime[inputIdx] = data.textures[texIdx].playbackTime;
+      }
+
+      bool changed = updateCached(cache.iResolution, req.iResolution, 3) || !cache.valid;
+      if (changed) {
+        glUniform3fv(pass.iResolutionLoc, 1, req.iResolution);
+      }
+      _uniformUploads.count(changed);
+
+      changed = updateCached(cache.iMouse, req.iMouse, 4) || !cache.valid;
+      if (changed) {
+        glUniform4fv(pass.iMouseLoc, 1, req.iMouse);
+      }
+      _uniformUploads.count(changed);
+
+      changed = updateCached(&cache.iSampleRate, &req.iSampleRate, 1) || !cache.valid;
+      if (changed) {
+        glUniform1f(pass.iSampleRateLoc, req.iSampleRate);
+      }
+      _uniformUploads.count(changed);
+
+      changed = updateCached(&cache.iChannelResolution[0][0], &pass.iChannelResolution[0][0], kMaxInputs * 3) || !cache.valid;
+      if (changed) {
+        glUniform3fv(pass.iChannelResolutionLoc, kMaxInputs, &pass.iChannelResolution[0][0]);
+      }
+      _uniformUploads.count(changed);
+
+      changed = updateCached(cache.iChannelTime, iChannelTime, kMaxInputs) || !cache.valid;
+      if (changed) {
+        glUniform1fv(pass.iChannelTimeLoc, kMaxInputs, iChannelTime);
+      }
+      _uniformUploads.count(changed);
+
+      cache.valid = true;
+
+      QOpenGLTexture* outTex = data.textures[pass.outputs[req.backBuffer]].obj;
+      if (pass.type == PassType::eCubemap) {
+        glViewport(0, 0, kCubemapWidth, kCubemapHeight);
+        for (int face = 0; face < 6; face++) {
+          glUniform3fv(pass.iRayDirsLoc, 3, reinterpret_cast<const float*>(kCubemapRayDirs[face]));
+          glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, kCubeFaces[face], outTex->textureId(), 0);
+          glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+      }
+      else {
+        glViewport(0, 0, req.renderWidth, req.renderHeight);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outTex->textureId(), 0);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+      }
+
+      for (int inputIdx = 0; inputIdx < kMaxInputs; inputIdx++) {
+        int texIdx = pass.inputs[inputIdx][req.frontBuffer];
+        glActiveTexture(GLenum(GL_TEXTURE0 + inputIdx));
+        glBindTexture(GLenum(data.textures[texIdx].obj->target()), 0);
+      }
+
+      glUseProgram(0);
+
+      // TODO: only generate mipmaps if a downstream pass requires them.
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GLenum(outTex->target()), outTex->textureId());
+      glGenerateMipmap(GLenum(outTex->target()));
+      glBindTexture(GLenum(outTex->target()), 0);
+
+      if (timed) {
+        glQueryCounter(_passTimerQueries[query][i][1], GL_TIMESTAMP);
+        _passTimerPending[query][i] = true;
+      }
+    }
+
+    for (int inputIdx = 0; inputIdx < kMaxInputs; inputIdx++) {
+      glBindSampler(GLuint(inputIdx), 0);
+    }
+
+    // Don't leave anything attached: the widget may delete these textures
+    // before our next frame.
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindVertexArray(0);
+
+    glEndQuery(GL_TIME_ELAPSED);
+
+    _finishedFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+  }
+
+
+  // A pass is due once it's skipped as many frames as its update rate
+  // allows. A time budget stretches that, so that its measured GPU time
+  // averages out to no more than the budget per frame.
+  bool RenderThread::passDue(int passIdx, const RenderPass& pass, int iFrame) const
+  {
+    if (pass.renderOnce) {
+      return false;
+    }
+
+    int divisor = qMax(1, pass.updateEvery);
+    if (pass.timeBudgetMS > 0.0f && _passGPUMS[passIdx] > 0.0) {
+      divisor = qMax(divisor, int(std::ceil(_passGPUMS[passIdx] / double(pass.timeBudgetMS))));
+    }
+
+    // iFrame goes backwards when playback is restarted.
+    int framesSince = iFrame - _lastRenderedFrame[passIdx];
+    return framesSince >= divisor || framesSince < 0;
+  }
+
+
+  // A skipped pass still has to end up with its latest output in the back
+  // buffer, because that's what becomes the front buffer once the frame is
+  // finished. Expects `_fbo` to be bound as the draw framebuffer.
+  void RenderThread::copyPassOutput(const RenderPass& pass)
+  {
+    const RenderData& data = *_data;
+    QOpenGLTexture* src = data.textures[pass.outputs[_request.frontBuffer]].obj;
+    QOpenGLTexture* dst = data.textures[pass.outputs[_request.backBuffer]].obj;
+    int w = src->width();
+    int h = src->height();
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _readFBO);
+    if (src->target() == QOpenGLTexture::TargetCubeMap) {
+      for (int face = 0; face < 6; face++) {
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, kCubeFaces[face], src->textureId(), 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, kCubeFaces[face], dst->textureId(), 0);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      }
+    }
+    else {
+      glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, src->textureId(), 0);
+      glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dst->textureId(), 0);
+      glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GLenum(dst->target()), dst->textureId());
+    glGenerateMipmap(GLenum(dst->target()));
+    glBindTexture(GLenum(dst->target()), 0);
+  }
+
+
+  // Picks up the results of any timer queries which have finished, without
+  // waiting for the ones which haven't.
+  void RenderThread::collectTimerQueries()
+  {
+    // Check them oldest first, so we end up reporting the newest result.
+    for (int i = 0; i < kNumTimerQueries; i++) {
+      int query = (_nextTimerQuery + i) % kNumTimerQueries;
+      if (!_timerPending[query]) {
+        continue;
+      }
+
+      GLint available = 0;
+      glGetQueryObjectiv(_timerQueries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available) {
+        continue;
+      }
+
+      GLuint64 elapsedNS = 0;
+      glGetQueryObjectui64v(_timerQueries[query], GL_QUERY_RESULT, &elapsedNS);
+      _finishedGPUMS = double(elapsedNS) / 1e6;
+      _timerPending[query] = false;
+    }
+
+    for (int i = 0; i < kNumTimerQueries; i++) {
+      int query = (_nextTimerQuery + i) % kNumTimerQueries;
+      for (int passIdx = 0; passIdx < kMaxRenderpasses; passIdx++) {
+        if (!_passTimerPending[query][passIdx]) {
+          continue;
+        }
+
+        GLint available = 0;
+        glGetQueryObjectiv(_passTimerQueries[query][passIdx][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+          continue;
+        }
+
+        GLuint64 startNS = 0;
+        GLuint64 endNS = 0;
+        glGetQueryObjectui64v(_passTimerQueries[query][passIdx][0], GL_QUERY_RESULT, &startNS);
+        glGetQueryObjectui64v(_passTimerQueries[query][passIdx][1], GL_QUERY_RESULT, &endNS);
+        _passGPUMS[passIdx] = double(endNS - startNS) / 1e6;
+        _passTimerPending[query][passIdx] = false;
+      }
+    }
+  }
+
+} // namespace vh
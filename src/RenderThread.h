@@ -0,0 +1,188 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_RENDERTHREAD_H
+#define VH_RENDERTHREAD_H
+
+#include "RenderData.h"
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QSemaphore>
+#include <QThread>
+
+#include <atomic>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kNumTimerQueries = 3;  // GPU timings we can have outstanding at once.
+
+
+  //
+  // Structs
+  //
+
+  /// Everything the render thread needs for a frame which isn't in
+  /// RenderData. This is a copy of the widget's state at the moment the
+  /// frame was submitted, so input events can keep updating the widget's
+  /// mouse position etc. while the frame renders.
+  struct FrameRequest {
+    int renderWidth     = 0;
+    int renderHeight    = 0;
+    uint8_t backBuffer  = 0;      // Which output texture of each pass to render into.
+    uint8_t frontBuffer = 1;      // Which output texture of each pass holds the previous frame.
+    bool clearTextures  = false;  // Clear all pass outputs before rendering, e.g. on frame 0.
+
+    float iResolution[3] = { 0.0f, 0.0f, 0.0f };
+    float iTime          = 0.0f;
+    float iTimeDelta     = 0.0f;
+    int   iFrame         = 0;
+    float iMouse[4]      = { 0.0f, 0.0f, -1.0f, -1.0f };
+    float iSampleRate    = 0.0f;
+
+    bool usePassUpdateRates = true; // Skip passes which aren't due, according to their update rate settings.
+
+    GLsync uploadsDone = nullptr; // Fenced after the widget's texture uploads for this frame. Owned by the render thread once submitted.
+  };
+
+
+  //
+  // RenderThread class
+  //
+
+  /// Runs a shader's render passes on a thread of its own, using an OpenGL
+  /// context shared with the RenderWidget's, so a slow frame doesn't freeze
+  /// the UI and UI work (menus, downloads, logging) doesn't eat into frame
+  /// time.
+  ///
+  /// The widget owns everything in RenderData and only changes it while the
+  /// thread is idle; the thread only reads it. Each frame goes:
+  ///
+  /// 1. The widget uploads the inputs for the frame (video frames, audio,
+  ///    the keyboard texture) and calls `submitFrame`.
+  /// 2. The thread renders every pass into the back buffer textures and
+  ///    emits `frameFinished`. A pass which isn't due, according to its
+  ///    update rate settings, has its previous output copied over instead.
+  /// 3. The widget calls `takeFinishedFrame`, swaps its front and back
+  ///    buffers and draws the result along with any decorations.
+  ///
+  /// The two contexts are ordered on the GPU with fences, so neither thread
+  /// ever waits for the GPU to finish. For the same reason, the GPU time for
+  /// each frame is measured with timer queries which are only read once
+  /// their results are available, a frame or two later.
+  class RenderThread : public QThread, protected GLFunctions
+  {
+    Q_OBJECT
+  public:
+    /// Must be called on the GUI thread. The thread is started by calling
+    /// `start()` as usual.
+    explicit RenderThread(QOpenGLContext* shareContext, QObject* parent = nullptr);
+    virtual ~RenderThread();
+
+    /// False if the thread's context or surface couldn't be created, or
+    /// the context couldn't be made current once the thread started. Nothing
+    /// can be rendered after that.
+    bool isValid() const;
+
+    /// True while a submitted frame is still being rendered.
+    bool isBusy() const;
+
+    /// Starts rendering a frame. Only call this when the thread isn't busy
+    /// and there's no finished frame waiting to be taken. `data` must stay
+    /// unchanged until the frame has finished.
+    void submitFrame(const RenderData* data, const FrameRequest& request);
+
+    /// If a frame has finished since the last call, returns true and sets
+    /// `done` to a fence which the caller must wait on (with `glWaitSync`)
+    /// and delete before using the results. `gpuMS` is set to the GPU time
+    /// for the most recent frame whose timing has become available since
+    /// the last call, or to a negative value if there isn't one.
+    bool takeFinishedFrame(GLsync& done, double& gpuMS);
+
+    /// How many of the uniforms which can stay the same from one frame to
+    /// the next were actually set. Only call this while the thread isn't
+    /// busy.
+    UploadCounter uniformUploads() const;
+
+    /// Waits for any frame in progress to finish, then stops the thread.
+    void stop();
+
+  signals:
+    /// Emitted from the render thread when a frame is ready to be taken.
+    void frameFinished();
+
+    /// Emitted from the render thread if it's unable to start rendering.
+    void failed();
+
+  protected:
+    virtual void run() override;
+
+  private:
+    enum class State {
+      eIdle,
+      eRendering,
+      eFinished,
+    };
+
+    // The values we last set on each pass's program, so we only call
+    // glUniform when something has changed.
+    struct UniformCache {
+      bool valid      = false;
+      int generation  = 0;
+      GLuint program  = 0;
+      float iResolution[3]                    = {};
+      float iMouse[4]                         = {};
+      float iSampleRate                       = 0.0f;
+      float iChannelResolution[kMaxInputs][3] = {};
+      float iChannelTime[kMaxInputs]          = {};
+    };
+
+    void renderFrame();
+    bool passDue(int passIdx, const RenderPass& pass, int iFrame) const;
+    void copyPassOutput(const RenderPass& pass);
+    void collectTimerQueries();
+
+  private:
+    QOpenGLContext* _context    = nullptr;
+    QOffscreenSurface* _surface = nullptr;
+
+    // Container objects aren't shared between contexts, so the thread needs
+    // its own.
+    GLuint _vao = 0;
+    GLuint _fbo = 0;
+    GLuint _readFBO = 0;
+
+    const RenderData* _data = nullptr;
+    FrameRequest _request;
+    GLsync _finishedFence   = nullptr;
+    double _finishedGPUMS   = -1.0;
+
+    GLuint _timerQueries[kNumTimerQueries] = {};
+    bool _timerPending[kNumTimerQueries]   = {};
+    int _nextTimerQuery = 0;
+
+    // Passes which are allowed to skip frames. Passes with a time budget
+    // are timed individually, with a pair of timestamps in the same query
+    // slot as the frame's timer.
+    int _lastRenderedFrame[kMaxRenderpasses] = {};  // iFrame when each pass was last rendered.
+    int _lastGeneration   = -1;
+    int _lastRenderWidth  = 0;
+    int _lastRenderHeight = 0;
+    GLuint _passTimerQueries[kNumTimerQueries][kMaxRenderpasses][2] = {};
+    bool _passTimerPending[kNumTimerQueries][kMaxRenderpasses]      = {};
+    double _passGPUMS[kMaxRenderpasses] = {};       // Latest GPU time for each pass with a time budget, or 0 until one is measured.
+
+    UniformCache _uniformCache[kMaxRenderpasses];
+    UploadCounter _uniformUploads;
+
+    QSemaphore _wake;
+    std::atomic<State> _state { State::eIdle };
+    std::atomic<bool> _quit   { false };
+    std::atomic<bool> _failed { false };
+  };
+
+} // namespace vh
+
+#endif // VH_RENDERTHREAD_H
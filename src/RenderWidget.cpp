@@ -1,14 +1,26 @@
 // Copyright 2019 Vilya Harvey
 #include "RenderWidget.h"
 
+#include "LiveAudioInput.h"
+#include "RenderThread.h"
+#include "ShaderTemplate.h"
+#include "SoundOutput.h"
+#include "SoundRenderer.h"
+#include "TextureSidecar.h"
+
+#include <QFileInfo>
+#include <QGuiApplication>
 #include <QMessageLogger>
 #include <QOpenGLPixelTransferOptions>
 #include <QPainter>
-#include <QRegularExpression>
-#include <QTimer>
+#include <QScreen>
+#include <QWindow>
+#include <QtMath>
 
 #include <QMediaPlaylist>
 
+#include <cstring>
+
 namespace vh  {
 
   //
@@ -19,53 +31,26 @@ namespace vh  {
   static constexpr double kMediumStepMS = 1000.0;
   static constexpr double kLargeStepMS = 10000.0;
 
-  static constexpr GLenum kCubeFaces[6] = {
-    GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-    GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-    GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-    GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-    GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-    GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
-  };
-
-  static constexpr float kCubemapRayDirs[6][3][3] = {
-    // Ray dirs for +x face
-    {
-      {  1.0,  1.0,  1.0 },
-      {  1.0,  1.0, -3.0 },
-      {  1.0, -3.0,  1.0 },
-    },
-    // Ray dirs for -x face
-    {
-      { -1.0,  1.0, -1.0 },
-      { -1.0,  1.0,  3.0 },
-      { -1.0, -3.0, -1.0 },
-    },
-    // Ray dirs for +y face
-    {
-      { -1.0,  1.0, -1.0 },
-      {  3.0,  1.0, -1.0 },
-      { -1.0,  1.0,  3.0 },
-    },
-    // Ray dirs for -y face
-    {
-      { -1.0, -1.0,  1.0 },
-      {  3.0, -1.0,  1.0 },
-      { -1.0, -1.0, -3.0 },
-    },
-    // Ray dirs for +z face
-    {
-      { -1.0,  1.0,  1.0 },
-      {  3.0,  1.0,  1.0 },
-      { -1.0, -3.0,  1.0 },
-    },
-    // Ray dirs for -z face
-    {
-      {  1.0,  1.0, -1.0 },
-      { -3.0,  1.0, -1.0 },
-      {  1.0, -3.0, -1.0 },
-    },
-  };
+  // Adaptive render resolution. The scale only moves in whole steps, so
+  // render targets are reallocated rarely, and only after averaging the GPU
+  // time over a batch of frames.
+  static constexpr float kAdaptiveMinScale     = 0.25f;
+  static constexpr float kAdaptiveMaxScale     = 1.0f;
+  static constexpr float kAdaptiveScaleStep    = 0.125f;
+  static constexpr int   kAdaptiveSampleFrames = 30;    // Frames to average the GPU time over before each adjustment.
+  static constexpr float kAdaptiveHeadroom     = 0.85f; // Only scale up if the next step is predicted to stay under this fraction of the target.
+
+  // Window resizes only change relative render sizes once the window has
+  // been the same size for kResizeSettleMS, or every kResizeMaxDelayMS while
+  // it keeps changing.
+  static constexpr int kResizeSettleMS   = 150;
+  static constexpr int kResizeMaxDelayMS = 500;
+
+  // A frame which starts more than this fraction of a frame interval after
+  // it was due has missed its refresh or fixed rate slot. Misses are
+  // summarised in the log at most once per kMissedDeadlineLogMS.
+  static constexpr double kMissedDeadlineFraction = 0.5;
+  static constexpr double kMissedDeadlineLogMS    = 1000.0;
 
 
   //
@@ -128,38 +113,6 @@ namespace vh  {
 #endif
 
 
-  static QString preprocessShaderSource(const QString& filename, const QMap<QString, QString>& macros)
-  {
-    QFileInfo fileInfo(filename);
-    if (!fileInfo.exists()) {
-      return "";
-    }
-
-    // Replace all #macro lines with their replacement text.
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly)) {
-      return "";
-    }
-
-    QString code = QString::fromLocal8Bit(file.readAll());
-    file.close();
-
-    QMapIterator<QString, QString> it(macros);
-    while (it.hasNext()) {
-      it.next();
-      QString before = QString("#macro %1").arg(it.key());
-      QString after = it.value();
-      code.replace(before, after);
-    }
-
-    // Remove any remaining unmatched #macro lines.
-    QRegularExpression macroRE("#macro.*$", QRegularExpression::MultilineOption);
-    code.replace(macroRE, "");
-
-    return code;
-  }
-
-
   //
   // RenderWidget public methods
   //
@@ -173,12 +126,26 @@ namespace vh  {
 
     Preferences prefs;
     _hudFlags = prefs.hudFlags();
+    _texturePool.setHighWaterBytes(qint64(qMax(0, prefs.texturePoolMaxMB())) * 1024 * 1024);
+    _pacingMode = prefs.pacingMode();
+    _maxFPS = qMax(1, prefs.maxFPS());
 
     _hudPen.setStyle(Qt::DashLine);
     _hudPen.setColor(Qt::lightGray);
 
+    _resizeTimer = new QTimer(this);
+    _resizeTimer->setSingleShot(true);
+    _resizeTimer->setInterval(kResizeSettleMS);
+    connect(_resizeTimer, &QTimer::timeout, this, &RenderWidget::applyResize);
+
+    _frameCapTimer = new QTimer(this);
+    _frameCapTimer->setSingleShot(true);
+    _frameCapTimer->setTimerType(Qt::PreciseTimer);
+    connect(_frameCapTimer, &QTimer::timeout, this, [this](){ update(); });
+
     QFontMetrics metrics(_hudFont);
-    _lineWidth = metrics.width(QString("Mouse Down -8888.88,-8888.88"));
+    _lineWidth = qMax(metrics.width(QString("Mouse Down -8888.88,-8888.88")),
+                      metrics.width(QString("Targets 8888.8 MB, 8888.8 MB pooled")));
     _lineHeight = metrics.height();
     _lineAscent = metrics.ascent();
 
@@ -215,6 +182,15 @@ namespace vh  {
 
   RenderWidget::~RenderWidget()
   {
+    // Must be stopped while our context still exists, since its context is
+    // shared with ours.
+    delete _renderThread;
+
+    // Anything still pooled has to be deleted while our context is current.
+    makeCurrent();
+    _texturePool.clear();
+    doneCurrent();
+
     if (_pendingDoc != _currentDoc) {
       delete _pendingDoc;
     }
@@ -237,7 +213,7 @@ namespace vh  {
   {
     _pendingDoc = newDoc;
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -255,15 +231,57 @@ namespace vh  {
   }
 
 
+  bool RenderWidget::renderingOnDemand() const
+  {
+    return _timeInvariant && _playbackTimer.running();
+  }
+
+
+  PacingMode RenderWidget::pacingMode() const
+  {
+    return _pacingMode;
+  }
+
+
+  int RenderWidget::maxFPS() const
+  {
+    return _maxFPS;
+  }
+
+
+  bool RenderWidget::passUpdateRatesEnabled() const
+  {
+    return _usePassUpdateRates;
+  }
+
+
+  int RenderWidget::swapIntervalForPacing(PacingMode mode)
+  {
+    return (mode == PacingMode::eUncapped) ? 0 : 1;
+  }
+
+
+  UploadStats RenderWidget::uploadStats() const
+  {
+    UploadStats stats = _uploadStats;
+    // The render thread's counters are only safe to read while it's idle,
+    // and they're all it would change.
+    if (_renderThread != nullptr && !_renderThread->isBusy()) {
+      stats.uniforms = _renderThread->uniformUploads();
+    }
+    return stats;
+  }
+
+
   int RenderWidget::renderWidth() const
   {
-    return _useRelativeRenderSize ? int(framebufferWidth() * _renderScale) : _renderWidth;
+    return _useRelativeRenderSize ? int(_appliedFramebufferWidth * _renderScale) : _renderWidth;
   }
 
 
   int RenderWidget::renderHeight() const
   {
-    return _useRelativeRenderSize ? int(framebufferHeight() * _renderScale) : _renderHeight;
+    return _useRelativeRenderSize ? int(_appliedFramebufferHeight * _renderScale) : _renderHeight;
   }
 
 
@@ -313,6 +331,16 @@ namespace vh  {
       audio.player->play();
     }
 
+    for (int i = 0; i < _renderData.numLiveAudios; i++) {
+      LiveAudio& live = _renderData.liveAudios[i];
+      live.input->surface()->unpause();
+      live.input->start();
+    }
+
+    if (_renderData.hasSound) {
+      _renderData.sound.needsRestart = true;
+    }
+
     _renderData.iTime = 0.0f;
     _renderData.iFrame = 0;
 
@@ -342,6 +370,16 @@ namespace vh  {
       audio.player->pause();
     }
 
+    // Live inputs keep capturing while paused, so there's no startup delay
+    // when we resume, but the texture stays frozen.
+    for (int i = 0; i < _renderData.numLiveAudios; i++) {
+      _renderData.liveAudios[i].input->surface()->pause();
+    }
+
+    if (_renderData.hasSound) {
+      _renderData.sound.output->suspend();
+    }
+
     _playbackTimer.stop();
 
     update();
@@ -367,6 +405,14 @@ namespace vh  {
       audio.player->play();
     }
 
+    for (int i = 0; i < _renderData.numLiveAudios; i++) {
+      _renderData.liveAudios[i].input->surface()->unpause();
+    }
+
+    if (_renderData.hasSound) {
+      _renderData.sound.output->resume();
+    }
+
     float prevTimeDelta = _renderData.iTime - _prevTime;
     _playbackTimer.resume();
     _prevTime = _playbackTimer.elapsedSecs() - prevTimeDelta;
@@ -397,6 +443,10 @@ namespace vh  {
 
     _playbackTimer.adjustTimeMS(amountMS);
 
+    if (_renderData.hasSound) {
+      _renderData.sound.needsRestart = true;
+    }
+
     if (!wasPlayingBack) {
       update();
     }
@@ -420,6 +470,7 @@ namespace vh  {
     int oldDisplayH = displayHeight();
 
     _useRelativeRenderSize = false;
+    _useAdaptiveRenderSize = false;
     _renderWidth = w;
     _renderHeight = h;
 
@@ -428,7 +479,7 @@ namespace vh  {
     _displayPanX -= float(displayWidth()  - oldDisplayW) * 0.5f;
     _displayPanY -= float(displayHeight() - oldDisplayH) * 0.5f;
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -440,6 +491,7 @@ namespace vh  {
     int oldDisplayH = displayHeight();
 
     _useRelativeRenderSize = true;
+    _useAdaptiveRenderSize = false;
     _renderScale = windowScale;
 
     _resized = true;
@@ -447,7 +499,76 @@ namespace vh  {
     _displayPanX -= float(displayWidth()  - oldDisplayW) * 0.5f;
     _displayPanY -= float(displayHeight() - oldDisplayH) * 0.5f;
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
+      update();
+    }
+  }
+
+
+  void RenderWidget::setAdaptiveRenderResolution(float targetFrameMS)
+  {
+    int oldDisplayW = displayWidth();
+    int oldDisplayH = displayHeight();
+
+    // Start from the nearest step to the current scale, so switching from
+    // one of the relative sizes doesn't jump.
+    float scale = _useRelativeRenderSize ? _renderScale : 0.5f;
+    scale = qRound(scale / kAdaptiveScaleStep) * kAdaptiveScaleStep;
+
+    _useRelativeRenderSize = true;
+    _useAdaptiveRenderSize = true;
+    _targetFrameMS = targetFrameMS;
+    _renderScale = qBound(kAdaptiveMinScale, scale, kAdaptiveMaxScale);
+    _adaptiveGPUMSTotal = 0.0;
+    _adaptiveFrames = 0;
+
+    _resized = true;
+
+    _displayPanX -= float(displayWidth()  - oldDisplayW) * 0.5f;
+    _displayPanY -= float(displayHeight() - oldDisplayH) * 0.5f;
+
+    if (!continuousRendering()) {
+      update();
+    }
+  }
+
+
+  void RenderWidget::setPacingMode(PacingMode mode)
+  {
+    _pacingMode = mode;
+    _pacedLastFrame = false;
+
+    Preferences prefs;
+    prefs.setPacingMode(_pacingMode);
+
+    // If a frame is being held back by the old rate, it may be due already.
+    if (_frameCapTimer->isActive()) {
+      _frameCapTimer->stop();
+      update();
+    }
+  }
+
+
+  void RenderWidget::setMaxFPS(int fps)
+  {
+    _maxFPS = qMax(1, fps);
+    _pacedLastFrame = false;
+
+    Preferences prefs;
+    prefs.setMaxFPS(_maxFPS);
+
+    if (_frameCapTimer->isActive()) {
+      _frameCapTimer->stop();
+      update();
+    }
+  }
+
+
+  void RenderWidget::setPassUpdateRatesEnabled(bool enabled)
+  {
+    _usePassUpdateRates = enabled;
+
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -480,7 +601,7 @@ namespace vh  {
       _displayPanY -= (displayHeight() - oldDisplayH) * 0.5f;
     }
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -503,7 +624,7 @@ namespace vh  {
     _displayPass = newPassIndex;
     qDebug("Display pass set to %s (idx = %d)", qPrintable(_renderData.renderpasses[_displayPass].name), _displayPass);
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -521,7 +642,7 @@ namespace vh  {
     Preferences prefs;
     prefs.setHUDFlags(_hudFlags);
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -531,7 +652,7 @@ namespace vh  {
   {
     _showHUD = !_showHUD;
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -541,7 +662,7 @@ namespace vh  {
   {
     _showInputs = !_showInputs;
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -551,7 +672,7 @@ namespace vh  {
   {
     _showOutputs = !_showOutputs;
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -562,7 +683,7 @@ namespace vh  {
     _displayPanX = (framebufferWidth()  -  displayWidth()) * 0.5f;
     _displayPanY = (framebufferHeight() - displayHeight()) * 0.5f;
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -577,7 +698,7 @@ namespace vh  {
     _displayPanY = (_displayPanY - cy) * relScale + cy;
     _displayScale = newScale;
 
-    if (!_playbackTimer.running()) {
+    if (!continuousRendering()) {
       update();
     }
   }
@@ -650,13 +771,13 @@ namespace vh  {
       break;
     case Action::eCaptureSingleFrame:
       _capture = Capture::eSingleFrame;
-      if (!_playbackTimer.running()) {
+      if (!continuousRendering()) {
         update();
       }
       break;
     case Action::eCaptureScreenshot:
       _capture = Capture::eScreenshot;
-      if (!_playbackTimer.running()) {
+      if (!continuousRendering()) {
         update();
       }
       break;
@@ -684,18 +805,62 @@ namespace vh  {
     glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);       // Enable all messages with source='application'
     glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
   #endif // SHADERTOOL_USE_GL41
+
+    // We get called again if our context is ever recreated, in which case
+    // the old render thread's context is no longer shared with ours.
+    delete _renderThread;
+    _renderThread = new RenderThread(context());
+    connect(_renderThread, &RenderThread::frameFinished, this, &RenderWidget::renderThreadFrameFinished, Qt::QueuedConnection);
+    connect(_renderThread, &RenderThread::failed, this, &RenderWidget::renderThreadFailed, Qt::QueuedConnection);
+    if (_renderThread->isValid()) {
+      _renderFailure.clear();
+      _renderThread->start();
+    }
+    else {
+      // Not reported directly, since we're in the middle of setting up GL.
+      QMetaObject::invokeMethod(this, "renderThreadFailed", Qt::QueuedConnection);
+    }
   }
 
 
   void RenderWidget::paintGL()
   {
-    _fpsCounter.newFrame(_runtimeTimer.elapsedMS());
+    // Pick up the frame the render thread finished since we last painted.
+    GLsync frameDone = nullptr;
+    double gpuMS = -1.0;
+    if (_renderThread->takeFinishedFrame(frameDone, gpuMS)) {
+      glWaitSync(frameDone, 0, GL_TIMEOUT_IGNORED);
+      glDeleteSync(frameDone);
+      _renderData.frontBuffer ^= 1;
+      _renderData.backBuffer ^= 1;
+      _hasFrame = true;
+      if (_useAdaptiveRenderSize && gpuMS >= 0.0) {
+        adaptRenderScale(gpuMS);
+      }
+    }
 
     QPainter painter(this);
     painter.beginNativePainting();
 
-    updateRenderData();
-    if (_currentDoc != nullptr) {
+    // The render thread reads the render data, so we can only change it (or
+    // start another frame) while the thread is idle. If it's still busy,
+    // we just show the last finished frame again.
+    if (_renderThread->isValid() && !_renderThread->isBusy()) {
+      updateRenderData();
+      if (_currentDoc != nullptr && (!_displayOnly || _clearTextures)) {
+        double waitMS = (_pacingMode == PacingMode::eFixedRate && _pacedLastFrame && !_clearTextures) ? _nextFrameMS - _runtimeTimer.elapsedMS() : 0.0;
+        if (waitMS <= 0.0) {
+          submitFrame();
+        }
+        else if (!_frameCapTimer->isActive()) {
+          _frameCapTimer->start(qCeil(waitMS));
+        }
+      }
+    }
+    _displayOnly = false;
+
+    // Without the render thread, the pass outputs never get anything in them.
+    if (_currentDoc != nullptr && _renderThread->isValid()) {
       renderMain();
       renderIntermediates(); // returns early if nothing to be drawn.
     }
@@ -705,47 +870,52 @@ namespace vh  {
 
     painter.endNativePainting();
 
-    if (_showHUD) {
-      renderHUD(painter);
-    }
-
-    if (_currentDoc != nullptr) {
-      ++_renderData.iFrame;
-      _prevTime = _renderData.iTime;
+    if (!_renderFailure.isEmpty()) {
+      renderFailure(painter);
     }
-
-    // Clear the "key pressed" flag for all keys. The flag only stays set for
-    // the duration of one frame.
-    for (int i = 0; i < 256; i++) {
-      _renderData.keyboardTexData[1][i] = 0;
+    else if (_showHUD) {
+      renderHUD(painter);
     }
 
+    // Captures are of the frame we've just displayed, so have to wait until
+    // there is one.
     switch (_capture) {
     case Capture::eScreenshot:
       screenshot();
       _capture = Capture::eNothing;
       break;
     case Capture::eSingleFrame:
-      captureFrame();
-      _capture = Capture::eNothing;
+      if (_hasFrame) {
+        captureFrame();
+        _capture = Capture::eNothing;
+      }
       break;
     default:
       break;
     }
-
-    if (_playbackTimer.running()) {
-      QTimer::singleShot(1, this, SLOT(update()));
-    }
   }
 
 
+  // Resizing every render target on each step of a window drag is slow, so
+  // the render size only follows the window once it has settled (see
+  // `applyResize`). Until then the current output is stretched to fit.
   void RenderWidget::resizeGL(int /*w*/, int /*h*/)
   {
-    if (_useRelativeRenderSize) {
-      // Resizing of resources will be done during the next `paintGL` call, so
-      // that we can ensure it doesn't happen while we're trying to render.
-      _resized = true;
+    if (_appliedFramebufferWidth == 0 || _appliedFramebufferHeight == 0) {
+      // First resize: there's nothing to stretch yet.
+      applyResize();
+      return;
+    }
+
+    if (!_resizePending) {
+      _resizePending = true;
+      _resizePendingTimer.start();
+    }
+    if (_resizePendingTimer.elapsedMS() >= double(kResizeMaxDelayMS)) {
+      applyResize();
+      return;
     }
+    _resizeTimer->start();
 
     _initialDisplayScale = _displayScale;
     if (_displayFitWidth) {
@@ -784,6 +954,11 @@ namespace vh  {
     default:
       break;
     }
+
+    if (renderingOnDemand()) {
+      _needsRender = true;
+      update();
+    }
   }
 
 
@@ -813,6 +988,11 @@ namespace vh  {
     default:
       break;
     }
+
+    if (renderingOnDemand() && _mouseAction != MouseAction::eNone) {
+      _needsRender = true;
+      update();
+    }
   }
 
 
@@ -835,6 +1015,11 @@ namespace vh  {
     }
 
     _mouseAction = newMouseAction;
+
+    if (renderingOnDemand()) {
+      _needsRender = true;
+      update();
+    }
   }
 
 
@@ -887,6 +1072,12 @@ namespace vh  {
       _renderData.keyboardTexData[0][key] = 255;  // The key down flag
       _renderData.keyboardTexData[1][key] = 255;  // The key pressed flag, non-zero only on the frame where the key is first pressed.
       _renderData.keyboardTexData[2][key] ^= 255; // The key toggle. Flips each time the key is pressed.
+      _renderData.keyboardDirty = true;
+      _renderData.keyPressedThisFrame = true;
+      if (renderingOnDemand()) {
+        _needsRender = true;
+        update();
+      }
     }
     else if (action != Action::eNone) {
       doAction(action);
@@ -918,6 +1109,11 @@ namespace vh  {
       // Update the keyboard texture
       int key = (event->text().size() == 1) ? event->text().toUpper().at(0).toLatin1() : event->nativeVirtualKey();
       _renderData.keyboardTexData[0][key] = 0;  // The key down flag
+      _renderData.keyboardDirty = true;
+      if (renderingOnDemand()) {
+        _needsRender = true;
+        update();
+      }
     }
     else if (action != Action::eNone) {
       doAction(action);
@@ -942,6 +1138,8 @@ namespace vh  {
     if (_currentDoc != nullptr) {
       setupRenderData();
     }
+    _adaptiveGPUMSTotal = 0.0;
+    _adaptiveFrames = 0;
     recenterImage();
     emit currentShaderToyDocumentChanged();
   }
@@ -953,6 +1151,10 @@ namespace vh  {
 
     // Assume that any old render data has already been cleared.
 
+    ++_renderData.generation;
+    _renderData.channelResolutionsDirty = true;
+    _renderData.keyboardDirty = true;
+
     glGenVertexArrays(1, &_renderData.defaultVAO);
     glGenFramebuffers(1, &_renderData.defaultFBO);
     glGenFramebuffers(1, &_renderData.flipFBO);
@@ -964,8 +1166,11 @@ namespace vh  {
     int commonIdx = _currentDoc->findRenderPassByType(kRenderPassType_Common);
     if (commonIdx != -1) {
       _renderData.commonSourceCode = _currentDoc->renderpasses[commonIdx].code;
+      _renderData.commonSourceFile = _currentDoc->renderpasses[commonIdx].filename;
     }
 
+    _renderData.iSampleRate = float(kSoundSampleRate);
+
     _renderData.numTextures = kNumSpecialTextures;
 
     // Allocate the "no texture" texture.
@@ -1130,6 +1335,10 @@ namespace vh  {
 
       passOut.sourceCode = passIn.code;
       passOut.sourceFile = passIn.filename;
+
+      passOut.updateEvery  = passIn.updateEvery;
+      passOut.renderOnce   = passIn.renderOnce;
+      passOut.timeBudgetMS = float(passIn.timeBudgetMS);
     }
 
     // Set up all render pass inputs, loading assets as we encounter them.
@@ -1310,7 +1519,30 @@ namespace vh  {
           continue;
         }
 
-        // TODO: other input types.
+        // If this is the microphone or a raw PCM stream that we haven't set up yet...
+        if (input.ctype == kInputType_Mic || input.ctype == kInputType_PCMStream) {
+          int texIndex = kTexture_PlaceholderImage;
+          if (_renderData.numLiveAudios < kMaxLiveAudios) {
+            LiveAudio& live = _renderData.liveAudios[_renderData.numLiveAudios++];
+            if (input.ctype == kInputType_Mic) {
+              live.input = new MicrophoneInput(this);
+            }
+            else {
+              live.input = new PCMStreamInput(input.src, this);
+            }
+            live.texOutput = allocAudioTexture();
+            texIndex = live.texOutput;
+            assetIDtoTextureIndex[tr] = texIndex;
+          }
+          else {
+            qWarning("Too many live audio inputs, ignoring channel %d of %s", input.channel, qPrintable(passIn.name));
+          }
+          passOut.inputs[input.channel][0] = texIndex;
+          passOut.inputs[input.channel][1] = texIndex;
+          continue;
+        }
+
+        qWarning("Unsupported input type '%s' on channel %d of %s", qPrintable(input.ctype), input.channel, qPrintable(passIn.name));
       }
     }
 
@@ -1329,8 +1561,13 @@ namespace vh  {
       macros["SAMPLER_1_TYPE"] =  _renderData.textures[passOut.inputs[1][0]].samplerType(1);
       macros["SAMPLER_2_TYPE"] =  _renderData.textures[passOut.inputs[2][0]].samplerType(2);
       macros["SAMPLER_3_TYPE"] =  _renderData.textures[passOut.inputs[3][0]].samplerType(3);
-      macros["COMMON_CODE"] = _renderData.commonSourceCode;
-      macros["USER_CODE"] = passOut.sourceCode;
+      // Each program gets its own copy of anything its common and user code
+      // include, just as each one gets its own copy of the common code.
+      ShaderIncludes includes;
+      includes.refDir = includeDirForPass(_currentDoc->refDir, _renderData.commonSourceFile);
+      macros["COMMON_CODE"] = expandIncludes(_renderData.commonSourceCode, kSourceString_Common, includes);
+      includes.refDir = includeDirForPass(_currentDoc->refDir, passOut.sourceFile);
+      macros["USER_CODE"] = expandIncludes(passOut.sourceCode, kSourceString_User, includes);
 
       QString vertShaderSource;
       if (passOut.type == PassType::eCubemap) {
@@ -1396,13 +1633,39 @@ namespace vh  {
       quadShader.program->release();
     }
 
+    // The sound pass doesn't take part in the normal frame loop. It renders
+    // blocks of samples ahead of the playhead and feeds them to the audio
+    // output instead.
+    int soundIdx = _currentDoc->findRenderPassByType(kRenderPassType_Sound);
+    if (soundIdx != -1) {
+      setupSound(_currentDoc->renderpasses[soundIdx]);
+    }
+
     // Display the "image" pass
     setDisplayPassByOutputID(kOutputID_Image);
+
+    _timeInvariant = isTimeInvariant();
+    if (_timeInvariant) {
+      qDebug("Shader output doesn't depend on time, rendering on demand");
+    }
   }
 
 
   void RenderWidget::teardownRenderData()
   {
+    // The pass outputs are about to go away, so there's nothing to display
+    // until the next frame is finished.
+    _hasFrame = false;
+    _timeInvariant = false;
+
+    if (_renderData.numRenderpasses > 0) {
+      UploadStats stats = uploadStats();
+      qDebug("Uploads performed/skipped: keyboard %lld/%lld, channel resolutions %lld/%lld, uniforms %lld/%lld",
+             stats.keyboard.performed, stats.keyboard.skipped,
+             stats.channelResolutions.performed, stats.channelResolutions.skipped,
+             stats.uniforms.performed, stats.uniforms.skipped);
+    }
+
     // Delete the default vertex array.
     glDeleteVertexArrays(1, &_renderData.defaultVAO);
     _renderData.defaultVAO = 0;
@@ -1442,6 +1705,10 @@ namespace vh  {
       pass.sourceCode = QString();
       pass.sourceFile = QString();
 
+      pass.updateEvery  = 1;
+      pass.renderOnce   = false;
+      pass.timeBudgetMS = 0.0f;
+
       pass.iResolutionLoc        = -1;
       pass.iTimeLoc              = -1;
       pass.iTimeDeltaLoc         = -1;
@@ -1458,6 +1725,9 @@ namespace vh  {
     }
     _renderData.numRenderpasses = 0;
 
+    // Delete the sound pass and stop any sound it was playing.
+    teardownSound();
+
     // Delete the camera
     if (_renderData.camera.obj != nullptr) {
       _renderData.camera.obj->stop();
@@ -1500,13 +1770,28 @@ namespace vh  {
     }
     _renderData.numAudios = 0;
 
+    // Delete all live audio inputs.
+    for (int i = 0; i < _renderData.numLiveAudios; i++) {
+      LiveAudio& live = _renderData.liveAudios[i];
+      delete live.input; // Stops capturing as well.
+      live.input = nullptr;
+      live.texOutput = -1;
+    }
+    _renderData.numLiveAudios = 0;
+
     // Delete all textures.
     for (int texIdx = 0; texIdx < _renderData.numTextures; texIdx++) {
       Texture& tex = _renderData.textures[texIdx];
-      delete tex.obj;
+      if (tex.isPooled) {
+        _texturePool.release(tex.obj);
+      }
+      else {
+        delete tex.obj;
+      }
       tex.obj = nullptr;
 
       tex.isRenderSized = false;
+      tex.isPooled = false;
       tex.playbackTime = 0.0;
     }
     _renderData.numTextures = 0;
@@ -1544,7 +1829,6 @@ namespace vh  {
           }
         }
         _resized = false;
-        _clearTextures = true;
       }
     }
 
@@ -1556,7 +1840,12 @@ namespace vh  {
       _renderData.iTime = static_cast<float>(_playbackTimer.elapsedSecs());
       _renderData.iTimeDelta = _renderData.iTime - _prevTime;
 
-      _renderData.textures[kTexture_Keyboard].obj->setData(QOpenGLTexture::Red,  QOpenGLTexture::UInt8, reinterpret_cast<const void*>(_renderData.keyboardTexData));
+      // Most frames, no key has changed since the last upload.
+      _uploadStats.keyboard.count(_renderData.keyboardDirty);
+      if (_renderData.keyboardDirty) {
+        _renderData.textures[kTexture_Keyboard].obj->setData(QOpenGLTexture::Red,  QOpenGLTexture::UInt8, reinterpret_cast<const void*>(_renderData.keyboardTexData));
+        _renderData.keyboardDirty = false;
+      }
 
       if (_renderData.iFrame == 0) {
         _clearTextures = true;
@@ -1617,122 +1906,231 @@ namespace vh  {
           continue;
         }
 
-        qint64 playbackTimeUS = audio.player->position();
-        float playbackTime = float(playbackTimeUS) / 1000.0f;
+        // QMediaPlayer reports its position in milliseconds, but audio buffer
+        // timestamps are in microseconds.
+        qint64 playbackTimeUS = audio.player->position() * 1000;
+        float playbackTime = float(audio.player->position()) / 1000.0f;
 
         QOpenGLTexture* texObj = _renderData.textures[audio.texOutput].obj;
         audio.surface->copyToTexture(texObj, playbackTimeUS);
         _renderData.textures[audio.texOutput].playbackTime = playbackTime;
       }
+
+      // Live inputs have no playback position, so we just use the most
+      // recently captured samples.
+      for (int i = 0; i < _renderData.numLiveAudios; i++) {
+        LiveAudio& live = _renderData.liveAudios[i];
+        TextureAudioSurface* surface = live.input->surface();
+        if (!surface->hasCurrentBuffer() || live.texOutput < kNumSpecialTextures) {
+          continue;
+        }
+
+        QOpenGLTexture* texObj = _renderData.textures[live.texOutput].obj;
+        surface->copyToTexture(texObj, surface->ringBuffer().endTimeUS());
+        _renderData.textures[live.texOutput].playbackTime = _renderData.iTime;
+      }
+
+      // Only after the video uploads, since they can resize their textures.
+      _uploadStats.channelResolutions.count(_renderData.channelResolutionsDirty);
+      if (_renderData.channelResolutionsDirty) {
+        updateChannelResolutions();
+        _renderData.channelResolutionsDirty = false;
+      }
+
+      updateSound();
     }
   }
 
 
-  void RenderWidget::renderMain()
+  // Works out the iChannelResolution values for every pass, so the render
+  // thread doesn't have to query each input texture every frame.
+  void RenderWidget::updateChannelResolutions()
   {
-    glDisable(GL_DEPTH_TEST);
-    glDepthMask(GL_FALSE);
-    glDisable(GL_STENCIL_TEST);
-    glStencilMask(0);
+    for (int passIdx = 0; passIdx < _renderData.numRenderpasses; passIdx++) {
+      RenderPass& pass = _renderData.renderpasses[passIdx];
+      for (int inputIdx = 0; inputIdx < kMaxInputs; inputIdx++) {
+        // Both buffers of a pass output are always the same size, so it
+        // doesn't matter which one we look at.
+        QOpenGLTexture* tex = _renderData.textures[pass.inputs[inputIdx][0]].obj;
+        pass.iChannelResolution[inputIdx][0] = static_cast<float>(tex->width());
+        pass.iChannelResolution[inputIdx][1] = static_cast<float>(tex->height());
+        pass.iChannelResolution[inputIdx][2] = static_cast<float>(tex->depth());
+      }
+    }
+  }
 
-    glBindVertexArray(_renderData.defaultVAO);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, _renderData.defaultFBO);
-    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  void RenderWidget::submitFrame()
+  {
+    // Everything which asked for this frame gets captured in the request.
+    _needsRender = false;
 
-    glClearColor(0.0, 1.0, 0.0, 1.0);
+    FrameRequest request;
+    request.renderWidth   = renderWidth();
+    request.renderHeight  = renderHeight();
+    request.backBuffer    = _renderData.backBuffer;
+    request.frontBuffer   = _renderData.frontBuffer;
+    request.clearTextures = _clearTextures;
+    for (int i = 0; i < 3; i++) {
+      request.iResolution[i] = _renderData.iResolution[i];
+    }
+    request.iTime       = _renderData.iTime;
+    request.iTimeDelta  = _renderData.iTimeDelta;
+    request.iFrame      = _renderData.iFrame;
+    for (int i = 0; i < 4; i++) {
+      request.iMouse[i] = _renderData.iMouse[i];
+    }
+    request.iSampleRate = _renderData.iSampleRate;
+    request.usePassUpdateRates = _usePassUpdateRates;
 
-    // If we're on frame 0, clear all the output textures to make sure any
-    // render pass which reads from them doesn't get garbage values.
-    if (_clearTextures) {
-      for (int i = 0; i < _renderData.numRenderpasses; i++) {
-        for (int j = 0; j < 2; j++) {
-          int texIndex = _renderData.renderpasses[i].outputs[j];
-          QOpenGLTexture* texObj = _renderData.textures[texIndex].obj;
-          if (texObj->target() == QOpenGLTexture::TargetCubeMap) {
-            for (int face = 0; face < 6; face++) {
-              glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, kCubeFaces[face], texObj->textureId(), 0);
-              glClear(GL_COLOR_BUFFER_BIT);
-            }
-          }
-          else {
-            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texObj->textureId(), 0);
-            glClear(GL_COLOR_BUFFER_BIT);
-          }
-        }
-      }
-      _clearTextures = false;
+    // The render thread's context waits on this before it starts, so it
+    // sees everything we've uploaded or (re)created for this frame.
+    request.uploadsDone = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    _renderThread->submitFrame(&_renderData, request);
+
+    double frameStartMS = _runtimeTimer.elapsedMS();
+    trackFramePacing(frameStartMS);
+
+    _clearTextures = false;
+    ++_renderData.iFrame;
+    _prevTime = _renderData.iTime;
+    _lastSubmitMS = frameStartMS;
+
+    // Clear the "key pressed" flag for all keys. The flag only stays set for
+    // the duration of one frame.
+    if (_renderData.keyPressedThisFrame) {
+      std::memset(_renderData.keyboardTexData[1], 0, sizeof(_renderData.keyboardTexData[1]));
+      _renderData.keyPressedThisFrame = false;
+      _renderData.keyboardDirty = true;
     }
+  }
 
-    for (int i = 0; i < _renderData.numRenderpasses; i++) {
-      const RenderPass& pass = _renderData.renderpasses[i];
 
-      pass.program->bind();
+  // A document is time invariant if rendering it twice with the same inputs
+  // gives the same result: none of its passes use a uniform which changes
+  // every frame, it has no media inputs and no pass reads a buffer which
+  // hasn't been rendered yet this frame (i.e. its own previous output, or a
+  // later pass's). The shader compiler strips unused uniforms, so their
+  // locations tell us what each pass actually depends on.
+  bool RenderWidget::isTimeInvariant() const
+  {
+    if (_renderData.numVideos > 0 || _renderData.numAudios > 0 ||
+        _renderData.numLiveAudios > 0 || _renderData.hasCamera || _renderData.hasSound) {
+      return false;
+    }
 
-      pass.program->setUniformValueArray(pass.iResolutionLoc, _renderData.iResolution, 1, 3);
-      pass.program->setUniformValue(pass.iTimeLoc, _renderData.iTime);
-      pass.program->setUniformValue(pass.iTimeDeltaLoc, _renderData.iTimeDelta);
-      pass.program->setUniformValue(pass.iFrameLoc, _renderData.iFrame);
-      pass.program->setUniformValueArray(pass.iMouseLoc, _renderData.iMouse, 1, 4);
+    for (int passIdx = 0; passIdx < _renderData.numRenderpasses; passIdx++) {
+      const RenderPass& pass = _renderData.renderpasses[passIdx];
+      if (pass.type == PassType::eSound) {
+        continue;
+      }
+      if (pass.program == nullptr || !pass.program->isLinked()) {
+        return false;
+      }
+      if (pass.iTimeLoc != -1 || pass.iTimeDeltaLoc != -1 || pass.iFrameLoc != -1 ||
+          pass.iDateLoc != -1 || pass.iChannelTimeLoc != -1) {
+        return false;
+      }
 
-      for (int inputIdx = 0; inputIdx < kMaxInputs; inputIdx++) {
-        glBindSampler(GLuint(inputIdx), pass.samplers[inputIdx]);
+      for (int i = 0; i < kMaxInputs; i++) {
+        int texIdx = pass.inputs[i][0];
+        if (texIdx == 0) {
+          continue;
+        }
+        for (int srcIdx = passIdx; srcIdx < _renderData.numRenderpasses; srcIdx++) {
+          const RenderPass& srcPass = _renderData.renderpasses[srcIdx];
+          if (srcPass.outputs[0] == texIdx || srcPass.outputs[1] == texIdx) {
+            return false;
+          }
+        }
       }
+    }
+    return true;
+  }
 
-      float iChannelResolution[4][3];
-      float iChannelTime[4];
-      for (int inputIdx = 0; inputIdx < kMaxInputs; inputIdx++) {
-        int texIdx = pass.inputs[inputIdx][_renderData.frontBuffer];
-        QOpenGLTexture* tex = _renderData.textures[texIdx].obj;
-        tex->bind(inputIdx);
 
-        iChannelResolution[inputIdx][0] = static_cast<float>(tex->width());
-        iChannelResolution[inputIdx][1] = static_cast<float>(tex->height());
-        iChannelResolution[inputIdx][2] = static_cast<float>(tex->depth());
+  bool RenderWidget::continuousRendering() const
+  {
+    return _playbackTimer.running() && !_timeInvariant;
+  }
+
 
-        iChannelTime[inputIdx] = _renderData.textures[texIdx].playbackTime;
+  // While frames are being started back to back, each one has a deadline:
+  // one refresh after the previous frame with vsync, or its slot with a
+  // fixed frame rate. Uncapped frames have no deadline. Must be called
+  // before `_lastSubmitMS` and `_clearTextures` are updated for the new
+  // frame.
+  void RenderWidget::trackFramePacing(double frameStartMS)
+  {
+    _fpsCounter.newFrame(frameStartMS);
+
+    double intervalMS = 0.0;
+    if (_pacingMode == PacingMode::eFixedRate) {
+      intervalMS = 1000.0 / double(_maxFPS);
+    }
+    else if (_pacingMode == PacingMode::eVSync) {
+      QWindow* win = window()->windowHandle();
+      QScreen* screen = (win != nullptr) ? win->screen() : QGuiApplication::primaryScreen();
+      if (screen != nullptr && screen->refreshRate() > 0.0) {
+        intervalMS = 1000.0 / screen->refreshRate();
       }
-      pass.program->setUniformValueArray(pass.iChannelResolutionLoc, reinterpret_cast<float*>(iChannelResolution), 4, 3);
-      pass.program->setUniformValueArray(pass.iChannelTimeLoc, iChannelTime, 4, 1);
+    }
 
-      if (pass.type == PassType::eCubemap) {
-        glViewport(0, 0, kCubemapWidth, kCubemapHeight);
-        for (int face = 0; face < 6; face++) {
-          pass.program->setUniformValueArray(pass.iRayDirsLoc, reinterpret_cast<const float*>(kCubemapRayDirs[face]), 3, 3);
-          glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, kCubeFaces[face], _renderData.textures[pass.outputs[_renderData.backBuffer]].obj->textureId(), 0);
-          glDrawArrays(GL_TRIANGLES, 0, 3);
-        }
+    bool paced = continuousRendering() && !_clearTextures;
+    if (paced && _pacedLastFrame && intervalMS > 0.0) {
+      double dueMS = (_pacingMode == PacingMode::eFixedRate) ? _nextFrameMS : _lastSubmitMS + intervalMS;
+      double latenessMS = frameStartMS - dueMS;
+      if (latenessMS > intervalMS * kMissedDeadlineFraction) {
+        ++_missedDeadlines;
+        _worstLatenessMS = qMax(_worstLatenessMS, latenessMS);
+        // Don't try to catch up on the slots we've missed.
+        _nextFrameMS = frameStartMS + intervalMS;
       }
       else {
-        glViewport(0, 0, renderWidth(), renderHeight());
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _renderData.textures[pass.outputs[_renderData.backBuffer]].obj->textureId(), 0);
-        glDrawArrays(GL_TRIANGLES, 0, 3);
+        _nextFrameMS = dueMS + intervalMS;
       }
+    }
+    else {
+      _nextFrameMS = frameStartMS + intervalMS;
+    }
+    _pacedLastFrame = paced;
 
-      for (int inputIdx = 0; inputIdx < kMaxInputs; inputIdx++) {
-        int texIdx = pass.inputs[inputIdx][_renderData.frontBuffer];
-        _renderData.textures[texIdx].obj->release();
-      }
+    if (_missedDeadlines > 0 && frameStartMS - _missedDeadlineLogMS >= kMissedDeadlineLogMS) {
+      qDebug("Missed %d frame deadlines at %.2f ms per frame, worst by %.2f ms",
+             _missedDeadlines, intervalMS, _worstLatenessMS);
+      _missedDeadlines = 0;
+      _worstLatenessMS = 0.0;
+      _missedDeadlineLogMS = frameStartMS;
+    }
+  }
 
-      pass.program->release();
 
-      // TODO: only generate mipmaps if a downstream pass requires them.
-      _renderData.textures[pass.outputs[_renderData.backBuffer]].obj->generateMipMaps();
-    }
+  void RenderWidget::renderMain()
+  {
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, defaultFramebufferObject());
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-    for (int inputIdx = 0; inputIdx < kMaxInputs; inputIdx++) {
-      glBindSampler(GLuint(inputIdx), 0);
+    // Nothing to show until the render thread has finished the first frame.
+    if (!_hasFrame) {
+      return;
     }
 
-    int displayTexIdx = _renderData.renderpasses[_displayPass].outputs[_renderData.backBuffer];
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_STENCIL_TEST);
+    glStencilMask(0);
+
+    glBindVertexArray(_renderData.defaultVAO);
+
+    int displayTexIdx = _renderData.renderpasses[_displayPass].outputs[_renderData.frontBuffer];
     int dstX, dstY, dstW, dstH;
     displayRect(dstX, dstY, dstW, dstH);
 
     glBindFramebuffer(GL_READ_FRAMEBUFFER, _renderData.defaultFBO);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, defaultFramebufferObject());
-    glDrawBuffer(GL_COLOR_ATTACHMENT0);
-    glClearColor(0.0, 0.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
 
     QOpenGLTexture* texObj = _renderData.textures[displayTexIdx].obj;
     if (texObj->target() == QOpenGLTexture::TargetCubeMap) {
@@ -1741,21 +2139,17 @@ namespace vh  {
     else {
       int srcW = texObj->width();
       int srcH = texObj->height();
-      glBindFramebuffer(GL_READ_FRAMEBUFFER, _renderData.defaultFBO);
       glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texObj->textureId(), 0);
       glBlitFramebuffer(0, 0, srcW, srcH, dstX, dstY, dstX + dstW, dstY + dstH, GL_COLOR_BUFFER_BIT, GL_LINEAR);
     }
 
     glBindVertexArray(0);
-
-    _renderData.frontBuffer ^= 1;
-    _renderData.backBuffer ^= 1;
   }
 
 
   void RenderWidget::renderIntermediates()
   {
-    if (!_showOutputs && !_showInputs) {
+    if (!_hasFrame || (!_showOutputs && !_showInputs)) {
       return;
     }
 
@@ -1824,6 +2218,15 @@ namespace vh  {
   }
 
 
+  void RenderWidget::renderFailure(QPainter& painter)
+  {
+    painter.setFont(_hudFont);
+    painter.setPen(Qt::white);
+    painter.setBrush(Qt::NoBrush);
+    painter.drawText(rect(), Qt::AlignCenter | Qt::TextWordWrap, _renderFailure);
+  }
+
+
   void RenderWidget::renderHUD(QPainter& painter)
   {
     if (!_showHUD) {
@@ -1870,7 +2273,18 @@ namespace vh  {
       y += _lineHeight;
     }
     if (_hudFlags & kHUD_FramesPerSec) {
-      painter.drawText(x, y, QString("%1 FPS").arg(_fpsCounter.framesPerSec(), 0, 'f', 2));
+      if (renderingOnDemand()) {
+        painter.drawText(x, y, QString("Static, rendering on demand"));
+      }
+      else {
+        QString pacing;
+        switch (_pacingMode) {
+        case PacingMode::eVSync:     pacing = "vsync"; break;
+        case PacingMode::eUncapped:  pacing = "uncapped"; break;
+        case PacingMode::eFixedRate: pacing = QString("fixed %1").arg(_maxFPS); break;
+        }
+        painter.drawText(x, y, QString("%1 FPS, %2").arg(_fpsCounter.framesPerSec(), 0, 'f', 2).arg(pacing));
+      }
       y += _lineHeight;
     }
     if (_hudFlags & kHUD_MousePos) {
@@ -1881,6 +2295,12 @@ namespace vh  {
       painter.drawText(x, y, QString("Mouse Down %1,%2").arg(_renderData.iMouse[2], 0, 'f', 2).arg(_renderData.iMouse[3], 0, 'f', 2));
       y += _lineHeight;
     }
+    if (_hudFlags & kHUD_TextureMemory) {
+      const TexturePoolStats& poolStats = _texturePool.stats();
+      const double kMB = 1024.0 * 1024.0;
+      painter.drawText(x, y, QString("Targets %1 MB, %2 MB pooled").arg(double(poolStats.liveBytes) / kMB, 0, 'f', 1).arg(double(poolStats.pooledBytes) / kMB, 0, 'f', 1));
+      y += _lineHeight;
+    }
   }
 
 
@@ -1913,16 +2333,13 @@ namespace vh  {
 
     qDebug("Creating render pass %s with resolution %dx%d", (passType == PassType::eCubemap) ? "cubemap" : "texture", w, h);
 
-    tex.obj = new QOpenGLTexture(target);
-    tex.obj->setSize(w, h);
-    tex.obj->setFormat(format);
-    tex.obj->setAutoMipMapGenerationEnabled(false);
+    tex.obj = _texturePool.acquire(target, format, w, h);
     tex.obj->setMagnificationFilter(QOpenGLTexture::Linear);
     tex.obj->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
     tex.obj->setWrapMode(QOpenGLTexture::ClampToEdge);
-    tex.obj->allocateStorage();
 
     tex.isRenderSized = (passType == PassType::eImage || passType == PassType::eBuffer);
+    tex.isPooled = true;
     tex.playbackTime = 0.0;
   }
 
@@ -1938,19 +2355,42 @@ namespace vh  {
 
     qDebug("Resizing texture from %dx%d to %dx%d", tex.obj->width(), tex.obj->height(), newW, newH);
 
-    delete tex.obj;
+    _renderData.channelResolutionsDirty = true;
+
+    QOpenGLTexture* oldObj = tex.obj;
+    int oldW = oldObj->width();
+    int oldH = oldObj->height();
     createRenderPassTexture(tex, PassType::eBuffer);
+
+    // Scale the old contents into the new texture, so that buffers which
+    // feed back into themselves carry on from where they were instead of
+    // starting again from black.
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _renderData.defaultFBO);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, oldObj->textureId(), 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _renderData.grabFBO);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex.obj->textureId(), 0);
+    glBlitFramebuffer(0, 0, oldW, oldH, 0, 0, newW, newH, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    _texturePool.release(oldObj);
   }
 
 
   bool RenderWidget::loadImageTexture(const QString& filename, bool flip, bool srgb, Texture& tex)
   {
-    QString adjustedFilename = filename;
+    QString sidecar;
     if (_cache != nullptr && _cache->isCached(filename)) {
-      adjustedFilename = _cache->pathForCachedFile(filename);
+      sidecar = _cache->textureSidecarPath(filename, flip ? "flip" : "noflip");
+      if (!sidecar.isEmpty() && loadTextureSidecar(sidecar, QOpenGLTexture::Target2D, srgb, tex)) {
+        _cache->useTextureSidecar(sidecar);
+        return true;
+      }
     }
 
-    QImage img(adjustedFilename);
+    QImage img = (_cache != nullptr) ? _cache->loadImage(filename) : QImage(filename);
     if (img.isNull()) {
       qDebug("failed to load texture %s", qPrintable(filename));
       return false;
@@ -1970,17 +2410,19 @@ namespace vh  {
     tex.obj->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
     tex.obj->setWrapMode(QOpenGLTexture::ClampToEdge);
     tex.obj->allocateStorage();
-    for (int i = 0; i < 6; i++) {
-      QOpenGLPixelTransferOptions transferOptions;
-      transferOptions.setAlignment(4);
 
-      tex.obj->setData(sourceFormat, sourceType, img.constBits(), &transferOptions);
-    }
+    QOpenGLPixelTransferOptions transferOptions;
+    transferOptions.setAlignment(4);
+    tex.obj->setData(sourceFormat, sourceType, img.constBits(), &transferOptions);
     tex.obj->generateMipMaps();
 
     tex.isRenderSized = false;
     tex.playbackTime = 0.0f;
 
+    if (!sidecar.isEmpty()) {
+      saveTextureSidecar(sidecar, tex);
+    }
+
     return true;
   }
 
@@ -2000,16 +2442,26 @@ namespace vh  {
     facePaths[4] = QString("%1/%2_4.%3").arg(path).arg(basename).arg(suffix);
     facePaths[5] = QString("%1/%2_5.%3").arg(path).arg(basename).arg(suffix);
 
-    for (int i = 0; i < 6; i++) {
-      if (_cache != nullptr && _cache->isCached(filename)) {
-        facePaths[i] = _cache->pathForCachedFile(facePaths[i]);
+    // Cubemap sidecars are keyed on all six faces, so replacing any one of
+    // them means decoding afresh. There's only a sidecar if every face is
+    // cached.
+    QString sidecar;
+    if (_cache != nullptr) {
+      QStringList faceList;
+      for (int i = 0; i < 6; i++) {
+        faceList.append(facePaths[i]);
+      }
+      sidecar = _cache->cubemapSidecarPath(faceList, flip ? "cube-flip" : "cube-noflip");
+      if (!sidecar.isEmpty() && loadTextureSidecar(sidecar, QOpenGLTexture::TargetCubeMap, srgb, tex)) {
+        _cache->useTextureSidecar(sidecar);
+        return true;
       }
     }
 
     QImage faces[6];
     bool allFacesLoaded = true;
     for (int i = 0; i < 6; i++) {
-      faces[i] = QImage(facePaths[i]);
+      faces[i] = (_cache != nullptr) ? _cache->loadImage(facePaths[i]) : QImage(facePaths[i]);
       if (faces[i].isNull()) {
         qDebug("cubemap %s is missing face %d", qPrintable(facePaths[i]), i);
         allFacesLoaded = false;
@@ -2057,10 +2509,99 @@ namespace vh  {
     tex.isRenderSized = false;
     tex.playbackTime = 0.0f;
 
+    if (!sidecar.isEmpty()) {
+      saveTextureSidecar(sidecar, tex);
+    }
+
+    return true;
+  }
+
+
+  // Uploads every level of every face exactly as stored, so there's no
+  // decoding and no mipmap generation.
+  bool RenderWidget::loadTextureSidecar(const QString& sidecarFilename, QOpenGLTexture::Target target, bool srgb, Texture& tex)
+  {
+    TextureSidecar sidecar;
+    if (!sidecar.open(sidecarFilename)) {
+      return false;
+    }
+    int faces = (target == QOpenGLTexture::TargetCubeMap) ? 6 : 1;
+    if (sidecar.faces() != faces) {
+      return false;
+    }
+
+    QOpenGLTexture::TextureFormat targetFormat = srgb ? QOpenGLTexture::SRGB8_Alpha8 : QOpenGLTexture::RGBA8_UNorm;
+    QOpenGLTexture::PixelFormat sourceFormat = QOpenGLTexture::RGBA;
+    QOpenGLTexture::PixelType sourceType = QOpenGLTexture::UInt8;
+
+    tex.obj = new QOpenGLTexture(target);
+    tex.obj->setAutoMipMapGenerationEnabled(false);
+    tex.obj->setSize(sidecar.width(), sidecar.height());
+    tex.obj->setFormat(targetFormat);
+    tex.obj->setMipLevels(sidecar.levels());
+    tex.obj->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+    tex.obj->setWrapMode(QOpenGLTexture::ClampToEdge);
+    tex.obj->allocateStorage(sourceFormat, sourceType);
+
+    QOpenGLPixelTransferOptions transferOptions;
+    transferOptions.setAlignment(4);
+    for (int level = 0; level < sidecar.levels(); level++) {
+      for (int face = 0; face < faces; face++) {
+        if (faces == 1) {
+          tex.obj->setData(level, sourceFormat, sourceType, sidecar.bits(level, face), &transferOptions);
+        }
+        else {
+          QOpenGLTexture::CubeMapFace cubeFace = QOpenGLTexture::CubeMapFace(QOpenGLTexture::CubeMapPositiveX + face);
+          tex.obj->setData(level, 0, cubeFace, sourceFormat, sourceType, sidecar.bits(level, face), &transferOptions);
+        }
+      }
+    }
+
+    tex.isRenderSized = false;
+    tex.playbackTime = 0.0f;
+
     return true;
   }
 
 
+  // Reads back the texture we've just uploaded, mips and all, so the next
+  // load can skip straight to the upload. This stalls until the mipmaps have
+  // been generated, but only happens once per image.
+  void RenderWidget::saveTextureSidecar(const QString& sidecarFilename, Texture& tex)
+  {
+    int width = tex.obj->width();
+    int height = tex.obj->height();
+    int levels = tex.obj->mipLevels();
+    bool cube = (tex.obj->target() == QOpenGLTexture::TargetCubeMap);
+    int faces = cube ? 6 : 1;
+    if (TextureSidecar::totalBytes(width, height, faces, levels) > kTextureSidecarMaxBytes) {
+      return;
+    }
+
+    QVector<QByteArray> images;
+    images.reserve(faces * levels);
+
+    tex.obj->bind();
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    for (int level = 0; level < levels; level++) {
+      for (int face = 0; face < faces; face++) {
+        QByteArray image(int(TextureSidecar::levelBytes(width, height, level)), Qt::Uninitialized);
+        GLenum target = cube ? GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face) : GLenum(GL_TEXTURE_2D);
+        glGetTexImage(target, level, GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+        images.append(image);
+      }
+    }
+    tex.obj->release();
+
+    // Sidecars count towards the cache's size budget. This one is in use,
+    // so it's safe from the eviction.
+    if (TextureSidecar::write(sidecarFilename, width, height, faces, levels, images) && _cache != nullptr) {
+      _cache->useTextureSidecar(sidecarFilename);
+      _cache->evictInBackground();
+    }
+  }
+
+
   bool RenderWidget::loadVideo(const QString& filename, bool flip, int vidIndex)
   {
     Video& vid = _renderData.videos[vidIndex];
@@ -2156,6 +2697,107 @@ namespace vh  {
   }
 
 
+  bool RenderWidget::setupSound(const ShaderToyRenderPass& soundPass)
+  {
+    Preferences prefs;
+    int blockSamples    = qBound(kSoundBlockWidth, prefs.soundBlockSamples(), kSoundBlockWidth * 1024);
+    int lookAheadBlocks = qBound(1, prefs.soundLookAheadBlocks(), kMaxSoundBlocksInFlight);
+
+    // Round the block size to a whole number of texture rows.
+    blockSamples = (blockSamples / kSoundBlockWidth) * kSoundBlockWidth;
+
+    Sound& sound = _renderData.sound;
+    sound.renderer = new SoundRenderer();
+    QDir commonDir = includeDirForPass(_currentDoc->refDir, _renderData.commonSourceFile);
+    QDir soundDir  = includeDirForPass(_currentDoc->refDir, soundPass.filename);
+    if (!sound.renderer->setup(commonDir, _renderData.commonSourceCode, soundDir, soundPass.code, blockSamples, kSoundSampleRate)) {
+      delete sound.renderer;
+      sound.renderer = nullptr;
+      return false;
+    }
+
+    // The jitter buffer needs room for every block we might have queued, plus
+    // the one currently playing and one for slack.
+    int capacityFrames = (kMaxSoundBlocksInFlight + 2) * sound.renderer->samplesPerBlock();
+    sound.output = new SoundOutput(kSoundSampleRate, capacityFrames, this);
+    sound.nextSample = 0;
+    sound.lookAheadBlocks = lookAheadBlocks;
+    sound.needsRestart = true;
+
+    _renderData.hasSound = true;
+    return true;
+  }
+
+
+  void RenderWidget::teardownSound()
+  {
+    Sound& sound = _renderData.sound;
+    if (sound.output != nullptr) {
+      sound.output->stop();
+    }
+    delete sound.output;
+    delete sound.renderer; // Releases its GL resources, so the context must be current.
+    sound.output = nullptr;
+    sound.renderer = nullptr;
+    sound.nextSample = 0;
+    sound.lookAheadBlocks = 0;
+    sound.needsRestart = false;
+    sound.scratch.clear();
+    _renderData.hasSound = false;
+  }
+
+
+  void RenderWidget::updateSound()
+  {
+    if (!_renderData.hasSound) {
+      return;
+    }
+
+    Sound& sound = _renderData.sound;
+    const int blockSamples = sound.renderer->samplesPerBlock();
+
+    if (sound.needsRestart) {
+      // Playback has jumped, so anything already rendered is for the wrong
+      // time. Render the first block synchronously so there's something to
+      // play straight away; the rest get queued below.
+      qint64 firstSample = qMax(qint64(0), qint64(_playbackTimer.elapsedSecs() * double(sound.renderer->sampleRate())));
+      sound.renderer->discardPending();
+      sound.renderer->renderBlock(firstSample, sound.scratch);
+      sound.output->start(firstSample);
+      sound.output->write(firstSample, sound.scratch.constData(), blockSamples);
+      if (!_playbackTimer.running()) {
+        sound.output->suspend();
+      }
+      sound.nextSample = firstSample + blockSamples;
+      sound.needsRestart = false;
+    }
+
+    if (!_playbackTimer.running()) {
+      return;
+    }
+
+    // Hand any blocks the GPU has finished with over to the audio output.
+    qint64 firstSample = 0;
+    while (sound.renderer->collectBlock(firstSample, sound.scratch, false)) {
+      sound.output->write(firstSample, sound.scratch.constData(), blockSamples);
+    }
+
+    // If we've fallen so far behind that the output has already played past
+    // the next block, there's no point rendering it.
+    qint64 playhead = sound.output->readPosition();
+    if (sound.nextSample < playhead) {
+      qWarning("Sound pass fell behind playback by %lld samples", playhead - sound.nextSample);
+      sound.nextSample = playhead;
+    }
+
+    // Keep the configured number of blocks in flight ahead of the playhead.
+    qint64 horizon = playhead + qint64(sound.lookAheadBlocks + 1) * blockSamples;
+    while (sound.nextSample < horizon && sound.renderer->queueBlock(sound.nextSample)) {
+      sound.nextSample += blockSamples;
+    }
+  }
+
+
   int RenderWidget::allocVideoTexture()
   {
     int texIndex = _renderData.numTextures++;
@@ -2206,6 +2848,7 @@ namespace vh  {
                              QOpenGLTexture::RedValue,
                              QOpenGLTexture::AlphaValue);
       texObj->allocateStorage();
+      _renderData.channelResolutionsDirty = true;
     }
   }
 
@@ -2228,6 +2871,54 @@ namespace vh  {
   }
 
 
+  // GPU time is roughly proportional to the number of pixels rendered, so
+  // we use that to predict which step will fit in the target. We drop
+  // straight to that step if we're over budget, but only ever go up one
+  // step at a time and only when it should leave some headroom, so we
+  // don't keep flipping between two steps.
+  void RenderWidget::adaptRenderScale(double gpuMS)
+  {
+    _adaptiveGPUMSTotal += gpuMS;
+    if (++_adaptiveFrames < kAdaptiveSampleFrames) {
+      return;
+    }
+
+    double avgMS = _adaptiveGPUMSTotal / _adaptiveFrames;
+    _adaptiveGPUMSTotal = 0.0;
+    _adaptiveFrames = 0;
+
+    float newScale = _renderScale;
+    if (avgMS > double(_targetFrameMS)) {
+      float fitScale = _renderScale * float(qSqrt(double(_targetFrameMS) / avgMS));
+      newScale = qFloor(fitScale / kAdaptiveScaleStep) * kAdaptiveScaleStep;
+    }
+    else {
+      float upScale = _renderScale + kAdaptiveScaleStep;
+      double predictedMS = avgMS * double(upScale * upScale) / double(_renderScale * _renderScale);
+      if (predictedMS < double(_targetFrameMS * kAdaptiveHeadroom)) {
+        newScale = upScale;
+      }
+    }
+    newScale = qBound(kAdaptiveMinScale, newScale, kAdaptiveMaxScale);
+    if (newScale == _renderScale) {
+      return;
+    }
+
+    qDebug("Adaptive resolution: %.2f ms/frame on the GPU, target %.2f ms, changing render scale from %.3f to %.3f",
+           avgMS, double(_targetFrameMS), double(_renderScale), double(newScale));
+
+    // Keep the image the same size on screen, and the shader's mouse
+    // coordinates pointing at the same place in it.
+    float ratio = newScale / _renderScale;
+    _displayScale /= ratio;
+    for (int i = 0; i < 4; i++) {
+      _renderData.iMouse[i] *= ratio;
+    }
+    _renderScale = newScale;
+    _resized = true;
+  }
+
+
   void RenderWidget::updateShaderMousePos(QPoint mousePosWithFlippedY, bool setDownPos)
   {
     int dstX, dstY, dstW, dstH;
@@ -2268,6 +2959,11 @@ namespace vh  {
   void RenderWidget::reloadCurrentShaderToyDocument()
   {
     _forceReload = true;
+
+    if (!continuousRendering()) {
+      _needsRender = true;
+      update();
+    }
   }
 
 
@@ -2342,6 +3038,64 @@ namespace vh  {
   // RenderWidget private slots
   //
 
+  void RenderWidget::renderThreadFrameFinished()
+  {
+    // While paused, or while playing a shader which renders the same frame
+    // every time, the finished frame only needs displaying. Starting another
+    // one would keep us rendering the same frame over and over. The one
+    // exception is a key press: the frame after it has to see the key's
+    // "pressed" flag cleared again. Input which arrived while the frame was
+    // rendering hasn't been seen yet either, so it still needs a frame too.
+    _displayOnly = !continuousRendering() && !_needsRender && !(renderingOnDemand() && _renderData.keyboardDirty);
+    update();
+  }
+
+
+  void RenderWidget::renderThreadFailed()
+  {
+    // The widget may have been re-initialised with a working thread since.
+    if (_renderThread == nullptr || _renderThread->isValid() || !_renderFailure.isEmpty()) {
+      return;
+    }
+
+    _renderFailure = "Unable to render shaders: no OpenGL context could be set up for rendering. See the log for details.";
+    stopPlayback();
+    emit renderingFailed(_renderFailure);
+    update();
+  }
+
+
+  void RenderWidget::applyResize()
+  {
+    _resizeTimer->stop();
+    _resizePending = false;
+
+    int w = int(framebufferWidth());
+    int h = int(framebufferHeight());
+    if (w != _appliedFramebufferWidth || h != _appliedFramebufferHeight) {
+      _appliedFramebufferWidth = w;
+      _appliedFramebufferHeight = h;
+      if (_useRelativeRenderSize) {
+        // Resizing of resources will be done during the next `paintGL` call, so
+        // that we can ensure it doesn't happen while we're trying to render.
+        _resized = true;
+      }
+    }
+
+    _initialDisplayScale = _displayScale;
+    if (_displayFitWidth) {
+      _displayScale = float(framebufferWidth()) / float(renderWidth());
+    }
+    else if (_displayFitHeight) {
+      _displayScale = float(framebufferHeight()) / float(renderHeight());
+    }
+
+    recenterImage();
+    _needsRender = true;
+    update();
+  }
+
+
   void RenderWidget::fileChanged(const QString& path)
   {
     qDebug("%s changed, reloading shader", qPrintable(path));
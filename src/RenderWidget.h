@@ -7,11 +7,13 @@
 #include "Preferences.h"
 #include "RenderData.h"
 #include "ShaderToy.h"
+#include "TexturePool.h"
 #include "TextureVideoSurface.h"
 #include "Timer.h"
 
 #include <QFont>
 #include <QHash>
+#include <QImage>
 #include <QKeyEvent>
 #include <QKeySequence>
 #include <QMap>
@@ -23,6 +25,7 @@
 #include <QOpenGLTexture>
 #include <QPen>
 #include <QString>
+#include <QTimer>
 
 #include <QCamera>
 #include <QMediaPlayer>
@@ -148,10 +151,21 @@ namespace vh {
   }
 
 
+  //
+  // Forward declarations
+  //
+
+  class RenderThread;
+
+
   //
   // RenderWidget class
   //
 
+  /// Displays a running shader. The render passes themselves run on a
+  /// RenderThread; this widget owns the shader's resources, feeds in its
+  /// inputs, draws each finished frame at the chosen scale and position and
+  /// adds the HUD and other decorations on top.
   class RenderWidget :
       public QOpenGLWidget,
     #ifdef SHADERTOOL_USE_GL41
@@ -175,6 +189,21 @@ namespace vh {
 
     uint hudFlags() const;
 
+    /// Whether the current document's output only changes when its inputs
+    /// do, so it's only rendered on input, resize or reload.
+    bool renderingOnDemand() const;
+    PacingMode pacingMode() const;
+    bool passUpdateRatesEnabled() const;
+    int maxFPS() const;
+
+    /// The swap interval windows need for `mode`. It can only be set before
+    /// the window is created, so changing between modes which need
+    /// different intervals only fully takes effect after a restart.
+    static int swapIntervalForPacing(PacingMode mode);
+
+    /// Counts of GPU updates made versus skipped because nothing changed.
+    UploadStats uploadStats() const;
+
     int renderWidth() const;
     int renderHeight() const;
     int displayWidth() const;
@@ -191,6 +220,10 @@ namespace vh {
 
     void frameCaptured(const QImage& frame);
 
+    /// Emitted once if shaders can't be rendered at all, e.g. because the
+    /// render thread couldn't get an OpenGL context.
+    void renderingFailed(const QString& message);
+
   public slots:
     void startPlayback();
     void stopPlayback();
@@ -200,6 +233,15 @@ namespace vh {
 
     void setFixedRenderResolution(int w, int h);
     void setRelativeRenderResolution(float windowScale);
+    /// Scales the render resolution relative to the window, between 0.25x
+    /// and 1x, to keep the GPU time for each frame under `targetFrameMS`.
+    void setAdaptiveRenderResolution(float targetFrameMS);
+    void setPacingMode(PacingMode mode);
+    /// The frame rate used by PacingMode::eFixedRate.
+    void setMaxFPS(int fps);
+    /// Whether passes with an update rate setting in the document skip
+    /// frames. When disabled, every pass is rendered every frame.
+    void setPassUpdateRatesEnabled(bool enabled);
     void setDisplayOptions(bool fitWidth, bool fitHeight, float scale);
     void setDisplayPassByOutputID(int outputID);
     void toggleHUDFlag(uint flag);
@@ -236,9 +278,14 @@ namespace vh {
     void setupRenderData();
     void teardownRenderData();
     void updateRenderData();
+    void submitFrame();
+    bool isTimeInvariant() const;
+    bool continuousRendering() const;
+    void trackFramePacing(double frameStartMS);
     void renderMain();
     void renderIntermediates();
     void renderEmpty();
+    void renderFailure(QPainter& painter);
     void renderHUD(QPainter& painter);
 
     bool inputIsRenderPass(const ShaderToyInput& input) const;
@@ -247,15 +294,23 @@ namespace vh {
     void resizeRenderPassTexture(Texture& tex);
     bool loadImageTexture(const QString& filename, bool flip, bool srgb, Texture& tex);
     bool loadCubemapTexture(const QString& filename, bool flip, bool srgb, Texture& tex);
+    bool loadTextureSidecar(const QString& sidecarFilename, QOpenGLTexture::Target target, bool srgb, Texture& tex);
+    void saveTextureSidecar(const QString& sidecarFilename, Texture& tex);
 
     bool loadVideo(const QString& filename, bool flip, int vidIndex);
     bool loadAudio(const QString& filename, int audIndex);
 
+    bool setupSound(const ShaderToyRenderPass& soundPass);
+    void teardownSound();
+    void updateSound();
+    void updateChannelResolutions();
+
     int allocVideoTexture(); // Texture has no storage yet, because we don't know the width & height until after this is called.
     int allocAudioTexture();
     void resizeTextureForVideo(TextureVideoSurface* surface, QOpenGLTexture* texObj);
     void flipTexture(QOpenGLTexture* texObj, QOpenGLTexture* flippedTexObj);
 
+    void adaptRenderScale(double gpuMS);
     void updateShaderMousePos(QPoint mousePosWithFlippedY, bool setDownPos);
 
     float framebufferWidth() const;
@@ -268,6 +323,9 @@ namespace vh {
     void blitCubemapAsCross(QOpenGLTexture* src, int dstX, int dstY, int dstW, int dstH);
 
   private slots:
+    void renderThreadFrameFinished();
+    void renderThreadFailed();
+    void applyResize();
     void fileChanged(const QString& path);
     void videoError(QMediaPlayer::Error err, int vidIndex);
     void audioError(QMediaPlayer::Error err, int audIndex);
@@ -277,6 +335,8 @@ namespace vh {
     Timer _playbackTimer;
     float _prevTime = 0.0f;
     FPSCounter _fpsCounter;
+    TexturePool _texturePool;   // Render targets, recycled across document loads and resizes.
+    UploadStats _uploadStats;
 
     bool _showHUD = true;
     QFont _hudFont;
@@ -293,10 +353,36 @@ namespace vh {
     bool _forceReload = false;
     bool _resized = false;
 
+    // Relative render sizes are based on the framebuffer size as of the last
+    // resize we applied, which lags behind the real size while the window is
+    // being dragged. See `resizeGL`.
+    int _appliedFramebufferWidth  = 0;
+    int _appliedFramebufferHeight = 0;
+    QTimer* _resizeTimer = nullptr;   // Fires once the window size has been stable for a moment.
+    bool _resizePending  = false;
+    Timer _resizePendingTimer;        // How long since the first resize we haven't applied yet.
+
     bool _clearTextures = true;
 
     RenderData _renderData;
 
+    RenderThread* _renderThread = nullptr;
+    bool _hasFrame = false;     // Whether the front buffer holds a finished frame for the current document.
+    QString _renderFailure;     // Why nothing can be rendered, if the render thread failed.
+    bool _displayOnly = false;  // Whether the next paint should only display the latest frame, not start another.
+    bool _needsRender = false;  // Whether something has changed since the last frame was submitted which the next frame has to show, e.g. input while rendering on demand.
+    bool _timeInvariant = false;  // Whether the current document renders the same frame every time, given the same inputs.
+
+    PacingMode _pacingMode = kDefaultPacingMode;
+    int _maxFPS = kDefaultMaxFPS;
+    double _lastSubmitMS = 0.0;        // `_runtimeTimer` time when the last frame was started.
+    double _nextFrameMS = 0.0;         // When the next frame is due to start with PacingMode::eFixedRate.
+    QTimer* _frameCapTimer = nullptr;  // Starts the next frame once the fixed frame rate allows it.
+    bool _pacedLastFrame = false;      // Whether the last frame was part of a continuous run, so the next one has a deadline.
+    int _missedDeadlines = 0;          // Since the last time we logged them.
+    double _worstLatenessMS = 0.0;
+    double _missedDeadlineLogMS = 0.0;
+
     int _displayPass = -1; // Which render pass to display output from.
 
     int _renderWidth            = 800;
@@ -304,6 +390,10 @@ namespace vh {
     float _renderScale          = 0.5f;
     float _renderHeightScale    = 0.5f;
     bool _useRelativeRenderSize = false;
+    bool _useAdaptiveRenderSize = false;  // If true, `_renderScale` is adjusted to keep GPU frame times under `_targetFrameMS`.
+    float _targetFrameMS        = 16.0f;
+    double _adaptiveGPUMSTotal  = 0.0;
+    int _adaptiveFrames         = 0;
 
     bool _displayFitWidth = true;
     bool _displayFitHeight = false;
@@ -312,6 +402,7 @@ namespace vh {
     float _displayPanY = 0.0f;
 
     bool _keyboardShaderInput = false;
+    bool _usePassUpdateRates = true;
 
     QHash<KeyBinding, Action> _keyPressBindings;
     QHash<KeyBinding, Action> _keyReleaseBindings;
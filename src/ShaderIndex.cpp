@@ -0,0 +1,410 @@
+// Copyright 2019 Vilya Harvey
+#include "ShaderIndex.h"
+
+#include "ShaderToy.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QSaveFile>
+
+#include <algorithm>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  // Fields which a bare word in a query is matched against.
+  static const char* kTextFields[] = { "name", "user", "tag", "desc" };
+
+
+  //
+  // Private helper functions
+  //
+
+  static QStringList words(const QString& text)
+  {
+    static const QRegularExpression kSeparators("[^\\w]+", QRegularExpression::UseUnicodePropertiesOption);
+    return text.toLower().split(kSeparators, QString::SkipEmptyParts);
+  }
+
+
+  static QStringList termsForRecord(const ShaderIndexRecord& record)
+  {
+    QStringList terms;
+    for (const QString& word : words(record.name)) {
+      terms.append("name:" + word);
+    }
+    for (const QString& word : words(record.username)) {
+      terms.append("user:" + word);
+    }
+    for (const QString& tag : record.tags) {
+      for (const QString& word : words(tag)) {
+        terms.append("tag:" + word);
+      }
+    }
+    for (const QString& word : words(record.description)) {
+      terms.append("desc:" + word);
+    }
+    for (const QString& type : record.passTypes) {
+      terms.append("pass:" + type.toLower());
+    }
+    for (const QString& type : record.inputTypes) {
+      terms.append("input:" + type.toLower());
+    }
+    return terms;
+  }
+
+
+  // Turns one word of a query into the index terms it has to match, all of
+  // them. Text is split into words the same way as when it was indexed, so
+  // `ray-marching` matches shaders with both "ray" and "marching". A field
+  // prefix applies to every word and a trailing `*` to the last one.
+  static QStringList termsForQueryWord(const QString& queryWord)
+  {
+    QString field;
+    QString value = queryWord;
+    int colon = queryWord.indexOf(':');
+    if (colon > 0) {
+      field = queryWord.left(colon + 1);
+      value = queryWord.mid(colon + 1);
+    }
+
+    bool prefixMatch = value.endsWith('*');
+    if (prefixMatch) {
+      value.chop(1);
+    }
+
+    // Pass and input types are indexed whole.
+    QStringList valueWords;
+    if (field == "pass:" || field == "input:") {
+      if (!value.isEmpty()) {
+        valueWords.append(value);
+      }
+    }
+    else {
+      valueWords = words(value);
+    }
+
+    QStringList terms;
+    for (const QString& word : valueWords) {
+      terms.append(field + word);
+    }
+    if (prefixMatch && !terms.isEmpty()) {
+      terms.last() += '*';
+    }
+    return terms;
+  }
+
+
+  static QJsonArray toJSONArray(const QStringList& list)
+  {
+    QJsonArray array;
+    for (const QString& item : list) {
+      array.append(item);
+    }
+    return array;
+  }
+
+
+  static QStringList fromJSONArray(const QJsonValue& value)
+  {
+    QStringList list;
+    for (const QJsonValue& item : value.toArray()) {
+      list.append(item.toString());
+    }
+    return list;
+  }
+
+
+  //
+  // ShaderIndex public methods
+  //
+
+  ShaderIndex::ShaderIndex()
+  {
+  }
+
+
+  bool ShaderIndex::load(const QString& filename)
+  {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+      return false;
+    }
+
+    QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+    if (json["version"].toInt() != kShaderIndexVersion) {
+      qDebug("Ignoring shader index with unsupported version %d", json["version"].toInt());
+      return false;
+    }
+
+    QMutexLocker lock(&_lock);
+    _records.clear();
+    _postings.clear();
+
+    QJsonObject shaders = json["shaders"].toObject();
+    for (auto it = shaders.constBegin(); it != shaders.constEnd(); ++it) {
+      QJsonObject obj = it.value().toObject();
+      ShaderIndexRecord record;
+      record.id          = it.key();
+      record.sha256      = obj["sha256"].toString().toLatin1();
+      record.name        = obj["name"].toString();
+      record.username    = obj["username"].toString();
+      record.description = obj["description"].toString();
+      record.tags        = fromJSONArray(obj["tags"]);
+      record.passTypes   = fromJSONArray(obj["passes"]);
+      record.inputTypes  = fromJSONArray(obj["inputs"]);
+      addRecordLocked(record);
+    }
+    _dirty = false;
+    return true;
+  }
+
+
+  bool ShaderIndex::save(const QString& filename) const
+  {
+    QJsonObject shaders;
+    {
+      QMutexLocker lock(&_lock);
+      for (const ShaderIndexRecord& record : _records) {
+        QJsonObject obj;
+        obj["sha256"]      = QString::fromLatin1(record.sha256);
+        obj["name"]        = record.name;
+        obj["username"]    = record.username;
+        obj["description"] = record.description;
+        obj["tags"]        = toJSONArray(record.tags);
+        obj["passes"]      = toJSONArray(record.passTypes);
+        obj["inputs"]      = toJSONArray(record.inputTypes);
+        shaders[record.id] = obj;
+      }
+      _dirty = false;
+    }
+
+    QJsonObject json;
+    json["version"] = kShaderIndexVersion;
+    json["shaders"] = shaders;
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+      qWarning("Unable to save shader index %s: %s", qPrintable(filename), qPrintable(file.errorString()));
+      _dirty = true;
+      return false;
+    }
+    file.write(QJsonDocument(json).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+      qWarning("Unable to save shader index %s: %s", qPrintable(filename), qPrintable(file.errorString()));
+      _dirty = true;
+      return false;
+    }
+    return true;
+  }
+
+
+  bool ShaderIndex::isDirty() const
+  {
+    return _dirty;
+  }
+
+
+  bool ShaderIndex::isUpToDate(const QString& id, const QByteArray& sha256) const
+  {
+    QMutexLocker lock(&_lock);
+    auto it = _records.constFind(id);
+    return it != _records.constEnd() && !sha256.isEmpty() && it->sha256 == sha256;
+  }
+
+
+  void ShaderIndex::update(const QString& id, const QByteArray& sha256, const ShaderToyDocument& doc)
+  {
+    ShaderIndexRecord record;
+    record.id          = id;
+    record.sha256      = sha256;
+    record.name        = doc.info.name;
+    record.username    = doc.info.username;
+    record.description = doc.info.description;
+    record.tags        = doc.info.tags;
+    for (const ShaderToyRenderPass& pass : doc.renderpasses) {
+      record.passTypes.append(pass.type);
+      for (const ShaderToyInput& input : pass.inputs) {
+        if (!input.ctype.isEmpty() && !record.inputTypes.contains(input.ctype)) {
+          record.inputTypes.append(input.ctype);
+        }
+      }
+    }
+
+    QMutexLocker lock(&_lock);
+    removeRecordLocked(id);
+    addRecordLocked(record);
+    _dirty = true;
+  }
+
+
+  void ShaderIndex::remove(const QString& id)
+  {
+    QMutexLocker lock(&_lock);
+    if (_records.contains(id)) {
+      removeRecordLocked(id);
+      _dirty = true;
+    }
+  }
+
+
+  void ShaderIndex::clear()
+  {
+    QMutexLocker lock(&_lock);
+    _records.clear();
+    _postings.clear();
+    _dirty = true;
+  }
+
+
+  QStringList ShaderIndex::ids() const
+  {
+    QMutexLocker lock(&_lock);
+    return _records.keys();
+  }
+
+
+  int ShaderIndex::size() const
+  {
+    QMutexLocker lock(&_lock);
+    return _records.size();
+  }
+
+
+  QVector<ShaderIndexRecord> ShaderIndex::search(const QString& query) const
+  {
+    // An excluded word may turn into several terms, in which case only the
+    // shaders matching all of them are excluded.
+    QStringList include;
+    QVector<QStringList> exclude;
+    for (const QString& queryWord : query.toLower().split(' ', QString::SkipEmptyParts)) {
+      if (queryWord.startsWith('-') && queryWord.size() > 1) {
+        QStringList terms = termsForQueryWord(queryWord.mid(1));
+        if (!terms.isEmpty()) {
+          exclude.append(terms);
+        }
+      }
+      else {
+        include.append(termsForQueryWord(queryWord));
+      }
+    }
+
+    QVector<ShaderIndexRecord> results;
+    if (include.isEmpty()) {
+      return results;
+    }
+
+    QMutexLocker lock(&_lock);
+
+    // Intersect the matches for each term, starting with the smallest set so
+    // that the intersections stay cheap.
+    QVector<QSet<QString>> matches;
+    for (const QString& term : include) {
+      matches.append(matchTermLocked(term));
+      if (matches.last().isEmpty()) {
+        return results;
+      }
+    }
+    std::sort(matches.begin(), matches.end(), [](const QSet<QString>& a, const QSet<QString>& b) {
+      return a.size() < b.size();
+    });
+
+    QSet<QString> ids = matches[0];
+    for (int i = 1; i < matches.size() && !ids.isEmpty(); i++) {
+      ids.intersect(matches[i]);
+    }
+    for (const QStringList& terms : exclude) {
+      QSet<QString> excluded = matchTermLocked(terms[0]);
+      for (int i = 1; i < terms.size() && !excluded.isEmpty(); i++) {
+        excluded.intersect(matchTermLocked(terms[i]));
+      }
+      ids.subtract(excluded);
+    }
+
+    results.reserve(ids.size());
+    for (const QString& id : ids) {
+      results.append(_records.value(id));
+    }
+    std::sort(results.begin(), results.end(), [](const ShaderIndexRecord& a, const ShaderIndexRecord& b) {
+      int cmp = QString::compare(a.name, b.name, Qt::CaseInsensitive);
+      return (cmp != 0) ? (cmp < 0) : (a.id < b.id);
+    });
+    return results;
+  }
+
+
+  //
+  // ShaderIndex private methods
+  //
+
+  // The caller must be holding `_lock`.
+  void ShaderIndex::addRecordLocked(const ShaderIndexRecord& record)
+  {
+    _records.insert(record.id, record);
+    for (const QString& term : termsForRecord(record)) {
+      _postings[term].insert(record.id);
+    }
+  }
+
+
+  // The caller must be holding `_lock`.
+  void ShaderIndex::removeRecordLocked(const QString& id)
+  {
+    auto it = _records.find(id);
+    if (it == _records.end()) {
+      return;
+    }
+    for (const QString& term : termsForRecord(it.value())) {
+      auto posting = _postings.find(term);
+      if (posting != _postings.end()) {
+        posting->remove(id);
+        if (posting->isEmpty()) {
+          _postings.erase(posting);
+        }
+      }
+    }
+    _records.erase(it);
+  }
+
+
+  // The caller must be holding `_lock`.
+  QSet<QString> ShaderIndex::matchTermLocked(const QString& term) const
+  {
+    QStringList keys;
+    int colon = term.indexOf(':');
+    if (colon > 0) {
+      keys.append(term);
+    }
+    else {
+      for (const char* field : kTextFields) {
+        keys.append(QString("%1:%2").arg(field).arg(term));
+      }
+    }
+
+    QSet<QString> ids;
+    for (const QString& key : keys) {
+      if (key.endsWith('*')) {
+        // Prefix matches have to look at every term, but there are only a
+        // few tens of thousands of those even for a big cache.
+        QString prefix = key.left(key.size() - 1);
+        for (auto it = _postings.constBegin(); it != _postings.constEnd(); ++it) {
+          if (it.key().startsWith(prefix)) {
+            ids.unite(it.value());
+          }
+        }
+      }
+      else {
+        ids.unite(_postings.value(key));
+      }
+    }
+    return ids;
+  }
+
+} // namespace vh
@@ -0,0 +1,103 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_SHADERINDEX_H
+#define VH_SHADERINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+
+namespace vh {
+
+  //
+  // Forward declarations
+  //
+
+  struct ShaderToyDocument;
+
+
+  //
+  // Constants
+  //
+
+  static constexpr int kShaderIndexVersion = 1;
+
+
+  //
+  // Structs
+  //
+
+  struct ShaderIndexRecord {
+    QString id;
+    QByteArray sha256;        // Of the JSON file the record was made from. Hex encoded.
+    QString name;
+    QString username;
+    QString description;
+    QStringList tags;
+    QStringList passTypes;    // One per pass, e.g. "image", "buffer", "cubemap".
+    QStringList inputTypes;   // Distinct input ctypes across all passes, e.g. "texture", "music".
+  };
+
+
+  //
+  // ShaderIndex class
+  //
+
+  /// A searchable index of shader metadata, so we can find shaders in the
+  /// cache without parsing any JSON.
+  ///
+  /// Each shader's name, username, tags and description are split into
+  /// lower case words, and its pass types and input types are added as
+  /// whole terms. An inverted index maps each term onto the IDs of the
+  /// shaders containing it. A query is a list of terms which must all match:
+  ///
+  /// - `word` matches the name, username, tags or description.
+  /// - `name:`, `user:`, `tag:`, `desc:`, `pass:` or `input:` before a term
+  ///   restricts it to that field, e.g. `pass:cubemap` or `input:music`.
+  /// - `*` at the end of a term matches any word starting with it.
+  /// - `-` in front of a term excludes shaders which match it.
+  ///
+  /// All methods are thread safe.
+  class ShaderIndex
+  {
+  public:
+    ShaderIndex();
+
+    bool load(const QString& filename);
+    bool save(const QString& filename) const;
+    bool isDirty() const;
+
+    /// True if we have a record for `id` made from a file with this hash.
+    bool isUpToDate(const QString& id, const QByteArray& sha256) const;
+
+    void update(const QString& id, const QByteArray& sha256, const ShaderToyDocument& doc);
+    void remove(const QString& id);
+    void clear();
+
+    QStringList ids() const;
+    int size() const;
+
+    /// Records for every shader matching `query`, sorted by name. An empty
+    /// query matches nothing.
+    QVector<ShaderIndexRecord> search(const QString& query) const;
+
+  private:
+    void addRecordLocked(const ShaderIndexRecord& record);
+    void removeRecordLocked(const QString& id);
+    QSet<QString> matchTermLocked(const QString& term) const;
+
+  private:
+    QHash<QString, ShaderIndexRecord> _records;   // Keyed by shader ID.
+    QHash<QString, QSet<QString>> _postings;      // "field:word" -> IDs of the shaders containing it.
+    mutable QMutex _lock;
+    mutable std::atomic<bool> _dirty { false };
+  };
+
+} // namespace vh
+
+#endif // VH_SHADERINDEX_H
@@ -0,0 +1,210 @@
+// Copyright 2019 Vilya Harvey
+#include "ShaderTemplate.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // Private types
+  //
+
+  struct ShaderTemplateSegment {
+    QString text;   // Literal text to copy into the output...
+    QString macro;  // ...or, if this is non-empty, the name of the macro whose value goes here instead.
+  };
+
+
+  //
+  // Private variables
+  //
+
+  // Templates are shared by the GUI thread and the offline renderers, so
+  // access to the cache is serialised.
+  static QMutex gTemplateCacheMutex;
+  static QHash<QString, QVector<ShaderTemplateSegment>> gTemplateCache;
+
+
+  //
+  // Private helper functions
+  //
+
+  // Splits a template into runs of literal text and `#macro` lines. Each
+  // `#macro` line's newline stays in the text which follows it, so a macro
+  // value replaces the directive but not the line break.
+  static QVector<ShaderTemplateSegment> parseTemplate(const QString& code)
+  {
+    QVector<ShaderTemplateSegment> segments;
+    QString text;
+
+    int lineStart = 0;
+    while (lineStart < code.size()) {
+      int lineEnd = code.indexOf('\n', lineStart);
+      if (lineEnd == -1) {
+        lineEnd = code.size();
+      }
+
+      QStringRef line = code.midRef(lineStart, lineEnd - lineStart);
+      if (line.startsWith("#macro")) {
+        if (!text.isEmpty()) {
+          segments.push_back(ShaderTemplateSegment{ text, QString() });
+          text.clear();
+        }
+        segments.push_back(ShaderTemplateSegment{ QString(), line.mid(6).trimmed().toString() });
+      }
+      else {
+        text += line;
+      }
+      if (lineEnd < code.size()) {
+        text += '\n';
+      }
+
+      lineStart = lineEnd + 1;
+    }
+
+    if (!text.isEmpty()) {
+      segments.push_back(ShaderTemplateSegment{ text, QString() });
+    }
+    return segments;
+  }
+
+
+  // Returns the file name from an `#include "name"` or `#include <name>`
+  // line, or an empty string if it isn't one.
+  static QString includeName(const QString& trimmedLine)
+  {
+    if (!trimmedLine.startsWith("#include")) {
+      return QString();
+    }
+
+    QString rest = trimmedLine.mid(8).trimmed();
+    if (rest.size() < 2) {
+      return QString();
+    }
+    QChar close = (rest[0] == '"') ? QChar('"') : (rest[0] == '<') ? QChar('>') : QChar();
+    if (close.isNull()) {
+      return QString();
+    }
+    int end = rest.indexOf(close, 1);
+    return (end > 1) ? rest.mid(1, end - 1) : QString();
+  }
+
+
+  static QString expandIncludesIn(const QString& code, const QDir& dir, int sourceString, ShaderIncludes& includes)
+  {
+    // Most code doesn't include anything, so avoid copying it.
+    if (!code.contains("#include")) {
+      return code;
+    }
+
+    QString out;
+    out.reserve(code.size());
+
+    const QStringList lines = code.split('\n');
+    for (int i = 0; i < lines.size(); i++) {
+      if (i > 0) {
+        out += '\n';
+      }
+
+      const QString& line = lines[i];
+      QString name = includeName(line.trimmed());
+      if (name.isEmpty()) {
+        out += line;
+        continue;
+      }
+
+      // Leave the line blank rather than removing it, so the line numbers
+      // of everything after it don't change.
+      QString path = QDir::cleanPath(dir.absoluteFilePath(name));
+      if (includes.files.contains(path)) {
+        continue;
+      }
+
+      QFile file(path);
+      if (!file.open(QIODevice::ReadOnly)) {
+        qWarning("Unable to include %s: %s", qPrintable(path), qPrintable(file.errorString()));
+        out += QString("#error unable to include \"%1\"").arg(name);
+        continue;
+      }
+      QString included = QString::fromLatin1(file.readAll());
+      file.close();
+
+      includes.files.push_back(path);
+      int includedString = kSourceString_FirstInclude + includes.files.size() - 1;
+      qDebug("Including %s as source string %d", qPrintable(path), includedString);
+
+      out += QString("#line 1 %1\n").arg(includedString);
+      out += expandIncludesIn(included, QFileInfo(path).absoluteDir(), includedString, includes);
+      out += QString("\n#line %1 %2").arg(i + 2).arg(sourceString);
+    }
+
+    return out;
+  }
+
+
+  //
+  // Public functions
+  //
+
+  QString preprocessShaderSource(const QString& filename, const QMap<QString, QString>& macros)
+  {
+    QVector<ShaderTemplateSegment> segments;
+    {
+      QMutexLocker lock(&gTemplateCacheMutex);
+      auto it = gTemplateCache.constFind(filename);
+      if (it != gTemplateCache.constEnd()) {
+        segments = it.value();
+      }
+      else {
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly)) {
+          return "";
+        }
+        segments = parseTemplate(QString::fromLocal8Bit(file.readAll()));
+        file.close();
+        gTemplateCache.insert(filename, segments);
+      }
+    }
+
+    // Work out the final size first, so the output is only allocated once.
+    int size = 0;
+    for (const ShaderTemplateSegment& segment : segments) {
+      size += segment.macro.isEmpty() ? segment.text.size() : macros.value(segment.macro).size();
+    }
+
+    QString code;
+    code.reserve(size);
+    for (const ShaderTemplateSegment& segment : segments) {
+      if (segment.macro.isEmpty()) {
+        code += segment.text;
+        continue;
+      }
+      auto it = macros.constFind(segment.macro);
+      if (it != macros.constEnd()) {
+        code += it.value();
+      }
+    }
+    return code;
+  }
+
+
+  QString expandIncludes(const QString& code, int sourceString, ShaderIncludes& includes)
+  {
+    return expandIncludesIn(code, includes.refDir, sourceString, includes);
+  }
+
+
+  QDir includeDirForPass(const QDir& refDir, const QString& filename)
+  {
+    if (filename.isEmpty()) {
+      return refDir;
+    }
+    return QFileInfo(refDir.absoluteFilePath(filename)).absoluteDir();
+  }
+
+} // namespace vh
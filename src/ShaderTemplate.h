@@ -0,0 +1,67 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_SHADERTEMPLATE_H
+#define VH_SHADERTEMPLATE_H
+
+// Code for turning the GLSL templates in our resources into compilable
+// shader source.
+
+#include <QDir>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  // GLSL source string numbers used in `#line` directives, so compile errors
+  // say which piece of code they're in. See template.frag.
+  static constexpr int kSourceString_Template     = 0;
+  static constexpr int kSourceString_User         = 1;
+  static constexpr int kSourceString_Common       = 2;
+  static constexpr int kSourceString_FirstInclude = 3; // Included files are numbered from here, in the order they were first included.
+
+
+  //
+  // Structs
+  //
+
+  /// The files `#include`d so far while expanding the code for one program.
+  struct ShaderIncludes {
+    QDir refDir;        // Relative includes in the top level code are resolved against this. Common and user code can live in different directories, so set it before expanding each.
+    QStringList files;  // Absolute paths, in the order they were first included. File `i` is source string `kSourceString_FirstInclude + i`.
+  };
+
+
+  //
+  // Public functions
+  //
+
+  /// Loads the template `filename` and replaces each `#macro <NAME>` line in
+  /// it with the corresponding value from `macros`. Any `#macro` lines which
+  /// don't have a value are removed.
+  ///
+  /// Each template is only read and parsed the first time it's used. After
+  /// that, it's kept as a list of literal text segments and macro slots, so
+  /// the source is put together in a single pass without searching it.
+  QString preprocessShaderSource(const QString& filename, const QMap<QString, QString>& macros);
+
+  /// Replaces each `#include "file"` line in `code` with the contents of that
+  /// file, recursively. Paths are relative to the file doing the including,
+  /// or to `includes.refDir` for `code` itself. Like a header with include
+  /// guards, each file is only included once per `includes`, so use the same
+  /// one for a program's common and user code. `#line` directives are added
+  /// around each included file so compile errors point at the right line.
+  /// A file which can't be read is replaced with an `#error`.
+  QString expandIncludes(const QString& code, int sourceString, ShaderIncludes& includes);
+
+  /// The directory relative `#include`s in a pass's code are resolved
+  /// against: the one holding its external code file if it has one, given
+  /// by `filename` relative to `refDir`, otherwise `refDir` itself.
+  QDir includeDirForPass(const QDir& refDir, const QString& filename);
+
+} // namespace vh
+
+#endif // VH_SHADERTEMPLATE_H
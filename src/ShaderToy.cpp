@@ -1,6 +1,10 @@
 // Copyright 2019 Vilya Harvey
 #include "ShaderToy.h"
 
+#include "ShaderTemplate.h"
+#include "ShaderToyReader.h"
+#include "Timer.h"
+
 #include <QFile>
 #include <QFileInfo>
 #include <QJsonArray>
@@ -10,6 +14,7 @@
 #include <QMap>
 #include <QMessageLogger>
 
+#include <memory>
 #include <stdexcept>
 
 namespace vh {
@@ -184,6 +189,10 @@ namespace vh {
 
     filename    = json["filename"].toString();
 
+    updateEvery  = qMax(1, json["updateEvery"].toInt(1));
+    renderOnce   = json["renderOnce"].toBool(false);
+    timeBudgetMS = qMax(0.0, json["timeBudgetMS"].toDouble(0.0));
+
     QJsonArray jsonInputs = json["inputs"].toArray();
     inputs.clear();
     for (int i = 0; i < jsonInputs.size(); i++) {
@@ -213,6 +222,18 @@ namespace vh {
 
     json["filename"]    = filename;
 
+    // Leave out the update rate settings unless they've been changed, so
+    // documents which don't use them stay as close to standard as possible.
+    if (updateEvery != 1) {
+      json["updateEvery"] = updateEvery;
+    }
+    if (renderOnce) {
+      json["renderOnce"] = true;
+    }
+    if (timeBudgetMS > 0.0) {
+      json["timeBudgetMS"] = timeBudgetMS;
+    }
+
     QJsonArray jsonInputs;
     for (int i = 0; i < inputs.size(); i++) {
       jsonInputs.push_back(inputs[i].toJSON());
@@ -455,33 +476,60 @@ namespace vh {
   // Public functions
   //
 
-  ShaderToyDocument* loadShaderToyJSONFile(const QString& filename)
+  ShaderToyDocument* loadShaderToyJSONFile(const QString& filename, ShaderToyLoadMode mode, ShaderToyLoadStats* stats)
   {
+    Timer timer(true);
+
     QFile file(filename);
     if (!file.open(QIODevice::ReadOnly)) {
       throw std::runtime_error("Failed to open ShaderToy file for reading");
     }
 
-    QJsonDocument jsonDoc = QJsonDocument::fromJson(file.readAll());
+    // Parse straight out of a memory mapping where possible, so the file
+    // contents are never copied.
+    QByteArray contents;
+    const char* data = nullptr;
+    qint64 size = file.size();
+    uchar* mapped = (size > 0) ? file.map(0, size) : nullptr;
+    if (mapped != nullptr) {
+      data = reinterpret_cast<const char*>(mapped);
+    }
+    else {
+      contents = file.readAll();
+      data = contents.constData();
+      size = contents.size();
+    }
+    double readSecs = timer.elapsedSecs();
+
+    std::unique_ptr<ShaderToyDocument> document(new ShaderToyDocument());
+    ShaderToyReader reader(data, size, mode);
+    bool ok = reader.read(*document);
+
+    if (mapped != nullptr) {
+      file.unmap(mapped);
+    }
     file.close();
 
-    QJsonObject json = jsonDoc.object();
-    if (json.contains("Error")) {
-      QString err = QString("ShaderToy error: %1").arg(json["Error"].toString());
-      throw std::runtime_error(err.toStdString());
+    if (!ok) {
+      throw std::runtime_error(reader.errorString().toStdString());
     }
 
-    ShaderToyDocument* document = new ShaderToyDocument();
     QFileInfo fileInfo(filename);
     document->src = filename;
     document->refDir = fileInfo.absoluteDir();
-    document->fromJSON(json["Shader"].toObject());
-    if (!document->isValid()) {
-      throw std::runtime_error("File contains invalid data");
+    if (mode == ShaderToyLoadMode::eFull) {
+      if (!document->isValid()) {
+        throw std::runtime_error("File contains invalid data");
+      }
+      document->loadExternalCode();
     }
-    document->loadExternalCode();
 
-    return document;
+    if (stats != nullptr) {
+      stats->bytes = size;
+      stats->readSecs = readSecs;
+      stats->parseSecs = timer.elapsedSecs() - readSecs;
+    }
+    return document.release();
   }
 
 
@@ -602,6 +650,19 @@ namespace vh {
         qDebug("Watching file %s", qPrintable(pass.filename));
       }
     }
+
+    // Editing a file which any of the passes #include should reload the
+    // document too. This walks the same include graph the passes will be
+    // compiled from, so it's exactly the set of files they depend on.
+    ShaderIncludes includes;
+    for (const ShaderToyRenderPass& pass : document->renderpasses) {
+      includes.refDir = includeDirForPass(document->refDir, pass.filename);
+      expandIncludes(pass.code, kSourceString_User, includes);
+    }
+    for (const QString& path : includes.files) {
+      watcher.addPath(path);
+      qDebug("Watching included file %s", qPrintable(path));
+    }
   }
 
 
@@ -35,6 +35,8 @@ namespace vh {
   static const QString kInputType_Video     = "video";
   static const QString kInputType_Webcam    = "webcam";
   static const QString kInputType_Music     = "music";
+  static const QString kInputType_Mic       = "mic";
+  static const QString kInputType_PCMStream = "pcmstream"; // non-standard: raw PCM from a named pipe, file or stdin.
 
   static const QString kSamplerFilterType_Nearest = "nearest";
   static const QString kSamplerFilterType_Linear  = "linear";
@@ -55,10 +57,28 @@ namespace vh {
   static const int kOutputID_BufD = 260;
 
 
+  //
+  // Enums
+  //
+
+  enum class ShaderToyLoadMode {
+    eFull,
+    eAssetsOnly,  // Only the shader ID and each pass's type & inputs; enough to find out which assets it uses.
+    eMetadata,    // Everything except the code of each pass.
+  };
+
+
   //
   // Structs
   //
 
+  struct ShaderToyLoadStats {
+    qint64 bytes     = 0;
+    double readSecs  = 0.0;  // Time taken to open & map (or read) the file.
+    double parseSecs = 0.0;  // Time taken to parse the JSON into a ShaderToyDocument.
+  };
+
+
   struct ShaderToySampler {
     QString filter;
     QString wrap;
@@ -129,6 +149,12 @@ namespace vh {
 
     QString filename; // optional, non-standard.
 
+    // Optional, non-standard: how often the pass is re-rendered. On the
+    // frames in between it keeps its previous output.
+    int updateEvery     = 1;      // Render every Nth frame.
+    bool renderOnce     = false;  // Only render on the first frame after the outputs are cleared or resized.
+    double timeBudgetMS = 0.0;    // Average GPU time per frame the pass may use, 0 for no limit.
+
     void fromJSON(const QJsonObject& json);
     QJsonObject toJSON() const;
 
@@ -164,7 +190,13 @@ namespace vh {
   };
 
 
-  ShaderToyDocument* loadShaderToyJSONFile(const QString& filename);
+  /// Throws a std::runtime_error if the file can't be read or doesn't
+  /// contain a valid shader. In the eAssetsOnly and eMetadata modes the
+  /// document is only partially filled in, isn't validated and doesn't load
+  /// external code.
+  ShaderToyDocument* loadShaderToyJSONFile(const QString& filename,
+                                           ShaderToyLoadMode mode = ShaderToyLoadMode::eFull,
+                                           ShaderToyLoadStats* stats = nullptr);
   void saveShaderToyJSONFile(const ShaderToyDocument* document, const QString& filename);
 
   ShaderToyDocument* defaultShaderToyDocument();
@@ -1,6 +1,8 @@
 // Copyright 2019 Vilya Harvey
 #include "ShaderToyDownloadForm.h"
 
+#include "FileCache.h"
+
 #include <QDialog>
 #include <QDialogButtonBox>
 #include <QLabel>
@@ -9,12 +11,20 @@
 
 namespace vh {
 
+  //
+  // Constants
+  //
+
+  static constexpr int kMaxSearchResults = 500;
+
+
   //
   // ShaderToyDownloadForm public methods
   //
 
-  ShaderToyDownloadForm::ShaderToyDownloadForm(QWidget *parent) :
-    QDialog(parent)
+  ShaderToyDownloadForm::ShaderToyDownloadForm(FileCache* cache, QWidget *parent) :
+    QDialog(parent),
+    _cache(cache)
   {
     setSizeGripEnabled(true);
 
@@ -31,11 +41,32 @@ namespace vh {
     buttons->addButton(QString("Download"), QDialogButtonBox::AcceptRole);
     buttons->addButton(QDialogButtonBox::Cancel);
 
-    topLayout->addWidget(shaderIDLabel,       0, 0);
-    topLayout->addWidget(_shaderIDField,      0, 1);
-    topLayout->addWidget(forceDownloadLabel,  1, 0);
-    topLayout->addWidget(_forceDownloadField, 1, 1);
-    topLayout->addWidget(buttons,             2, 0, 1, 2);
+    int row = 0;
+    if (_cache != nullptr) {
+      _searchField = new QLineEdit();
+      _searchField->setPlaceholderText("e.g. clouds tag:raymarching pass:cubemap -input:video");
+      _searchResults = new QListWidget();
+
+      QLabel* searchLabel = new QLabel("Search cached shaders");
+
+      topLayout->addWidget(searchLabel,    row, 0);
+      topLayout->addWidget(_searchField,   row, 1);
+      ++row;
+      topLayout->addWidget(_searchResults, row, 0, 1, 2);
+      ++row;
+
+      connect(_searchField, &QLineEdit::textChanged, this, &ShaderToyDownloadForm::onSearchTextChanged);
+      connect(_searchResults, &QListWidget::currentItemChanged, this, &ShaderToyDownloadForm::onSearchResultSelected);
+      connect(_searchResults, &QListWidget::itemDoubleClicked, this, &ShaderToyDownloadForm::accept);
+    }
+
+    topLayout->addWidget(shaderIDLabel,       row, 0);
+    topLayout->addWidget(_shaderIDField,      row, 1);
+    ++row;
+    topLayout->addWidget(forceDownloadLabel,  row, 0);
+    topLayout->addWidget(_forceDownloadField, row, 1);
+    ++row;
+    topLayout->addWidget(buttons,             row, 0, 1, 2);
 
     connect(buttons, &QDialogButtonBox::accepted, this, &ShaderToyDownloadForm::accept);
     connect(buttons, &QDialogButtonBox::rejected, this, &ShaderToyDownloadForm::reject);
@@ -84,4 +115,31 @@ namespace vh {
   }
 
 
+  void ShaderToyDownloadForm::onSearchTextChanged(const QString& text)
+  {
+    _searchResults->clear();
+
+    QVector<ShaderIndexRecord> results = _cache->searchShaders(text);
+    for (int i = 0; i < results.size() && i < kMaxSearchResults; i++) {
+      const ShaderIndexRecord& record = results[i];
+      QListWidgetItem* item = new QListWidgetItem(QString("%1 by %2 (%3)").arg(record.name).arg(record.username).arg(record.id));
+      item->setData(Qt::UserRole, record.id);
+      _searchResults->addItem(item);
+    }
+    if (results.size() > kMaxSearchResults) {
+      QListWidgetItem* item = new QListWidgetItem(QString("...and %1 more").arg(results.size() - kMaxSearchResults));
+      item->setFlags(Qt::NoItemFlags);
+      _searchResults->addItem(item);
+    }
+  }
+
+
+  void ShaderToyDownloadForm::onSearchResultSelected(QListWidgetItem* item)
+  {
+    if (item != nullptr && !item->data(Qt::UserRole).toString().isEmpty()) {
+      _shaderIDField->setText(item->data(Qt::UserRole).toString());
+    }
+  }
+
+
 } // namespace vh
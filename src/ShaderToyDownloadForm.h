@@ -5,16 +5,30 @@
 #include <QCheckBox>
 #include <QDialog>
 #include <QLineEdit>
+#include <QListWidget>
 #include <QString>
 #include <QWidget>
 
 namespace vh {
 
+  //
+  // Forward declarations
+  //
+
+  class FileCache;
+
+
+  //
+  // ShaderToyDownloadForm class
+  //
+
+  /// Asks for a shader to download. If given a cache, it can also search the
+  /// shaders which have already been downloaded.
   class ShaderToyDownloadForm : public QDialog
   {
     Q_OBJECT
   public:
-    explicit ShaderToyDownloadForm(QWidget *parent = nullptr);
+    explicit ShaderToyDownloadForm(FileCache* cache = nullptr, QWidget *parent = nullptr);
     virtual ~ShaderToyDownloadForm();
 
     QString selectedShaderID() const;
@@ -28,8 +42,13 @@ namespace vh {
 
   private slots:
     void onDownloadButtonClicked();
+    void onSearchTextChanged(const QString& text);
+    void onSearchResultSelected(QListWidgetItem* item);
 
   private:
+    FileCache* _cache              = nullptr;
+    QLineEdit* _searchField        = nullptr;
+    QListWidget* _searchResults    = nullptr;
     QLineEdit* _shaderIDField      = nullptr;
     QCheckBox* _forceDownloadField = nullptr;
   };
@@ -0,0 +1,816 @@
+// Copyright 2019 Vilya Harvey
+#include "ShaderToyReader.h"
+
+#include <cctype>
+#include <cstring>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static const char kUTF8BOM[] = "\xEF\xBB\xBF";
+
+
+  //
+  // Private helper functions
+  //
+
+  static bool readHex4(const char*& pos, const char* end, uint& value)
+  {
+    if (end - pos < 4) {
+      return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+      char c = *pos++;
+      value <<= 4;
+      if (c >= '0' && c <= '9') {
+        value |= uint(c - '0');
+      }
+      else if (c >= 'a' && c <= 'f') {
+        value |= uint(c - 'a' + 10);
+      }
+      else if (c >= 'A' && c <= 'F') {
+        value |= uint(c - 'A' + 10);
+      }
+      else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  static void appendUTF8(QByteArray& out, uint codepoint)
+  {
+    if (codepoint < 0x80) {
+      out.append(char(codepoint));
+    }
+    else if (codepoint < 0x800) {
+      out.append(char(0xC0 | (codepoint >> 6)));
+      out.append(char(0x80 | (codepoint & 0x3F)));
+    }
+    else if (codepoint < 0x10000) {
+      out.append(char(0xE0 | (codepoint >> 12)));
+      out.append(char(0x80 | ((codepoint >> 6) & 0x3F)));
+      out.append(char(0x80 | (codepoint & 0x3F)));
+    }
+    else {
+      out.append(char(0xF0 | (codepoint >> 18)));
+      out.append(char(0x80 | ((codepoint >> 12) & 0x3F)));
+      out.append(char(0x80 | ((codepoint >> 6) & 0x3F)));
+      out.append(char(0x80 | (codepoint & 0x3F)));
+    }
+  }
+
+
+  // Decodes the body of a string containing escapes, starting at `pos` and
+  // stopping at (but not consuming) the closing quote.
+  static bool unescape(const char*& pos, const char* end, QByteArray& out)
+  {
+    while (pos < end && *pos != '"') {
+      char c = *pos++;
+      if (c != '\\') {
+        out.append(c);
+        continue;
+      }
+      if (pos >= end) {
+        return false;
+      }
+      char e = *pos++;
+      switch (e) {
+      case '"':
+      case '\\':
+      case '/': out.append(e);    break;
+      case 'b': out.append('\b'); break;
+      case 'f': out.append('\f'); break;
+      case 'n': out.append('\n'); break;
+      case 'r': out.append('\r'); break;
+      case 't': out.append('\t'); break;
+      case 'u':
+        {
+          uint codepoint;
+          if (!readHex4(pos, end, codepoint)) {
+            return false;
+          }
+          if (codepoint >= 0xD800 && codepoint < 0xDC00) {
+            // High surrogate: combine it with the low surrogate which should follow.
+            uint low;
+            if (end - pos >= 6 && pos[0] == '\\' && pos[1] == 'u') {
+              const char* lowPos = pos + 2;
+              if (readHex4(lowPos, end, low) && low >= 0xDC00 && low < 0xE000) {
+                codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                pos = lowPos;
+              }
+              else {
+                codepoint = 0xFFFD;
+              }
+            }
+            else {
+              codepoint = 0xFFFD;
+            }
+          }
+          else if (codepoint >= 0xDC00 && codepoint < 0xE000) {
+            codepoint = 0xFFFD;
+          }
+          appendUTF8(out, codepoint);
+        }
+        break;
+      default:
+        return false;
+      }
+    }
+    return pos < end;
+  }
+
+
+  // Numbers which are missing come out as -1, the same as with fromJSON.
+  static void setInfoDefaults(ShaderToyInfo& info)
+  {
+    info.viewed = info.likes = info.published = info.flags = info.hasliked = -1;
+  }
+
+
+  //
+  // ShaderToyReader public methods
+  //
+
+  ShaderToyReader::ShaderToyReader(const char* data, qint64 size, ShaderToyLoadMode mode) :
+    _begin(data),
+    _pos(data),
+    _end(data + size),
+    _mode(mode)
+  {
+    if (size >= 3 && memcmp(_pos, kUTF8BOM, 3) == 0) {
+      _pos += 3;
+    }
+  }
+
+
+  bool ShaderToyReader::read(ShaderToyDocument& doc)
+  {
+    skipWhitespace();
+    if (_pos >= _end || *_pos != '{') {
+      return fail("expected an object");
+    }
+
+    bool foundShader = false;
+    beginObject();
+    bool first = true;
+    while (nextMember(first)) {
+      if (keyIs("Shader")) {
+        foundShader = true;
+        if (!readDocument(doc)) {
+          return false;
+        }
+      }
+      else if (keyIs("Error")) {
+        QString message;
+        if (readString(message)) {
+          _error = QString("ShaderToy error: %1").arg(message);
+        }
+        return false;
+      }
+      else {
+        skipValue();
+      }
+    }
+    if (!ok()) {
+      return false;
+    }
+
+    skipWhitespace();
+    if (_pos != _end) {
+      return fail("unexpected data after the end of the document");
+    }
+    if (!foundShader) {
+      return fail("no shader in the document");
+    }
+    return true;
+  }
+
+
+  QString ShaderToyReader::errorString() const
+  {
+    return _error;
+  }
+
+
+  //
+  // ShaderToyReader private methods
+  //
+
+  bool ShaderToyReader::readDocument(ShaderToyDocument& doc)
+  {
+    setInfoDefaults(doc.info);
+    if (!beginObject()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextMember(first)) {
+      if (keyIs("ver")) {
+        readString(doc.version);
+      }
+      else if (keyIs("info")) {
+        readInfo(doc.info);
+      }
+      else if (keyIs("renderpass")) {
+        readRenderPasses(doc.renderpasses);
+      }
+      else {
+        skipValue();
+      }
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readInfo(ShaderToyInfo& info)
+  {
+    setInfoDefaults(info);
+    if (!beginObject()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextMember(first)) {
+      if (keyIs("id")) {
+        readString(info.id);
+      }
+      else if (_mode == ShaderToyLoadMode::eAssetsOnly) {
+        skipValue();
+      }
+      else if (keyIs("name")) {
+        readString(info.name);
+      }
+      else if (keyIs("username")) {
+        readString(info.username);
+      }
+      else if (keyIs("description")) {
+        readString(info.description);
+      }
+      else if (keyIs("date")) {
+        readString(info.date);
+      }
+      else if (keyIs("viewed")) {
+        readInt(info.viewed);
+      }
+      else if (keyIs("likes")) {
+        readInt(info.likes);
+      }
+      else if (keyIs("published")) {
+        readInt(info.published);
+      }
+      else if (keyIs("flags")) {
+        readInt(info.flags);
+      }
+      else if (keyIs("hasliked")) {
+        readInt(info.hasliked);
+      }
+      else if (keyIs("tags")) {
+        readStringList(info.tags);
+      }
+      else {
+        skipValue();
+      }
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readRenderPasses(QVector<ShaderToyRenderPass>& renderpasses)
+  {
+    renderpasses.clear();
+    if (!beginArray()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextElement(first)) {
+      ShaderToyRenderPass pass;
+      if (!readRenderPass(pass)) {
+        return false;
+      }
+      renderpasses.push_back(pass);
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readRenderPass(ShaderToyRenderPass& pass)
+  {
+    if (!beginObject()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextMember(first)) {
+      if (keyIs("inputs")) {
+        readInputs(pass.inputs);
+      }
+      else if (keyIs("type")) {
+        readString(pass.type);
+      }
+      else if (_mode == ShaderToyLoadMode::eAssetsOnly) {
+        skipValue();
+      }
+      else if (keyIs("code") && _mode == ShaderToyLoadMode::eMetadata) {
+        skipValue();
+      }
+      else if (keyIs("code")) {
+        readString(pass.code);
+      }
+      else if (keyIs("name")) {
+        readString(pass.name);
+      }
+      else if (keyIs("description")) {
+        readString(pass.description);
+      }
+      else if (keyIs("filename")) {
+        readString(pass.filename);
+      }
+      else if (keyIs("updateEvery")) {
+        readInt(pass.updateEvery);
+        pass.updateEvery = qMax(1, pass.updateEvery);
+      }
+      else if (keyIs("renderOnce")) {
+        readBool(pass.renderOnce);
+      }
+      else if (keyIs("timeBudgetMS")) {
+        readDouble(pass.timeBudgetMS);
+        pass.timeBudgetMS = qMax(0.0, pass.timeBudgetMS);
+      }
+      else if (keyIs("outputs")) {
+        readOutputs(pass.outputs);
+      }
+      else {
+        skipValue();
+      }
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readInputs(QVector<ShaderToyInput>& inputs)
+  {
+    inputs.clear();
+    if (!beginArray()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextElement(first)) {
+      ShaderToyInput input;
+      if (!readInput(input)) {
+        return false;
+      }
+      inputs.push_back(input);
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readInput(ShaderToyInput& input)
+  {
+    input.id = input.channel = input.published = -1;
+
+    if (!beginObject()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextMember(first)) {
+      if (keyIs("src")) {
+        readString(input.src);
+      }
+      else if (keyIs("ctype")) {
+        readString(input.ctype);
+      }
+      else if (keyIs("id")) {
+        readInt(input.id);
+      }
+      else if (keyIs("channel")) {
+        readInt(input.channel);
+      }
+      else if (keyIs("published")) {
+        readInt(input.published);
+      }
+      else if (keyIs("sampler") && _mode != ShaderToyLoadMode::eAssetsOnly) {
+        readSampler(input.sampler);
+      }
+      else {
+        skipValue();
+      }
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readOutputs(QVector<ShaderToyOutput>& outputs)
+  {
+    outputs.clear();
+    if (!beginArray()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextElement(first)) {
+      ShaderToyOutput output;
+      if (!readOutput(output)) {
+        return false;
+      }
+      outputs.push_back(output);
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readOutput(ShaderToyOutput& output)
+  {
+    output.id = output.channel = -1;
+
+    if (!beginObject()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextMember(first)) {
+      if (keyIs("id")) {
+        readInt(output.id);
+      }
+      else if (keyIs("channel")) {
+        readInt(output.channel);
+      }
+      else {
+        skipValue();
+      }
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readSampler(ShaderToySampler& sampler)
+  {
+    if (!beginObject()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextMember(first)) {
+      if (keyIs("filter")) {
+        readString(sampler.filter);
+      }
+      else if (keyIs("wrap")) {
+        readString(sampler.wrap);
+      }
+      else if (keyIs("vflip")) {
+        readString(sampler.vflip);
+      }
+      else if (keyIs("srgb")) {
+        readString(sampler.srgb);
+      }
+      else if (keyIs("internal")) {
+        readString(sampler.internal);
+      }
+      else {
+        skipValue();
+      }
+    }
+    return ok();
+  }
+
+
+  bool ShaderToyReader::readStringList(QStringList& list)
+  {
+    list.clear();
+    if (!beginArray()) {
+      return ok();
+    }
+    bool first = true;
+    while (nextElement(first)) {
+      QString value;
+      if (!readString(value)) {
+        return false;
+      }
+      list.push_back(value);
+    }
+    return ok();
+  }
+
+
+  void ShaderToyReader::skipWhitespace()
+  {
+    while (_pos < _end && (*_pos == ' ' || *_pos == '\n' || *_pos == '\r' || *_pos == '\t')) {
+      ++_pos;
+    }
+  }
+
+
+  bool ShaderToyReader::expect(char c)
+  {
+    skipWhitespace();
+    if (_pos >= _end || *_pos != c) {
+      char msg[] = "expected ' '";
+      msg[10] = c;
+      return fail(msg);
+    }
+    ++_pos;
+    return true;
+  }
+
+
+  // Returns true if the next value is an object, having consumed its opening
+  // brace. Anything else is skipped, the same as `QJsonValue::toObject()`
+  // treating it as empty.
+  bool ShaderToyReader::beginObject()
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    if (_pos < _end && *_pos == '{') {
+      ++_pos;
+      return true;
+    }
+    skipValue();
+    return false;
+  }
+
+
+  // Moves on to the next member of the current object, leaving `_key` set to
+  // its name and the position at its value. Returns false at the end of the
+  // object, or on an error.
+  bool ShaderToyReader::nextMember(bool& first)
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    if (_pos < _end && *_pos == '}') {
+      ++_pos;
+      return false;
+    }
+    if (!first && !expect(',')) {
+      return false;
+    }
+    first = false;
+    return readKey() && expect(':');
+  }
+
+
+  bool ShaderToyReader::beginArray()
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    if (_pos < _end && *_pos == '[') {
+      ++_pos;
+      return true;
+    }
+    skipValue();
+    return false;
+  }
+
+
+  bool ShaderToyReader::nextElement(bool& first)
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    if (_pos < _end && *_pos == ']') {
+      ++_pos;
+      return false;
+    }
+    if (!first && !expect(',')) {
+      return false;
+    }
+    first = false;
+    return true;
+  }
+
+
+  bool ShaderToyReader::readKey()
+  {
+    if (!expect('"')) {
+      return false;
+    }
+    const char* start = _pos;
+    while (_pos < _end && *_pos != '"' && *_pos != '\\') {
+      ++_pos;
+    }
+    if (_pos < _end && *_pos == '"') {
+      _key = start;
+      _keyLen = int(_pos - start);
+      ++_pos;
+      return true;
+    }
+
+    _keyBuffer = QByteArray(start, int(_pos - start));
+    if (!unescape(_pos, _end, _keyBuffer)) {
+      return fail("bad string");
+    }
+    ++_pos;
+    _key = _keyBuffer.constData();
+    _keyLen = _keyBuffer.size();
+    return true;
+  }
+
+
+  bool ShaderToyReader::readString(QString& value)
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    if (_pos >= _end || *_pos != '"') {
+      value = QString();
+      return skipValue();
+    }
+    ++_pos;
+
+    // Most strings have no escapes, so we can convert them straight from the
+    // input without an intermediate copy.
+    const char* start = _pos;
+    while (_pos < _end && *_pos != '"' && *_pos != '\\') {
+      ++_pos;
+    }
+    if (_pos < _end && *_pos == '"') {
+      value = QString::fromUtf8(start, int(_pos - start));
+      ++_pos;
+      return true;
+    }
+
+    QByteArray utf8(start, int(_pos - start));
+    if (!unescape(_pos, _end, utf8)) {
+      return fail("bad string");
+    }
+    ++_pos;
+    value = QString::fromUtf8(utf8);
+    return true;
+  }
+
+
+  bool ShaderToyReader::readInt(int& value)
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    const char* start = _pos;
+    if (_pos >= _end || (*_pos != '-' && (*_pos < '0' || *_pos > '9'))) {
+      value = -1;
+      return skipValue();
+    }
+
+    // Plain integers are by far the most common, so handle them directly.
+    bool negative = (*_pos == '-');
+    if (negative) {
+      ++_pos;
+    }
+    qint64 n = 0;
+    while (_pos < _end && *_pos >= '0' && *_pos <= '9' && n < (qint64(1) << 53)) {
+      n = n * 10 + (*_pos - '0');
+      ++_pos;
+    }
+    if (_pos >= _end || (*_pos != '.' && *_pos != 'e' && *_pos != 'E' && (*_pos < '0' || *_pos > '9'))) {
+      value = int(negative ? -n : n);
+      return _pos > start + (negative ? 1 : 0) || fail("bad number");
+    }
+
+    while (_pos < _end && (*_pos == '-' || *_pos == '+' || *_pos == '.' || *_pos == 'e' || *_pos == 'E' || (*_pos >= '0' && *_pos <= '9'))) {
+      ++_pos;
+    }
+    bool converted = false;
+    double d = QByteArray(start, int(_pos - start)).toDouble(&converted);
+    if (!converted) {
+      return fail("bad number");
+    }
+    value = int(d);
+    return true;
+  }
+
+
+  bool ShaderToyReader::readDouble(double& value)
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    if (_pos >= _end || (*_pos != '-' && (*_pos < '0' || *_pos > '9'))) {
+      value = 0.0;
+      return skipValue();
+    }
+
+    const char* start = _pos;
+    while (_pos < _end && (*_pos == '-' || *_pos == '+' || *_pos == '.' || *_pos == 'e' || *_pos == 'E' || (*_pos >= '0' && *_pos <= '9'))) {
+      ++_pos;
+    }
+    bool converted = false;
+    value = QByteArray(start, int(_pos - start)).toDouble(&converted);
+    return converted || fail("bad number");
+  }
+
+
+  // Anything other than `true` or `false` is skipped and read as false, the
+  // same as `QJsonValue::toBool()`.
+  bool ShaderToyReader::readBool(bool& value)
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    if (_end - _pos >= 4 && memcmp(_pos, "true", 4) == 0) {
+      _pos += 4;
+      value = true;
+      return true;
+    }
+    if (_end - _pos >= 5 && memcmp(_pos, "false", 5) == 0) {
+      _pos += 5;
+      value = false;
+      return true;
+    }
+    value = false;
+    return skipValue();
+  }
+
+
+  bool ShaderToyReader::skipString()
+  {
+    ++_pos; // Opening quote.
+    while (true) {
+      const char* quote = static_cast<const char*>(memchr(_pos, '"', size_t(_end - _pos)));
+      if (quote == nullptr) {
+        return fail("unterminated string");
+      }
+      // The quote is escaped if it's preceded by an odd number of backslashes.
+      const char* backslashes = quote;
+      while (backslashes > _pos && backslashes[-1] == '\\') {
+        --backslashes;
+      }
+      _pos = quote + 1;
+      if (((quote - backslashes) & 1) == 0) {
+        return true;
+      }
+    }
+  }
+
+
+  // Skips over a value without decoding it. Objects and arrays are only
+  // checked for balanced brackets, not for being well formed inside.
+  bool ShaderToyReader::skipValue()
+  {
+    if (!ok()) {
+      return false;
+    }
+    skipWhitespace();
+    if (_pos >= _end) {
+      return fail("unexpected end of file");
+    }
+
+    char c = *_pos;
+    if (c == '"') {
+      return skipString();
+    }
+    if (c == '{' || c == '[') {
+      int depth = 0;
+      do {
+        c = *_pos;
+        if (c == '"') {
+          if (!skipString()) {
+            return false;
+          }
+          continue;
+        }
+        if (c == '{' || c == '[') {
+          ++depth;
+        }
+        else if (c == '}' || c == ']') {
+          --depth;
+        }
+        ++_pos;
+      } while (depth > 0 && _pos < _end);
+      return depth == 0 || fail("unexpected end of file");
+    }
+
+    const char* start = _pos;
+    while (_pos < _end && (isalnum(uchar(*_pos)) || *_pos == '-' || *_pos == '+' || *_pos == '.')) {
+      ++_pos;
+    }
+    if (_pos == start) {
+      return fail("expected a value");
+    }
+    return true;
+  }
+
+
+  bool ShaderToyReader::fail(const char* msg)
+  {
+    if (_error.isEmpty()) {
+      _error = QString("JSON parse error at byte %1: %2").arg(_pos - _begin).arg(msg);
+    }
+    return false;
+  }
+
+
+  bool ShaderToyReader::ok() const
+  {
+    return _error.isEmpty();
+  }
+
+} // namespace vh
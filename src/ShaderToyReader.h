@@ -0,0 +1,92 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_SHADERTOYREADER_H
+#define VH_SHADERTOYREADER_H
+
+#include "ShaderToy.h"
+
+#include <QByteArray>
+#include <QString>
+
+#include <cstring>
+
+namespace vh {
+
+  //
+  // ShaderToyReader class
+  //
+
+  /// A single pass JSON parser which fills in a ShaderToyDocument directly
+  /// from the bytes of a ShaderToy file, without building a QJsonDocument
+  /// first. Keys are compared in place and anything we don't use is skipped
+  /// without being decoded.
+  ///
+  /// In `ShaderToyLoadMode::eAssetsOnly` mode only the shader ID and each
+  /// pass's type and inputs are filled in. Everything else, notably the
+  /// shader code, is skipped, which makes it much cheaper to find out which
+  /// assets a shader needs. `ShaderToyLoadMode::eMetadata` reads everything
+  /// except the code.
+  ///
+  /// Values of the wrong type are treated as missing, the same as
+  /// `QJsonValue::toString()` and friends would.
+  class ShaderToyReader
+  {
+  public:
+    ShaderToyReader(const char* data, qint64 size, ShaderToyLoadMode mode);
+
+    /// Reads a `{"Shader": ...}` document, as saved by Shadertron or
+    /// returned by the ShaderToy API. Returns false if the JSON is malformed
+    /// or ShaderToy returned an error instead of a shader.
+    bool read(ShaderToyDocument& doc);
+
+    QString errorString() const;
+
+  private:
+    bool readDocument(ShaderToyDocument& doc);
+    bool readInfo(ShaderToyInfo& info);
+    bool readRenderPasses(QVector<ShaderToyRenderPass>& renderpasses);
+    bool readRenderPass(ShaderToyRenderPass& pass);
+    bool readInputs(QVector<ShaderToyInput>& inputs);
+    bool readInput(ShaderToyInput& input);
+    bool readOutputs(QVector<ShaderToyOutput>& outputs);
+    bool readOutput(ShaderToyOutput& output);
+    bool readSampler(ShaderToySampler& sampler);
+    bool readStringList(QStringList& list);
+
+    void skipWhitespace();
+    bool expect(char c);
+    bool beginObject();
+    bool nextMember(bool& first);
+    bool beginArray();
+    bool nextElement(bool& first);
+    bool readKey();
+    bool readString(QString& value);
+    bool readInt(int& value);
+    bool readDouble(double& value);
+    bool readBool(bool& value);
+    bool skipString();
+    bool skipValue();
+    bool fail(const char* msg);
+    bool ok() const;
+
+    template <int N>
+    bool keyIs(const char (&name)[N]) const
+    {
+      return _keyLen == N - 1 && memcmp(_key, name, N - 1) == 0;
+    }
+
+  private:
+    const char* _begin;
+    const char* _pos;
+    const char* _end;
+    ShaderToyLoadMode _mode;
+
+    const char* _key = nullptr;  // Points into the input, or into `_keyBuffer` if the key had escapes in it.
+    int _keyLen = 0;
+    QByteArray _keyBuffer;
+
+    QString _error;
+  };
+
+} // namespace vh
+
+#endif // VH_SHADERTOYREADER_H
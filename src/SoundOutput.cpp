@@ -0,0 +1,211 @@
+// Copyright 2019 Vilya Harvey
+#include "SoundOutput.h"
+
+#include <QAudioDeviceInfo>
+#include <QAudioFormat>
+#include <QMutexLocker>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kBytesPerFrame = 2 * sizeof(qint16); // 16-bit stereo.
+
+
+  //
+  // SoundOutput public methods
+  //
+
+  SoundOutput::SoundOutput(int sampleRate, int capacityFrames, QObject* parent) :
+    QIODevice(parent),
+    _sampleRate(sampleRate),
+    _capacityFrames(qMax(1, capacityFrames))
+  {
+    _ring.fill(0.0f, _capacityFrames * 2);
+
+    QAudioFormat format;
+    format.setSampleRate(sampleRate);
+    format.setChannelCount(2);
+    format.setSampleSize(16);
+    format.setSampleType(QAudioFormat::SignedInt);
+    format.setByteOrder(QAudioFormat::LittleEndian);
+    format.setCodec("audio/pcm");
+
+    QAudioDeviceInfo device = QAudioDeviceInfo::defaultOutputDevice();
+    if (!device.isFormatSupported(format)) {
+      qWarning("Default audio output device doesn't support %d Hz 16-bit stereo, sound may not play", sampleRate);
+    }
+
+    _audio = new QAudioOutput(device, format, this);
+  }
+
+
+  SoundOutput::~SoundOutput()
+  {
+    stop();
+  }
+
+
+  int SoundOutput::sampleRate() const
+  {
+    return _sampleRate;
+  }
+
+
+  void SoundOutput::start(qint64 firstSample)
+  {
+    stop();
+
+    {
+      QMutexLocker lock(&_mutex);
+      _readFrame = firstSample;
+      _writeFrame = firstSample;
+      _underrunFrames = 0;
+    }
+
+    open(QIODevice::ReadOnly);
+    _audio->start(this);
+  }
+
+
+  void SoundOutput::stop()
+  {
+    if (isOpen()) {
+      _audio->stop();
+      close();
+    }
+  }
+
+
+  void SoundOutput::suspend()
+  {
+    if (_audio->state() == QAudio::ActiveState || _audio->state() == QAudio::IdleState) {
+      _audio->suspend();
+    }
+  }
+
+
+  void SoundOutput::resume()
+  {
+    if (_audio->state() == QAudio::SuspendedState) {
+      _audio->resume();
+    }
+  }
+
+
+  void SoundOutput::write(qint64 firstSample, const float* samples, int numFrames)
+  {
+    QMutexLocker lock(&_mutex);
+
+    // Skip anything the device has already gone past.
+    if (firstSample < _readFrame) {
+      qint64 skip = qMin(qint64(numFrames), _readFrame - firstSample);
+      samples += skip * 2;
+      numFrames -= int(skip);
+      firstSample += skip;
+    }
+
+    // Don't let the writer lap the reader.
+    qint64 limit = _readFrame + _capacityFrames;
+    if (firstSample + numFrames > limit) {
+      qWarning("Sound output buffer is full, dropping %lld samples", firstSample + numFrames - limit);
+      numFrames = int(qMax(qint64(0), limit - firstSample));
+    }
+    if (numFrames <= 0) {
+      return;
+    }
+
+    // Fill any gap between the previous block and this one with silence.
+    for (qint64 frame = _writeFrame; frame < firstSample; frame++) {
+      int pos = int(frame % _capacityFrames) * 2;
+      _ring[pos]     = 0.0f;
+      _ring[pos + 1] = 0.0f;
+    }
+
+    for (int i = 0; i < numFrames; i++) {
+      int pos = int((firstSample + i) % _capacityFrames) * 2;
+      _ring[pos]     = samples[i * 2];
+      _ring[pos + 1] = samples[i * 2 + 1];
+    }
+
+    _writeFrame = qMax(_writeFrame, firstSample + numFrames);
+  }
+
+
+  qint64 SoundOutput::readPosition() const
+  {
+    QMutexLocker lock(&_mutex);
+    return _readFrame;
+  }
+
+
+  qint64 SoundOutput::writePosition() const
+  {
+    QMutexLocker lock(&_mutex);
+    return _writeFrame;
+  }
+
+
+  qint64 SoundOutput::underrunFrames() const
+  {
+    QMutexLocker lock(&_mutex);
+    return _underrunFrames;
+  }
+
+
+  bool SoundOutput::isSequential() const
+  {
+    return true;
+  }
+
+
+  qint64 SoundOutput::bytesAvailable() const
+  {
+    // We can always supply data, even if it's only silence.
+    return qint64(_capacityFrames) * kBytesPerFrame + QIODevice::bytesAvailable();
+  }
+
+
+  //
+  // SoundOutput protected methods
+  //
+
+  qint64 SoundOutput::readData(char* data, qint64 maxlen)
+  {
+    QMutexLocker lock(&_mutex);
+
+    const qint64 numFrames = maxlen / kBytesPerFrame;
+    qint16* dst = reinterpret_cast<qint16*>(data);
+
+    qint64 underrun = 0;
+    for (qint64 i = 0; i < numFrames; i++, _readFrame++) {
+      if (_readFrame < _writeFrame) {
+        int pos = int(_readFrame % _capacityFrames) * 2;
+        *dst++ = qint16(qBound(-1.0f, _ring[pos],     1.0f) * 32767.0f);
+        *dst++ = qint16(qBound(-1.0f, _ring[pos + 1], 1.0f) * 32767.0f);
+      }
+      else {
+        *dst++ = 0;
+        *dst++ = 0;
+        ++underrun;
+      }
+    }
+
+    if (underrun > 0 && _underrunFrames == 0) {
+      qDebug("Sound output ran dry at sample %lld", _readFrame - underrun);
+    }
+    _underrunFrames += underrun;
+    _writeFrame = qMax(_writeFrame, _readFrame);
+
+    return numFrames * kBytesPerFrame;
+  }
+
+
+  qint64 SoundOutput::writeData(const char* /*data*/, qint64 /*len*/)
+  {
+    return 0;
+  }
+
+} // namespace vh
@@ -0,0 +1,71 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_SOUNDOUTPUT_H
+#define VH_SOUNDOUTPUT_H
+
+#include <QAudioOutput>
+#include <QIODevice>
+#include <QMutex>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // SoundOutput class
+  //
+
+  /// Plays back stereo float samples through a `QAudioOutput`. Samples are
+  /// written in blocks tagged with the absolute index of their first sample
+  /// and held in a jitter buffer until the audio device pulls them.
+  ///
+  /// If the device asks for samples which haven't been written yet we play
+  /// silence but still advance the read position, so the output never drifts
+  /// away from the clock the samples were generated against.
+  class SoundOutput : public QIODevice
+  {
+    Q_OBJECT
+  public:
+    SoundOutput(int sampleRate, int capacityFrames, QObject* parent = nullptr);
+    virtual ~SoundOutput();
+
+    int sampleRate() const;
+
+    /// Discards everything buffered and starts playing from `firstSample`.
+    void start(qint64 firstSample);
+    void stop();
+    void suspend();
+    void resume();
+
+    /// Adds a block of interleaved left & right samples. Anything before the
+    /// current read position is dropped, as is anything that doesn't fit.
+    void write(qint64 firstSample, const float* samples, int numFrames);
+
+    /// Absolute index of the next sample the audio device will be given.
+    qint64 readPosition() const;
+    /// Absolute index just past the last sample written.
+    qint64 writePosition() const;
+
+    qint64 underrunFrames() const;
+
+    // QIODevice overrides
+    virtual bool isSequential() const override;
+    virtual qint64 bytesAvailable() const override;
+
+  protected:
+    virtual qint64 readData(char* data, qint64 maxlen) override;
+    virtual qint64 writeData(const char* data, qint64 len) override;
+
+  private:
+    QAudioOutput* _audio = nullptr;
+    int _sampleRate;
+
+    mutable QMutex _mutex;
+    QVector<float> _ring;       // Interleaved stereo samples, indexed by absolute frame modulo capacity.
+    int _capacityFrames;
+    qint64 _readFrame  = 0;
+    qint64 _writeFrame = 0;
+    qint64 _underrunFrames = 0;
+  };
+
+} // namespace vh
+
+#endif // VH_SOUNDOUTPUT_H
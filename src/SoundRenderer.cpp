@@ -0,0 +1,329 @@
+// Copyright 2019 Vilya Harvey
+#include "SoundRenderer.h"
+
+#include "ShaderTemplate.h"
+
+#include <QMap>
+#include <QRegularExpression>
+
+namespace vh {
+
+  //
+  // SoundRenderer public methods
+  //
+
+  SoundRenderer::SoundRenderer()
+  {
+  }
+
+
+  SoundRenderer::~SoundRenderer()
+  {
+    if (_program == nullptr && _texture == 0) {
+      return;
+    }
+
+    // If the context has been destroyed, our GL objects went with it.
+    if (_context.isNull()) {
+      delete _program;
+      _program = nullptr;
+      return;
+    }
+
+    QOpenGLContext* prevContext = QOpenGLContext::currentContext();
+    QSurface* prevSurface = (prevContext != nullptr) ? prevContext->surface() : nullptr;
+    const bool switchContext = (prevContext != _context);
+    if (switchContext && !_context->makeCurrent(_surface)) {
+      qWarning("Unable to make the sound renderer's context current, its GL objects will be leaked");
+      delete _program;
+      _program = nullptr;
+      return;
+    }
+
+    teardown();
+
+    if (switchContext) {
+      if (prevContext != nullptr) {
+        prevContext->makeCurrent(prevSurface);
+      }
+      else {
+        _context->doneCurrent();
+      }
+    }
+  }
+
+
+  bool SoundRenderer::setup(const QDir& commonDir, const QString& commonCode, const QDir& soundDir, const QString& soundCode, int blockSamples, int sampleRate)
+  {
+    teardown();
+    initializeOpenGLFunctions();
+
+    _context = QOpenGLContext::currentContext();
+    _surface = !_context.isNull() ? _context->surface() : nullptr;
+
+    _blockWidth  = kSoundBlockWidth;
+    _blockHeight = qMax(1, blockSamples / kSoundBlockWidth);
+    _sampleRate  = sampleRate;
+
+    // ShaderToy has two signatures for the sound entry point: the original
+    // `vec2 mainSound(float time)` and the newer `vec2 mainSound(int samp, float time)`.
+    QRegularExpression sampleEntryPointRE("\\bmainSound\\s*\\(\\s*(in\\s+)?int\\b");
+
+    ShaderIncludes includes;
+    includes.refDir = commonDir;
+    QString expandedCommonCode = expandIncludes(commonCode, kSourceString_Common, includes);
+    includes.refDir = soundDir;
+    QString expandedSoundCode  = expandIncludes(soundCode, kSourceString_User, includes);
+
+    QMap<QString, QString> macros;
+#ifdef SHADERTOOL_USE_GL41
+    macros["GLSL_VERSION"]   =  "#version 410 core";
+#else
+    macros["GLSL_VERSION"]   =  "#version 450 core";
+#endif // SHADERTOOL_USE_GL41
+    macros["SHADER_TYPE"] = QString("#define SHADER_TYPE %1").arg(int(PassType::eSound));
+    if (sampleEntryPointRE.match(expandedSoundCode).hasMatch()) {
+      macros["SOUND_ENTRY_POINT"] = "#define SOUND_ENTRY_POINT_TAKES_SAMPLE";
+    }
+    macros["SAMPLER_0_TYPE"] = "#define SAMPLER_0_TYPE sampler2D";
+    macros["SAMPLER_1_TYPE"] = "#define SAMPLER_1_TYPE sampler2D";
+    macros["SAMPLER_2_TYPE"] = "#define SAMPLER_2_TYPE sampler2D";
+    macros["SAMPLER_3_TYPE"] = "#define SAMPLER_3_TYPE sampler2D";
+    macros["COMMON_CODE"] = expandedCommonCode;
+    macros["USER_CODE"] = expandedSoundCode;
+
+    QString vertShaderSource = preprocessShaderSource(":/glsl/fullscreen.vert", macros);
+    QString fragShaderSource = preprocessShaderSource(":/glsl/template.frag",   macros);
+
+    _program = new QOpenGLShaderProgram();
+    _program->addShaderFromSourceCode(QOpenGLShader::Vertex,   vertShaderSource);
+    _program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragShaderSource);
+    if (!_program->link()) {
+      qCritical("Failed to compile sound pass: %s", qPrintable(_program->log()));
+      teardown();
+      return false;
+    }
+
+    _iSampleRateLoc       = _program->uniformLocation("iSampleRate");
+    _iSoundBlockOffsetLoc = _program->uniformLocation("iSoundBlockOffset");
+    _iSoundBlockWidthLoc  = _program->uniformLocation("iSoundBlockWidth");
+
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, _blockWidth, _blockHeight, 0, GL_RG, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _texture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+      qCritical("Sound pass framebuffer is incomplete (status 0x%x)", status);
+      teardown();
+      return false;
+    }
+
+    glGenVertexArrays(1, &_vao);
+
+    const GLsizeiptr blockBytes = GLsizeiptr(_blockWidth) * _blockHeight * 2 * sizeof(float);
+    for (int i = 0; i < kMaxSoundBlocksInFlight; i++) {
+      glGenBuffers(1, &_blocks[i].pbo);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, _blocks[i].pbo);
+      glBufferData(GL_PIXEL_PACK_BUFFER, blockBytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    qDebug("Sound pass set up with %d samples per block at %d Hz", samplesPerBlock(), _sampleRate);
+    return true;
+  }
+
+
+  void SoundRenderer::teardown()
+  {
+    if (_program == nullptr && _texture == 0) {
+      return;
+    }
+
+    discardPending();
+
+    for (int i = 0; i < kMaxSoundBlocksInFlight; i++) {
+      if (_blocks[i].pbo != 0) {
+        glDeleteBuffers(1, &_blocks[i].pbo);
+        _blocks[i].pbo = 0;
+      }
+    }
+
+    glDeleteVertexArrays(1, &_vao);
+    _vao = 0;
+
+    glDeleteFramebuffers(1, &_fbo);
+    _fbo = 0;
+
+    glDeleteTextures(1, &_texture);
+    _texture = 0;
+
+    delete _program;
+    _program = nullptr;
+
+    _iSampleRateLoc       = -1;
+    _iSoundBlockOffsetLoc = -1;
+    _iSoundBlockWidthLoc  = -1;
+  }
+
+
+  bool SoundRenderer::isValid() const
+  {
+    return _program != nullptr && _fbo != 0;
+  }
+
+
+  int SoundRenderer::samplesPerBlock() const
+  {
+    return _blockWidth * _blockHeight;
+  }
+
+
+  int SoundRenderer::sampleRate() const
+  {
+    return _sampleRate;
+  }
+
+
+  void SoundRenderer::renderBlock(qint64 firstSample, QVector<float>& samples)
+  {
+    if (!isValid()) {
+      return;
+    }
+
+    drawBlock(firstSample);
+
+    samples.resize(samplesPerBlock() * 2);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, _blockWidth, _blockHeight, GL_RG, GL_FLOAT, samples.data());
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+
+  bool SoundRenderer::queueBlock(qint64 firstSample)
+  {
+    if (!isValid() || _numPending == kMaxSoundBlocksInFlight) {
+      return false;
+    }
+
+    PendingBlock& block = _blocks[(_firstPending + _numPending) % kMaxSoundBlocksInFlight];
+
+    drawBlock(firstSample);
+
+    // Read into the PBO rather than client memory, so that the read happens
+    // asynchronously. We insert a fence afterwards so we can tell when it's
+    // safe to map the buffer.
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, block.pbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, _blockWidth, _blockHeight, GL_RG, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    block.firstSample = firstSample;
+    block.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush(); // Make sure the fence actually gets signalled even if nobody waits on it.
+
+    ++_numPending;
+    return true;
+  }
+
+
+  bool SoundRenderer::collectBlock(qint64& firstSample, QVector<float>& samples, bool wait)
+  {
+    if (_numPending == 0) {
+      return false;
+    }
+
+    PendingBlock& block = _blocks[_firstPending];
+
+    GLbitfield flags = wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0;
+    GLuint64 timeoutNS = wait ? GLuint64(1000000000) : 0;
+    GLenum status = glClientWaitSync(block.fence, flags, timeoutNS);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      return false;
+    }
+    else if (status == GL_WAIT_FAILED) {
+      qCritical("Waiting for sound block at sample %lld failed", block.firstSample);
+      discardPending();
+      return false;
+    }
+
+    const int numValues = samplesPerBlock() * 2;
+    samples.resize(numValues);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, block.pbo);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(numValues) * sizeof(float), GL_MAP_READ_BIT);
+    if (mapped != nullptr) {
+      memcpy(samples.data(), mapped, size_t(numValues) * sizeof(float));
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else {
+      samples.fill(0.0f);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    firstSample = block.firstSample;
+
+    glDeleteSync(block.fence);
+    block.fence = nullptr;
+    _firstPending = (_firstPending + 1) % kMaxSoundBlocksInFlight;
+    --_numPending;
+
+    return true;
+  }
+
+
+  void SoundRenderer::discardPending()
+  {
+    while (_numPending > 0) {
+      PendingBlock& block = _blocks[_firstPending];
+      glDeleteSync(block.fence);
+      block.fence = nullptr;
+      _firstPending = (_firstPending + 1) % kMaxSoundBlocksInFlight;
+      --_numPending;
+    }
+    _firstPending = 0;
+  }
+
+
+  int SoundRenderer::blocksInFlight() const
+  {
+    return _numPending;
+  }
+
+
+  //
+  // SoundRenderer private methods
+  //
+
+  void SoundRenderer::drawBlock(qint64 firstSample)
+  {
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_BLEND);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, _blockWidth, _blockHeight);
+    glBindVertexArray(_vao);
+
+    _program->bind();
+    _program->setUniformValue(_iSampleRateLoc, float(_sampleRate));
+    _program->setUniformValue(_iSoundBlockOffsetLoc, int(firstSample));
+    _program->setUniformValue(_iSoundBlockWidthLoc, _blockWidth);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    _program->release();
+
+    glBindVertexArray(0);
+  }
+
+} // namespace vh
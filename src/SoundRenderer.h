@@ -0,0 +1,111 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_SOUNDRENDERER_H
+#define VH_SOUNDRENDERER_H
+
+#include "RenderData.h"
+
+#include <QDir>
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QPointer>
+#include <QString>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kSoundSampleRate          = 44100;
+  static constexpr int kSoundBlockWidth          = 512;  // Width of the texture we render sound blocks into, in samples.
+  static constexpr int kMaxSoundBlocksInFlight   = 4;    // Number of blocks which can be waiting for readback at once.
+
+
+  //
+  // SoundRenderer class
+  //
+
+  /// Runs a ShaderToy sound pass (i.e. `mainSound`) on the GPU. Each block of
+  /// samples is rendered into a float texture, one stereo sample per texel,
+  /// then read back to the CPU.
+  ///
+  /// Blocks can either be rendered and read back synchronously, or queued up
+  /// and collected later once the GPU has finished with them. Readback for
+  /// queued blocks goes via pixel buffer objects, so queueing never stalls.
+  ///
+  /// All methods must be called with the same OpenGL context current as when
+  /// `setup` was called. The destructor is the exception: it makes that
+  /// context current itself if it has to, so a renderer can be destroyed
+  /// anywhere on the context's thread without leaking its GL objects or
+  /// deleting names from some other context.
+  class SoundRenderer : protected GLFunctions
+  {
+  public:
+    SoundRenderer();
+    ~SoundRenderer();
+
+    /// Compiles the sound shader. Any `#include`s in the common and sound
+    /// code are resolved relative to `commonDir` and `soundDir` respectively.
+    bool setup(const QDir& commonDir, const QString& commonCode, const QDir& soundDir, const QString& soundCode, int blockSamples, int sampleRate);
+    void teardown();
+
+    bool isValid() const;
+    int samplesPerBlock() const;
+    int sampleRate() const;
+
+    /// Renders the block starting at `firstSample` and waits for the result.
+    /// `samples` receives interleaved left & right values.
+    void renderBlock(qint64 firstSample, QVector<float>& samples);
+
+    /// Starts rendering the block starting at `firstSample`. Returns false if
+    /// there are already too many blocks waiting to be collected.
+    bool queueBlock(qint64 firstSample);
+
+    /// Retrieves the oldest queued block, if the GPU has finished with it. If
+    /// `wait` is true this blocks for up to a second waiting for the results;
+    /// a very slow shader can take longer than that, in which case it returns
+    /// false with the block still queued. If waiting fails outright, every
+    /// queued block is discarded, so `blocksInFlight()` drops to zero.
+    bool collectBlock(qint64& firstSample, QVector<float>& samples, bool wait);
+
+    /// Throws away any blocks which have been queued but not yet collected.
+    void discardPending();
+
+    int blocksInFlight() const;
+
+  private:
+    void drawBlock(qint64 firstSample);
+
+  private:
+    struct PendingBlock {
+      qint64 firstSample = 0;
+      GLuint pbo         = 0;
+      GLsync fence       = nullptr;
+    };
+
+    QPointer<QOpenGLContext> _context;  // The context our GL objects belong to.
+    QSurface* _surface = nullptr;       // The surface it was current on when we were set up.
+
+    QOpenGLShaderProgram* _program = nullptr;
+    GLuint _texture = 0;
+    GLuint _fbo     = 0;
+    GLuint _vao     = 0;
+
+    int _blockWidth  = kSoundBlockWidth;
+    int _blockHeight = 0;
+    int _sampleRate  = kSoundSampleRate;
+
+    // Uniform locations
+    int _iSampleRateLoc       = -1;
+    int _iSoundBlockOffsetLoc = -1;
+    int _iSoundBlockWidthLoc  = -1;
+
+    PendingBlock _blocks[kMaxSoundBlocksInFlight];
+    int _firstPending = 0; // Index into _blocks of the oldest pending block.
+    int _numPending   = 0;
+  };
+
+} // namespace vh
+
+#endif // VH_SOUNDRENDERER_H
@@ -33,9 +33,9 @@ namespace vh {
   }
 
 
-  QAudioBuffer& TextureAudioSurface::currentBuffer()
+  const AudioRingBuffer& TextureAudioSurface::ringBuffer() const
   {
-    return _buffer;
+    return _ring;
   }
 
 
@@ -45,49 +45,30 @@ namespace vh {
   }
 
 
-  void TextureAudioSurface::copyToTexture(QOpenGLTexture* tex, qint64 playbackTime)
+  void TextureAudioSurface::copyToTexture(QOpenGLTexture* tex, qint64 playbackTimeUS)
   {
-//    qDebug("Copy audio buffer to texture. Buffer has: "
-//           "%d channels, %d frames, %.3lf KHz sample rate, starts at %.3lf ms and plays for %.3lf ms",
-//           _buffer.format().channelCount(),
-//           _buffer.frameCount(),
-//           double(_buffer.format().sampleRate()) / 1000.0,
-//           double(_buffer.startTime()) / 1000.0,
-//           double(_buffer.duration()) / 1000.0
-//    );
-
-    qint64 startOffsetMicrosecs = playbackTime - _buffer.startTime();
-    if (startOffsetMicrosecs < 0) {
-      startOffsetMicrosecs = 0;
+    // The window ends at the current playback position, so the shader always
+    // sees the samples which have most recently been heard. The ring buffer
+    // takes care of windows which span more than one decoded buffer. We need
+    // twice as many samples for the FFT as for the waveform.
+    const int sampleRate = _ring.sampleRate();
+    const qint64 windowUS = (sampleRate > 0) ? (qint64(kAudioFFTSize) * 1000000 / sampleRate) : 0;
+    _ring.extract(playbackTimeUS - windowUS, kAudioFFTSize, _window);
+
+    _spectrum.analyse(_window);
+    const float* levels = _spectrum.levels();
+    for (int i = 0; i < 512; i++) {
+      _texData[0][i] = short(levels[i] * 32767.0f);
     }
 
-    // Sample rate is in Hz, i.e. samples per second. Our start offset is
-    // in microseconds so we need to divide it by 1,000,000 to convert it
-    // into seconds. Doing the division last to preserve accuracy.
-    qint64 startFrame = _buffer.format().sampleRate() * startOffsetMicrosecs / 1000000;
-    qint64 endFrame = startFrame + 512;
-    if (endFrame > _buffer.frameCount()) {
-      endFrame = _buffer.frameCount();
-      startFrame = endFrame - 512;
-      if (startFrame < 0) {
-        startFrame = 0;
-      }
+    // Map [-1, 1] onto the positive half of the signed 16-bit range, which
+    // the shader will see as [0, 1].
+    const float* waveform = _window + (kAudioFFTSize - 512);
+    for (int i = 0; i < 512; i++) {
+      float sample = qBound(-1.0f, waveform[i], 1.0f);
+      _texData[1][i] = short((sample * 0.5f + 0.5f) * 32767.0f);
     }
 
-//    qDebug("audio start frame = %lld, end frame = %lld", startFrame, endFrame);
-
-    const short* sourceData = reinterpret_cast<const short*>(_buffer.constData());
-    const int stride = _buffer.format().channelCount();
-    int i = 0, j = 0;
-    for (qint64 frame = startFrame; frame < endFrame; frame++) {
-      _texData[1][i] = sourceData[j] / 2 + (1 << 14);
-      ++i;
-      j += stride;
-    }
-
-    // TODO: This is just here as a placeholder. _texData[0] is supposed to hold the FFT of the waveform.
-    memcpy(_texData[0], _texData[1], 512 * sizeof(short));
-
     QOpenGLTexture::PixelFormat sourceFormat = QOpenGLTexture::Red;
     QOpenGLTexture::PixelType sourceType = QOpenGLTexture::Int16;
 
@@ -111,20 +92,20 @@ namespace vh {
   void TextureAudioSurface::audioBufferReady(const QAudioBuffer& buffer)
   {
     if (!_paused) {
-      _buffer = buffer;
+      _ring.append(buffer);
       if (!_hasBuffer) {
-        int st = int(_buffer.format().sampleType());
+        int st = int(buffer.format().sampleType());
         const char* sampleTypeName = (st >= 0 && st <= 3) ? sampleTypeNames[st] : "<invalid type>";
 
         qDebug("First audio buffer received.");
         qDebug("Audio buffer has: %d channels, %d frames, %.3lf KHz sample rate, starts at %.3lf ms and plays for %.3lf ms",
-               _buffer.format().channelCount(),
-               _buffer.frameCount(),
-               double(_buffer.format().sampleRate()) / 1000.0,
-               double(_buffer.startTime()) / 1000.0,
-               double(_buffer.duration()) / 1000.0);
-        qDebug("Audio buffer is %s", (_buffer.format().byteOrder() == QAudioFormat::LittleEndian) ? "little-endian" : "big-endian");
-        qDebug("Audio buffer samples are %d bit %s", _buffer.format().sampleSize(), sampleTypeName);
+               buffer.format().channelCount(),
+               buffer.frameCount(),
+               double(buffer.format().sampleRate()) / 1000.0,
+               double(buffer.startTime()) / 1000.0,
+               double(buffer.duration()) / 1000.0);
+        qDebug("Audio buffer is %s", (buffer.format().byteOrder() == QAudioFormat::LittleEndian) ? "little-endian" : "big-endian");
+        qDebug("Audio buffer samples are %d bit %s", buffer.format().sampleSize(), sampleTypeName);
       }
       _hasBuffer = true;
     }
@@ -133,7 +114,9 @@ namespace vh {
 
   void TextureAudioSurface::audioFlushed()
   {
-    // TODO - is anything necessary here?
+    // Whatever comes next won't be contiguous with what we've got.
+    _ring.clear();
+    _spectrum.reset();
   }
 
 } // namespace vh
@@ -2,12 +2,20 @@
 #ifndef VH_TEXTUREAUDIOSURFACE_H
 #define VH_TEXTUREAUDIOSURFACE_H
 
+#include "AudioRingBuffer.h"
+#include "AudioSpectrum.h"
+
 #include <QAudioBuffer>
 #include <QObject>
 #include <QOpenGLTexture>
 
+#include <atomic>
+
 namespace vh {
 
+  /// Turns decoded or captured audio into ShaderToy's 512x2 audio texture:
+  /// the spectrum in row 0 and the waveform in row 1. Buffers may be
+  /// delivered from any thread.
   class TextureAudioSurface : public QObject
   {
     Q_OBJECT
@@ -15,22 +23,27 @@ namespace vh {
     explicit TextureAudioSurface(QObject *parent = nullptr);
     virtual ~TextureAudioSurface();
 
-    QAudioBuffer& currentBuffer();
+    const AudioRingBuffer& ringBuffer() const;
     bool hasCurrentBuffer() const;
 
     void pause();
     void unpause();
 
-    void copyToTexture(QOpenGLTexture* tex, qint64 playbackTime);
+    // `playbackTimeUS` is the presentation time, in microseconds, of the
+    // sample currently being heard. The texture gets the window of samples
+    // ending at that point.
+    void copyToTexture(QOpenGLTexture* tex, qint64 playbackTimeUS);
 
   public slots:
     void audioBufferReady(const QAudioBuffer& buffer);
     void audioFlushed();
 
   private:
-    QAudioBuffer _buffer;
-    bool _hasBuffer = false;
-    bool _paused    = false;
+    AudioRingBuffer _ring;
+    AudioSpectrum _spectrum;
+    std::atomic<bool> _hasBuffer { false };
+    std::atomic<bool> _paused    { false };
+    float _window[kAudioFFTSize];
     short _texData[2][512];
   };
 
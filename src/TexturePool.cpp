@@ -0,0 +1,186 @@
+// Copyright 2019 Vilya Harvey
+#include "TexturePool.h"
+
+namespace vh {
+
+  //
+  // Private helper functions
+  //
+
+  static qint64 bytesPerTexel(QOpenGLTexture::TextureFormat format)
+  {
+    switch (format) {
+    case QOpenGLTexture::RGBA32F:       return 16;
+    case QOpenGLTexture::RGBA16F:       return 8;
+    case QOpenGLTexture::RG32F:         return 8;
+    case QOpenGLTexture::R32F:          return 4;
+    case QOpenGLTexture::RGBA8_UNorm:   return 4;
+    case QOpenGLTexture::SRGB8_Alpha8:  return 4;
+    case QOpenGLTexture::R8_UNorm:      return 1;
+    default:                            return 4;
+    }
+  }
+
+
+  //
+  // TexturePool public methods
+  //
+
+  TexturePool::TexturePool()
+  {
+  }
+
+
+  TexturePool::~TexturePool()
+  {
+    if (!_releaseOrder.isEmpty()) {
+      qWarning("Texture pool destroyed with %d textures still pooled", _releaseOrder.size());
+    }
+  }
+
+
+  void TexturePool::setHighWaterBytes(qint64 bytes)
+  {
+    _highWaterBytes = qMax(qint64(0), bytes);
+    trimTo(_highWaterBytes);
+  }
+
+
+  qint64 TexturePool::highWaterBytes() const
+  {
+    return _highWaterBytes;
+  }
+
+
+  QOpenGLTexture* TexturePool::acquire(QOpenGLTexture::Target target, QOpenGLTexture::TextureFormat format, int width, int height, int mipLevels)
+  {
+    TexturePoolKey key;
+    key.target    = target;
+    key.format    = format;
+    key.width     = width;
+    key.height    = height;
+    key.mipLevels = mipLevels;
+
+    const qint64 bytes = bytesForTexture(key);
+
+    auto it = _pooled.find(key);
+    if (it != _pooled.end()) {
+      QOpenGLTexture* tex = it->takeLast();
+      if (it->isEmpty()) {
+        _pooled.erase(it);
+      }
+      _releaseOrder.removeOne(tex);
+
+      _stats.pooledBytes -= bytes;
+      _stats.pooledTextures--;
+      _stats.liveBytes += bytes;
+      _stats.liveTextures++;
+      _stats.hits++;
+      return tex;
+    }
+
+    QOpenGLTexture* tex = new QOpenGLTexture(target);
+    tex->setSize(width, height);
+    tex->setFormat(format);
+    tex->setMipLevels(mipLevels);
+    tex->setAutoMipMapGenerationEnabled(false);
+    tex->allocateStorage();
+
+    _keys.insert(tex, key);
+    _stats.liveBytes += bytes;
+    _stats.liveTextures++;
+    _stats.misses++;
+    return tex;
+  }
+
+
+  void TexturePool::release(QOpenGLTexture* tex)
+  {
+    if (tex == nullptr) {
+      return;
+    }
+
+    auto keyIt = _keys.constFind(tex);
+    if (keyIt == _keys.constEnd()) {
+      delete tex;
+      return;
+    }
+
+    const TexturePoolKey& key = keyIt.value();
+    const qint64 bytes = bytesForTexture(key);
+    _stats.liveBytes -= bytes;
+    _stats.liveTextures--;
+
+    // A texture bigger than the whole pool would only be deleted again by
+    // the trim below, so don't bother pooling it.
+    if (bytes > _highWaterBytes) {
+      _keys.remove(tex);
+      delete tex;
+      return;
+    }
+
+    trimTo(_highWaterBytes - bytes);
+
+    _pooled[key].append(tex);
+    _releaseOrder.append(tex);
+    _stats.pooledBytes += bytes;
+    _stats.pooledTextures++;
+  }
+
+
+  void TexturePool::clear()
+  {
+    trimTo(0);
+  }
+
+
+  const TexturePoolStats& TexturePool::stats() const
+  {
+    return _stats;
+  }
+
+
+  qint64 TexturePool::bytesForTexture(const TexturePoolKey& key)
+  {
+    qint64 total = 0;
+    qint64 w = key.width;
+    qint64 h = key.height;
+    for (int level = 0; level < qMax(1, key.mipLevels); level++) {
+      total += w * h;
+      w = qMax(qint64(1), w / 2);
+      h = qMax(qint64(1), h / 2);
+    }
+    if (key.target == QOpenGLTexture::TargetCubeMap) {
+      total *= 6;
+    }
+    return total * bytesPerTexel(key.format);
+  }
+
+
+  //
+  // TexturePool private methods
+  //
+
+  // Deletes the oldest pooled textures until the pool holds at most
+  // `maxBytes`.
+  void TexturePool::trimTo(qint64 maxBytes)
+  {
+    while (_stats.pooledBytes > maxBytes && !_releaseOrder.isEmpty()) {
+      QOpenGLTexture* tex = _releaseOrder.takeFirst();
+      TexturePoolKey key = _keys.take(tex);
+
+      auto it = _pooled.find(key);
+      if (it != _pooled.end()) {
+        it->removeOne(tex);
+        if (it->isEmpty()) {
+          _pooled.erase(it);
+        }
+      }
+
+      _stats.pooledBytes -= bytesForTexture(key);
+      _stats.pooledTextures--;
+      delete tex;
+    }
+  }
+
+} // namespace vh
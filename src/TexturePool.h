@@ -0,0 +1,100 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_TEXTUREPOOL_H
+#define VH_TEXTUREPOOL_H
+
+#include <QHash>
+#include <QList>
+#include <QOpenGLTexture>
+
+namespace vh {
+
+  //
+  // Structs
+  //
+
+  struct TexturePoolKey {
+    QOpenGLTexture::Target target        = QOpenGLTexture::Target2D;
+    QOpenGLTexture::TextureFormat format = QOpenGLTexture::RGBA8_UNorm;
+    int width                            = 0;
+    int height                           = 0;
+    int mipLevels                        = 1;
+
+    bool operator == (const TexturePoolKey& other) const {
+      return target == other.target && format == other.format && width == other.width && height == other.height && mipLevels == other.mipLevels;
+    }
+    bool operator != (const TexturePoolKey& other) const { return !(*this == other); }
+  };
+
+
+  inline uint qHash(const TexturePoolKey& key)
+  {
+    uint h = ::qHash(qMakePair(int(key.target), int(key.format)));
+    h = ::qHash(qMakePair(h, uint(key.mipLevels)));
+    return ::qHash(qMakePair(h, qMakePair(key.width, key.height)));
+  }
+
+
+  struct TexturePoolStats {
+    qint64 liveBytes    = 0;  // Textures which have been acquired and not released yet.
+    qint64 pooledBytes  = 0;  // Textures waiting to be reused.
+    int liveTextures    = 0;
+    int pooledTextures  = 0;
+    qint64 hits         = 0;  // Acquires satisfied from the pool.
+    qint64 misses       = 0;  // Acquires which had to allocate a new texture.
+  };
+
+
+  //
+  // TexturePool class
+  //
+
+  /// Recycles GPU textures, so that loading a document, reloading it or
+  /// resizing the window doesn't free and reallocate every render target.
+  ///
+  /// Released textures are kept, keyed by target, format, size and mip
+  /// levels, until something asks for a matching one. If the pooled
+  /// textures add up to more than the high water mark, the ones released
+  /// longest ago are deleted.
+  ///
+  /// All methods must be called with the OpenGL context the textures belong
+  /// to current, including `clear()`, which must be called before the pool
+  /// is destroyed.
+  class TexturePool
+  {
+  public:
+    TexturePool();
+    ~TexturePool();
+
+    void setHighWaterBytes(qint64 bytes);
+    qint64 highWaterBytes() const;
+
+    /// Returns an allocated texture with the requested properties. Its
+    /// contents are undefined and its filter and wrap modes are whatever
+    /// they were last set to, so callers should set the ones they need.
+    QOpenGLTexture* acquire(QOpenGLTexture::Target target, QOpenGLTexture::TextureFormat format, int width, int height, int mipLevels = 1);
+
+    /// Hands a texture back to the pool. Textures which didn't come from
+    /// `acquire` are simply deleted.
+    void release(QOpenGLTexture* tex);
+
+    /// Deletes every pooled texture. Live ones are unaffected.
+    void clear();
+
+    const TexturePoolStats& stats() const;
+
+    static qint64 bytesForTexture(const TexturePoolKey& key);
+
+  private:
+    void trimTo(qint64 maxBytes);
+
+  private:
+    QHash<TexturePoolKey, QList<QOpenGLTexture*>> _pooled;
+    QList<QOpenGLTexture*> _releaseOrder;           // Pooled textures, oldest first.
+    QHash<QOpenGLTexture*, TexturePoolKey> _keys;   // For every texture we've handed out or are holding on to.
+    qint64 _highWaterBytes = 0;
+    TexturePoolStats _stats;
+  };
+
+} // namespace vh
+
+#endif // VH_TEXTUREPOOL_H
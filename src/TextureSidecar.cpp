@@ -0,0 +1,196 @@
+// Copyright 2019 Vilya Harvey
+#include "TextureSidecar.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <cstring>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static const char kTextureSidecarMagic[8] = { 'S', 'H', 'T', 'R', 'T', 'E', 'X', '1' };
+  static constexpr qint64 kTextureSidecarHeaderBytes = 32;
+  static constexpr int kMaxTextureSize = 32768;
+
+
+  //
+  // TextureSidecar public methods
+  //
+
+  TextureSidecar::TextureSidecar()
+  {
+  }
+
+
+  TextureSidecar::~TextureSidecar()
+  {
+    close();
+  }
+
+
+  // Header layout: magic (8 bytes), version, width, height, faces, levels,
+  // reserved (all u32). All little endian.
+  bool TextureSidecar::open(const QString& filename)
+  {
+    close();
+
+    _file.setFileName(filename);
+    if (!_file.open(QIODevice::ReadOnly)) {
+      return false; // Not an error: we just haven't made one yet.
+    }
+
+    QDataStream in(&_file);
+    in.setByteOrder(QDataStream::LittleEndian);
+
+    char magic[sizeof(kTextureSidecarMagic)];
+    quint32 version = 0, width = 0, height = 0, faces = 0, levels = 0, reserved = 0;
+    if (in.readRawData(magic, sizeof(magic)) != int(sizeof(magic)) ||
+        memcmp(magic, kTextureSidecarMagic, sizeof(magic)) != 0) {
+      qWarning("%s is not a texture sidecar", qPrintable(filename));
+      close();
+      return false;
+    }
+    in >> version >> width >> height >> faces >> levels >> reserved;
+    if (in.status() != QDataStream::Ok || version != quint32(kTextureSidecarVersion) ||
+        width == 0 || height == 0 || width > quint32(kMaxTextureSize) || height > quint32(kMaxTextureSize) ||
+        (faces != 1 && faces != 6) || levels == 0 || levels > 32) {
+      qWarning("%s has a bad header", qPrintable(filename));
+      close();
+      return false;
+    }
+    if (_file.size() != kTextureSidecarHeaderBytes + totalBytes(int(width), int(height), int(faces), int(levels))) {
+      qWarning("%s is truncated", qPrintable(filename));
+      close();
+      return false;
+    }
+
+    _base = _file.map(0, _file.size());
+    if (_base == nullptr) {
+      qWarning("Unable to memory map %s", qPrintable(filename));
+      close();
+      return false;
+    }
+
+    _width  = int(width);
+    _height = int(height);
+    _faces  = int(faces);
+    _levels = int(levels);
+    return true;
+  }
+
+
+  void TextureSidecar::close()
+  {
+    if (_base != nullptr) {
+      _file.unmap(const_cast<uchar*>(_base));
+      _base = nullptr;
+    }
+    _file.close();
+    _width = _height = _faces = _levels = 0;
+  }
+
+
+  int TextureSidecar::width() const
+  {
+    return _width;
+  }
+
+
+  int TextureSidecar::height() const
+  {
+    return _height;
+  }
+
+
+  int TextureSidecar::faces() const
+  {
+    return _faces;
+  }
+
+
+  int TextureSidecar::levels() const
+  {
+    return _levels;
+  }
+
+
+  const uchar* TextureSidecar::bits(int level, int face) const
+  {
+    qint64 offset = kTextureSidecarHeaderBytes;
+    for (int i = 0; i < level; i++) {
+      offset += levelBytes(_width, _height, i) * _faces;
+    }
+    offset += levelBytes(_width, _height, level) * face;
+    return _base + offset;
+  }
+
+
+  bool TextureSidecar::write(const QString& filename, int width, int height, int faces, int levels, const QVector<QByteArray>& images)
+  {
+    if (images.size() != faces * levels) {
+      return false;
+    }
+    for (int level = 0; level < levels; level++) {
+      for (int face = 0; face < faces; face++) {
+        if (images[level * faces + face].size() != levelBytes(width, height, level)) {
+          qWarning("Not saving %s: image for level %d, face %d is the wrong size", qPrintable(filename), level, face);
+          return false;
+        }
+      }
+    }
+
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+      qWarning("Unable to open %s for writing: %s", qPrintable(filename), qPrintable(file.errorString()));
+      return false;
+    }
+
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.writeRawData(kTextureSidecarMagic, sizeof(kTextureSidecarMagic));
+    out << quint32(kTextureSidecarVersion);
+    out << quint32(width) << quint32(height) << quint32(faces) << quint32(levels);
+    out << quint32(0);
+
+    for (const QByteArray& image : images) {
+      file.write(image);
+    }
+
+    if (!file.commit()) {
+      qWarning("Unable to save %s: %s", qPrintable(filename), qPrintable(file.errorString()));
+      return false;
+    }
+    return true;
+  }
+
+
+  int TextureSidecar::levelWidth(int width, int level)
+  {
+    return qMax(1, width >> level);
+  }
+
+
+  qint64 TextureSidecar::levelBytes(int width, int height, int level)
+  {
+    return qint64(levelWidth(width, level)) * qint64(levelWidth(height, level)) * 4;
+  }
+
+
+  qint64 TextureSidecar::totalBytes(int width, int height, int faces, int levels)
+  {
+    qint64 total = 0;
+    for (int level = 0; level < levels; level++) {
+      total += levelBytes(width, height, level) * faces;
+    }
+    return total;
+  }
+
+} // namespace vh
@@ -0,0 +1,73 @@
+// Copyright 2019 Vilya Harvey
+#ifndef VH_TEXTURESIDECAR_H
+#define VH_TEXTURESIDECAR_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+namespace vh {
+
+  //
+  // Constants
+  //
+
+  static constexpr int kTextureSidecarVersion = 1;
+
+  // Textures bigger than this (including their mips) aren't worth keeping a
+  // decoded copy of: the sidecar would be many times the size of the image
+  // and reading it would take longer than decoding.
+  static constexpr qint64 kTextureSidecarMaxBytes = 64 * 1024 * 1024;
+
+
+  //
+  // TextureSidecar class
+  //
+
+  /// A decoded copy of an image texture, ready to upload without decoding,
+  /// format conversion or mipmap generation. Holds RGBA8 pixels for every
+  /// mip level of every face (1 for a 2D texture, 6 for a cubemap) after
+  /// any flipping has been applied. The same pixels are used for both sRGB
+  /// and linear textures; only the internal format differs.
+  ///
+  /// The layout is a fixed size header followed by the pixel data, level by
+  /// level with the faces of each level back to back. Once open, the file
+  /// stays memory mapped so `bits()` points straight into it.
+  class TextureSidecar
+  {
+  public:
+    TextureSidecar();
+    ~TextureSidecar();
+
+    bool open(const QString& filename);
+    void close();
+
+    int width() const;
+    int height() const;
+    int faces() const;
+    int levels() const;
+
+    /// Tightly packed RGBA8 pixels for one face of one mip level.
+    const uchar* bits(int level, int face) const;
+
+    /// `images` holds the pixels for each level and face, in the same order
+    /// as they're laid out in the file (i.e. `images[level * faces + face]`).
+    static bool write(const QString& filename, int width, int height, int faces, int levels, const QVector<QByteArray>& images);
+
+    static int levelWidth(int width, int level);
+    static qint64 levelBytes(int width, int height, int level);
+    static qint64 totalBytes(int width, int height, int faces, int levels);
+
+  private:
+    QFile _file;
+    const uchar* _base = nullptr;
+    int _width = 0;
+    int _height = 0;
+    int _faces = 0;
+    int _levels = 0;
+  };
+
+} // namespace vh
+
+#endif // VH_TEXTURESIDECAR_H
@@ -1,5 +1,7 @@
 // Copyright 2019 Vilya Harvey
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QFile>
 #include <QFileDialog>
 #include <QMainWindow>
 #include <QMenu>
@@ -7,9 +9,18 @@
 #include <QObject>
 #include <QSurfaceFormat>
 
+#include <stdexcept>
+
 #include "AppWindow.h"
+#include "AssetBundle.h"
+#include "FileCache.h"
+#include "OfflineImageRenderer.h"
+#include "OfflineSoundRenderer.h"
+#include "Preferences.h"
 #include "ShaderToy.h"
 #include "RenderWidget.h"
+#include "SoundRenderer.h"
+#include "Timer.h"
 
 #ifdef _WIN32
 // If we're on a machine with both an integrated GPU and a discrete GPU,
@@ -27,6 +38,260 @@ using namespace vh;
 static QtMessageHandler gOldHandler = nullptr;
 
 
+// Renders the sound pass of `filename` straight to a WAV file, without
+// creating any windows. Returns the process exit code.
+static int renderSoundOffline(const QString& filename, const QString& wavFilename, const QString& duration, int blockSamples)
+{
+  // Written as a negated range check so NaN is rejected too.
+  bool durationOK = false;
+  double durationSecs = duration.toDouble(&durationOK);
+  if (!durationOK || !(durationSecs > 0.0 && durationSecs <= OfflineSoundRenderer::maxDurationSecs())) {
+    qCritical("Invalid duration '%s', expected a number of seconds more than 0 and at most %.0f",
+              qPrintable(duration), OfflineSoundRenderer::maxDurationSecs());
+    return EXIT_FAILURE;
+  }
+
+  ShaderToyDocument* doc = nullptr;
+  try {
+    doc = loadShaderToyJSONFile(filename);
+  }
+  catch (const std::runtime_error& err) {
+    qCritical("Unable to load %s: %s", qPrintable(filename), err.what());
+    return EXIT_FAILURE;
+  }
+
+  OfflineSoundRenderer renderer;
+  renderer.setDurationSecs(durationSecs);
+  if (blockSamples > 0) {
+    renderer.setBlockSamples(blockSamples);
+  }
+  bool ok = renderer.render(doc, wavFilename);
+  delete doc;
+
+  const OfflineSoundStats& stats = renderer.stats();
+  qInfo("Rendered %lld samples to %s in %.3f secs (%.0f samples/sec, %.1fx realtime)",
+        stats.numSamples, qPrintable(wavFilename), stats.renderSecs,
+        stats.samplesPerSec(), stats.samplesPerSec() / double(kSoundSampleRate));
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Renders a single frame of the image pass of `filename` to a PPM file in
+// tiles, without creating any windows. Returns the process exit code.
+static int renderImageOffline(const QString& filename, const QString& ppmFilename, const QString& size, int tileSize, double timeSecs,
+                              int samples, double noiseThreshold, double timeBudgetSecs)
+{
+  QStringList dims = size.split('x');
+  int width = (dims.size() == 2) ? dims[0].toInt() : 0;
+  int height = (dims.size() == 2) ? dims[1].toInt() : 0;
+  if (width <= 0 || height <= 0) {
+    qCritical("Invalid image size '%s', expected WIDTHxHEIGHT", qPrintable(size));
+    return EXIT_FAILURE;
+  }
+
+  ShaderToyDocument* doc = nullptr;
+  try {
+    doc = loadShaderToyJSONFile(filename);
+  }
+  catch (const std::runtime_error& err) {
+    qCritical("Unable to load %s: %s", qPrintable(filename), err.what());
+    return EXIT_FAILURE;
+  }
+
+  FileCache cache;
+  OfflineImageRenderer renderer;
+  renderer.setFileCache(&cache);
+  renderer.setSize(width, height);
+  renderer.setTimeSecs(timeSecs);
+  renderer.setSamples(samples);
+  renderer.setNoiseThreshold(noiseThreshold);
+  renderer.setTimeBudgetSecs(timeBudgetSecs);
+  if (tileSize > 0) {
+    renderer.setTileSize(tileSize);
+  }
+  bool ok = renderer.render(doc, ppmFilename);
+  delete doc;
+
+  const OfflineImageStats& stats = renderer.stats();
+  qInfo("Rendered %dx%d pixels in %d tiles to %s in %.3f secs (%.1f megapixels/sec)",
+        stats.width, stats.height, stats.numTiles, qPrintable(ppmFilename),
+        stats.renderSecs, stats.megapixelsPerSec());
+  if (samples > 1) {
+    qInfo("Averaged %.1f samples per pixel, estimated noise %.5f (threshold %.5f)",
+          stats.samplesPerPixel(), stats.maxNoise, noiseThreshold);
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Checks everything in the file cache against its hash and removes anything
+// that's damaged. Returns the process exit code.
+static int scrubCache()
+{
+  FileCache cache;
+  FileCacheScrubStats stats = cache.scrub();
+  qInfo("Checked %d cached files: %d missing, %d corrupt, %d migrated",
+        stats.checked, stats.missing, stats.corrupt, stats.migrated);
+  return EXIT_SUCCESS;
+}
+
+
+// Packs every cached image into a single memory mapped file, so textures
+// load without opening each image separately. Returns the process exit code.
+static int packCache()
+{
+  FileCache cache;
+  Timer timer(true);
+  AssetPackWriteStats stats;
+  bool ok = cache.rebuildPack(&stats);
+  if (ok) {
+    qInfo("Packed %d cached images (%d distinct, %lld bytes) in %.3f secs",
+          stats.entries, stats.objects, stats.bytes, timer.elapsedSecs());
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Parses every shader in the cache, first just for its assets and then in
+// full, and reports how long each took. Returns the process exit code.
+static int parseCache()
+{
+  FileCache cache;
+  QStringList ids = cache.cachedShaders();
+
+  const ShaderToyLoadMode modes[] = { ShaderToyLoadMode::eAssetsOnly, ShaderToyLoadMode::eFull };
+  const char* modeNames[] = { "assets only", "full" };
+  bool ok = true;
+  for (int m = 0; m < 2; m++) {
+    ShaderToyLoadStats total;
+    int parsed = 0;
+    for (const QString& id : ids) {
+      ShaderToyLoadStats stats;
+      try {
+        delete loadShaderToyJSONFile(cache.pathForCachedFile(FileCache::pathForShaderID(id)), modes[m], &stats);
+      }
+      catch (const std::runtime_error& err) {
+        qWarning("Unable to parse shader %s (%s): %s", qPrintable(id), modeNames[m], err.what());
+        ok = false;
+        continue;
+      }
+      ++parsed;
+      total.bytes += stats.bytes;
+      total.readSecs += stats.readSecs;
+      total.parseSecs += stats.parseSecs;
+    }
+
+    double mb = total.bytes / (1024.0 * 1024.0);
+    qInfo("Parsed %d of %d shaders (%s): %.1f MB, %.3f secs reading, %.3f secs parsing (%.1f MB/sec)",
+          parsed, ids.size(), modeNames[m], mb, total.readSecs, total.parseSecs,
+          (total.parseSecs > 0.0) ? mb / total.parseSecs : 0.0);
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Searches the shaders in the cache, bringing the search index up to date
+// first. Returns the process exit code.
+static int searchCache(const QString& query)
+{
+  FileCache cache;
+  Timer timer(true);
+  cache.updateShaderIndex();
+  double indexSecs = timer.elapsedSecs();
+
+  timer.start();
+  QVector<ShaderIndexRecord> results = cache.searchShaders(query);
+  double searchSecs = timer.elapsedSecs();
+
+  for (const ShaderIndexRecord& record : results) {
+    qInfo("%s  %s  by %s", qPrintable(record.id), qPrintable(record.name), qPrintable(record.username));
+  }
+  qInfo("Found %d shaders in %.3f secs (%.3f secs updating the index)",
+        results.size(), searchSecs, indexSecs);
+  return EXIT_SUCCESS;
+}
+
+
+// Downloads a batch of shaders and their assets into the cache. `ids` is
+// either a comma separated list of shader IDs or URLs, or the name of a file
+// containing one per line. Returns the process exit code.
+static int prefetchShaders(QCoreApplication& app, const QString& ids, int concurrency, const QString& serverURL)
+{
+  QStringList idList;
+  QFile file(ids);
+  if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    idList = QString::fromUtf8(file.readAll()).split('\n', QString::SkipEmptyParts);
+  }
+  else {
+    idList = ids.split(',', QString::SkipEmptyParts);
+  }
+
+  FileCache cache;
+  if (!serverURL.isEmpty()) {
+    cache.setServerURL(serverURL);
+  }
+  if (concurrency > 0) {
+    cache.setDownloadConcurrency(concurrency);
+  }
+
+  int exitCode = EXIT_SUCCESS;
+  QObject::connect(&cache, &FileCache::shaderPrefetched, [](const QString& id, bool ok) {
+    qInfo("%s %s", qPrintable(id), ok ? "ok" : "FAILED");
+  });
+  QObject::connect(&cache, &FileCache::prefetchFinished, [&](int succeeded, int failed) {
+    const DownloadSchedulerStats& stats = cache.prefetchStats();
+    qInfo("Prefetched %d shaders (%d failed): %d downloads, %d retries, %lld bytes in %.3f secs (%.1f KB/sec)",
+          succeeded, failed, stats.succeeded + stats.failed, stats.retries,
+          stats.bytes, stats.secs, stats.bytesPerSec() / 1024.0);
+    exitCode = (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    app.quit();
+  });
+
+  cache.prefetchShaders(idList);
+  app.exec();
+  return exitCode;
+}
+
+
+// Packs shaders and all the assets they use into a single file, for copying
+// onto machines with no network access. Returns the process exit code.
+static int exportBundle(const QString& bundleFilename, const QStringList& shaders)
+{
+  if (shaders.isEmpty()) {
+    qCritical("--export-bundle needs at least one shader ID or file");
+    return EXIT_FAILURE;
+  }
+
+  FileCache cache;
+  AssetBundle bundle(&cache);
+  bool ok = bundle.exportTo(bundleFilename, shaders);
+
+  const AssetBundleStats& stats = bundle.stats();
+  if (ok) {
+    qInfo("Exported %d files (%d distinct, %lld bytes) to %s in %.3f secs; %d missing from the cache",
+          stats.files, stats.objects, stats.bytes, qPrintable(bundleFilename), stats.secs, stats.skipped);
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Copies everything from a bundle into the cache. Returns the process exit
+// code.
+static int importBundle(const QString& bundleFilename)
+{
+  FileCache cache;
+  AssetBundle bundle(&cache);
+  bool ok = bundle.importFrom(bundleFilename);
+
+  const AssetBundleStats& stats = bundle.stats();
+  qInfo("Imported %d files (%lld bytes) from %s in %.3f secs; %d already cached",
+        stats.objects, stats.bytes, qPrintable(bundleFilename), stats.secs, stats.skipped);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
 void appWindowMessageHandler(QtMsgType type, const QMessageLogContext& context, const QString& message)
 {
   if (gAppWindow != nullptr) {
@@ -62,10 +327,154 @@ int main(int argc, char *argv[])
   app.setAttribute(Qt::AA_UseDesktopOpenGL);
   app.setAttribute(Qt::AA_ShareOpenGLContexts);
 
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Run ShaderToy shaders locally.");
+  parser.addHelpOption();
+  parser.addVersionOption();
+  parser.addPositionalArgument("file", "ShaderToy JSON file to open.", "[file]");
+
+  QCommandLineOption renderSoundOption("render-sound",
+      "Render the sound pass of <file> to a WAV file and exit, without opening a window.", "wav");
+  QCommandLineOption durationOption("duration",
+      "Seconds of audio to generate with --render-sound (default: 180).", "secs",
+      QString::number(kDefaultOfflineSoundDurationSecs));
+  QCommandLineOption soundBlockOption("sound-block-samples",
+      "Samples generated per GPU dispatch with --render-sound.", "samples");
+  QCommandLineOption renderImageOption("render-image",
+      "Render one frame of the image pass of <file> to a PPM file in tiles and exit, without opening a window.", "ppm");
+  QCommandLineOption imageSizeOption("size",
+      QString("Size of the image to generate with --render-image (default: %1x%2).")
+          .arg(kDefaultOfflineImageWidth).arg(kDefaultOfflineImageHeight), "WxH",
+      QString("%1x%2").arg(kDefaultOfflineImageWidth).arg(kDefaultOfflineImageHeight));
+  QCommandLineOption tileSizeOption("tile",
+      QString("Width and height of the tiles rendered by each GPU dispatch with --render-image (default: %1).")
+          .arg(kDefaultOfflineImageTileSize), "pixels");
+  QCommandLineOption timeOption("time",
+      "Value of iTime for the frame generated with --render-image (default: 0).", "secs",
+      QString::number(kDefaultOfflineImageTimeSecs));
+  QCommandLineOption samplesOption("samples",
+      "Maximum jittered samples to average per pixel with --render-image, for anti-aliasing (default: 1).", "n",
+      QString::number(kDefaultOfflineImageSamples));
+  QCommandLineOption noiseThresholdOption("noise-threshold",
+      "Stop sampling a tile with --render-image once the estimated noise of every pixel in it drops below this, or 0 to always "
+      "take every sample (default: half an 8 bit step).", "noise",
+      QString::number(kDefaultOfflineImageNoiseThreshold));
+  QCommandLineOption timeBudgetOption("time-budget",
+      "Stop sampling with --render-image once this many seconds have been spent, shared evenly between the tiles "
+      "(default: no limit).", "secs",
+      QString::number(kDefaultOfflineImageTimeBudgetSecs));
+  QCommandLineOption scrubCacheOption("scrub-cache",
+      "Verify the contents of the download cache, remove any damaged files and exit.");
+  QCommandLineOption packCacheOption("pack-cache",
+      "Pack all cached images into a single file so they load faster, and exit.");
+  QCommandLineOption parseCacheOption("parse-cache",
+      "Parse every shader in the cache, report how long it took and exit.");
+  QCommandLineOption searchOption("search",
+      "List the cached shaders matching <query> and exit, e.g. \"tag:fractal -input:music\".", "query");
+  QCommandLineOption prefetchOption("prefetch",
+      "Download the given shaders and their assets into the cache and exit. <ids> is a comma separated list of "
+      "shader IDs or URLs, or a file containing one per line.", "ids");
+  QCommandLineOption concurrencyOption("concurrency",
+      QString("Maximum number of simultaneous downloads with --prefetch (default: %1).").arg(kDefaultDownloadConcurrency), "n");
+  QCommandLineOption exportBundleOption("export-bundle",
+      "Pack the shaders given as arguments (IDs, URLs or files) and all their assets from the cache into a bundle file and exit.", "bundle");
+  QCommandLineOption importBundleOption("import-bundle",
+      "Copy everything from a bundle file into the cache and exit.", "bundle");
+  QCommandLineOption serverURLOption("shadertoy-url",
+      "Download from this server instead of www.shadertoy.com with --prefetch (e.g. a local mirror).", "url");
+  parser.addOption(renderSoundOption);
+  parser.addOption(durationOption);
+  parser.addOption(soundBlockOption);
+  parser.addOption(renderImageOption);
+  parser.addOption(imageSizeOption);
+  parser.addOption(tileSizeOption);
+  parser.addOption(timeOption);
+  parser.addOption(samplesOption);
+  parser.addOption(noiseThresholdOption);
+  parser.addOption(timeBudgetOption);
+  parser.addOption(scrubCacheOption);
+  parser.addOption(packCacheOption);
+  parser.addOption(parseCacheOption);
+  parser.addOption(searchOption);
+  parser.addOption(prefetchOption);
+  parser.addOption(concurrencyOption);
+  parser.addOption(exportBundleOption);
+  parser.addOption(importBundleOption);
+  parser.addOption(serverURLOption);
+
+  parser.process(app);
+
+  const QStringList args = parser.positionalArguments();
+  QString filename = args.isEmpty() ? QString() : args.first();
+
+  if (parser.isSet(scrubCacheOption)) {
+    return scrubCache();
+  }
+
+  if (parser.isSet(packCacheOption)) {
+    return packCache();
+  }
+
+  if (parser.isSet(parseCacheOption)) {
+    return parseCache();
+  }
+
+  if (parser.isSet(searchOption)) {
+    return searchCache(parser.value(searchOption));
+  }
+
+  if (parser.isSet(exportBundleOption)) {
+    return exportBundle(parser.value(exportBundleOption), args);
+  }
+
+  if (parser.isSet(importBundleOption)) {
+    return importBundle(parser.value(importBundleOption));
+  }
+
+  if (parser.isSet(prefetchOption)) {
+    return prefetchShaders(app, parser.value(prefetchOption),
+                           parser.value(concurrencyOption).toInt(),
+                           parser.value(serverURLOption));
+  }
+
+  if (parser.isSet(renderSoundOption)) {
+    if (filename.isEmpty()) {
+      qCritical("--render-sound needs a ShaderToy file to render");
+      return EXIT_FAILURE;
+    }
+    return renderSoundOffline(filename, parser.value(renderSoundOption),
+                              parser.value(durationOption),
+                              parser.value(soundBlockOption).toInt());
+  }
+
+  if (parser.isSet(renderImageOption)) {
+    if (filename.isEmpty()) {
+      qCritical("--render-image needs a ShaderToy file to render");
+      return EXIT_FAILURE;
+    }
+    return renderImageOffline(filename, parser.value(renderImageOption),
+                              parser.value(imageSizeOption),
+                              parser.value(tileSizeOption).toInt(),
+                              parser.value(timeOption).toDouble(),
+                              parser.value(samplesOption).toInt(),
+                              parser.value(noiseThresholdOption).toDouble(),
+                              parser.value(timeBudgetOption).toDouble());
+  }
+
+  // Vsync is part of the window's surface format, so it has to be set before
+  // any windows are created. Preferences aren't readable until the
+  // application object exists, so this can't go with the rest of the format
+  // above; the swap interval doesn't affect context sharing though.
+  {
+    Preferences prefs;
+    QSurfaceFormat windowFormat = QSurfaceFormat::defaultFormat();
+    windowFormat.setSwapInterval(RenderWidget::swapIntervalForPacing(prefs.pacingMode()));
+    QSurfaceFormat::setDefaultFormat(windowFormat);
+  }
+
   AppWindow mainWindow;
   gAppWindow = &mainWindow;
-  if (argc > 1) {
-    QString filename = QString::fromLocal8Bit(argv[1]);
+  if (!filename.isEmpty()) {
     mainWindow.openNamedFile(filename);
   }
 